@@ -53,6 +53,10 @@ public:
     virtual int build(void * obj) const = 0;
     virtual size_t size() const = 0;
     virtual uint64_t type_id() const = 0;
+
+    /// Return true if the constructed object makes itself durable (e.g. if it copies bulk data using
+    /// non-temporal stores), so that ::pmem_constructor does not need to persist the whole object again.
+    virtual bool self_persisting() const { return false; }
 };
 
 
@@ -109,6 +113,7 @@ public: // methods
 
     virtual size_t size() const { return AtomicConstructor<T>::size(); }
     virtual uint64_t type_id() const { return AtomicConstructor<T>::type_id(); }
+    virtual bool self_persisting() const { return AtomicConstructor<T>::self_persisting(); }
 };
 
 
@@ -131,6 +136,7 @@ public: // methods
 
     virtual size_t size() const { return AtomicConstructor<T>::size(); }
     virtual uint64_t type_id() const { return AtomicConstructor<T>::type_id(); }
+    virtual bool self_persisting() const { return AtomicConstructor<T>::self_persisting(); }
 
 protected: // members
 
@@ -160,6 +166,7 @@ public: // methods
 
     virtual size_t size() const { return AtomicConstructor<T>::size(); }
     virtual uint64_t type_id() const { return AtomicConstructor<T>::type_id(); }
+    virtual bool self_persisting() const { return AtomicConstructor<T>::self_persisting(); }
 
 protected: // members
 
@@ -190,6 +197,7 @@ public: // methods
 
     virtual size_t size() const { return AtomicConstructor<T>::size(); }
     virtual uint64_t type_id() const { return AtomicConstructor<T>::type_id(); }
+    virtual bool self_persisting() const { return AtomicConstructor<T>::self_persisting(); }
 
 protected: // members
 
@@ -222,6 +230,7 @@ public: // methods
 
     virtual size_t size() const { return AtomicConstructor<T>::size(); }
     virtual uint64_t type_id() const { return AtomicConstructor<T>::type_id(); }
+    virtual bool self_persisting() const { return AtomicConstructor<T>::self_persisting(); }
 
 protected: // members
 
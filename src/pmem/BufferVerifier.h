@@ -0,0 +1,110 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+#ifndef pmem_BufferVerifier_H
+#define pmem_BufferVerifier_H
+
+#include <cstddef>
+#include <vector>
+
+#include "eckit/log/Log.h"
+
+#include "pmem/LibPMem.h"
+#include "pmem/Parallel.h"
+#include "pmem/PersistentBuffer.h"
+#include "pmem/PersistentPool.h"
+#include "pmem/PersistentPtr.h"
+
+
+namespace pmem {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Verify the checksums of every PersistentBuffer in a pool, spreading the work across a ThreadPool.
+///
+/// @note This is header-only, as it depends on the type_id of PersistentBuffer, which is defined by the
+///       application.
+
+class BufferVerifier {
+
+public: // methods
+
+    BufferVerifier(ThreadPool& threads = ThreadPool::instance()) : threads_(threads), buffers_(0), bytes_(0) {}
+
+    /// Returns the number of corrupt buffers found.
+    size_t verify(const PersistentPool& pool);
+
+    /// The number of buffers and bytes examined by the last call to verify()
+    size_t buffers() const { return buffers_; }
+    size_t bytes() const { return bytes_; }
+
+    /// The buffers that failed verification
+    const std::vector<PersistentPtr<PersistentBuffer> >& corrupt() const { return corrupt_; }
+
+private: // members
+
+    ThreadPool& threads_;
+
+    size_t buffers_;
+    size_t bytes_;
+
+    std::vector<PersistentPtr<PersistentBuffer> > corrupt_;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+inline size_t BufferVerifier::verify(const PersistentPool& pool) {
+
+    std::vector<PersistentPtr<PersistentBuffer> > buffers = pool.objects<PersistentBuffer>();
+
+    // Buffers are typically large, so only a few are assigned to each task.
+
+    std::vector<size_t> indices(buffers.size());
+    for (size_t i = 0; i < indices.size(); i++)
+        indices[i] = i;
+
+    std::vector<char> failed(buffers.size(), 0);
+
+    bytes_ = parallel_transform_reduce(indices.begin(), indices.end(), size_t(0),
+                                       [](size_t a, size_t b) { return a + b; },
+                                       [&buffers, &failed](size_t i) {
+                                           failed[i] = buffers[i]->verify() ? 0 : 1;
+                                           return buffers[i]->storedSize();
+                                       },
+                                       16, threads_);
+
+    buffers_ = buffers.size();
+
+    corrupt_.clear();
+    for (size_t i = 0; i < buffers.size(); i++) {
+        if (failed[i])
+            corrupt_.push_back(buffers[i]);
+    }
+
+    eckit::Log::debug<LibPMem>() << "Verified " << buffers_ << " buffers (" << bytes_ << " bytes): "
+                                 << corrupt_.size() << " corrupt" << std::endl;
+
+    return corrupt_.size();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace pmem
+
+#endif // pmem_BufferVerifier_H
@@ -0,0 +1,311 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+#include <cstring>
+#include <vector>
+
+#include "pmem/Checksum.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PMEM_HAVE_SSE42_CRC
+#include <nmmintrin.h>
+#endif
+
+
+/*
+ * As for the POD kernels, the SSE4.2 implementation is compiled with a per-function target attribute, so that the
+ * library still runs on machines without it.
+ */
+
+
+namespace pmem {
+namespace checksum {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace {
+
+/// The (reflected) Castagnoli polynomial
+const uint32_t polynomial = 0x82f63b78;
+
+
+/// Tables for the slicing-by-8 implementation. Table k gives the contribution of a byte followed by k zero bytes.
+
+struct Tables {
+
+    uint32_t t[8][256];
+
+    Tables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? (c >> 1) ^ polynomial : (c >> 1);
+            t[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int k = 1; k < 8; k++)
+                t[k][i] = (t[k-1][i] >> 8) ^ t[0][t[k-1][i] & 0xff];
+        }
+    }
+};
+
+
+const Tables& tables() {
+    static const Tables t;
+    return t;
+}
+
+
+/// n.b. The crc here is the raw register value (i.e. already inverted).
+
+uint32_t crc_software(const unsigned char* p, size_t n, uint32_t crc) {
+
+    const Tables& tab(tables());
+
+    for (; n >= 8; p += 8, n -= 8) {
+        uint32_t lo;
+        uint32_t hi;
+        ::memcpy(&lo, p, sizeof(lo));
+        ::memcpy(&hi, p + 4, sizeof(hi));
+        lo ^= crc;
+        crc = tab.t[7][lo & 0xff] ^ tab.t[6][(lo >> 8) & 0xff] ^ tab.t[5][(lo >> 16) & 0xff] ^ tab.t[4][lo >> 24] ^
+              tab.t[3][hi & 0xff] ^ tab.t[2][(hi >> 8) & 0xff] ^ tab.t[1][(hi >> 16) & 0xff] ^ tab.t[0][hi >> 24];
+    }
+
+    for (; n > 0; p++, n--)
+        crc = (crc >> 8) ^ tab.t[0][(crc ^ *p) & 0xff];
+
+    return crc;
+}
+
+
+#ifdef PMEM_HAVE_SSE42_CRC
+
+#define PMEM_SSE42 __attribute__((target("sse4.2")))
+
+
+bool useSSE42() {
+    static const bool sse42 = (__builtin_cpu_init(), __builtin_cpu_supports("sse4.2"));
+    return sse42;
+}
+
+
+/// The crc32 instruction has a latency of three cycles, but a throughput of one per cycle. Large blocks are split into
+/// three stripes that are checksummed in an interleaved fashion, and the results combined (see Shift).
+
+const size_t stripe = 4096;
+
+
+/// Advance a (raw) crc register over stripe zero bytes. As the crc is linear, the register resulting from
+/// checksumming A followed by B is shift(crc(A)) ^ crc(B), where crc(B) starts from zero.
+
+struct Shift {
+
+    uint32_t t[4][256];
+
+    Shift() {
+
+        // Determine the effect on each bit, and then combine these for each byte value.
+
+        uint32_t bits[32];
+        std::vector<unsigned char> zeros(stripe, 0);
+        for (int i = 0; i < 32; i++)
+            bits[i] = crc_software(&zeros[0], zeros.size(), uint32_t(1) << i);
+
+        for (int k = 0; k < 4; k++) {
+            for (uint32_t v = 0; v < 256; v++) {
+                uint32_t c = 0;
+                for (int b = 0; b < 8; b++) {
+                    if (v & (1 << b)) c ^= bits[8 * k + b];
+                }
+                t[k][v] = c;
+            }
+        }
+    }
+
+    uint32_t operator()(uint32_t crc) const {
+        return t[0][crc & 0xff] ^ t[1][(crc >> 8) & 0xff] ^ t[2][(crc >> 16) & 0xff] ^ t[3][crc >> 24];
+    }
+};
+
+
+const Shift& shift() {
+    static const Shift s;
+    return s;
+}
+
+
+PMEM_SSE42 uint32_t crc_tail_sse42(const unsigned char* p, size_t n, uint32_t crc) {
+
+#ifdef __x86_64__
+    uint64_t c = crc;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t v;
+        ::memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+    }
+    crc = uint32_t(c);
+#endif
+
+    for (; n >= 4; p += 4, n -= 4) {
+        uint32_t v;
+        ::memcpy(&v, p, sizeof(v));
+        crc = _mm_crc32_u32(crc, v);
+    }
+
+    for (; n > 0; p++, n--)
+        crc = _mm_crc32_u8(crc, *p);
+
+    return crc;
+}
+
+
+PMEM_SSE42 uint32_t crc_sse42(const unsigned char* p, size_t n, uint32_t crc) {
+
+#ifdef __x86_64__
+    if (n >= 3 * stripe) {
+
+        const Shift& sh(shift());
+
+        for (; n >= 3 * stripe; p += 3 * stripe, n -= 3 * stripe) {
+
+            uint64_t c0 = crc;
+            uint64_t c1 = 0;
+            uint64_t c2 = 0;
+
+            for (size_t i = 0; i < stripe; i += 8) {
+                uint64_t v0, v1, v2;
+                ::memcpy(&v0, p + i, sizeof(v0));
+                ::memcpy(&v1, p + stripe + i, sizeof(v1));
+                ::memcpy(&v2, p + 2 * stripe + i, sizeof(v2));
+                c0 = _mm_crc32_u64(c0, v0);
+                c1 = _mm_crc32_u64(c1, v1);
+                c2 = _mm_crc32_u64(c2, v2);
+            }
+
+            crc = sh(sh(uint32_t(c0)) ^ uint32_t(c1)) ^ uint32_t(c2);
+        }
+    }
+#endif
+
+    return crc_tail_sse42(p, n, crc);
+}
+
+
+/// The data is loaded into registers once, and both stored and accumulated from there.
+
+PMEM_SSE42 uint32_t crc_copy_sse42(unsigned char* d, const unsigned char* s, size_t n, uint32_t crc) {
+
+#ifdef __x86_64__
+    if (n >= 3 * stripe) {
+
+        const Shift& sh(shift());
+
+        for (; n >= 3 * stripe; d += 3 * stripe, s += 3 * stripe, n -= 3 * stripe) {
+
+            uint64_t c0 = crc;
+            uint64_t c1 = 0;
+            uint64_t c2 = 0;
+
+            for (size_t i = 0; i < stripe; i += 8) {
+                uint64_t v0, v1, v2;
+                ::memcpy(&v0, s + i, sizeof(v0));
+                ::memcpy(&v1, s + stripe + i, sizeof(v1));
+                ::memcpy(&v2, s + 2 * stripe + i, sizeof(v2));
+                c0 = _mm_crc32_u64(c0, v0);
+                c1 = _mm_crc32_u64(c1, v1);
+                c2 = _mm_crc32_u64(c2, v2);
+                ::memcpy(d + i, &v0, sizeof(v0));
+                ::memcpy(d + stripe + i, &v1, sizeof(v1));
+                ::memcpy(d + 2 * stripe + i, &v2, sizeof(v2));
+            }
+
+            crc = sh(sh(uint32_t(c0)) ^ uint32_t(c1)) ^ uint32_t(c2);
+        }
+    }
+#endif
+
+    ::memcpy(d, s, n);
+    return crc_tail_sse42(s, n, crc);
+}
+
+#endif
+
+
+uint32_t crc_copy_software(unsigned char* d, const unsigned char* s, size_t n, uint32_t crc) {
+
+    // Work in blocks small enough that the source is still in L1 when it is checksummed.
+
+    const size_t block = 4096;
+
+    while (n > 0) {
+        size_t len = n < block ? n : block;
+        ::memcpy(d, s, len);
+        crc = crc_software(s, len, crc);
+        d += len;
+        s += len;
+        n -= len;
+    }
+
+    return crc;
+}
+
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+uint32_t crc32c(const void* data, size_t length, uint32_t crc) {
+
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+
+#ifdef PMEM_HAVE_SSE42_CRC
+    if (useSSE42())
+        return ~crc_sse42(p, length, ~crc);
+#endif
+
+    return ~crc_software(p, length, ~crc);
+}
+
+
+uint32_t crc32c_copy(void* dest, const void* src, size_t length, uint32_t crc) {
+
+    unsigned char* d = static_cast<unsigned char*>(dest);
+    const unsigned char* s = static_cast<const unsigned char*>(src);
+
+#ifdef PMEM_HAVE_SSE42_CRC
+    if (useSSE42())
+        return ~crc_copy_sse42(d, s, length, ~crc);
+#endif
+
+    return ~crc_copy_software(d, s, length, ~crc);
+}
+
+
+bool hardware() {
+#ifdef PMEM_HAVE_SSE42_CRC
+    return useSSE42();
+#else
+    return false;
+#endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace checksum
+} // namespace pmem
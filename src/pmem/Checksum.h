@@ -0,0 +1,56 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+#ifndef pmem_Checksum_H
+#define pmem_Checksum_H
+
+#include <cstddef>
+#include <stdint.h>
+
+
+/*
+ * CRC32C (Castagnoli) checksums, used to detect corruption of the data stored in persistent memory.
+ *
+ * Where the CPU supports SSE4.2 (determined at runtime) the crc32 instruction is used, which processes 8 bytes per
+ * instruction. Otherwise a table driven (slicing-by-8) implementation is used. Both give identical results.
+ *
+ * The checksums may be chained, so that crc32c(b, lb, crc32c(a, la)) is the checksum of a followed by b.
+ */
+
+
+namespace pmem {
+namespace checksum {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// The checksum of a block of memory, continuing from a previous checksum (or zero to start afresh).
+uint32_t crc32c(const void* data, size_t length, uint32_t crc = 0);
+
+/// Copy a block of memory, computing the checksum of the data as it is copied (so it is only read once).
+/// The regions must not overlap.
+uint32_t crc32c_copy(void* dest, const void* src, size_t length, uint32_t crc = 0);
+
+/// Is the crc32 instruction in use on this machine?
+bool hardware();
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace checksum
+} // namespace pmem
+
+#endif // pmem_Checksum_H
@@ -0,0 +1,250 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+#include "pmem/Compression.h"
+#include "pmem/Exceptions.h"
+
+
+namespace pmem {
+namespace compression {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace {
+
+const size_t min_match = 4;
+const size_t max_offset = 65535;
+
+/// The final bytes are always emitted as literals, and no match may start close to the end of the input. This
+/// keeps the compressor's reads in bounds without checks in the inner loop.
+const size_t last_literals = 5;
+const size_t match_limit = 12;
+
+const int hash_log = 12;
+const size_t hash_size = size_t(1) << hash_log;
+const size_t no_position = size_t(-1);
+
+
+inline uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    ::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+
+inline size_t hash(uint32_t v) {
+    return (v * 2654435761U) >> (32 - hash_log);
+}
+
+
+/// Lengths which do not fit in the 4-bit token field continue in following bytes. Each byte of 255 adds 255, and
+/// the first byte less than 255 terminates the length.
+
+bool write_length(unsigned char*& op, const unsigned char* oend, size_t length) {
+
+    while (length >= 255) {
+        if (op >= oend) return false;
+        *op++ = 255;
+        length -= 255;
+    }
+
+    if (op >= oend) return false;
+    *op++ = static_cast<unsigned char>(length);
+    return true;
+}
+
+
+size_t read_length(const unsigned char*& ip, const unsigned char* iend) {
+
+    size_t length = 0;
+    unsigned char b;
+    do {
+        if (ip >= iend)
+            throw PersistentError("Truncated compressed data", Here());
+        b = *ip++;
+        length += b;
+    } while (b == 255);
+
+    return length;
+}
+
+
+/// Emit one sequence. The last sequence in a block has only literals, indicated by a match length of zero.
+
+bool emit(unsigned char*& op, const unsigned char* oend,
+          const unsigned char* literals, size_t nliterals, size_t offset, size_t match) {
+
+    if (op >= oend) return false;
+    unsigned char* token = op++;
+
+    *token = static_cast<unsigned char>(std::min(nliterals, size_t(15)) << 4);
+    if (nliterals >= 15 && !write_length(op, oend, nliterals - 15))
+        return false;
+
+    if (size_t(oend - op) < nliterals) return false;
+    ::memcpy(op, literals, nliterals);
+    op += nliterals;
+
+    if (match == 0)
+        return true;
+
+    if (size_t(oend - op) < 2) return false;
+    *op++ = static_cast<unsigned char>(offset & 0xff);
+    *op++ = static_cast<unsigned char>(offset >> 8);
+
+    size_t m = match - min_match;
+    *token |= static_cast<unsigned char>(std::min(m, size_t(15)));
+    if (m >= 15 && !write_length(op, oend, m - 15))
+        return false;
+
+    return true;
+}
+
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+size_t bound(size_t length) {
+    return length + (length / 255) + 16;
+}
+
+
+size_t compress(const void* src, size_t length, void* dst, size_t capacity) {
+
+    const unsigned char* in = static_cast<const unsigned char*>(src);
+    unsigned char* const out = static_cast<unsigned char*>(dst);
+    unsigned char* op = out;
+    const unsigned char* oend = out + capacity;
+
+    size_t anchor = 0;
+
+    if (length > match_limit) {
+
+        size_t table[hash_size];
+        std::fill(table, table + hash_size, no_position);
+
+        size_t limit = length - match_limit;
+        size_t end = length - last_literals;
+        size_t ip = 0;
+
+        while (ip < limit) {
+
+            uint32_t v = read32(in + ip);
+            size_t h = hash(v);
+            size_t ref = table[h];
+            table[h] = ip;
+
+            if (ref != no_position && ip - ref <= max_offset && read32(in + ref) == v) {
+
+                size_t match = min_match;
+                while (ip + match < end && in[ref + match] == in[ip + match])
+                    match++;
+
+                if (!emit(op, oend, in + anchor, ip - anchor, ip - ref, match))
+                    return 0;
+
+                ip += match;
+                anchor = ip;
+
+            } else {
+
+                // Step faster through data that is not compressing
+                ip += 1 + ((ip - anchor) >> 6);
+            }
+        }
+    }
+
+    if (!emit(op, oend, in + anchor, length - anchor, 0, 0))
+        return 0;
+
+    return op - out;
+}
+
+
+void decompress(const void* src, size_t srcLength, void* dst, size_t length) {
+
+    const unsigned char* ip = static_cast<const unsigned char*>(src);
+    const unsigned char* iend = ip + srcLength;
+    unsigned char* const out = static_cast<unsigned char*>(dst);
+    unsigned char* op = out;
+    unsigned char* oend = out + length;
+
+    while (true) {
+
+        if (ip >= iend)
+            throw PersistentError("Truncated compressed data", Here());
+
+        unsigned char token = *ip++;
+
+        // Literals
+
+        size_t nliterals = token >> 4;
+        if (nliterals == 15)
+            nliterals += read_length(ip, iend);
+
+        if (size_t(iend - ip) < nliterals || size_t(oend - op) < nliterals)
+            throw PersistentError("Corrupt compressed data: literals out of range", Here());
+
+        ::memcpy(op, ip, nliterals);
+        ip += nliterals;
+        op += nliterals;
+
+        // The last sequence has no match
+
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            throw PersistentError("Truncated compressed data", Here());
+
+        size_t offset = size_t(ip[0]) | (size_t(ip[1]) << 8);
+        ip += 2;
+
+        size_t match = token & 15;
+        if (match == 15)
+            match += read_length(ip, iend);
+        match += min_match;
+
+        if (offset == 0 || offset > size_t(op - out) || size_t(oend - op) < match)
+            throw PersistentError("Corrupt compressed data: match out of range", Here());
+
+        // Overlapping matches (offset < match) replicate a short pattern, so must be copied forwards byte by byte.
+
+        const unsigned char* ref = op - offset;
+        if (offset >= match) {
+            ::memcpy(op, ref, match);
+        } else {
+            for (size_t i = 0; i < match; i++)
+                op[i] = ref[i];
+        }
+        op += match;
+    }
+
+    if (op != oend)
+        throw PersistentError("Corrupt compressed data: wrong decompressed length", Here());
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace compression
+} // namespace pmem
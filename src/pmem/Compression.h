@@ -0,0 +1,58 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+#ifndef pmem_Compression_H
+#define pmem_Compression_H
+
+#include <cstddef>
+
+
+/*
+ * A fast, byte oriented LZ77 codec, used to compress PersistentBuffer payloads.
+ *
+ * The format follows the LZ4 block format: a sequence of (literals, match) pairs, each introduced by a token byte
+ * holding the literal and match lengths, with matches referring back up to 64KiB into the decompressed output.
+ * There is no entropy coding, so decompression is little more than a sequence of memcpys. The compressor uses a
+ * single-probe hash table, trading some ratio for speed.
+ *
+ * The codec is self-contained so that the library does not acquire a further external dependency.
+ */
+
+
+namespace pmem {
+namespace compression {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// The largest possible output of compress() for an input of the given length.
+size_t bound(size_t length);
+
+/// Compress length bytes from src into dst, which has space for capacity bytes. Returns the compressed size, or
+/// zero if the output would not fit.
+size_t compress(const void* src, size_t length, void* dst, size_t capacity);
+
+/// Decompress srcLength bytes from src, which must expand to exactly length bytes in dst. Corrupt or truncated input
+/// throws a PersistentError, rather than reading or writing out of bounds.
+void decompress(const void* src, size_t srcLength, void* dst, size_t length);
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace compression
+} // namespace pmem
+
+#endif // pmem_Compression_H
@@ -0,0 +1,335 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+
+#include <chrono>
+#include <limits>
+
+#include "eckit/exception/Exceptions.h"
+#include "eckit/log/Log.h"
+
+#include "pmem/EpochManager.h"
+#include "pmem/LibPMem.h"
+#include "pmem/PoolObjectRegistry.h"
+
+using namespace eckit;
+
+
+namespace pmem {
+
+namespace {
+
+// n.b. Managers may be opened during static initialisation, so the registry is constructed on first use.
+PoolObjectRegistry<EpochManager>& registry() {
+    static PoolObjectRegistry<EpochManager> managers;
+    return managers;
+}
+
+/// The reader slot last used by this thread. Threads normally find it free again, so entry needs only one CAS.
+thread_local size_t slotHint = 0;
+
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+PersistentRetireList::PersistentRetireList(size_t capacity) :
+    capacity_(capacity) {
+
+    for (size_t i = 0; i < capacity_; i++) {
+        records_[i].object = OID_NULL;
+        records_[i].location = OID_NULL;
+    }
+}
+
+
+PersistentRetireList::PersistentRetireList(const PersistentRetireList& source, size_t capacity) :
+    capacity_(capacity) {
+
+    ASSERT(capacity_ >= source.capacity_);
+
+    size_t i;
+    for (i = 0; i < source.capacity_; i++) {
+        records_[i] = source.records_[i];
+    }
+    for (; i < capacity_; i++) {
+        records_[i].object = OID_NULL;
+        records_[i].location = OID_NULL;
+    }
+}
+
+
+size_t PersistentRetireList::data_size(size_t capacity) {
+    ASSERT(capacity > 0);
+    return sizeof(PersistentRetireList) + (capacity - 1) * sizeof(Record);
+}
+
+
+size_t PersistentRetireList::capacity() const {
+    return capacity_;
+}
+
+
+PersistentRetireList::Record& PersistentRetireList::operator[](size_t i) {
+    ASSERT(i < capacity_);
+    return records_[i];
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------
+
+const size_t EpochManager::max_readers;
+const size_t EpochManager::initial_capacity;
+const size_t EpochManager::reclaim_batch;
+const size_t EpochManager::reclaim_interval;
+
+
+EpochManager::~EpochManager() {
+
+    if (reclaimer_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        reclaimer_.join();
+    }
+
+    // Anything that cannot be freed yet remains in the persistent list, and is freed when the pool is next opened.
+
+    reclaim();
+
+    Log::debug<LibPMem>() << "Closed epoch manager with " << pending() << " objects awaiting reclamation"
+                          << std::endl;
+
+    deregisterManager(pool_);
+}
+
+
+size_t EpochManager::enter() {
+
+    size_t slot = slotHint;
+    uint64_t epoch = epoch_.load();
+
+    // Claim a free slot, starting from the one this thread used last.
+
+    for (size_t attempts = 0; ; slot = (slot + 1) % max_readers) {
+        uint64_t expected = 0;
+        if (readers_[slot].epoch.compare_exchange_strong(expected, epoch))
+            break;
+        if (++attempts % max_readers == 0)
+            std::this_thread::yield();
+    }
+
+    slotHint = slot;
+
+    // If the epoch has been advanced meanwhile, a writer may not have seen this reader. Publish the new epoch
+    // until it is seen to be current, after which every writer that retires an object will.
+
+    for (uint64_t current = epoch_.load(); current != epoch; current = epoch_.load()) {
+        epoch = current;
+        readers_[slot].epoch.store(epoch);
+    }
+
+    return slot;
+}
+
+
+void EpochManager::exit(size_t slot) {
+    ASSERT(slot < max_readers);
+    readers_[slot].epoch.store(0, std::memory_order_release);
+}
+
+
+void EpochManager::commit(size_t index) {
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    PersistentRetireList::Record& rec((*list_)[index]);
+    rec.location = OID_NULL;
+    ::pmemobj_persist(pool_, &rec.location, sizeof(rec.location));
+
+    // The object has been unlinked, so readers that enter after the epoch is advanced cannot find it.
+
+    retired_.push_back(std::make_pair(epoch_.fetch_add(1), index));
+
+    if (retired_.size() % reclaim_batch == 0)
+        cv_.notify_one();
+}
+
+
+void EpochManager::abandon(size_t index) {
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    PersistentRetireList::Record& rec((*list_)[index]);
+    rec.object.off = 0;
+    ::pmemobj_persist(pool_, &rec.object.off, sizeof(rec.object.off));
+
+    free_.push_back(index);
+}
+
+
+void EpochManager::recover() {
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    size_t freed = 0;
+    size_t discarded = 0;
+
+    for (size_t i = list_->capacity(); i > 0; i--) {
+
+        PersistentRetireList::Record& rec((*list_)[i - 1]);
+
+        if (!OID_IS_NULL(rec.object)) {
+
+            // An interrupted unlink. If the pointer still refers to the object, it is still in use.
+
+            const PMEMoid* location = static_cast<const PMEMoid*>(::pmemobj_direct(rec.location));
+
+            if (location && OID_EQUALS(*location, rec.object)) {
+                rec.object.off = 0;
+                ::pmemobj_persist(pool_, &rec.object.off, sizeof(rec.object.off));
+                discarded++;
+            } else {
+                ::pmemobj_free(&rec.object);
+                freed++;
+            }
+        }
+
+        free_.push_back(i - 1);
+    }
+
+    if (freed != 0 || discarded != 0) {
+        Log::info() << "Epoch manager recovery freed " << freed << " retired objects, and discarded "
+                    << discarded << " incomplete records" << std::endl;
+    }
+}
+
+
+uint64_t EpochManager::oldestReader() const {
+
+    uint64_t oldest = std::numeric_limits<uint64_t>::max();
+
+    for (size_t i = 0; i < max_readers; i++) {
+        uint64_t epoch = readers_[i].epoch.load();
+        if (epoch != 0 && epoch < oldest)
+            oldest = epoch;
+    }
+
+    return oldest;
+}
+
+
+size_t EpochManager::reclaim() {
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // An object retired at epoch e may be in use by readers that entered at or before e.
+
+    uint64_t oldest = oldestReader();
+    size_t count = 0;
+
+    while (!retired_.empty() && retired_.front().first < oldest) {
+
+        PersistentRetireList::Record& rec((*list_)[retired_.front().second]);
+        ::pmemobj_free(&rec.object);
+
+        free_.push_back(retired_.front().second);
+        retired_.pop_front();
+        count++;
+    }
+
+    if (count != 0)
+        Log::debug<LibPMem>() << "Reclaimed " << count << " retired objects" << std::endl;
+
+    return count;
+}
+
+
+void EpochManager::synchronize() {
+
+    // Readers that enter from now on have a later epoch. Wait for the rest.
+
+    uint64_t epoch = epoch_.fetch_add(1);
+
+    for (size_t i = 0; i < max_readers; i++) {
+        for (uint64_t e = readers_[i].epoch.load(); e != 0 && e <= epoch; e = readers_[i].epoch.load())
+            std::this_thread::yield();
+    }
+}
+
+
+size_t EpochManager::pending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return retired_.size();
+}
+
+
+void EpochManager::reclaimLoop() {
+
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (!stop_) {
+
+        cv_.wait_for(lock, std::chrono::milliseconds(reclaim_interval));
+
+        if (!stop_ && !retired_.empty()) {
+            lock.unlock();
+            reclaim();
+            lock.lock();
+        }
+    }
+}
+
+
+EpochManager& EpochManager::lookup(const void* ptr) {
+
+    PMEMobjpool* pool = ::pmemobj_pool_by_ptr(ptr);
+
+    if (pool == 0)
+        throw SeriousBug("Requested pointer not in mapped pmem space", Here());
+
+    return lookup(pool);
+}
+
+
+EpochManager& EpochManager::lookup(PMEMobjpool* pool) {
+
+    EpochManager* manager = registry().find(pool);
+    if (manager == 0)
+        throw SeriousBug("No epoch manager has been opened for the pool", Here());
+
+    return *manager;
+}
+
+
+void EpochManager::registerManager(PMEMobjpool* pool, EpochManager* manager) {
+
+    // Only one manager may be open for each pool, otherwise readers of one would be invisible to the other.
+    registry().add(pool, manager);
+}
+
+
+void EpochManager::deregisterManager(PMEMobjpool* pool) {
+    registry().remove(pool);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace pmem
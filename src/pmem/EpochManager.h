@@ -0,0 +1,374 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+
+#ifndef pmem_EpochManager_H
+#define pmem_EpochManager_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include "eckit/exception/Exceptions.h"
+#include "eckit/log/Log.h"
+#include "eckit/memory/NonCopyable.h"
+
+#include "pmem/AtomicConstructor.h"
+#include "pmem/LibPMem.h"
+#include "pmem/PersistentPtr.h"
+
+
+/*
+ * Modus-operandi:
+ *
+ * Deferred freeing of persistent objects that may still be in use by concurrent readers, which take no locks
+ * (e.g. the superseded copies of the data of a PersistentVector, see PersistentVector::publish_back).
+ *
+ * Readers:
+ *
+ * A reader holds an EpochGuard while it uses (pointers to) objects that may be replaced. On entry, the guard
+ * publishes the current global epoch in one of a fixed set of reader slots, and on exit it clears it again. This
+ * costs one compare-and-swap and one store, and no locks are taken. Guards may be nested.
+ *
+ * Writers:
+ *
+ * An object is retired by atomically unlinking it from the persistent pointer that refers to it, either by
+ * replacing it with a new object (replace_ctr) or by nullifying the pointer (retire). The global epoch is then
+ * advanced. Readers that enter after this cannot find the object, so it may be freed once all of the readers that
+ * entered at or before its epoch have exited. This is checked by reclaim(), which frees all of the eligible
+ * objects in one batch. Normally this is called from a background thread, which wakes periodically (or once a
+ * batch of objects is waiting).
+ *
+ * Persistence:
+ *
+ * The objects awaiting reclamation are recorded in a PersistentRetireList, owned by the application (normally in
+ * the root object). Each record holds the object, and (while it is being unlinked) the location of the pointer
+ * that refers to it:
+ *
+ *   i)   The record is written, and persisted, before the object is unlinked. The object field is written last,
+ *        so it is only valid once complete.
+ *   ii)  The pointer is atomically swung (or nullified), and persisted.
+ *   iii) The location is cleared, and persisted. The object is now retired.
+ *   iv)  Once its grace period has expired, the object is freed (atomically clearing the record, by passing
+ *        pmemobj_free the address of the record itself).
+ *
+ * When the manager is constructed (i.e. the pool is opened) there cannot be any readers, so all of the retired
+ * objects are freed immediately. A record that still has a location was interrupted while being unlinked. The
+ * object is freed if the pointer no longer refers to it, otherwise the record is discarded. Nothing is leaked,
+ * and nothing still in use is freed, wherever persistence is lost.
+ *
+ * The list starts small, and is atomically replaced with a larger copy as required. It is only accessed by the
+ * manager (with its mutex held), so it can be freed immediately.
+ *
+ * Each manager registers itself against its pool, so that objects in the pool can find it from their own address
+ * (in the same way as the InternTable).
+ *
+ * n.b. A thread must not call synchronize() while it holds an EpochGuard, as it would wait for itself.
+ *
+ * n.b. The methods that allocate, or replace, persistent objects depend on the type_id of PersistentRetireList
+ *      (and of the objects being replaced), which are defined by the application, so they are defined inline.
+ */
+
+
+namespace pmem {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+/// The persistent record of the objects awaiting reclamation by an EpochManager.
+
+class PersistentRetireList {
+
+public: // types
+
+    struct Record {
+        /// The object to free. Null if the record is unused.
+        PMEMoid object;
+        /// The persistent pointer that referred to the object, while it is being unlinked. Otherwise null.
+        PMEMoid location;
+    };
+
+public: // methods
+
+    PersistentRetireList(size_t capacity);
+
+    /// Copy the records into a larger list.
+    PersistentRetireList(const PersistentRetireList& source, size_t capacity);
+
+    /// The amount of memory that needs to be allocated to store this
+    static size_t data_size(size_t capacity);
+
+    size_t capacity() const;
+
+    Record& operator[](size_t i);
+
+private: // members
+
+    uint64_t capacity_;
+
+    // The allocator/constructor will make the PersistentRetireList the right size.
+    Record records_[1];
+};
+
+
+template <>
+class AtomicConstructor1<PersistentRetireList, size_t> : public AtomicConstructor1Base<PersistentRetireList, size_t> {
+public:
+    AtomicConstructor1(const size_t& x1) : AtomicConstructor1Base<PersistentRetireList, size_t>(x1) {}
+    virtual size_t size() const { return PersistentRetireList::data_size(this->x1_); }
+};
+
+
+template <>
+class AtomicConstructor2<PersistentRetireList, PersistentRetireList, size_t> :
+        public AtomicConstructor2Base<PersistentRetireList, PersistentRetireList, size_t> {
+public:
+    AtomicConstructor2(const PersistentRetireList& x1, const size_t& x2) :
+        AtomicConstructor2Base<PersistentRetireList, PersistentRetireList, size_t>(x1, x2) {}
+    virtual size_t size() const { return PersistentRetireList::data_size(this->x2_); }
+};
+
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+class EpochManager : private eckit::NonCopyable {
+
+public: // types
+
+    typedef PersistentPtr<PersistentRetireList> storage_type;
+
+    /// The number of readers that may be inside a critical section at once. Further readers wait for a slot.
+    static const size_t max_readers = 128;
+
+    /// The initial capacity of the persistent list. It doubles as required.
+    static const size_t initial_capacity = 64;
+
+    /// The background thread is woken once this many objects are waiting, and otherwise every reclaim_interval
+    /// milliseconds.
+    static const size_t reclaim_batch = 32;
+    static const size_t reclaim_interval = 100;
+
+public: // methods
+
+    /// Open the manager, allocating the persistent list if need be, and freeing any objects that were retired
+    /// when the pool was last used.
+    EpochManager(storage_type& storage, bool background=true);
+    ~EpochManager();
+
+    /// Enter and exit a read-side critical section. Use EpochGuard in preference.
+    size_t enter();
+    void exit(size_t slot);
+
+    /// Atomically replace the object referred to by a persistent pointer with a new one, as for
+    /// PersistentPtr::replace_ctr, but defer freeing the original until no reader can be using it.
+    template <typename T>
+    void replace_ctr(PersistentPtr<T>& ptr, const AtomicConstructor<T>& constructor);
+
+    /// Atomically nullify a persistent pointer, deferring freeing the object it referred to until no reader can be
+    /// using it.
+    template <typename T>
+    void retire(PersistentPtr<T>& ptr);
+
+    /// Free all of the retired objects that can no longer be in use. Returns the number freed.
+    size_t reclaim();
+
+    /// Wait until all of the readers currently inside critical sections have exited them.
+    void synchronize();
+
+    /// The number of retired objects not yet freed.
+    size_t pending() const;
+
+    /// The manager registered for the pool containing the given persistent object (or pool).
+    static EpochManager& lookup(const void* ptr);
+    static EpochManager& lookup(PMEMobjpool* pool);
+
+private: // types
+
+    /// Each slot holds the epoch at which a reader entered, or zero. Padded to avoid false sharing between readers.
+    struct ReaderSlot {
+        std::atomic<uint64_t> epoch;
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+private: // methods
+
+    /// Record an object (and the pointer that refers to it) before it is unlinked. Returns the record index.
+    size_t record(const PMEMoid& object, const void* location);
+
+    /// Retire the object in the record, once it has been unlinked.
+    void commit(size_t index);
+
+    /// Discard the record, if the object could not be unlinked.
+    void abandon(size_t index);
+
+    /// Free the objects left over from the last time the pool was used. There must be no readers.
+    void recover();
+
+    /// The oldest epoch of any reader, or UINT64_MAX if there are none.
+    uint64_t oldestReader() const;
+
+    void reclaimLoop();
+
+    static void registerManager(PMEMobjpool* pool, EpochManager* manager);
+    static void deregisterManager(PMEMobjpool* pool);
+
+private: // members
+
+    storage_type& storage_;
+
+    PMEMobjpool* pool_;
+
+    /// Epochs start from 1, as zero marks an unused reader slot.
+    std::atomic<uint64_t> epoch_;
+
+    ReaderSlot readers_[max_readers];
+
+    /// Protects everything below (and the persistent list).
+    mutable std::mutex mutex_;
+
+    PersistentRetireList* list_;
+
+    std::vector<size_t> free_;
+
+    /// The retired records (and the epochs at which they were retired), oldest first.
+    std::deque<std::pair<uint64_t, size_t> > retired_;
+
+    std::condition_variable cv_;
+    bool stop_;
+    std::thread reclaimer_;
+};
+
+
+/// Hold a read-side critical section of an EpochManager, for the lifetime of the object.
+
+class EpochGuard : private eckit::NonCopyable {
+public:
+    EpochGuard(EpochManager& epochs) : epochs_(epochs), slot_(epochs.enter()) {}
+    ~EpochGuard() { epochs_.exit(slot_); }
+private:
+    EpochManager& epochs_;
+    size_t slot_;
+};
+
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+inline EpochManager::EpochManager(storage_type& storage, bool background) :
+    storage_(storage),
+    pool_(::pmemobj_pool_by_ptr(&storage)),
+    epoch_(1),
+    list_(0),
+    stop_(false) {
+
+    if (pool_ == 0)
+        throw eckit::SeriousBug("Epoch manager storage is not in a persistent pool", Here());
+
+    for (size_t i = 0; i < max_readers; i++)
+        readers_[i].epoch.store(0);
+
+    if (storage_.null())
+        storage_.allocate(size_t(initial_capacity));
+
+    list_ = storage_.get();
+    recover();
+
+    registerManager(pool_, this);
+
+    if (background)
+        reclaimer_ = std::thread(&EpochManager::reclaimLoop, this);
+}
+
+
+template <typename T>
+inline void EpochManager::replace_ctr(PersistentPtr<T>& ptr, const AtomicConstructor<T>& constructor) {
+
+    ASSERT(!ptr.null());
+
+    size_t index = record(ptr.raw(), &ptr);
+
+    try {
+        ptr.publish_ctr(constructor);
+    } catch (...) {
+        abandon(index);
+        throw;
+    }
+
+    commit(index);
+}
+
+
+template <typename T>
+inline void EpochManager::retire(PersistentPtr<T>& ptr) {
+
+    ASSERT(!ptr.null());
+
+    size_t index = record(ptr.raw(), &ptr);
+    ptr.setPersist(PersistentPtr<T>());
+    commit(index);
+}
+
+
+inline size_t EpochManager::record(const PMEMoid& object, const void* location) {
+
+    ASSERT(::pmemobj_pool_by_ptr(location) == pool_);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Grow the list if it is full. Only the manager uses it, so the old copy can be freed immediately.
+
+    if (free_.empty()) {
+        size_t capacity = list_->capacity();
+        eckit::Log::debug<LibPMem>() << "Growing retire list to " << 2 * capacity << " records" << std::endl;
+
+        storage_.replace_ctr(AtomicConstructor2<PersistentRetireList, PersistentRetireList, size_t>(*list_,
+                                                                                                   2 * capacity));
+        list_ = storage_.get();
+        for (size_t i = 2 * capacity; i > capacity; i--)
+            free_.push_back(i - 1);
+    }
+
+    size_t index = free_.back();
+    free_.pop_back();
+
+    // The object is written last, as it marks the record as valid.
+
+    PersistentRetireList::Record& rec((*list_)[index]);
+    ASSERT(OID_IS_NULL(rec.object));
+
+    rec.location = ::pmemobj_oid(location);
+    rec.object.pool_uuid_lo = object.pool_uuid_lo;
+    ::pmemobj_persist(pool_, &rec, sizeof(rec));
+
+    rec.object.off = object.off;
+    ::pmemobj_persist(pool_, &rec.object.off, sizeof(rec.object.off));
+
+    return index;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace pmem
+
+#endif // pmem_EpochManager_H
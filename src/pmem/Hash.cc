@@ -0,0 +1,144 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+#include <cstring>
+
+#include "pmem/Hash.h"
+
+
+namespace pmem {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace {
+
+const uint64_t prime1 = 11400714785074694791ULL;
+const uint64_t prime2 = 14029467366897019727ULL;
+const uint64_t prime3 = 1609587929392839161ULL;
+const uint64_t prime4 = 9650029242287828579ULL;
+const uint64_t prime5 = 2870177450012600261ULL;
+
+
+// n.b. The algorithm is defined in terms of little-endian reads, which is what these give on our (x86) targets.
+
+inline uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    ::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+
+inline uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    ::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+
+inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+
+inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+    acc += input * prime2;
+    acc = rotl(acc, 31);
+    return acc * prime1;
+}
+
+
+inline uint64_t merge_round(uint64_t acc, uint64_t val) {
+    acc ^= hash_round(0, val);
+    return acc * prime1 + prime4;
+}
+
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+uint64_t hash64(const void* data, size_t length, uint64_t seed) {
+
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + length;
+
+    uint64_t h;
+
+    // Four independent accumulators over 32 byte stripes
+
+    if (length >= 32) {
+
+        const unsigned char* limit = end - 32;
+
+        uint64_t v1 = seed + prime1 + prime2;
+        uint64_t v2 = seed + prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - prime1;
+
+        do {
+            v1 = hash_round(v1, read64(p));
+            v2 = hash_round(v2, read64(p + 8));
+            v3 = hash_round(v3, read64(p + 16));
+            v4 = hash_round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge_round(h, v1);
+        h = merge_round(h, v2);
+        h = merge_round(h, v3);
+        h = merge_round(h, v4);
+
+    } else {
+        h = seed + prime5;
+    }
+
+    h += length;
+
+    // And the tail
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= hash_round(0, read64(p));
+        h = rotl(h, 27) * prime1 + prime4;
+    }
+
+    if (p + 4 <= end) {
+        h ^= uint64_t(read32(p)) * prime1;
+        h = rotl(h, 23) * prime2 + prime3;
+        p += 4;
+    }
+
+    for (; p < end; p++) {
+        h ^= (*p) * prime5;
+        h = rotl(h, 11) * prime1;
+    }
+
+    // Final avalanche
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace pmem
@@ -0,0 +1,41 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+#ifndef pmem_Hash_H
+#define pmem_Hash_H
+
+#include <cstddef>
+#include <stdint.h>
+
+
+namespace pmem {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// A fast, non-cryptographic 64-bit hash of a block of memory (the xxHash64 algorithm). This processes several GB/s
+/// on a single core, and is suitable for content digests where equality is confirmed by comparing the data.
+///
+/// @note The value does not depend on the build, so may be stored persistently.
+
+uint64_t hash64(const void* data, size_t length, uint64_t seed = 0);
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace pmem
+
+#endif // pmem_Hash_H
@@ -0,0 +1,202 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+
+#include <cmath>
+#include <cstdlib>
+
+#include "eckit/exception/Exceptions.h"
+
+#include "pmem/InternTable.h"
+#include "pmem/PoolObjectRegistry.h"
+
+using namespace eckit;
+
+
+namespace pmem {
+
+namespace {
+
+// n.b. Tables may be opened during static initialisation, so the registry is constructed on first use.
+PoolObjectRegistry<InternTable>& registry() {
+    static PoolObjectRegistry<InternTable> tables;
+    return tables;
+}
+
+class ReadLock : private NonCopyable {
+public:
+    ReadLock(pthread_rwlock_t& lock) : lock_(lock) {
+        int rc = ::pthread_rwlock_rdlock(&lock_);
+        ASSERT(rc == 0);
+    }
+    ~ReadLock() { ::pthread_rwlock_unlock(&lock_); }
+private:
+    pthread_rwlock_t& lock_;
+};
+
+
+class WriteLock : private NonCopyable {
+public:
+    WriteLock(pthread_rwlock_t& lock) : lock_(lock) {
+        int rc = ::pthread_rwlock_wrlock(&lock_);
+        ASSERT(rc == 0);
+    }
+    ~WriteLock() { ::pthread_rwlock_unlock(&lock_); }
+private:
+    pthread_rwlock_t& lock_;
+};
+
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+const uint32_t InternTable::missing;
+const size_t InternTable::first_chunk_bits;
+const size_t InternTable::first_chunk;
+const size_t InternTable::max_chunks;
+
+
+InternTable::~InternTable() {
+
+    deregisterTable(pool_);
+    ::pthread_rwlock_destroy(&lock_);
+}
+
+
+uint32_t InternTable::find(const std::string& str) const {
+
+    ReadLock lock(lock_);
+
+    std::unordered_map<std::string, uint32_t>::const_iterator it = ids_.find(str);
+    return (it == ids_.end()) ? missing : it->second;
+}
+
+
+const std::string& InternTable::string(uint32_t id) const {
+    return symbol(id).str;
+}
+
+
+bool InternTable::number(uint32_t id, double& value) const {
+
+    const Symbol& sym(symbol(id));
+
+    value = sym.number;
+    return sym.numeric;
+}
+
+
+const InternTable::Symbol& InternTable::symbol(uint32_t id) const {
+
+    size_t size = size_.load(std::memory_order_acquire);
+    if (id >= size)
+        throw OutOfRange(id, size, Here());
+
+    size_t chunk;
+    size_t offset;
+    locate(id, chunk, offset);
+
+    return chunks_[chunk][offset];
+}
+
+
+size_t InternTable::size() const {
+    return size_.load(std::memory_order_acquire);
+}
+
+
+uint32_t InternTable::cache(const std::string& str) {
+
+    uint32_t id = size_.load(std::memory_order_relaxed);
+
+    size_t chunk;
+    size_t offset;
+    locate(id, chunk, offset);
+
+    if (!chunks_[chunk])
+        chunks_[chunk].reset(new Symbol[first_chunk << chunk]);
+
+    Symbol& sym(chunks_[chunk][offset]);
+    sym.str = str;
+
+    // Parse the numbers up front, so that ranges of values can be tested cheaply (see tree::TreeQuery).
+
+    char* end;
+    sym.number = str.empty() ? 0 : ::strtod(str.c_str(), &end);
+    sym.numeric = !str.empty() && end == str.c_str() + str.length() && std::isfinite(sym.number);
+
+    // The entry is published under the lock, together with the id, so that anyone given the id (by intern() or
+    // find() on another thread) can resolve it, and any id that can be resolved can also be found.
+
+    WriteLock lock(lock_);
+    ids_.insert(std::make_pair(str, id));
+    size_.store(id + 1, std::memory_order_release);
+
+    return id;
+}
+
+
+void InternTable::locate(uint32_t id, size_t& chunk, size_t& offset) {
+
+    // Chunk k holds (first_chunk << k) strings, starting from id ((first_chunk << k) - first_chunk).
+
+    uint64_t n = uint64_t(id) + first_chunk;
+    size_t bits = 63 - __builtin_clzll(n);
+
+    chunk = bits - first_chunk_bits;
+    offset = n - (uint64_t(1) << bits);
+
+    ASSERT(chunk < max_chunks);
+}
+
+
+InternTable& InternTable::lookup(const void* ptr) {
+
+    PMEMobjpool* pool = ::pmemobj_pool_by_ptr(ptr);
+
+    if (pool == 0)
+        throw SeriousBug("Requested pointer not in mapped pmem space", Here());
+
+    return lookup(pool);
+}
+
+
+InternTable& InternTable::lookup(PMEMobjpool* pool) {
+
+    InternTable* table = registry().find(pool);
+    if (table == 0)
+        throw SeriousBug("No intern table has been opened for the pool", Here());
+
+    return *table;
+}
+
+
+void InternTable::registerTable(PMEMobjpool* pool, InternTable* table) {
+
+    // Only one table may be open for each pool, otherwise their caches would diverge.
+    registry().add(pool, table);
+}
+
+
+void InternTable::deregisterTable(PMEMobjpool* pool) {
+    registry().remove(pool);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace pmem
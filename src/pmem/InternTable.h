@@ -0,0 +1,205 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+
+#ifndef pmem_InternTable_H
+#define pmem_InternTable_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "eckit/exception/Exceptions.h"
+#include "eckit/log/Log.h"
+#include "eckit/memory/NonCopyable.h"
+
+#include "pmem/LibPMem.h"
+#include "pmem/PersistentString.h"
+#include "pmem/PersistentVector.h"
+
+
+/*
+ * Modus-operandi:
+ *
+ * A pool-level symbol table, mapping strings to small integer ids. Objects in the pool store the ids in place of
+ * the strings, so comparisons become integer comparisons, and each distinct string is only stored once.
+ *
+ * The persistent part is just a PersistentVector<PersistentString>, owned by the application (normally in the
+ * root object). The id of a string is its index in the vector. Strings are only ever appended, so ids are stable.
+ *
+ * The InternTable is a volatile wrapper around this vector. When it is constructed (i.e. when the pool is opened)
+ * it builds an in-memory cache of the strings, in both directions, so that neither interning nor resolving an id
+ * needs to touch persistent memory unless a new string is added.
+ *
+ * Each table registers itself against the pool containing its vector, so that objects in the pool can find the
+ * table from their own address (see PoolObjectRegistry). Resolving ids takes no locks, and looking up strings only
+ * excludes writers, so that the table can be used on every access to the tree from many threads at once.
+ *
+ * n.b. If persistence is lost while a string is being appended, the string is either present or not. A string
+ *      may be interned, and the object that uses it never created, in which case the string is just unused.
+ *
+ * n.b. The methods that touch the persistent vector depend on the type_id of PersistentString, which is defined
+ *      by the application, so they are defined inline.
+ */
+
+
+namespace pmem {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+class InternTable : private eckit::NonCopyable {
+
+public: // types
+
+    typedef PersistentVector<PersistentString> storage_type;
+
+    /// The id returned by find() for strings that have not been interned.
+    static const uint32_t missing = uint32_t(-1);
+
+public: // methods
+
+    InternTable(storage_type& strings);
+    ~InternTable();
+
+    /// The id of the string, adding it to the table if it is not already present.
+    uint32_t intern(const std::string& str);
+
+    /// The id of the string if it is present, otherwise InternTable::missing. The table is not modified.
+    uint32_t find(const std::string& str) const;
+
+    /// The string corresponding to an id. The reference remains valid for the lifetime of the table. Takes no locks.
+    const std::string& string(uint32_t id) const;
+
+    /// The numeric value of the string corresponding to an id, if the whole string is a (finite) number. This is
+    /// parsed once, when the string is cached. Takes no locks.
+    bool number(uint32_t id, double& value) const;
+
+    size_t size() const;
+
+    /// The table registered for the pool containing the given persistent object (or pool).
+    static InternTable& lookup(const void* ptr);
+    static InternTable& lookup(PMEMobjpool* pool);
+
+private: // types
+
+    struct Symbol {
+        std::string str;
+        double number;
+        bool numeric;
+    };
+
+private: // methods
+
+    /// Add a string to the volatile cache. The mutex must be held.
+    uint32_t cache(const std::string& str);
+
+    /// The entry for an id, which must have been cached.
+    const Symbol& symbol(uint32_t id) const;
+
+    /// The location of the entry with the given id in the chunks.
+    static void locate(uint32_t id, size_t& chunk, size_t& offset);
+
+    static void registerTable(PMEMobjpool* pool, InternTable* table);
+    static void deregisterTable(PMEMobjpool* pool);
+
+private: // members
+
+    storage_type& strings_;
+
+    PMEMobjpool* pool_;
+
+    /// Serialises the writers.
+    std::mutex mutex_;
+
+    /// Held for reading by lookups of strings, and for writing while a string is added to them.
+    mutable pthread_rwlock_t lock_;
+
+    /// The strings (and their numeric values), by id. These are held in chunks that double in size (so that the
+    /// strings never move, and the references returned by string() remain valid). Each entry is complete before it
+    /// is counted in size_.
+    static const size_t first_chunk_bits = 10;
+    static const size_t first_chunk = size_t(1) << first_chunk_bits;
+    static const size_t max_chunks = 23;
+    std::unique_ptr<Symbol[]> chunks_[max_chunks];
+    std::atomic<size_t> size_;
+
+    std::unordered_map<std::string, uint32_t> ids_;
+};
+
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+inline InternTable::InternTable(storage_type& strings) :
+    strings_(strings),
+    pool_(::pmemobj_pool_by_ptr(&strings)),
+    size_(0) {
+
+    if (pool_ == 0)
+        throw eckit::SeriousBug("Intern table storage is not in a persistent pool", Here());
+
+    int rc = ::pthread_rwlock_init(&lock_, 0);
+    ASSERT(rc == 0);
+
+    try {
+        for (storage_type::const_iterator it = strings_.begin(), end = strings_.end(); it != end; ++it)
+            cache(std::string((*it)->c_str(), (*it)->length()));
+
+        registerTable(pool_, this);
+    } catch (...) {
+        ::pthread_rwlock_destroy(&lock_);
+        throw;
+    }
+
+    eckit::Log::debug<LibPMem>() << "Opened intern table with " << size() << " strings" << std::endl;
+}
+
+
+inline uint32_t InternTable::intern(const std::string& str) {
+
+    // Most strings have already been interned, so look for them first without excluding the other readers.
+
+    uint32_t id = find(str);
+    if (id != missing)
+        return id;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    id = find(str);
+    if (id != missing)
+        return id;
+
+    // Persist the string before it is cached (and its id handed out).
+
+    ASSERT(strings_.size() == size());
+    ASSERT(size() < size_t(missing));
+
+    strings_.push_back(str);
+    return cache(str);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace pmem
+
+#endif // pmem_InternTable_H
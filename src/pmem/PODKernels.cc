@@ -0,0 +1,469 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+#include <cstring>
+
+#include "pmem/PODKernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PMEM_HAVE_AVX2_KERNELS
+#include <immintrin.h>
+#endif
+
+
+/*
+ * The AVX2 kernels are compiled with a per-function target attribute, rather than building this file with
+ * -mavx2, so that the library still runs on machines without AVX2. Whether they are used is decided once, at
+ * runtime.
+ *
+ * Each kernel is written once against a small set of per-type operations (AVX2Ops<T>), which hide the
+ * differences between the integer and floating point instructions, and the lack of unsigned and 64-bit
+ * comparisons in AVX2.
+ */
+
+
+namespace pmem {
+namespace kernels {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifdef PMEM_HAVE_AVX2_KERNELS
+
+namespace {
+
+#define PMEM_AVX2 __attribute__((target("avx2")))
+
+
+bool useAVX2() {
+    static const bool avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+    return avx2;
+}
+
+
+template <typename T> struct AVX2Ops;
+
+
+template <> struct AVX2Ops<int32_t> {
+
+    typedef __m256i vec;
+    typedef __m256i acc;
+    static const size_t lanes = 8;
+
+    PMEM_AVX2 static vec load(const int32_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    PMEM_AVX2 static vec set1(int32_t v) { return _mm256_set1_epi32(v); }
+    PMEM_AVX2 static int mask(vec m) { return _mm256_movemask_ps(_mm256_castsi256_ps(m)); }
+
+    PMEM_AVX2 static int eq(vec a, vec b) { return mask(_mm256_cmpeq_epi32(a, b)); }
+    PMEM_AVX2 static int in_range(vec x, vec lo, vec hi) {
+        return ~mask(_mm256_or_si256(_mm256_cmpgt_epi32(lo, x), _mm256_cmpgt_epi32(x, hi))) & 0xff;
+    }
+
+    PMEM_AVX2 static vec min(vec a, vec b) { return _mm256_min_epi32(a, b); }
+    PMEM_AVX2 static vec max(vec a, vec b) { return _mm256_max_epi32(a, b); }
+
+    PMEM_AVX2 static acc zero() { return _mm256_setzero_si256(); }
+    PMEM_AVX2 static acc accumulate(acc s, vec x) {
+        s = _mm256_add_epi64(s, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(x)));
+        return _mm256_add_epi64(s, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(x, 1)));
+    }
+    PMEM_AVX2 static int64_t reduce(acc s) {
+        int64_t v[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(v), s);
+        return v[0] + v[1] + v[2] + v[3];
+    }
+};
+
+
+template <> struct AVX2Ops<uint32_t> {
+
+    typedef __m256i vec;
+    typedef __m256i acc;
+    static const size_t lanes = 8;
+
+    PMEM_AVX2 static vec load(const uint32_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    PMEM_AVX2 static vec set1(uint32_t v) { return _mm256_set1_epi32(v); }
+    PMEM_AVX2 static int mask(vec m) { return _mm256_movemask_ps(_mm256_castsi256_ps(m)); }
+
+    // There are no unsigned comparisons. Flipping the sign bit maps the unsigned ordering onto the signed one.
+    PMEM_AVX2 static vec bias(vec x) { return _mm256_xor_si256(x, _mm256_set1_epi32(0x80000000)); }
+
+    PMEM_AVX2 static int eq(vec a, vec b) { return mask(_mm256_cmpeq_epi32(a, b)); }
+    PMEM_AVX2 static int in_range(vec x, vec lo, vec hi) {
+        x = bias(x);
+        return ~mask(_mm256_or_si256(_mm256_cmpgt_epi32(bias(lo), x), _mm256_cmpgt_epi32(x, bias(hi)))) & 0xff;
+    }
+
+    PMEM_AVX2 static vec min(vec a, vec b) { return _mm256_min_epu32(a, b); }
+    PMEM_AVX2 static vec max(vec a, vec b) { return _mm256_max_epu32(a, b); }
+
+    PMEM_AVX2 static acc zero() { return _mm256_setzero_si256(); }
+    PMEM_AVX2 static acc accumulate(acc s, vec x) {
+        s = _mm256_add_epi64(s, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(x)));
+        return _mm256_add_epi64(s, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(x, 1)));
+    }
+    PMEM_AVX2 static uint64_t reduce(acc s) {
+        uint64_t v[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(v), s);
+        return v[0] + v[1] + v[2] + v[3];
+    }
+};
+
+
+template <> struct AVX2Ops<int64_t> {
+
+    typedef __m256i vec;
+    typedef __m256i acc;
+    static const size_t lanes = 4;
+
+    PMEM_AVX2 static vec load(const int64_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    PMEM_AVX2 static vec set1(int64_t v) { return _mm256_set1_epi64x(v); }
+    PMEM_AVX2 static int mask(vec m) { return _mm256_movemask_pd(_mm256_castsi256_pd(m)); }
+
+    PMEM_AVX2 static int eq(vec a, vec b) { return mask(_mm256_cmpeq_epi64(a, b)); }
+    PMEM_AVX2 static int in_range(vec x, vec lo, vec hi) {
+        return ~mask(_mm256_or_si256(_mm256_cmpgt_epi64(lo, x), _mm256_cmpgt_epi64(x, hi))) & 0xf;
+    }
+
+    // There is no 64-bit min/max in AVX2
+    PMEM_AVX2 static vec min(vec a, vec b) { return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b)); }
+    PMEM_AVX2 static vec max(vec a, vec b) { return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a, b)); }
+
+    PMEM_AVX2 static acc zero() { return _mm256_setzero_si256(); }
+    PMEM_AVX2 static acc accumulate(acc s, vec x) { return _mm256_add_epi64(s, x); }
+    PMEM_AVX2 static int64_t reduce(acc s) {
+        int64_t v[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(v), s);
+        return v[0] + v[1] + v[2] + v[3];
+    }
+};
+
+
+template <> struct AVX2Ops<uint64_t> {
+
+    typedef __m256i vec;
+    typedef __m256i acc;
+    static const size_t lanes = 4;
+
+    PMEM_AVX2 static vec load(const uint64_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    PMEM_AVX2 static vec set1(uint64_t v) { return _mm256_set1_epi64x(v); }
+    PMEM_AVX2 static int mask(vec m) { return _mm256_movemask_pd(_mm256_castsi256_pd(m)); }
+
+    PMEM_AVX2 static vec bias(vec x) { return _mm256_xor_si256(x, _mm256_set1_epi64x(0x8000000000000000LL)); }
+    PMEM_AVX2 static vec gt(vec a, vec b) { return _mm256_cmpgt_epi64(bias(a), bias(b)); }
+
+    PMEM_AVX2 static int eq(vec a, vec b) { return mask(_mm256_cmpeq_epi64(a, b)); }
+    PMEM_AVX2 static int in_range(vec x, vec lo, vec hi) {
+        return ~mask(_mm256_or_si256(gt(lo, x), gt(x, hi))) & 0xf;
+    }
+
+    PMEM_AVX2 static vec min(vec a, vec b) { return _mm256_blendv_epi8(a, b, gt(a, b)); }
+    PMEM_AVX2 static vec max(vec a, vec b) { return _mm256_blendv_epi8(b, a, gt(a, b)); }
+
+    PMEM_AVX2 static acc zero() { return _mm256_setzero_si256(); }
+    PMEM_AVX2 static acc accumulate(acc s, vec x) { return _mm256_add_epi64(s, x); }
+    PMEM_AVX2 static uint64_t reduce(acc s) {
+        uint64_t v[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(v), s);
+        return v[0] + v[1] + v[2] + v[3];
+    }
+};
+
+
+template <> struct AVX2Ops<float> {
+
+    typedef __m256 vec;
+    typedef __m256d acc;
+    static const size_t lanes = 8;
+
+    PMEM_AVX2 static vec load(const float* p) { return _mm256_loadu_ps(p); }
+    PMEM_AVX2 static vec set1(float v) { return _mm256_set1_ps(v); }
+
+    PMEM_AVX2 static int eq(vec a, vec b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ)); }
+    PMEM_AVX2 static int in_range(vec x, vec lo, vec hi) {
+        return _mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(x, lo, _CMP_GE_OQ), _mm256_cmp_ps(x, hi, _CMP_LE_OQ)));
+    }
+
+    PMEM_AVX2 static vec min(vec a, vec b) { return _mm256_min_ps(a, b); }
+    PMEM_AVX2 static vec max(vec a, vec b) { return _mm256_max_ps(a, b); }
+
+    PMEM_AVX2 static acc zero() { return _mm256_setzero_pd(); }
+    PMEM_AVX2 static acc accumulate(acc s, vec x) {
+        s = _mm256_add_pd(s, _mm256_cvtps_pd(_mm256_castps256_ps128(x)));
+        return _mm256_add_pd(s, _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)));
+    }
+    PMEM_AVX2 static double reduce(acc s) {
+        double v[4];
+        _mm256_storeu_pd(v, s);
+        return (v[0] + v[1]) + (v[2] + v[3]);
+    }
+};
+
+
+template <> struct AVX2Ops<double> {
+
+    typedef __m256d vec;
+    typedef __m256d acc;
+    static const size_t lanes = 4;
+
+    PMEM_AVX2 static vec load(const double* p) { return _mm256_loadu_pd(p); }
+    PMEM_AVX2 static vec set1(double v) { return _mm256_set1_pd(v); }
+
+    PMEM_AVX2 static int eq(vec a, vec b) { return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ)); }
+    PMEM_AVX2 static int in_range(vec x, vec lo, vec hi) {
+        return _mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(x, lo, _CMP_GE_OQ), _mm256_cmp_pd(x, hi, _CMP_LE_OQ)));
+    }
+
+    PMEM_AVX2 static vec min(vec a, vec b) { return _mm256_min_pd(a, b); }
+    PMEM_AVX2 static vec max(vec a, vec b) { return _mm256_max_pd(a, b); }
+
+    PMEM_AVX2 static acc zero() { return _mm256_setzero_pd(); }
+    PMEM_AVX2 static acc accumulate(acc s, vec x) { return _mm256_add_pd(s, x); }
+    PMEM_AVX2 static double reduce(acc s) {
+        double v[4];
+        _mm256_storeu_pd(v, s);
+        return (v[0] + v[1]) + (v[2] + v[3]);
+    }
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// The generic vectorised kernels. The remainder that does not fill a whole vector is handled by the scalar code.
+
+template <typename T>
+PMEM_AVX2 size_t find_avx2(const T* data, size_t n, const T& value) {
+
+    typedef AVX2Ops<T> Ops;
+    typename Ops::vec v = Ops::set1(value);
+
+    size_t i = 0;
+    for (; i + Ops::lanes <= n; i += Ops::lanes) {
+        int m = Ops::eq(Ops::load(data + i), v);
+        if (m) return i + __builtin_ctz(m);
+    }
+    return i + scalar::find(data + i, n - i, value);
+}
+
+
+template <typename T>
+PMEM_AVX2 size_t count_avx2(const T* data, size_t n, const T& value) {
+
+    typedef AVX2Ops<T> Ops;
+    typename Ops::vec v = Ops::set1(value);
+
+    size_t c = 0;
+    size_t i = 0;
+    for (; i + Ops::lanes <= n; i += Ops::lanes) {
+        c += __builtin_popcount(Ops::eq(Ops::load(data + i), v));
+    }
+    return c + scalar::count(data + i, n - i, value);
+}
+
+
+template <typename T>
+PMEM_AVX2 size_t count_range_avx2(const T* data, size_t n, const T& lo, const T& hi) {
+
+    typedef AVX2Ops<T> Ops;
+    typename Ops::vec vlo = Ops::set1(lo);
+    typename Ops::vec vhi = Ops::set1(hi);
+
+    size_t c = 0;
+    size_t i = 0;
+    for (; i + Ops::lanes <= n; i += Ops::lanes) {
+        c += __builtin_popcount(Ops::in_range(Ops::load(data + i), vlo, vhi));
+    }
+    return c + scalar::count_range(data + i, n - i, lo, hi);
+}
+
+
+template <typename T>
+PMEM_AVX2 size_t filter_range_avx2(const T* data, size_t n, const T& lo, const T& hi,
+                                   std::vector<size_t>& indices) {
+
+    typedef AVX2Ops<T> Ops;
+    typename Ops::vec vlo = Ops::set1(lo);
+    typename Ops::vec vhi = Ops::set1(hi);
+
+    size_t initial = indices.size();
+    size_t i = 0;
+    for (; i + Ops::lanes <= n; i += Ops::lanes) {
+        int m = Ops::in_range(Ops::load(data + i), vlo, vhi);
+        while (m) {
+            indices.push_back(i + __builtin_ctz(m));
+            m &= m - 1;
+        }
+    }
+
+    size_t tail = indices.size();
+    scalar::filter_range(data + i, n - i, lo, hi, indices);
+    for (; tail < indices.size(); ++tail) indices[tail] += i;
+
+    return indices.size() - initial;
+}
+
+
+template <typename T, bool MAX>
+PMEM_AVX2 T minmax_avx2(const T* data, size_t n) {
+
+    typedef AVX2Ops<T> Ops;
+    ASSERT(n > 0);
+
+    if (n < Ops::lanes)
+        return MAX ? scalar::max(data, n) : scalar::min(data, n);
+
+    typename Ops::vec m = Ops::load(data);
+    size_t i = Ops::lanes;
+    for (; i + Ops::lanes <= n; i += Ops::lanes) {
+        m = MAX ? Ops::max(m, Ops::load(data + i)) : Ops::min(m, Ops::load(data + i));
+    }
+
+    // Combine the lanes, along with any remaining elements.
+
+    T lanes[Ops::lanes];
+    ::memcpy(lanes, &m, sizeof(lanes));
+    T result = MAX ? scalar::max(lanes, Ops::lanes) : scalar::min(lanes, Ops::lanes);
+    for (; i < n; i++) {
+        if (MAX ? (data[i] > result) : (data[i] < result)) result = data[i];
+    }
+    return result;
+}
+
+
+template <typename T>
+PMEM_AVX2 typename SumType<T>::type sum_avx2(const T* data, size_t n) {
+
+    typedef AVX2Ops<T> Ops;
+
+    typename Ops::acc s = Ops::zero();
+    size_t i = 0;
+    for (; i + Ops::lanes <= n; i += Ops::lanes) {
+        s = Ops::accumulate(s, Ops::load(data + i));
+    }
+    return Ops::reduce(s) + scalar::sum(data + i, n - i);
+}
+
+#undef PMEM_AVX2
+
+}
+
+#endif // PMEM_HAVE_AVX2_KERNELS
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// Runtime dispatch between the vectorised and scalar kernels.
+
+namespace {
+
+template <typename T>
+size_t find_impl(const T* data, size_t n, const T& value) {
+#ifdef PMEM_HAVE_AVX2_KERNELS
+    if (useAVX2()) return find_avx2(data, n, value);
+#endif
+    return scalar::find(data, n, value);
+}
+
+template <typename T>
+size_t count_impl(const T* data, size_t n, const T& value) {
+#ifdef PMEM_HAVE_AVX2_KERNELS
+    if (useAVX2()) return count_avx2(data, n, value);
+#endif
+    return scalar::count(data, n, value);
+}
+
+template <typename T>
+size_t count_range_impl(const T* data, size_t n, const T& lo, const T& hi) {
+#ifdef PMEM_HAVE_AVX2_KERNELS
+    if (useAVX2()) return count_range_avx2(data, n, lo, hi);
+#endif
+    return scalar::count_range(data, n, lo, hi);
+}
+
+template <typename T>
+size_t filter_range_impl(const T* data, size_t n, const T& lo, const T& hi, std::vector<size_t>& indices) {
+#ifdef PMEM_HAVE_AVX2_KERNELS
+    if (useAVX2()) return filter_range_avx2(data, n, lo, hi, indices);
+#endif
+    return scalar::filter_range(data, n, lo, hi, indices);
+}
+
+template <typename T>
+T min_impl(const T* data, size_t n) {
+#ifdef PMEM_HAVE_AVX2_KERNELS
+    if (useAVX2()) return minmax_avx2<T, false>(data, n);
+#endif
+    return scalar::min(data, n);
+}
+
+template <typename T>
+T max_impl(const T* data, size_t n) {
+#ifdef PMEM_HAVE_AVX2_KERNELS
+    if (useAVX2()) return minmax_avx2<T, true>(data, n);
+#endif
+    return scalar::max(data, n);
+}
+
+template <typename T>
+typename SumType<T>::type sum_impl(const T* data, size_t n) {
+#ifdef PMEM_HAVE_AVX2_KERNELS
+    if (useAVX2()) return sum_avx2(data, n);
+#endif
+    return scalar::sum(data, n);
+}
+
+}
+
+
+bool vectorised() {
+#ifdef PMEM_HAVE_AVX2_KERNELS
+    return useAVX2();
+#else
+    return false;
+#endif
+}
+
+
+#define PMEM_DEFINE_POD_KERNELS(T) \
+    template <> size_t find<T>(const T* data, size_t n, const T& value) { \
+        return find_impl(data, n, value); \
+    } \
+    template <> size_t count<T>(const T* data, size_t n, const T& value) { \
+        return count_impl(data, n, value); \
+    } \
+    template <> size_t count_range<T>(const T* data, size_t n, const T& lo, const T& hi) { \
+        return count_range_impl(data, n, lo, hi); \
+    } \
+    template <> size_t filter_range<T>(const T* data, size_t n, const T& lo, const T& hi, \
+                                       std::vector<size_t>& indices) { \
+        return filter_range_impl(data, n, lo, hi, indices); \
+    } \
+    template <> T min<T>(const T* data, size_t n) { return min_impl(data, n); } \
+    template <> T max<T>(const T* data, size_t n) { return max_impl(data, n); } \
+    template <> SumType<T>::type sum<T>(const T* data, size_t n) { return sum_impl(data, n); }
+
+PMEM_DEFINE_POD_KERNELS(int32_t)
+PMEM_DEFINE_POD_KERNELS(uint32_t)
+PMEM_DEFINE_POD_KERNELS(int64_t)
+PMEM_DEFINE_POD_KERNELS(uint64_t)
+PMEM_DEFINE_POD_KERNELS(float)
+PMEM_DEFINE_POD_KERNELS(double)
+
+#undef PMEM_DEFINE_POD_KERNELS
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace kernels
+} // namespace pmem
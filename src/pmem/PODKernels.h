@@ -0,0 +1,191 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+#ifndef pmem_PODKernels_H
+#define pmem_PODKernels_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+#include "eckit/exception/Exceptions.h"
+
+
+/*
+ * Search and reduction kernels over contiguous arrays of PODs, as stored in a PersistentPODVector.
+ *
+ * The generic templates are straightforward scalar loops. For the fixed-width integer types, float and
+ * double there are specialisations (in PODKernels.cc) which use AVX2 when the CPU supports it (determined at
+ * runtime), and otherwise fall back to the scalar loops.
+ *
+ * n.b. Floating point sums are accumulated in a different order by the vectorised kernels, so may differ from
+ *      the scalar result in the last bits. The results of min/max are unspecified if the data contains NaNs.
+ */
+
+
+namespace pmem {
+namespace kernels {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// The type used to accumulate sums. Narrow integers and floats are widened to avoid trivial overflow.
+
+template <typename T> struct SumType { typedef T type; };
+template <> struct SumType<int32_t> { typedef int64_t type; };
+template <> struct SumType<uint32_t> { typedef uint64_t type; };
+template <> struct SumType<float> { typedef double type; };
+
+
+/// The reference scalar implementations. These are also used for the tails of the vectorised kernels.
+
+namespace scalar {
+
+template <typename T>
+size_t find(const T* data, size_t n, const T& value) {
+    for (size_t i = 0; i < n; i++) {
+        if (data[i] == value) return i;
+    }
+    return n;
+}
+
+template <typename T>
+size_t count(const T* data, size_t n, const T& value) {
+    size_t c = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (data[i] == value) c++;
+    }
+    return c;
+}
+
+template <typename T>
+size_t count_range(const T* data, size_t n, const T& lo, const T& hi) {
+    size_t c = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (lo <= data[i] && data[i] <= hi) c++;
+    }
+    return c;
+}
+
+template <typename T>
+size_t filter_range(const T* data, size_t n, const T& lo, const T& hi, std::vector<size_t>& indices) {
+    size_t c = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (lo <= data[i] && data[i] <= hi) {
+            indices.push_back(i);
+            c++;
+        }
+    }
+    return c;
+}
+
+template <typename T>
+T min(const T* data, size_t n) {
+    ASSERT(n > 0);
+    T m = data[0];
+    for (size_t i = 1; i < n; i++) {
+        if (data[i] < m) m = data[i];
+    }
+    return m;
+}
+
+template <typename T>
+T max(const T* data, size_t n) {
+    ASSERT(n > 0);
+    T m = data[0];
+    for (size_t i = 1; i < n; i++) {
+        if (data[i] > m) m = data[i];
+    }
+    return m;
+}
+
+template <typename T>
+typename SumType<T>::type sum(const T* data, size_t n) {
+    typename SumType<T>::type s = 0;
+    for (size_t i = 0; i < n; i++) {
+        s += data[i];
+    }
+    return s;
+}
+
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Index of the first element equal to value, or n if there is none.
+template <typename T>
+size_t find(const T* data, size_t n, const T& value) { return scalar::find(data, n, value); }
+
+/// Number of elements equal to value.
+template <typename T>
+size_t count(const T* data, size_t n, const T& value) { return scalar::count(data, n, value); }
+
+/// Number of elements in the closed range [lo, hi].
+template <typename T>
+size_t count_range(const T* data, size_t n, const T& lo, const T& hi) {
+    return scalar::count_range(data, n, lo, hi);
+}
+
+/// Append the indices of the elements in the closed range [lo, hi] to indices. Returns the number appended.
+template <typename T>
+size_t filter_range(const T* data, size_t n, const T& lo, const T& hi, std::vector<size_t>& indices) {
+    return scalar::filter_range(data, n, lo, hi, indices);
+}
+
+/// The smallest/largest element. The array must not be empty.
+template <typename T>
+T min(const T* data, size_t n) { return scalar::min(data, n); }
+
+template <typename T>
+T max(const T* data, size_t n) { return scalar::max(data, n); }
+
+/// The sum of the elements, accumulated in SumType<T>::type.
+template <typename T>
+typename SumType<T>::type sum(const T* data, size_t n) { return scalar::sum(data, n); }
+
+/// Are the vectorised kernels in use on this machine?
+bool vectorised();
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Specialisations with runtime dispatch, defined in PODKernels.cc
+
+#define PMEM_DECLARE_POD_KERNELS(T) \
+    template <> size_t find<T>(const T* data, size_t n, const T& value); \
+    template <> size_t count<T>(const T* data, size_t n, const T& value); \
+    template <> size_t count_range<T>(const T* data, size_t n, const T& lo, const T& hi); \
+    template <> size_t filter_range<T>(const T* data, size_t n, const T& lo, const T& hi, \
+                                       std::vector<size_t>& indices); \
+    template <> T min<T>(const T* data, size_t n); \
+    template <> T max<T>(const T* data, size_t n); \
+    template <> SumType<T>::type sum<T>(const T* data, size_t n);
+
+PMEM_DECLARE_POD_KERNELS(int32_t)
+PMEM_DECLARE_POD_KERNELS(uint32_t)
+PMEM_DECLARE_POD_KERNELS(int64_t)
+PMEM_DECLARE_POD_KERNELS(uint64_t)
+PMEM_DECLARE_POD_KERNELS(float)
+PMEM_DECLARE_POD_KERNELS(double)
+
+#undef PMEM_DECLARE_POD_KERNELS
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace kernels
+} // namespace pmem
+
+#endif // pmem_PODKernels_H
@@ -0,0 +1,312 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+#ifndef pmem_Parallel_H
+#define pmem_Parallel_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "eckit/memory/NonCopyable.h"
+
+#include "pmem/ThreadPool.h"
+
+
+/*
+ * Parallel algorithms over random access ranges. These are intended to be used with the const_iterators of the
+ * persistent containers (which resolve the persistent data block once), e.g.
+ *
+ *    parallel_for_each(vec.begin(), vec.end(), fn);
+ *
+ * The index range is split into contiguous chunks, which are distributed across a ThreadPool. Ranges that are
+ * smaller than the grain size are processed serially in the calling thread.
+ *
+ * Irregular workloads, where the work is only discovered as it is done (e.g. the subtrees visited by a tree
+ * traversal), are better balanced by a WorkStealingScheduler. Each participant has its own deque of work items.
+ * Items spawned while processing an item are pushed onto the back of the participant's own deque, and popped from
+ * the back again (so each participant works depth-first, and its working set remains small). A participant that
+ * runs out of work steals from the front of the others' deques, which tends to hold the largest remaining
+ * pieces of work.
+ */
+
+
+namespace pmem {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// The minimum number of elements assigned to each task.
+const size_t default_parallel_grain = 1024;
+
+
+template <typename Iterator, typename Function>
+void parallel_for_each(Iterator first, Iterator last, Function fn,
+                       size_t grain = default_parallel_grain,
+                       ThreadPool& pool = ThreadPool::instance()) {
+
+    size_t n = std::distance(first, last);
+    if (grain == 0) grain = 1;
+
+    size_t nchunks = std::min((n + grain - 1) / grain, pool.size() + 1);
+
+    if (nchunks <= 1) {
+        for (; first != last; ++first) fn(*first);
+        return;
+    }
+
+    std::vector<ThreadPool::Task> tasks;
+    tasks.reserve(nchunks);
+
+    for (size_t c = 0; c < nchunks; c++) {
+        Iterator begin = first + (n * c) / nchunks;
+        Iterator end = first + (n * (c + 1)) / nchunks;
+        tasks.push_back([begin, end, &fn]() {
+            for (Iterator it = begin; it != end; ++it) fn(*it);
+        });
+    }
+
+    pool.run(tasks);
+}
+
+
+/// Transform each element, and combine the results with reduce(). The reduction must be associative, as the
+/// partial results from each chunk are combined in chunk order. The initial value is used once.
+
+template <typename Iterator, typename T, typename Reduce, typename Transform>
+T parallel_transform_reduce(Iterator first, Iterator last, T init, Reduce reduce, Transform transform,
+                            size_t grain = default_parallel_grain,
+                            ThreadPool& pool = ThreadPool::instance()) {
+
+    size_t n = std::distance(first, last);
+    if (grain == 0) grain = 1;
+
+    size_t nchunks = std::min((n + grain - 1) / grain, pool.size() + 1);
+
+    if (nchunks <= 1) {
+        for (; first != last; ++first) init = reduce(init, transform(*first));
+        return init;
+    }
+
+    // n.b. Each chunk starts from its first transformed element, so that init is only included once.
+
+    std::vector<T> partial(nchunks);
+    std::vector<ThreadPool::Task> tasks;
+    tasks.reserve(nchunks);
+
+    for (size_t c = 0; c < nchunks; c++) {
+        Iterator begin = first + (n * c) / nchunks;
+        Iterator end = first + (n * (c + 1)) / nchunks;
+        T& result(partial[c]);
+        tasks.push_back([begin, end, &result, &reduce, &transform]() {
+            Iterator it = begin;
+            result = transform(*it);
+            for (++it; it != end; ++it) result = reduce(result, transform(*it));
+        });
+    }
+
+    pool.run(tasks);
+
+    for (size_t c = 0; c < nchunks; c++) {
+        init = reduce(init, partial[c]);
+    }
+    return init;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Process a set of work items, and any further items spawned from them, across a ThreadPool. Items must be
+/// default constructible and copyable, and are normally small (e.g. pointers).
+
+template <typename Item>
+class WorkStealingScheduler : private eckit::NonCopyable {
+
+public: // types
+
+    /// Passed to the function processing each item, to spawn further items.
+    class Worker {
+    public:
+        /// Add an item to be processed, by this participant or (if it is stolen) by another.
+        void spawn(const Item& item) { scheduler_.push(index_, item); }
+        /// The participant processing the current item, in the range [0, participants()).
+        size_t index() const { return index_; }
+    private:
+        Worker(WorkStealingScheduler& scheduler, size_t index) : scheduler_(scheduler), index_(index) {}
+        WorkStealingScheduler& scheduler_;
+        size_t index_;
+        friend class WorkStealingScheduler;
+    };
+
+public: // methods
+
+    /// n.b. If called from inside a worker of a ThreadPool (i.e. nested parallelism), there is one participant.
+    WorkStealingScheduler(ThreadPool& pool = ThreadPool::instance()) :
+        pool_(pool),
+        queues_(ThreadPool::inWorker() ? 1 : pool.size() + 1),
+        outstanding_(0),
+        failed_(false) {}
+
+    /// The number of threads that process items. Per-participant state may be indexed by Worker::index().
+    size_t participants() const { return queues_.size(); }
+
+    /// Process the items with fn(item, worker), and return once they (and all the items they spawn) have been
+    /// processed. If fn throws, the remaining items are abandoned, and the first exception is rethrown.
+    template <typename Function>
+    void run(const std::vector<Item>& items, Function fn);
+
+private: // types
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Item> items;
+    };
+
+private: // methods
+
+    void push(size_t index, const Item& item);
+
+    /// Take the most recently spawned item of the participant.
+    bool pop(size_t index, Item& item);
+
+    /// Take the oldest item of another participant.
+    bool steal(size_t index, Item& item);
+
+    template <typename Function>
+    void participate(size_t index, Function& fn);
+
+private: // members
+
+    ThreadPool& pool_;
+
+    std::vector<Queue> queues_;
+
+    /// The number of items spawned, but not yet processed. An item is only counted as processed once the items
+    /// it spawns have been counted, so this only reaches zero once all the work is done.
+    std::atomic<size_t> outstanding_;
+
+    std::atomic<bool> failed_;
+};
+
+
+template <typename Item>
+template <typename Function>
+void WorkStealingScheduler<Item>::run(const std::vector<Item>& items, Function fn) {
+
+    outstanding_ = items.size();
+    failed_ = false;
+
+    for (size_t i = 0; i < items.size(); i++) {
+        queues_[i % queues_.size()].items.push_back(items[i]);
+    }
+
+    std::vector<ThreadPool::Task> tasks;
+    tasks.reserve(queues_.size());
+
+    for (size_t i = 0; i < queues_.size(); i++) {
+        tasks.push_back([this, i, &fn]() { participate(i, fn); });
+    }
+
+    try {
+        if (tasks.size() == 1)
+            tasks[0]();
+        else
+            pool_.run(tasks);
+    } catch (...) {
+        for (size_t i = 0; i < queues_.size(); i++) queues_[i].items.clear();
+        throw;
+    }
+}
+
+
+template <typename Item>
+template <typename Function>
+void WorkStealingScheduler<Item>::participate(size_t index, Function& fn) {
+
+    Worker worker(*this, index);
+    Item item;
+
+    // n.b. An idle participant cannot stop while any items are outstanding, as they may still spawn more.
+
+    while (!failed_) {
+
+        if (pop(index, item) || steal(index, item)) {
+            try {
+                fn(item, worker);
+            } catch (...) {
+                failed_ = true;
+                throw;
+            }
+            --outstanding_;
+        } else if (outstanding_ == 0) {
+            break;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+
+template <typename Item>
+void WorkStealingScheduler<Item>::push(size_t index, const Item& item) {
+    ++outstanding_;
+    std::lock_guard<std::mutex> lock(queues_[index].mutex);
+    queues_[index].items.push_back(item);
+}
+
+
+template <typename Item>
+bool WorkStealingScheduler<Item>::pop(size_t index, Item& item) {
+
+    std::lock_guard<std::mutex> lock(queues_[index].mutex);
+
+    if (queues_[index].items.empty())
+        return false;
+
+    item = queues_[index].items.back();
+    queues_[index].items.pop_back();
+    return true;
+}
+
+
+template <typename Item>
+bool WorkStealingScheduler<Item>::steal(size_t index, Item& item) {
+
+    for (size_t n = 1; n < queues_.size(); n++) {
+
+        Queue& victim(queues_[(index + n) % queues_.size()]);
+        std::lock_guard<std::mutex> lock(victim.mutex);
+
+        if (!victim.items.empty()) {
+            item = victim.items.front();
+            victim.items.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace pmem
+
+#endif // pmem_Parallel_H
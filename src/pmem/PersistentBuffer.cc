@@ -16,11 +16,23 @@
 /// @author Simon Smart
 /// @date   Feb 2016
 
+#include <algorithm>
 #include <cstring>
+#include <stdint.h>
 
+#include "libpmemobj.h"
+
+#include "eckit/exception/Exceptions.h"
 #include "eckit/io/Buffer.h"
+#include "eckit/io/DataHandle.h"
+#include "eckit/log/Log.h"
 
+#include "pmem/Checksum.h"
+#include "pmem/Compression.h"
+#include "pmem/LibPMem.h"
 #include "pmem/PersistentBuffer.h"
+#include "pmem/PersistentPool.h"
+#include "pmem/PoolRegistry.h"
 
 
 using namespace eckit;
@@ -31,11 +43,164 @@ namespace pmem {
 //----------------------------------------------------------------------------------------------------------------------
 
 
-PersistentBuffer::PersistentBuffer(const void *data, size_t length)
+/// Payloads at least this large are copied with non-temporal stores. This avoids evicting the working set from
+/// the cache with data that will not be read again soon, and avoids flushing it back out line by line.
+const size_t PersistentBuffer::nontemporal_threshold = 64 * 1024;
+
+const size_t PersistentBuffer::stream_chunk_size = 4 * 1024 * 1024;
+
+const size_t PersistentBuffer::checksum_block_size = 256 * 1024;
+
+static const size_t compressed_flag = size_t(1) << (8 * sizeof(size_t) - 1);
+
+
+/// The buffer is made durable here, rather than in ::pmem_constructor (see self_persisting()). If it is not in
+/// persistent memory (e.g. it is being built in a volatile buffer) then it is just copied.
+
+PersistentBuffer::PersistentBuffer(const void *data, size_t length) {
+    store(data, length, 0);
+}
+
+
+/// Each chunk is flushed as soon as it has been read, so that writing it back overlaps with reading the next one.
+/// It is checksummed while it is still in cache. Only the header (and a drain) remain once all the data has arrived.
+///
+/// @note This is run inside the atomic allocator. Errors must be reported by throwing an AllocationError, which
+///       causes the allocation to be unwound.
+
+PersistentBuffer::PersistentBuffer(DataHandle& handle, size_t length)
     : length_(length) {
 
-    if (length != 0 && data != 0)
-        ::memcpy(data_, data, length);
+    Log::debug<LibPMem>() << "Streaming " << length << " bytes from " << handle << std::endl;
+
+    PMEMobjpool* pool = ::pmemobj_pool_by_ptr(this);
+
+    uint32_t crc = 0;
+    size_t pos = 0;
+    while (pos < length) {
+
+        long chunk = std::min(length - pos, stream_chunk_size);
+        long nread;
+
+        // Any other exception would unwind through the allocator (which is C), so it is reported as a failed
+        // allocation instead.
+
+        try {
+            nread = handle.read(&data_[pos], chunk);
+        } catch (std::exception& e) {
+            Log::error() << "Error reading from " << handle << ": " << e.what() << std::endl;
+            throw AtomicConstructorBase::AllocationError("Error streaming data into PersistentBuffer");
+        }
+
+        if (nread <= 0) {
+            Log::error() << "Short read from " << handle << ": " << pos << " of " << length << " bytes" << std::endl;
+            throw AtomicConstructorBase::AllocationError("Short read streaming data into PersistentBuffer");
+        }
+
+        crc = checksum::crc32c(&data_[pos], nread, crc);
+
+        if (pool)
+            ::pmemobj_flush(pool, &data_[pos], nread);
+
+        pos += nread;
+    }
+
+    seal(crc);
+
+    if (pool)
+        ::pmemobj_persist(pool, this, sizeof(PersistentBuffer));
+}
+
+
+/// The compressed data (including its header) is stored in place of the original, and the length flagged as
+/// compressed. Buffers allocated through here are accounted for in the pool's compression statistics.
+
+PersistentBuffer::PersistentBuffer(const void* data, size_t length, const std::vector<char>& compressed) {
+
+    if (compressed.empty()) {
+        store(data, length, 0);
+    } else {
+        store(&compressed[0], compressed.size(), compressed_flag);
+    }
+
+    if (::pmemobj_pool_by_ptr(this))
+        PoolRegistry::instance().poolFromPointer(this).recordCompression(length, storedSize());
+}
+
+
+/// The compressed form is prefixed by the original length, and is only kept if it actually saves space.
+
+void PersistentBuffer::compress(const void* data, size_t length, std::vector<char>& compressed) {
+
+    compressed.clear();
+    if (length == 0)
+        return;
+
+    compressed.resize(sizeof(uint64_t) + compression::bound(length));
+
+    uint64_t original = length;
+    ::memcpy(&compressed[0], &original, sizeof(original));
+
+    size_t n = compression::compress(data, length, &compressed[sizeof(uint64_t)],
+                                     compressed.size() - sizeof(uint64_t));
+
+    if (n == 0 || sizeof(uint64_t) + n >= length) {
+        compressed.clear();
+    } else {
+        compressed.resize(sizeof(uint64_t) + n);
+    }
+
+    Log::debug<LibPMem>() << "Compressed " << length << " bytes to "
+                          << (compressed.empty() ? length : compressed.size()) << std::endl;
+}
+
+
+/// The checksum is computed as part of the copy, so the source data is only read once. Large payloads are copied with
+/// non-temporal stores, which cannot be combined with the checksum, so each block is checksummed just beforehand.
+
+void PersistentBuffer::store(const void* data, size_t length, size_t flags) {
+
+    length_ = length | flags;
+
+    PMEMobjpool* pool = ::pmemobj_pool_by_ptr(this);
+
+    if (pool && data != 0 && length >= nontemporal_threshold) {
+
+        const char* src = static_cast<const char*>(data);
+        uint32_t crc = 0;
+
+        for (size_t pos = 0; pos < length; pos += checksum_block_size) {
+            size_t n = std::min(length - pos, checksum_block_size);
+            crc = checksum::crc32c(src + pos, n, crc);
+            ::pmemobj_memcpy_persist(pool, &data_[pos], src + pos, n);
+        }
+
+        seal(crc);
+        ::pmemobj_persist(pool, this, sizeof(PersistentBuffer));
+        return;
+    }
+
+    uint32_t crc = 0;
+    if (data != 0) {
+        crc = checksum::crc32c_copy(data_, data, length);
+    } else {
+        crc = checksum::crc32c(data_, length);
+    }
+
+    seal(crc);
+
+    if (pool)
+        ::pmemobj_persist(pool, this, data_size(length));
+}
+
+
+void PersistentBuffer::seal(uint32_t crc) {
+    checksum_ = compute_checksum(crc);
+}
+
+
+uint32_t PersistentBuffer::compute_checksum(uint32_t crc) const {
+    return checksum::crc32c(&length_, sizeof(length_), crc);
 }
 
 
@@ -45,14 +210,75 @@ size_t PersistentBuffer::data_size(size_t length) {
 
 
 size_t PersistentBuffer::size() const {
-    return length_;
+
+    if (!compressed())
+        return length_;
+
+    uint64_t original;
+    ::memcpy(&original, data_, sizeof(original));
+    return original;
 }
 
 
 const void * PersistentBuffer::data () const {
+    ASSERT(!compressed());
     return data_;
 }
 
+
+const void* PersistentBuffer::data(std::vector<char>& scratch) const {
+
+    if (!compressed())
+        return data_;
+
+    size_t length = size();
+    if (scratch.size() < length)
+        scratch.resize(length);
+
+    decompress(&scratch[0], length);
+    return &scratch[0];
+}
+
+
+void PersistentBuffer::decompress(void* buffer, size_t length) const {
+
+    ASSERT(length >= size());
+
+    if (compressed()) {
+        compression::decompress(&data_[sizeof(uint64_t)], storedSize() - sizeof(uint64_t), buffer, size());
+    } else if (length_ != 0) {
+        ::memcpy(buffer, data_, length_);
+    }
+}
+
+
+bool PersistentBuffer::compressed() const {
+    return (length_ & compressed_flag) != 0;
+}
+
+
+size_t PersistentBuffer::storedSize() const {
+    return length_ & ~compressed_flag;
+}
+
+
+uint32_t PersistentBuffer::checksum() const {
+    return uint32_t(checksum_);
+}
+
+
+bool PersistentBuffer::verify() const {
+
+    bool ok = compute_checksum(checksum::crc32c(data_, storedSize())) == checksum();
+
+    if (!ok) {
+        Log::error() << "Checksum mismatch in PersistentBuffer of " << storedSize() << " bytes at " << this
+                     << std::endl;
+    }
+
+    return ok;
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 
 } // namespace tree
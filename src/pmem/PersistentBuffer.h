@@ -20,6 +20,8 @@
 #ifndef pmem_PersistentBuffer_H
 #define pmem_PersistentBuffer_H
 
+#include <stdint.h>
+#include <vector>
 
 #include "pmem/AtomicConstructor.h"
 #include "pmem/PersistentType.h"
@@ -27,6 +29,7 @@
 
 namespace eckit {
     class Buffer;
+    class DataHandle;
 }
 
 
@@ -42,20 +45,109 @@ namespace pmem {
 
 class PersistentBuffer {
 
+public: // types
+
+    // n.b. The constructor classes are defined inline. Their vtables refer to PersistentType<PersistentBuffer>, whose
+    //      type_id is defined by the application, so they must not be emitted into the library.
+
+    /// Construct the buffer by reading length bytes directly from a DataHandle (which must already be open for
+    /// reading) into persistent memory, without an intermediate copy.
+    class StreamConstructor : public AtomicConstructor<PersistentBuffer> {
+    public: // methods
+        StreamConstructor(eckit::DataHandle& handle, size_t length) : handle_(handle), length_(length) {}
+        virtual void make(PersistentBuffer& object) const { new (&object) PersistentBuffer(handle_, length_); }
+        virtual size_t size() const { return PersistentBuffer::data_size(length_); }
+        virtual bool self_persisting() const { return true; }
+    private: // members
+        eckit::DataHandle& handle_;
+        size_t length_;
+    };
+
+    /// Construct the buffer from data that is compressed on the way in. If the data does not compress, it is stored
+    /// as-is. The compression is done when the constructor object is created, outside the atomic allocation.
+    class CompressedConstructor : public AtomicConstructor<PersistentBuffer> {
+    public: // methods
+        CompressedConstructor(const void* data, size_t length) : data_(data), length_(length) {
+            PersistentBuffer::compress(data, length, compressed_);
+        }
+        virtual void make(PersistentBuffer& object) const { new (&object) PersistentBuffer(data_, length_, compressed_); }
+        virtual size_t size() const {
+            return PersistentBuffer::data_size(compressed_.empty() ? length_ : compressed_.size());
+        }
+        virtual bool self_persisting() const { return true; }
+    private: // members
+        const void* data_;
+        size_t length_;
+        std::vector<char> compressed_;
+    };
+
 public: // methods
 
     PersistentBuffer(const void* data, size_t length);
+    PersistentBuffer(eckit::DataHandle& handle, size_t length);
+
+    /// Store data compressed by compress() (or the original data, if compressed is empty).
+    PersistentBuffer(const void* data, size_t length, const std::vector<char>& compressed);
 
+    /// The size of the (uncompressed) data
     size_t size() const;
 
+    /// Direct access to the data. Only valid if the buffer is not compressed.
     const void* data() const;
 
+    /// Access the data, decompressing it into the supplied scratch buffer if required. The scratch buffer is only
+    /// grown, so may be reused to avoid repeated allocations.
+    const void* data(std::vector<char>& scratch) const;
+
+    /// Decompress (or copy) the data into a caller-supplied buffer of at least size() bytes.
+    void decompress(void* buffer, size_t length) const;
+
+    bool compressed() const;
+
+    /// The number of bytes occupied by the data in persistent memory
+    size_t storedSize() const;
+
+    /// The CRC32C of the stored data (and its length), computed as the buffer was written.
+    uint32_t checksum() const;
+
+    /// Recompute the checksum, and compare it with the stored one. Returns false if the buffer has been corrupted.
+    bool verify() const;
+
     static size_t data_size(size_t length);
 
+    /// Compress data into the form stored in the buffer. Leaves compressed empty if it would not save space.
+    static void compress(const void* data, size_t length, std::vector<char>& compressed);
+
+public: // members
+
+    static const size_t nontemporal_threshold;
+
+    /// The size of the reads made when streaming from a DataHandle
+    static const size_t stream_chunk_size;
+
+    /// Large payloads are checksummed in blocks of this size immediately before they are copied, so that they are
+    /// still in cache for the copy.
+    static const size_t checksum_block_size;
+
+private: // methods
+
+    /// Copy the (stored form of the) data into the buffer, and make it durable.
+    void store(const void* data, size_t length, size_t flags);
+
+    /// Complete a checksum of the data by including the length, and store it.
+    void seal(uint32_t crc);
+
+    uint32_t compute_checksum(uint32_t crc) const;
+
 private: // members
 
+    /// The stored length. The top bit flags compressed data, which is preceded by its original length (as a
+    /// uint64_t). Uncompressed buffers need no further header.
     size_t length_;
 
+    /// The CRC32C occupies the lower 32 bits. A full word is used so that the data remains 8-byte aligned.
+    uint64_t checksum_;
+
     // Accessor to the data.
     // Data is VARIABLY SIZED following on from this location.
     char data_[0];
@@ -70,6 +162,11 @@ inline size_t AtomicConstructor2Base<PersistentBuffer, const void*, size_t>::siz
     return PersistentBuffer::data_size(x2_);
 }
 
+template<>
+inline bool AtomicConstructor2Base<PersistentBuffer, const void*, size_t>::self_persisting() const {
+    return true;
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 
 } // namespace tree
@@ -0,0 +1,259 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <sstream>
+
+#include <sys/uio.h>
+
+#include "eckit/exception/Exceptions.h"
+
+#include "pmem/Exceptions.h"
+#include "pmem/PersistentBuffer.h"
+#include "pmem/PersistentBufferHandle.h"
+
+using namespace eckit;
+
+
+namespace pmem {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+PersistentBufferHandle::PersistentBufferHandle() :
+    decoded_(size_t(-1)),
+    size_(0),
+    verify_(false),
+    region_(0),
+    offset_(0),
+    position_(0) {}
+
+
+PersistentBufferHandle::~PersistentBufferHandle() {}
+
+
+void PersistentBufferHandle::add(const PersistentBuffer& buffer) {
+
+    if (verify_ && !buffer.verify())
+        throw PersistentError("Checksum mismatch in PersistentBuffer added to PersistentBufferHandle", Here());
+
+    if (!buffer.compressed()) {
+        add(buffer.data(), buffer.size());
+    } else if (buffer.size() != 0) {
+        Region r = { 0, buffer.size(), &buffer };
+        regions_.push_back(r);
+        size_ += r.length;
+    }
+}
+
+
+void PersistentBufferHandle::add(const void* data, size_t length) {
+
+    // Empty regions contribute nothing, and would only complicate walking the list.
+    if (length == 0)
+        return;
+
+    ASSERT(data);
+    Region r = { static_cast<const char*>(data), length, 0 };
+    regions_.push_back(r);
+    size_ += length;
+}
+
+
+size_t PersistentBufferHandle::regionCount() const {
+    return regions_.size();
+}
+
+
+void PersistentBufferHandle::verifyChecksums(bool on) {
+    verify_ = on;
+}
+
+
+Length PersistentBufferHandle::writeTo(int fd) {
+
+    size_t written = 0;
+
+    while (region_ < regions_.size()) {
+
+        // Gather as many regions as writev() will accept in one call. Compressed regions share the scratch
+        // buffer, so each one is written on its own.
+
+        std::vector<struct iovec> iov;
+        for (size_t r = region_; r < regions_.size() && iov.size() < size_t(IOV_MAX); r++) {
+
+            if (regions_[r].compressed && r != region_)
+                break;
+
+            struct iovec v;
+            v.iov_base = const_cast<char*>(regionData(r)) + (r == region_ ? offset_ : 0);
+            v.iov_len = regions_[r].length - (r == region_ ? offset_ : 0);
+            iov.push_back(v);
+
+            if (regions_[r].compressed)
+                break;
+        }
+
+        ssize_t n = ::writev(fd, &iov[0], iov.size());
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            std::ostringstream ss;
+            ss << "writev: " << *this << " to fd " << fd << ": " << ::strerror(errno);
+            throw FailedSystemCall(ss.str(), Here());
+        }
+
+        advance(n);
+        written += n;
+    }
+
+    return written;
+}
+
+
+void PersistentBufferHandle::print(std::ostream& s) const {
+    s << "PersistentBufferHandle[regions=" << regions_.size() << ", size=" << size_ << "]";
+}
+
+
+Length PersistentBufferHandle::openForRead() {
+    rewind();
+    return size_;
+}
+
+
+void PersistentBufferHandle::openForWrite(const Length&) {
+    throw NotImplemented("PersistentBufferHandle is read-only", Here());
+}
+
+
+void PersistentBufferHandle::openForAppend(const Length&) {
+    throw NotImplemented("PersistentBufferHandle is read-only", Here());
+}
+
+
+long PersistentBufferHandle::read(void* buffer, long length) {
+
+    char* out = static_cast<char*>(buffer);
+    size_t remaining = length;
+
+    while (remaining > 0 && region_ < regions_.size()) {
+
+        size_t n = std::min(remaining, regions_[region_].length - offset_);
+        ::memcpy(out, regionData(region_) + offset_, n);
+
+        advance(n);
+        out += n;
+        remaining -= n;
+    }
+
+    return length - remaining;
+}
+
+
+long PersistentBufferHandle::write(const void*, long) {
+    throw NotImplemented("PersistentBufferHandle is read-only", Here());
+}
+
+
+void PersistentBufferHandle::close() {}
+
+
+Length PersistentBufferHandle::estimate() {
+    return size_;
+}
+
+
+Offset PersistentBufferHandle::position() {
+    return position_;
+}
+
+
+Offset PersistentBufferHandle::seek(const Offset& offset) {
+
+    rewind();
+    skip(Length(static_cast<long long>(offset)));
+    return position_;
+}
+
+
+void PersistentBufferHandle::rewind() {
+    region_ = 0;
+    offset_ = 0;
+    position_ = 0;
+}
+
+
+void PersistentBufferHandle::skip(const Length& length) {
+    advance(std::min(size_t(static_cast<long long>(length)), size_ - position_));
+}
+
+
+bool PersistentBufferHandle::canSeek() const {
+    return true;
+}
+
+
+std::string PersistentBufferHandle::title() const {
+    std::ostringstream ss;
+    ss << "pmem[" << regions_.size() << " buffers]";
+    return ss.str();
+}
+
+
+void PersistentBufferHandle::advance(size_t n) {
+
+    ASSERT(position_ + n <= size_);
+    position_ += n;
+
+    while (n > 0) {
+        size_t available = regions_[region_].length - offset_;
+        if (n < available) {
+            offset_ += n;
+            return;
+        }
+        n -= available;
+        region_++;
+        offset_ = 0;
+    }
+}
+
+
+const char* PersistentBufferHandle::regionData(size_t r) {
+
+    const Region& region(regions_[r]);
+
+    if (!region.compressed)
+        return region.data;
+
+    if (decoded_ != r) {
+        const void* data = region.compressed->data(scratch_);
+        ASSERT(data == &scratch_[0]);
+        decoded_ = r;
+    }
+
+    return &scratch_[0];
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace pmem
@@ -0,0 +1,167 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+
+#ifndef pmem_PersistentBufferHandle_H
+#define pmem_PersistentBufferHandle_H
+
+#include <vector>
+
+#include "eckit/io/DataHandle.h"
+
+#include "pmem/PersistentBuffer.h"
+#include "pmem/PersistentPtr.h"
+
+
+namespace pmem {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// A read-only DataHandle which serves data directly from one or more regions of mapped persistent memory (normally
+/// PersistentBuffers), concatenated in the order that they were added.
+///
+/// Compressed PersistentBuffers are decompressed lazily, one at a time, into a scratch buffer owned by the handle as
+/// they are reached.
+///
+/// If requested (see verifyChecksums()), the checksum of each PersistentBuffer is verified as it is added, and a
+/// PersistentError thrown if it has been corrupted.
+///
+/// @note No data is copied when the handle is constructed, so the regions must remain valid (i.e. the pool must remain
+///       open, and the buffers must not be freed) for as long as the handle is in use.
+
+class PersistentBufferHandle : public eckit::DataHandle {
+
+public: // methods
+
+    PersistentBufferHandle();
+    PersistentBufferHandle(const PersistentPtr<PersistentBuffer>& buffer);
+    PersistentBufferHandle(const std::vector<PersistentPtr<PersistentBuffer> >& buffers);
+
+    virtual ~PersistentBufferHandle();
+
+    /// Append a further region to the data served by the handle
+    void add(const PersistentPtr<PersistentBuffer>& buffer);
+    void add(const PersistentBuffer& buffer);
+    void add(const void* data, size_t length);
+
+    size_t regionCount() const;
+
+    /// Verify the checksums of the PersistentBuffers added from now on.
+    void verifyChecksums(bool on);
+
+    /// Write the (remaining) contents of the handle to a file descriptor. This uses writev() directly on the
+    /// mapped regions, so avoids copying the data through an intermediate buffer.
+    eckit::Length writeTo(int fd);
+
+public: // DataHandle methods
+
+    virtual void print(std::ostream& s) const;
+
+    virtual eckit::Length openForRead();
+    virtual void openForWrite(const eckit::Length&);
+    virtual void openForAppend(const eckit::Length&);
+
+    virtual long read(void* buffer, long length);
+    virtual long write(const void* buffer, long length);
+    virtual void close();
+
+    virtual eckit::Length estimate();
+    virtual eckit::Offset position();
+    virtual eckit::Offset seek(const eckit::Offset& offset);
+    virtual void rewind();
+    virtual void skip(const eckit::Length& length);
+    virtual bool canSeek() const;
+
+    virtual std::string title() const;
+
+private: // types
+
+    struct Region {
+        const char* data;
+        size_t length;
+
+        // Set (and data is null) if the region must be decompressed
+        const PersistentBuffer* compressed;
+    };
+
+private: // methods
+
+    /// Move the read position forward by n bytes, across region boundaries.
+    void advance(size_t n);
+
+    /// The data for a region, decompressing it if required.
+    const char* regionData(size_t r);
+
+private: // members
+
+    std::vector<Region> regions_;
+
+    // Holds the decompressed data for the region indexed by decoded_
+    std::vector<char> scratch_;
+    size_t decoded_;
+
+    size_t size_;
+
+    bool verify_;
+
+    // The current read position, both as a (region, offset) pair and as an absolute position.
+    size_t region_;
+    size_t offset_;
+    size_t position_;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// n.b. The PersistentPtr<PersistentBuffer> overloads are defined inline, as the type_id of PersistentBuffer is
+//      defined by the application.
+
+inline PersistentBufferHandle::PersistentBufferHandle(const PersistentPtr<PersistentBuffer>& buffer) :
+    decoded_(size_t(-1)),
+    size_(0),
+    verify_(false),
+    region_(0),
+    offset_(0),
+    position_(0) {
+
+    add(buffer);
+}
+
+
+inline PersistentBufferHandle::PersistentBufferHandle(const std::vector<PersistentPtr<PersistentBuffer> >& buffers) :
+    decoded_(size_t(-1)),
+    size_(0),
+    verify_(false),
+    region_(0),
+    offset_(0),
+    position_(0) {
+
+    for (std::vector<PersistentPtr<PersistentBuffer> >::const_iterator it = buffers.begin(); it != buffers.end(); ++it)
+        add(*it);
+}
+
+
+inline void PersistentBufferHandle::add(const PersistentPtr<PersistentBuffer>& buffer) {
+    ASSERT(!buffer.null());
+    add(*buffer);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace pmem
+
+#endif // pmem_PersistentBufferHandle_H
@@ -0,0 +1,254 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+
+#ifndef pmem_PersistentChunkedBuffer_H
+#define pmem_PersistentChunkedBuffer_H
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <sys/uio.h>
+
+#include "eckit/exception/Exceptions.h"
+#include "eckit/io/DataHandle.h"
+#include "eckit/log/Bytes.h"
+#include "eckit/log/Log.h"
+
+#include "pmem/AtomicConstructor.h"
+#include "pmem/LibPMem.h"
+#include "pmem/PersistentBuffer.h"
+#include "pmem/PersistentVector.h"
+
+
+/*
+ * Modus-operandi:
+ *
+ * A buffer for objects that are too large to store in a single pmemobj allocation (which is limited in size, and
+ * fragments the heap badly when it is large). The data is stored as a list of extents, each of which is a
+ * PersistentBuffer of at most chunk_size bytes, so no single allocation is ever larger than one chunk.
+ *
+ * Like PersistentVector, this is stored directly in the owning object (it holds a single persistent pointer, to the
+ * list of extents).
+ *
+ * Data is added with append(), either from memory or streamed directly from a DataHandle. Each append is split into
+ * full extents of chunk_size bytes, followed by a shorter extent for any remainder. Each extent is allocated (and
+ * persisted) atomically, and then added to the list, so if persistence is lost during an append the buffer holds
+ * the data up to the end of some extent. The owner should not publish the buffer until the append is complete.
+ *
+ * The contents may be read by copying them into a set of iovecs (readv), or without copying by obtaining iovecs
+ * that describe the extents in persistent memory (regions), e.g. for writev().
+ *
+ * n.b. This is header-only, as it depends on the type_ids of PersistentBuffer and of its PersistentVectorData,
+ *      which are defined by the application.
+ */
+
+
+namespace pmem {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+class PersistentChunkedBuffer {
+
+public: // types
+
+    typedef PersistentVector<PersistentBuffer> extent_list;
+
+    /// The default size of each extent.
+    static const size_t default_chunk_size = 64 * 1024 * 1024;
+
+public: // methods
+
+    /// Initialise an empty buffer (in the constructor of the owning object).
+    void nullify();
+
+    /// Append data, in extents of at most chunk_size bytes.
+    void append(const void* data, size_t length, size_t chunk_size = default_chunk_size);
+
+    /// Append length bytes read from an (open) DataHandle, directly into the extents in persistent memory.
+    void append(eckit::DataHandle& handle, size_t length, size_t chunk_size = default_chunk_size);
+
+    /// The total number of bytes stored.
+    size_t size() const;
+
+    size_t extentCount() const;
+    const PersistentPtr<PersistentBuffer>& extent(size_t i) const;
+
+    /// Copy the data, starting at the given offset, into the supplied iovecs (filling each in turn). Returns the
+    /// number of bytes copied, which is less than the space available if the end of the data is reached.
+    size_t readv(const struct iovec* iov, size_t iovcnt, size_t offset = 0) const;
+
+    /// Append an iovec for each extent, referring directly to the data in persistent memory.
+    void regions(std::vector<struct iovec>& iov) const;
+
+    /// Verify the checksums of all the extents.
+    bool verify() const;
+
+    /// Free all the extents, and the list. Only once the owning object has been unlinked.
+    void free();
+
+private: // members
+
+    extent_list extents_;
+};
+
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+inline void PersistentChunkedBuffer::nullify() {
+    extents_.nullify();
+}
+
+
+inline void PersistentChunkedBuffer::append(const void* data, size_t length, size_t chunk_size) {
+
+    ASSERT(chunk_size > 0);
+
+    eckit::Log::debug<LibPMem>() << "Appending " << eckit::Bytes(length) << " to chunked buffer in extents of "
+                                 << eckit::Bytes(chunk_size) << std::endl;
+
+    const char* p = static_cast<const char*>(data);
+
+    for (size_t pos = 0; pos < length; pos += chunk_size) {
+        const void* chunk = p + pos;
+        size_t n = std::min(chunk_size, length - pos);
+        extents_.push_back_ctr(AtomicConstructor2<PersistentBuffer, const void*, size_t>(chunk, n));
+    }
+}
+
+
+inline void PersistentChunkedBuffer::append(eckit::DataHandle& handle, size_t length, size_t chunk_size) {
+
+    ASSERT(chunk_size > 0);
+
+    eckit::Log::debug<LibPMem>() << "Streaming " << eckit::Bytes(length) << " from " << handle.title()
+                                 << " to chunked buffer in extents of " << eckit::Bytes(chunk_size) << std::endl;
+
+    for (size_t pos = 0; pos < length; pos += chunk_size) {
+        size_t n = std::min(chunk_size, length - pos);
+        extents_.push_back_ctr(PersistentBuffer::StreamConstructor(handle, n));
+    }
+}
+
+
+inline size_t PersistentChunkedBuffer::size() const {
+
+    size_t total = 0;
+    for (extent_list::const_iterator it = extents_.begin(), end = extents_.end(); it != end; ++it)
+        total += (*it)->size();
+    return total;
+}
+
+
+inline size_t PersistentChunkedBuffer::extentCount() const {
+    return extents_.size();
+}
+
+
+inline const PersistentPtr<PersistentBuffer>& PersistentChunkedBuffer::extent(size_t i) const {
+    return extents_[i];
+}
+
+
+inline size_t PersistentChunkedBuffer::readv(const struct iovec* iov, size_t iovcnt, size_t offset) const {
+
+    size_t copied = 0;
+
+    size_t v = 0;
+    size_t vpos = 0;
+
+    for (extent_list::const_iterator it = extents_.begin(), end = extents_.end(); it != end && v < iovcnt; ++it) {
+
+        const PersistentBuffer& ext(**it);
+
+        // Skip over extents that lie entirely before the requested offset.
+
+        if (offset >= ext.size()) {
+            offset -= ext.size();
+            continue;
+        }
+
+        ASSERT(!ext.compressed());
+        const char* src = static_cast<const char*>(ext.data()) + offset;
+        size_t remaining = ext.size() - offset;
+        offset = 0;
+
+        // And copy the remainder of the extent into as many iovecs as needed.
+
+        while (remaining > 0 && v < iovcnt) {
+
+            size_t n = std::min(remaining, iov[v].iov_len - vpos);
+            ::memcpy(static_cast<char*>(iov[v].iov_base) + vpos, src, n);
+
+            src += n;
+            remaining -= n;
+            copied += n;
+            vpos += n;
+
+            if (vpos == iov[v].iov_len) {
+                v++;
+                vpos = 0;
+            }
+        }
+    }
+
+    return copied;
+}
+
+
+inline void PersistentChunkedBuffer::regions(std::vector<struct iovec>& iov) const {
+
+    for (extent_list::const_iterator it = extents_.begin(), end = extents_.end(); it != end; ++it) {
+        ASSERT(!(*it)->compressed());
+        struct iovec region;
+        region.iov_base = const_cast<void*>((*it)->data());
+        region.iov_len = (*it)->size();
+        iov.push_back(region);
+    }
+}
+
+
+inline bool PersistentChunkedBuffer::verify() const {
+
+    bool ok = true;
+    for (extent_list::const_iterator it = extents_.begin(), end = extents_.end(); it != end; ++it)
+        ok = (*it)->verify() && ok;
+    return ok;
+}
+
+
+inline void PersistentChunkedBuffer::free() {
+
+    if (extents_.null())
+        return;
+
+    for (size_t i = 0; i < extents_.size(); i++) {
+        PersistentPtr<PersistentBuffer> ext = extents_[i];
+        ext.free();
+    }
+
+    extents_.free();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace pmem
+
+#endif // pmem_PersistentChunkedBuffer_H
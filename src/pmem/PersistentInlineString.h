@@ -0,0 +1,240 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+
+#ifndef pmem_PersistentInlineString_H
+#define pmem_PersistentInlineString_H
+
+#include <cstring>
+#include <iosfwd>
+#include <string>
+#include <stdint.h>
+
+#include "eckit/exception/Exceptions.h"
+
+#include "pmem/Hash.h"
+#include "pmem/PersistentPtr.h"
+#include "pmem/PersistentString.h"
+
+
+/*
+ * Modus-operandi:
+ *
+ * A string that is stored as a member of another persistent object, rather than being allocated separately (as
+ * PersistentString is). Short strings (up to inline_capacity characters) are stored inline, and longer ones in a
+ * PersistentString allocated in the same pool.
+ *
+ * The length and a 64-bit hash (see hash64) of the contents are stored alongside. Comparing two strings checks
+ * these first, so unequal strings are (almost always) distinguished in O(1), and the out-of-line data is only
+ * touched to confirm that long strings are equal.
+ *
+ * The object occupies 48 bytes, of which 20 hold the inline characters (including the null character).
+ *
+ * n.b. The string is immutable. It should be initialised in the constructor of the owning object, which must be
+ *      in persistent memory (i.e. be constructed by an AtomicConstructor), and is persisted with it.
+ *
+ * n.b. Nothing may be allocated while an AtomicConstructor runs, and if the allocation of the owner is interrupted
+ *      (or fails) anything allocated beforehand is left unreferenced. So the out-of-line storage for a long string
+ *      is allocated first, by allocate(), directly into a persistent pointer from which it can be recovered (e.g.
+ *      a member of the parent object). It is then passed to the constructor of the owner. Once the owner has been
+ *      published, the parent clears its pointer. If interrupted before then, the parent must free the string
+ *      (unless the owner was published, and refers to it). The owning object calls free() before it is itself
+ *      freed.
+ *
+ * n.b. This is header-only, as it depends on the type_id of PersistentString, which is defined by the
+ *      application.
+ */
+
+
+namespace pmem {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+class PersistentInlineString {
+
+public: // types
+
+    /// The longest string that is stored inline. There is also space for the null character.
+    static const size_t inline_capacity = 19;
+
+public: // methods
+
+    /// The out-of-line storage must have been allocated (by allocate()) for the same string, or be null if it is
+    /// short enough to be stored inline.
+    PersistentInlineString(const std::string& str, const PersistentPtr<PersistentString>& heap);
+
+    /// Allocate the out-of-line storage for a string into the given persistent pointer, if it is too long to be
+    /// stored inline. Otherwise the pointer is left untouched.
+    static void allocate(PersistentPtr<PersistentString>& heap, const std::string& str);
+
+    size_t size() const;
+    size_t length() const;
+
+    uint64_t hash() const;
+
+    /// Is the string stored inline (i.e. without a separate allocation)?
+    bool inlined() const;
+
+    /// Matching the std::string implementation, these return null-terminated strings.
+    const char* c_str() const;
+    const char* data() const;
+
+    std::string str() const;
+
+    bool operator==(const PersistentInlineString& rhs) const;
+    bool operator==(const std::string& rhs) const;
+
+    bool operator!=(const PersistentInlineString& rhs) const;
+    bool operator!=(const std::string& rhs) const;
+
+    /// Free any storage allocated out of line.
+    void free();
+
+private: // members
+
+    uint64_t hash_;
+
+    PersistentPtr<PersistentString> heap_;
+
+    uint32_t length_;
+
+    char inline_[inline_capacity + 1];
+
+private: // friends
+
+    friend std::ostream& operator<<(std::ostream& os, const PersistentInlineString& s) {
+        os.write(s.data(), s.size());
+        return os;
+    }
+};
+
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+inline PersistentInlineString::PersistentInlineString(const std::string& str,
+                                                      const PersistentPtr<PersistentString>& heap) :
+    hash_(hash64(str.data(), str.size())),
+    heap_(heap),
+    length_(str.size()) {
+
+    ASSERT(str.size() == length_);
+
+    if (str.size() <= inline_capacity) {
+        ASSERT(heap.null());
+        ::memcpy(inline_, str.data(), str.size());
+        ::memset(&inline_[str.size()], 0, sizeof(inline_) - str.size());
+    } else {
+        ASSERT(!heap.null() && heap->length() == str.size());
+        ::memset(inline_, 0, sizeof(inline_));
+    }
+}
+
+
+inline void PersistentInlineString::allocate(PersistentPtr<PersistentString>& heap, const std::string& str) {
+
+    if (str.size() > inline_capacity)
+        heap.allocate(str);
+}
+
+
+inline size_t PersistentInlineString::size() const {
+    return length_;
+}
+
+
+inline size_t PersistentInlineString::length() const {
+    return length_;
+}
+
+
+inline uint64_t PersistentInlineString::hash() const {
+    return hash_;
+}
+
+
+inline bool PersistentInlineString::inlined() const {
+    return length_ <= inline_capacity;
+}
+
+
+inline const char* PersistentInlineString::c_str() const {
+    return inlined() ? inline_ : heap_->c_str();
+}
+
+
+inline const char* PersistentInlineString::data() const {
+    return c_str();
+}
+
+
+inline std::string PersistentInlineString::str() const {
+    return std::string(data(), size());
+}
+
+
+inline bool PersistentInlineString::operator==(const PersistentInlineString& rhs) const {
+
+    if (hash_ != rhs.hash_ || length_ != rhs.length_)
+        return false;
+
+    return ::memcmp(data(), rhs.data(), length_) == 0;
+}
+
+
+inline bool PersistentInlineString::operator==(const std::string& rhs) const {
+
+    if (length_ != rhs.size())
+        return false;
+
+    return ::memcmp(data(), rhs.data(), length_) == 0;
+}
+
+
+inline bool PersistentInlineString::operator!=(const PersistentInlineString& rhs) const {
+    return !(*this == rhs);
+}
+
+
+inline bool PersistentInlineString::operator!=(const std::string& rhs) const {
+    return !(*this == rhs);
+}
+
+
+inline bool operator==(const std::string& lhs, const PersistentInlineString& rhs) {
+    return rhs == lhs;
+}
+
+
+inline bool operator!=(const std::string& lhs, const PersistentInlineString& rhs) {
+    return !(rhs == lhs);
+}
+
+
+inline void PersistentInlineString::free() {
+
+    if (!heap_.null())
+        heap_.free();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace pmem
+
+#endif // pmem_PersistentInlineString_H
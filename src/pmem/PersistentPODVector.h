@@ -21,8 +21,12 @@
 #define pmem_PersistentPODVector_H
 
 
+#include <algorithm>
+#include <vector>
+
 #include "pmem/PersistentPtr.h"
 #include "pmem/LibPMem.h"
+#include "pmem/PODKernels.h"
 
 
 /*
@@ -49,12 +53,20 @@ namespace pmem {
 template <typename T>
 class PersistentPODVectorData {
 
+public: // types
+
+    typedef const T* const_iterator;
+
 public: // Constructors
 
     /// Constructors
     PersistentPODVectorData(size_t max_size);
     PersistentPODVectorData(const PersistentPODVectorData<T>& source, size_t max_size);
 
+    /// Copy the source, merging in the (already sorted) values. The result is sorted, whether or not the source
+    /// was.
+    PersistentPODVectorData(const PersistentPODVectorData<T>& source, size_t max_size, const std::vector<T>& values);
+
     /// The amount of memory that needs to be allocated to store this
     static size_t data_size(size_t max_size);
 
@@ -67,12 +79,23 @@ public: // Constructors
     /// How much space is available
     size_t allocated_size() const;
 
-    /// Append an element to the list.
+    /// Append an element to the list. The list is no longer known to be sorted.
     void push_back(const T& value);
 
+    /// Append elements that are known to be in order (and to follow the existing elements) to a sorted list,
+    /// making them visible with a single update of the element count.
+    void append_sorted(const T* values, size_t n);
+
+    /// Are the elements known to be in (non-decreasing) order?
+    bool sorted() const;
+
     /// Return a given element in the list
     const T& operator[] (size_t i) const;
 
+    /// Iterate over the elements in the list
+    const_iterator begin() const;
+    const_iterator end() const;
+
 protected: // methods
 
     /// Update the number of elements, ensuring that the result is persisted
@@ -84,6 +107,10 @@ protected: // members
     mutable size_t nelem_;
     size_t allocatedSize_;
 
+    // Set if the elements are known to be in order. This is cleared (and persisted) before any out-of-order
+    // element can become visible, so it may be pessimistic but is never wrong.
+    bool sorted_;
+
     // The allocator/constructor will make the PersistentPODVectorData the right size.
     T elements_[1];
 };
@@ -98,6 +125,7 @@ class PersistentPODVector : public PersistentPtr<PersistentPODVectorData<T> > {
 public: // types
 
     typedef PersistentPODVectorData<T> data_type;
+    typedef typename data_type::const_iterator const_iterator;
 
 public:
 
@@ -109,7 +137,30 @@ public:
 
     const T& operator[] (size_t i) const;
 
+    /// STL-compatible (random access) iteration. The persistent data block is only resolved once, rather than
+    /// on every element access as for operator[].
+    const_iterator begin() const;
+    const_iterator end() const;
+
     void resize(size_t new_size);
+
+    /// Search and reduction over the elements. These use the vectorised kernels in PODKernels.h for the
+    /// arithmetic types, and a scalar loop otherwise.
+
+    /// The index of the first element equal to value, or size() if there is none.
+    size_t find(const T& value) const;
+
+    size_t count(const T& value) const;
+
+    /// Count, or collect the indices of, the elements in the closed range [lo, hi]
+    size_t count_range(const T& lo, const T& hi) const;
+    size_t filter_range(const T& lo, const T& hi, std::vector<size_t>& indices) const;
+
+    /// The vector must not be empty
+    T min() const;
+    T max() const;
+
+    typename kernels::SumType<T>::type sum() const;
 };
 
 
@@ -143,20 +194,36 @@ public:
     }
 };
 
+
+template <typename T>
+class AtomicConstructor3<PersistentPODVectorData<T>, PersistentPODVectorData<T>, size_t, std::vector<T> > :
+        public AtomicConstructor3Base<PersistentPODVectorData<T>, PersistentPODVectorData<T>, size_t, std::vector<T> > {
+public:
+
+    AtomicConstructor3(const PersistentPODVectorData<T>& x1, const size_t& x2, const std::vector<T>& x3) :
+        AtomicConstructor3Base<PersistentPODVectorData<T>, PersistentPODVectorData<T>, size_t, std::vector<T> >(x1, x2, x3) {}
+
+    virtual size_t size() const {
+        return PersistentPODVectorData<T>::data_size(this->x2_);
+    }
+};
+
 //----------------------------------------------------------------------------------------------------------------------
 
 
 template <typename T>
 PersistentPODVectorData<T>::PersistentPODVectorData(size_t max_size) :
     nelem_(0),
-    allocatedSize_(max_size) {}
+    allocatedSize_(max_size),
+    sorted_(true) {}
 
 
 template <typename T>
 PersistentPODVectorData<T>::PersistentPODVectorData(const PersistentPODVectorData<T>& source,
                                                     size_t max_size) :
     nelem_(source.size()),
-    allocatedSize_(max_size) {
+    allocatedSize_(max_size),
+    sorted_(source.sorted_) {
 
     ASSERT(allocatedSize_ > nelem_);
 
@@ -166,6 +233,29 @@ PersistentPODVectorData<T>::PersistentPODVectorData(const PersistentPODVectorDat
 }
 
 
+template <typename T>
+PersistentPODVectorData<T>::PersistentPODVectorData(const PersistentPODVectorData<T>& source,
+                                                    size_t max_size,
+                                                    const std::vector<T>& values) :
+    nelem_(source.size() + values.size()),
+    allocatedSize_(max_size),
+    sorted_(true) {
+
+    ASSERT(allocatedSize_ >= nelem_);
+
+    // This is being built before it is made visible, so there is no need to worry about the ordering of writes.
+
+    std::copy(source.begin(), source.end(), &elements_[0]);
+    std::copy(values.begin(), values.end(), &elements_[source.size()]);
+
+    if (source.sorted_) {
+        std::inplace_merge(&elements_[0], &elements_[source.size()], &elements_[nelem_]);
+    } else {
+        std::sort(&elements_[0], &elements_[nelem_]);
+    }
+}
+
+
 template <typename T>
 size_t PersistentPODVectorData<T>::data_size(size_t max_size) {
     return sizeof(PersistentPODVectorData<T>) + (max_size - 1) * sizeof(T);
@@ -210,6 +300,11 @@ void PersistentPODVectorData<T>::push_back(const T& value) {
     // still retain an object in a reasonable state.
     // TODO: Add a method to the Constructor to make expanding the PersistentPODVectorData<> one-step.
 
+    if (sorted_) {
+        sorted_ = false;
+        ::pmemobj_persist(::pmemobj_pool_by_ptr(&sorted_), &sorted_, sizeof(sorted_));
+    }
+
     elements_[nelem_] = value;
     ::pmemobj_persist(::pmemobj_pool_by_ptr(&elements_[nelem_]), &elements_[nelem_], sizeof(T));
 
@@ -218,6 +313,42 @@ void PersistentPODVectorData<T>::push_back(const T& value) {
 }
 
 
+/// As for push_back, the elements are written beyond the end of the list, and only become visible once the
+/// count is updated.
+template<typename T>
+void PersistentPODVectorData<T>::append_sorted(const T* values, size_t n) {
+
+    ASSERT(sorted_);
+    ASSERT(nelem_ + n <= allocatedSize_);
+
+    if (n == 0)
+        return;
+
+    ASSERT(nelem_ == 0 || !(values[0] < elements_[nelem_-1]));
+    for (size_t i = 0; i < n; i++) {
+        ASSERT(i == 0 || !(values[i] < values[i-1]));
+        elements_[nelem_ + i] = values[i];
+    }
+    ::pmemobj_persist(::pmemobj_pool_by_ptr(&elements_[nelem_]), &elements_[nelem_], n * sizeof(T));
+
+    update_nelem(nelem_ + n);
+}
+
+
+template<typename T>
+bool PersistentPODVectorData<T>::sorted() const {
+    return sorted_;
+}
+
+
+template <typename T>
+void PersistentPODVectorData<T>::update_nelem(size_t nelem) const {
+
+    nelem_ = nelem;
+    ::pmemobj_persist(::pmemobj_pool_by_ptr(&nelem_), &nelem_, sizeof(nelem_));
+}
+
+
 /// Return a given element in the list
 template<typename T>
 const T& PersistentPODVectorData<T>::operator[] (size_t i) const {
@@ -225,6 +356,18 @@ const T& PersistentPODVectorData<T>::operator[] (size_t i) const {
 }
 
 
+template<typename T>
+typename PersistentPODVectorData<T>::const_iterator PersistentPODVectorData<T>::begin() const {
+    return &elements_[0];
+}
+
+
+template<typename T>
+typename PersistentPODVectorData<T>::const_iterator PersistentPODVectorData<T>::end() const {
+    return &elements_[size()];
+}
+
+
 //----------------------------------------------------------------------------------------------------------------------
 
 
@@ -267,6 +410,18 @@ const T& PersistentPODVector<T>::operator[] (size_t i) const {
 }
 
 
+template <typename T>
+typename PersistentPODVector<T>::const_iterator PersistentPODVector<T>::begin() const {
+    return PersistentPtr<data_type>::null() ? 0 : PersistentPtr<data_type>::get()->begin();
+}
+
+
+template <typename T>
+typename PersistentPODVector<T>::const_iterator PersistentPODVector<T>::end() const {
+    return PersistentPtr<data_type>::null() ? 0 : PersistentPtr<data_type>::get()->end();
+}
+
+
 template <typename T>
 void PersistentPODVector<T>::resize(size_t new_size) {
 
@@ -283,6 +438,48 @@ void PersistentPODVector<T>::resize(size_t new_size) {
 }
 
 
+template <typename T>
+size_t PersistentPODVector<T>::find(const T& value) const {
+    return kernels::find(begin(), size(), value);
+}
+
+
+template <typename T>
+size_t PersistentPODVector<T>::count(const T& value) const {
+    return kernels::count(begin(), size(), value);
+}
+
+
+template <typename T>
+size_t PersistentPODVector<T>::count_range(const T& lo, const T& hi) const {
+    return kernels::count_range(begin(), size(), lo, hi);
+}
+
+
+template <typename T>
+size_t PersistentPODVector<T>::filter_range(const T& lo, const T& hi, std::vector<size_t>& indices) const {
+    return kernels::filter_range(begin(), size(), lo, hi, indices);
+}
+
+
+template <typename T>
+T PersistentPODVector<T>::min() const {
+    return kernels::min(begin(), size());
+}
+
+
+template <typename T>
+T PersistentPODVector<T>::max() const {
+    return kernels::max(begin(), size());
+}
+
+
+template <typename T>
+typename kernels::SumType<T>::type PersistentPODVector<T>::sum() const {
+    return kernels::sum(begin(), size());
+}
+
+
 //----------------------------------------------------------------------------------------------------------------------
 
 
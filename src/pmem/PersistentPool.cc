@@ -43,7 +43,10 @@ namespace pmem {
 PersistentPool::PersistentPool(const eckit::PathName& path, const std::string& name) :
     path_(path),
     newPool_(false),
-    size_(0) {
+    size_(0),
+    compressedBuffers_(0),
+    compressedOriginalBytes_(0),
+    compressedStoredBytes_(0) {
 
     Log::debug<LibPMem>() << "Opening persistent pool: " << path << std::endl;
 
@@ -77,7 +80,10 @@ PersistentPool::PersistentPool(const eckit::PathName& path, size_t size, const s
                                const AtomicConstructorBase& constructor) :
     path_(path),
     newPool_(true),
-    size_(size) {
+    size_(size),
+    compressedBuffers_(0),
+    compressedOriginalBytes_(0),
+    compressedStoredBytes_(0) {
 
     Log::debug<LibPMem>() << "Creating persistent pool: " << path << std::endl;
 
@@ -167,6 +173,29 @@ uint64_t PersistentPool::uuid() const {
     return rootElem.pool_uuid_lo;
 }
 
+
+void PersistentPool::recordCompression(size_t originalBytes, size_t storedBytes) {
+
+    compressedBuffers_ += 1;
+    compressedOriginalBytes_ += originalBytes;
+    compressedStoredBytes_ += storedBytes;
+}
+
+
+PersistentPool::CompressionStats PersistentPool::compressionStats() const {
+
+    CompressionStats stats;
+    stats.buffers = compressedBuffers_;
+    stats.originalBytes = compressedOriginalBytes_;
+    stats.storedBytes = compressedStoredBytes_;
+    return stats;
+}
+
+
+double PersistentPool::CompressionStats::ratio() const {
+    return storedBytes == 0 ? 1.0 : double(originalBytes) / double(storedBytes);
+}
+
 // -------------------------------------------------------------------------------------------------
 
 } // namespace pmem
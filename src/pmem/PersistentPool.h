@@ -18,8 +18,10 @@
 #ifndef pmem_PersistentPool_H
 #define pmem_PersistentPool_H
 
+#include <atomic>
 #include <cstddef>
 #include <string>
+#include <vector>
 
 #include "libpmemobj.h"
 
@@ -40,6 +42,18 @@ template <typename T> class PersistentPtr;
 
 class PersistentPool : private eckit::NonCopyable {
 
+public: // types
+
+    /// Statistics on the compressed buffers allocated in this pool since it was opened (by this process).
+    struct CompressionStats {
+        size_t buffers;
+        size_t originalBytes;
+        size_t storedBytes;
+
+        /// The ratio of the original to stored sizes (i.e. > 1 if space is being saved).
+        double ratio() const;
+    };
+
 public: // methods
 
     /// Open existing persistent pool
@@ -77,6 +91,12 @@ public: // methods
     /// Obtain the UUID of the pool for later identification
     uint64_t uuid() const;
 
+    /// Account for a buffer allocated in this pool with compression requested (whether or not the data turned out
+    /// to be compressible). Thread safe.
+    void recordCompression(size_t originalBytes, size_t storedBytes);
+
+    CompressionStats compressionStats() const;
+
     /// When given a particular pool explicitly, we can allocate from here. This is intended for
     /// situations where the target persistent pointer is volatile, or persistence is being
     /// managed explicitly.
@@ -90,6 +110,11 @@ public: // methods
     template <typename T, typename X1, typename X2, typename X3>
     PersistentPtr<T> allocate(const X1& x1, const X2& x2, const X3& x3);
 
+    /// Find all of the allocated objects of a given type, by walking the pool. This is intended for maintenance
+    /// tasks (e.g. verification), and the pool should not be modified concurrently.
+    template <typename T>
+    std::vector<PersistentPtr<T> > objects() const;
+
 protected: // members
 
     eckit::PathName path_;
@@ -99,6 +124,10 @@ protected: // members
     bool newPool_;
 
     size_t size_;
+
+    std::atomic<size_t> compressedBuffers_;
+    std::atomic<size_t> compressedOriginalBytes_;
+    std::atomic<size_t> compressedStoredBytes_;
 };
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -151,6 +180,20 @@ PersistentPtr<T> PersistentPool::allocate(const X1& x1, const X2& x2, const X3&
     ret.allocate_ctr(*this, ctr);
     return ret;
 }
+
+
+template <typename T>
+std::vector<PersistentPtr<T> > PersistentPool::objects() const {
+
+    std::vector<PersistentPtr<T> > result;
+
+    for (PMEMoid oid = ::pmemobj_first(pool_); !OID_IS_NULL(oid); oid = ::pmemobj_next(oid)) {
+        if (::pmemobj_type_num(oid) == PersistentType<T>::type_id)
+            result.push_back(PersistentPtr<T>(oid));
+    }
+
+    return result;
+}
 //----------------------------------------------------------------------------------------------------------------------
 
 } // namespace pmem
@@ -45,8 +45,11 @@ int pmem_constructor(PMEMobjpool * pool, void * obj, void * arg) {
     // The constructor should return zero for success. If it has failed (e.g. if a subobjects
     // allocation has failed) this needs to be propagated upwards so that the block reservation
     // can be correctly unwound.
+    //
+    // A successfully constructed object must be durable before the allocator publishes it. Some
+    // objects take care of this themselves, in which case we avoid flushing them a second time.
     int ret = constr_fn->build(obj);
-    if (ret != 0)
+    if (ret == 0 && !constr_fn->self_persisting())
         ::pmemobj_persist(pool, obj, constr_fn->size());
     return ret;
 }
@@ -167,6 +167,11 @@ public: // methods
     template <typename X1, typename X2> void replace(const X1& x1, const X2& x2);
     template <typename X1, typename X2, typename X3> void replace(const X1& x1, const X2& x2, const X3& x3);
 
+    /// Atomically replace the existing object with a new one, as for replace_ctr, but without freeing the
+    /// original. Concurrent readers may continue to use the original, which the caller is responsible for freeing
+    /// once it is no longer in use (see EpochManager::replace_ctr).
+    void publish_ctr(const AtomicConstructor<object_type>& constructor);
+
     /// If we want to set a PersistentPtr that is is in persistent memory, then we need
     /// to ensure that it is set with
     void setPersist(const PersistentPtr<T>& ptr);
@@ -406,6 +411,29 @@ void PersistentPtr<T>::replace(const X1& x1, const X2& x2, const X3& x3) {
 }
 
 
+template <typename T>
+void PersistentPtr<T>::publish_ctr(const AtomicConstructor<object_type> &constructor) {
+
+    ASSERT(!null());
+    PMEMobjpool* pool = ::pmemobj_pool_by_ptr(this);
+
+    if (pool == 0)
+        throw eckit::SeriousBug("Publishing persistent memory allocation in non-persistent memory", Here());
+
+    // n.b. Only the offset of the oid changes (the pool is the same), so readers see either the old or the new
+    //      object. The new object is fully constructed and persisted before the oid is updated.
+
+    if (::pmemobj_alloc(pool,
+                        &oid_,
+                        constructor.size(),
+                        constructor.type_id(),
+                        &pmem_constructor,
+                        const_cast<void*>(reinterpret_cast<const void*>(&constructor))) != 0) {
+        throw AtomicConstructorBase::AllocationError("Persistent allocation failed");
+    }
+}
+
+
 template <typename T>
 void PersistentPtr<T>::setPersist(const PersistentPtr<T>& ptr) {
 
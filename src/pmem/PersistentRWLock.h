@@ -0,0 +1,94 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+#ifndef pmem_PersistentRWLock_H
+#define pmem_PersistentRWLock_H
+
+#include <cstring>
+#include <string>
+
+#include "eckit/exception/Exceptions.h"
+#include "eckit/memory/NonCopyable.h"
+
+#include "libpmemobj.h"
+
+
+namespace pmem {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// A readers-writer lock, stored in persistent memory. Any number of readers may hold the lock at once, or a single
+/// writer.
+///
+/// @note As for PersistentMutex, libpmemobj reinitialises the lock each time the pool is opened, so a lock held when
+///       a process dies does not remain held. The lock should be zeroed when the containing object is constructed.
+
+class PersistentRWLock {
+
+public: // methods
+
+    void zero()         { ::pmemobj_rwlock_zero(::pmemobj_pool_by_ptr(&lock_), &lock_); }
+
+    void lockRead()     { check(::pmemobj_rwlock_rdlock(::pmemobj_pool_by_ptr(&lock_), &lock_)); }
+    void lockWrite()    { check(::pmemobj_rwlock_wrlock(::pmemobj_pool_by_ptr(&lock_), &lock_)); }
+
+    bool tryLockRead()  { return ::pmemobj_rwlock_tryrdlock(::pmemobj_pool_by_ptr(&lock_), &lock_) == 0; }
+    bool tryLockWrite() { return ::pmemobj_rwlock_trywrlock(::pmemobj_pool_by_ptr(&lock_), &lock_) == 0; }
+
+    // n.b. unlock() does not throw, as it is called from the destructors of the guards.
+    void unlock()       { ::pmemobj_rwlock_unlock(::pmemobj_pool_by_ptr(&lock_), &lock_); }
+
+private: // methods
+
+    static void check(int ret) {
+        if (ret != 0)
+            throw eckit::FailedSystemCall(std::string("pmemobj_rwlock: ") + ::strerror(ret), Here());
+    }
+
+private: // members
+
+    PMEMrwlock lock_;
+};
+
+
+/// Hold a PersistentRWLock for reading, for the lifetime of the object.
+
+class AutoReadLock : private eckit::NonCopyable {
+public:
+    AutoReadLock(PersistentRWLock& lock) : lock_(lock) { lock_.lockRead(); }
+    ~AutoReadLock() { lock_.unlock(); }
+private:
+    PersistentRWLock& lock_;
+};
+
+
+/// Hold a PersistentRWLock for writing, for the lifetime of the object.
+
+class AutoWriteLock : private eckit::NonCopyable {
+public:
+    AutoWriteLock(PersistentRWLock& lock) : lock_(lock) { lock_.lockWrite(); }
+    ~AutoWriteLock() { lock_.unlock(); }
+private:
+    PersistentRWLock& lock_;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+}
+
+#endif // pmem_PersistentRWLock_H
@@ -0,0 +1,381 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+
+#ifndef pmem_PersistentRingBuffer_H
+#define pmem_PersistentRingBuffer_H
+
+#include <algorithm>
+#include <stdint.h>
+
+#include "pmem/PersistentPtr.h"
+#include "pmem/LibPMem.h"
+
+
+/*
+ * Modus-operandi:
+ *
+ * A fixed capacity circular log of PODs. The data is laid out in the same way as a PersistentPODVectorData (a
+ * small header, followed by an array of elements sized by the constructor), but it is never reallocated. Once
+ * full, new records overwrite the oldest ones in place.
+ *
+ * The head and tail are monotonically increasing record numbers (so they never need to wrap), and the record
+ * numbered i is stored in slot (i % capacity). The valid records are [head, tail).
+ *
+ * Appending a batch of records:
+ *
+ *   i)   If the batch would overwrite valid records, the head is advanced past them, and persisted.
+ *   ii)  The records are written into the (now unused) slots, and persisted.
+ *   iii) The tail is advanced, and persisted. This publishes the whole batch.
+ *
+ * Each index is a single 8-byte word, so if persistence is lost at any point the buffer contains either the old
+ * or the new set of records (less any that were about to be overwritten).
+ *
+ * n.b. There is no locking. A single producer is assumed. Readers that run concurrently with the producer should
+ *      check that the head has not passed the records that they have read (using valid()) once they have finished
+ *      with them, as they may have been overwritten.
+ */
+
+
+namespace pmem {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+template <typename T>
+class PersistentRingBufferData {
+
+public: // types
+
+    /// A contiguous run of records, directly in persistent memory
+    struct Span {
+        const T* data;
+        size_t count;
+        uint64_t first;
+    };
+
+public: // Constructors
+
+    PersistentRingBufferData(size_t capacity);
+
+    /// The amount of memory that needs to be allocated to store this
+    static size_t data_size(size_t capacity);
+
+public: // methods
+
+    size_t capacity() const;
+
+    /// The number of valid records
+    size_t size() const;
+
+    /// The record numbers of the oldest valid record, and one past the newest
+    uint64_t head() const;
+    uint64_t tail() const;
+
+    /// Append a batch of records, overwriting the oldest ones as required, and publish them together.
+    void append(const T* values, size_t n);
+
+    /// Obtain the longest contiguous run of valid records, starting from the record numbered position (or the
+    /// head, if that has already been overwritten). The span is empty if there are no more records.
+    Span span(uint64_t position) const;
+
+    /// Discard the oldest n records (or all of them, if there are fewer).
+    void discard(size_t n);
+
+    /// Is the record numbered position still available?
+    bool valid(uint64_t position) const;
+
+private: // methods
+
+    void update_head(uint64_t head) const;
+    void update_tail(uint64_t tail) const;
+
+private: // members
+
+    uint64_t capacity_;
+
+    mutable uint64_t head_;
+    mutable uint64_t tail_;
+
+    // The allocator/constructor will make the PersistentRingBufferData the right size.
+    T elements_[1];
+};
+
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+template <typename T>
+class PersistentRingBuffer : public PersistentPtr<PersistentRingBufferData<T> > {
+
+public: // types
+
+    typedef PersistentRingBufferData<T> data_type;
+    typedef typename data_type::Span Span;
+
+public: // methods
+
+    /// Allocate the buffer with the given capacity. This is only done once.
+    void allocate(size_t capacity);
+
+    size_t capacity() const;
+    size_t size() const;
+    bool empty() const;
+
+    uint64_t head() const;
+    uint64_t tail() const;
+
+    void push_back(const T& value);
+    void append(const T* values, size_t n);
+
+    Span span(uint64_t position) const;
+    void discard(size_t n);
+    bool valid(uint64_t position) const;
+};
+
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/// Override the determination of the size for the constructor.
+
+template <typename T>
+class AtomicConstructor1<PersistentRingBufferData<T>, size_t> :
+        public AtomicConstructor1Base<PersistentRingBufferData<T>, size_t> {
+public:
+
+    AtomicConstructor1(const size_t& x1) : AtomicConstructor1Base<PersistentRingBufferData<T>, size_t>(x1) {}
+
+    virtual size_t size() const {
+        return PersistentRingBufferData<T>::data_size(this->x1_);
+    }
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+template <typename T>
+PersistentRingBufferData<T>::PersistentRingBufferData(size_t capacity) :
+    capacity_(capacity),
+    head_(0),
+    tail_(0) {
+
+    ASSERT(capacity > 0);
+}
+
+
+template <typename T>
+size_t PersistentRingBufferData<T>::data_size(size_t capacity) {
+    return sizeof(PersistentRingBufferData<T>) + (capacity - 1) * sizeof(T);
+}
+
+
+template <typename T>
+size_t PersistentRingBufferData<T>::capacity() const {
+    return capacity_;
+}
+
+
+template <typename T>
+size_t PersistentRingBufferData<T>::size() const {
+    ASSERT(head_ <= tail_);
+    ASSERT(tail_ - head_ <= capacity_);
+    return tail_ - head_;
+}
+
+
+template <typename T>
+uint64_t PersistentRingBufferData<T>::head() const {
+    return head_;
+}
+
+
+template <typename T>
+uint64_t PersistentRingBufferData<T>::tail() const {
+    return tail_;
+}
+
+
+template <typename T>
+void PersistentRingBufferData<T>::append(const T* values, size_t n) {
+
+    ASSERT(n <= capacity_);
+    if (n == 0)
+        return;
+
+    // Retire any records that are about to be overwritten, before touching them.
+
+    if (tail_ + n - head_ > capacity_)
+        update_head(tail_ + n - capacity_);
+
+    // Write the records. This may wrap around the end of the storage, in which case it is done in two parts.
+
+    PMEMobjpool* pool = ::pmemobj_pool_by_ptr(this);
+
+    size_t start = tail_ % capacity_;
+    size_t first = std::min(n, size_t(capacity_ - start));
+
+    std::copy(values, values + first, &elements_[start]);
+    ::pmemobj_persist(pool, &elements_[start], first * sizeof(T));
+
+    if (first < n) {
+        std::copy(values + first, values + n, &elements_[0]);
+        ::pmemobj_persist(pool, &elements_[0], (n - first) * sizeof(T));
+    }
+
+    // And publish them
+
+    update_tail(tail_ + n);
+}
+
+
+template <typename T>
+typename PersistentRingBufferData<T>::Span PersistentRingBufferData<T>::span(uint64_t position) const {
+
+    Span s;
+    s.first = std::max(position, head_);
+
+    if (s.first >= tail_) {
+        s.data = 0;
+        s.count = 0;
+        return s;
+    }
+
+    size_t start = s.first % capacity_;
+    s.data = &elements_[start];
+    s.count = std::min(tail_ - s.first, uint64_t(capacity_ - start));
+    return s;
+}
+
+
+template <typename T>
+void PersistentRingBufferData<T>::discard(size_t n) {
+    update_head(n >= size() ? tail_ : head_ + n);
+}
+
+
+template <typename T>
+bool PersistentRingBufferData<T>::valid(uint64_t position) const {
+    return position >= head_ && position < tail_;
+}
+
+
+template <typename T>
+void PersistentRingBufferData<T>::update_head(uint64_t head) const {
+
+    head_ = head;
+    ::pmemobj_persist(::pmemobj_pool_by_ptr(&head_), &head_, sizeof(head_));
+}
+
+
+template <typename T>
+void PersistentRingBufferData<T>::update_tail(uint64_t tail) const {
+
+    tail_ = tail;
+    ::pmemobj_persist(::pmemobj_pool_by_ptr(&tail_), &tail_, sizeof(tail_));
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+template <typename T>
+void PersistentRingBuffer<T>::allocate(size_t capacity) {
+
+    ASSERT(PersistentPtr<data_type>::null());
+
+    eckit::Log::debug<LibPMem>() << "Allocating ring buffer with capacity for " << capacity << " records" << std::endl;
+    PersistentPtr<data_type>::allocate(capacity);
+}
+
+
+template <typename T>
+size_t PersistentRingBuffer<T>::capacity() const {
+    return PersistentPtr<data_type>::null() ? 0 : (*this)->capacity();
+}
+
+
+template <typename T>
+size_t PersistentRingBuffer<T>::size() const {
+    return PersistentPtr<data_type>::null() ? 0 : (*this)->size();
+}
+
+
+template <typename T>
+bool PersistentRingBuffer<T>::empty() const {
+    return size() == 0;
+}
+
+
+template <typename T>
+uint64_t PersistentRingBuffer<T>::head() const {
+    return PersistentPtr<data_type>::null() ? 0 : (*this)->head();
+}
+
+
+template <typename T>
+uint64_t PersistentRingBuffer<T>::tail() const {
+    return PersistentPtr<data_type>::null() ? 0 : (*this)->tail();
+}
+
+
+template <typename T>
+void PersistentRingBuffer<T>::push_back(const T& value) {
+    append(&value, 1);
+}
+
+
+template <typename T>
+void PersistentRingBuffer<T>::append(const T* values, size_t n) {
+
+    if (PersistentPtr<data_type>::null())
+        throw eckit::SeriousBug("Appending to a ring buffer that has not been allocated", Here());
+
+    PersistentPtr<data_type>::get()->append(values, n);
+}
+
+
+template <typename T>
+typename PersistentRingBuffer<T>::Span PersistentRingBuffer<T>::span(uint64_t position) const {
+
+    if (PersistentPtr<data_type>::null()) {
+        Span s = { 0, 0, position };
+        return s;
+    }
+
+    return PersistentPtr<data_type>::get()->span(position);
+}
+
+
+template <typename T>
+void PersistentRingBuffer<T>::discard(size_t n) {
+
+    if (!PersistentPtr<data_type>::null())
+        PersistentPtr<data_type>::get()->discard(n);
+}
+
+
+template <typename T>
+bool PersistentRingBuffer<T>::valid(uint64_t position) const {
+    return !PersistentPtr<data_type>::null() && PersistentPtr<data_type>::get()->valid(position);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace pmem
+
+#endif // pmem_PersistentRingBuffer_H
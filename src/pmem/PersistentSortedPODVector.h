@@ -0,0 +1,183 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+
+#ifndef pmem_PersistentSortedPODVector_H
+#define pmem_PersistentSortedPODVector_H
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "pmem/PersistentPODVector.h"
+
+
+/*
+ * Modus-operandi:
+ *
+ * A sorted vector uses exactly the same persistent data as a PersistentPODVector, and relies on the sorted_ flag
+ * that it maintains. Ordered lookups (lower_bound, equal_range, ...) are binary searches, and require the
+ * flag to be set.
+ *
+ * Elements are added in one of two ways:
+ *
+ * - insert() keeps the vector sorted. Where the new elements belong at the end, and fit, they are written into
+ *   the spare space and made visible with a single update of the element count. Otherwise a merged copy is built
+ *   (the shift) and then atomically swapped in (the commit), so a crash leaves either the old or the new vector
+ *   intact. Shifting in place is not crash safe without an undo log of the displaced elements.
+ *
+ * - push_back() (inherited) appends without regard to order, and clears the flag. This is the fast path for
+ *   loading large batches, which should be followed by a single call to sort().
+ */
+
+
+namespace pmem {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+template <typename T>
+class PersistentSortedPODVector : public PersistentPODVector<T> {
+
+public: // types
+
+    typedef typename PersistentPODVector<T>::data_type data_type;
+    typedef typename PersistentPODVector<T>::const_iterator const_iterator;
+
+public: // methods
+
+    /// Are the elements known to be sorted? An empty vector is sorted.
+    bool sorted() const;
+
+    /// Sort the elements, if they are not already known to be sorted.
+    void sort();
+
+    /// Insert elements, maintaining the sorted order.
+    void insert(const T& value);
+
+    template <typename InputIterator>
+    void insert(InputIterator first, InputIterator last);
+
+    /// Binary searches, with the same meaning as the STL algorithms. The vector must be sorted.
+    const_iterator lower_bound(const T& value) const;
+    const_iterator upper_bound(const T& value) const;
+    std::pair<const_iterator, const_iterator> equal_range(const T& value) const;
+
+private: // methods
+
+    void merge(const std::vector<T>& values);
+};
+
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+template <typename T>
+bool PersistentSortedPODVector<T>::sorted() const {
+    return PersistentPtr<data_type>::null() || PersistentPtr<data_type>::get()->sorted();
+}
+
+
+template <typename T>
+void PersistentSortedPODVector<T>::sort() {
+
+    if (!sorted()) {
+        eckit::Log::debug<LibPMem>() << "Sorting POD vector of " << this->size() << " elements" << std::endl;
+        PersistentPtr<data_type>::replace(**this, this->allocated_size(), std::vector<T>());
+    }
+}
+
+
+template <typename T>
+void PersistentSortedPODVector<T>::insert(const T& value) {
+    merge(std::vector<T>(1, value));
+}
+
+
+template <typename T>
+template <typename InputIterator>
+void PersistentSortedPODVector<T>::insert(InputIterator first, InputIterator last) {
+
+    std::vector<T> values(first, last);
+    std::sort(values.begin(), values.end());
+    merge(values);
+}
+
+
+template <typename T>
+typename PersistentSortedPODVector<T>::const_iterator PersistentSortedPODVector<T>::lower_bound(const T& value) const {
+    ASSERT(sorted());
+    return std::lower_bound(this->begin(), this->end(), value);
+}
+
+
+template <typename T>
+typename PersistentSortedPODVector<T>::const_iterator PersistentSortedPODVector<T>::upper_bound(const T& value) const {
+    ASSERT(sorted());
+    return std::upper_bound(this->begin(), this->end(), value);
+}
+
+
+template <typename T>
+std::pair<typename PersistentSortedPODVector<T>::const_iterator, typename PersistentSortedPODVector<T>::const_iterator>
+PersistentSortedPODVector<T>::equal_range(const T& value) const {
+    ASSERT(sorted());
+    return std::equal_range(this->begin(), this->end(), value);
+}
+
+
+/// Merge a sorted list of values into the vector.
+
+template <typename T>
+void PersistentSortedPODVector<T>::merge(const std::vector<T>& values) {
+
+    if (values.empty())
+        return;
+
+    if (PersistentPtr<data_type>::null())
+        PersistentPtr<data_type>::allocate(values.size());
+
+    data_type& data(*PersistentPtr<data_type>::get());
+    size_t required = data.size() + values.size();
+
+    // If the values belong at the end, and there is space, they can just be appended.
+
+    if (data.sorted() && required <= data.allocated_size() &&
+            (data.size() == 0 || !(values.front() < data[data.size()-1]))) {
+        data.append_sorted(&values[0], values.size());
+        return;
+    }
+
+    // Otherwise build a merged copy, and atomically replace the existing data. Grow by factors of two, as for
+    // push_back().
+
+    size_t new_size = std::max(data.allocated_size(), size_t(1));
+    while (new_size < required)
+        new_size *= 2;
+
+    eckit::Log::debug<LibPMem>() << "Merging " << values.size() << " elements into sorted POD vector of "
+                                 << data.size() << " elements" << std::endl;
+
+    PersistentPtr<data_type>::replace(data, new_size, values);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace pmem
+
+#endif // pmem_PersistentSortedPODVector_H
@@ -68,19 +68,19 @@ char PersistentString::operator[] (size_t i) const {
 bool PersistentString::operator==(const PersistentString& rhs) const {
 
     size_t lsize = size();
-    size_t rsize = size();
+    size_t rsize = rhs.size();
 
     if (lsize != rsize)
         return false;
     else
-        return ::strncmp(c_str(), rhs.c_str(), lsize) == 0;
+        return ::memcmp(c_str(), rhs.c_str(), lsize) == 0;
 }
 
 bool PersistentString::operator==(const std::string& rhs) const {
     if (size() != rhs.size())
         return false;
     else
-        return c_str() == rhs;
+        return ::memcmp(c_str(), rhs.data(), rhs.size()) == 0;
 }
 
 bool operator==(const std::string& lhs, const PersistentString& rhs) {
@@ -70,6 +70,11 @@ inline size_t AtomicConstructor1Base<PersistentString, std::string>::size() cons
     return PersistentBuffer::data_size(x1_.size() + 1);
 }
 
+template<>
+inline bool AtomicConstructor1Base<PersistentString, std::string>::self_persisting() const {
+    return true;
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 
 } // namespace tree
@@ -20,8 +20,13 @@
 #ifndef pmem_PersistentVector_H
 #define pmem_PersistentVector_H
 
+#include <atomic>
+#include <utility>
+
 #include "eckit/log/Log.h"
 
+#include "pmem/EpochManager.h"
+#include "pmem/LibPMem.h"
 #include "pmem/PersistentPtr.h"
 
 
@@ -35,6 +40,22 @@
  * N.B. An advantage of the interface, is that this can easily be extended. If we use
  *      fixed sizes of vector, we don't need to re-allocate until we reach a certain
  *      number of elements. We can then point to a "continuation array".
+ *
+ * Concurrent readers:
+ *
+ * Elements may be appended with publish_back() while other threads read the vector through published(), without
+ * any locking on the part of the readers (writers must still be serialised). Published data is never modified in
+ * place, other than to fill the unused space at its end:
+ *
+ * - An element is written (and persisted) into the next free slot before the element count is atomically
+ *   incremented, so readers see either the old or the new set of elements.
+ * - When the space is full, a copy with twice the space is constructed and published with an atomic pointer swing.
+ *   Readers may still be using the previous copy, so it is retired to the EpochManager of the pool, which frees it
+ *   once they have finished (see EpochManager::replace_ctr). Readers must hold an EpochGuard while they use the
+ *   range returned by published().
+ *
+ * n.b. published() does not perform the consistency checks (or repairs) that size() does, as these may modify
+ *      the data. The next writer makes any repairs required.
  */
 
 
@@ -53,6 +74,7 @@ class PersistentVectorData {
 public: // types
 
     typedef T object_type;
+    typedef const PersistentPtr<object_type>* const_iterator;
 
 public: // methods
 
@@ -78,13 +100,28 @@ public: // methods
     /// Append an existing element to the list.
     void push_back_elem(const PersistentPtr<object_type>& elem);
 
+    /// Append an existing element to the list, such that it is atomically visible to concurrent readers.
+    void publish_back(const PersistentPtr<object_type>& elem);
+
+    /// The number of elements, as seen by concurrent readers. No consistency check is made.
+    size_t published_size() const;
+
+    /// Remove an element from the list, by moving the last element into its place. The removed element is
+    /// returned, but not freed. Ordering of the elements is not preserved.
+    PersistentPtr<object_type> erase(size_t i);
+
     /// Return a given element in the list
     const PersistentPtr<object_type>& operator[] (size_t i) const;
 
+    /// Iterate over the elements in the list
+    const_iterator begin() const;
+    const_iterator end() const;
+
     /// As the nelem_ member is updated after allocation has taken place, and hence non-atomically, we need to
     /// be able to check that its value is correct.
     ///
-    /// @note this implementation will be insufficient if we add the capacity to remove elements as well as add them.
+    /// @note Removal of elements is a multi-step operation, so it is recorded (eraseIndex_, eraseSize_) before it
+    ///       starts. Any interrupted erase is completed here before the "null means end" checks are made.
     void consistency_check() const;
 
 protected: // methods
@@ -92,12 +129,22 @@ protected: // methods
     /// Update the number of elements, ensuring that the result is persisted
     void update_nelem(size_t nelem) const;
 
+    /// Complete an erase that has been recorded in eraseIndex_/eraseSize_. Each step is idempotent, so this can
+    /// be safely re-run after an interruption at any point.
+    void complete_erase() const;
+
 protected: // members
 
-    // Track the allocated size, and the number of elements used
-    mutable size_t nelem_;
+    // Track the allocated size, and the number of elements used. n.b. nelem_ is atomic, as it is read by
+    // concurrent readers while publish_back() updates it.
+    mutable std::atomic<size_t> nelem_;
     size_t allocatedSize_;
 
+    // Record of an in-progress erase. eraseSize_ is the number of elements before the erase, and is zero if
+    // there is no erase in progress.
+    mutable size_t eraseIndex_;
+    mutable size_t eraseSize_;
+
     // The allocator/constructor will make the PersistentVectorData the right size.
     PersistentPtr<object_type> elements_[1];
 };
@@ -113,12 +160,22 @@ public: // types
 
     typedef T object_type;
     typedef PersistentVectorData<T> data_type;
+    typedef typename data_type::const_iterator const_iterator;
 
 public:
 
     PersistentPtr<object_type> push_back_ctr(const AtomicConstructor<object_type>& constructor);
     void push_back_elem(const PersistentPtr<object_type>& ptr);
 
+    /// Append an existing element without disturbing concurrent readers that use published(). Writers must be
+    /// serialised. Any data that is replaced to make space is retired to the supplied EpochManager.
+    void publish_back(const PersistentPtr<object_type>& ptr, EpochManager& epochs);
+
+    /// The elements, from a single snapshot of the data. This may be used concurrently with publish_back(). The
+    /// range remains valid while the caller holds an EpochGuard (entered before this call), unless the vector is
+    /// modified by other means (e.g. erase or resize).
+    std::pair<const_iterator, const_iterator> published() const;
+
     PersistentPtr<object_type> push_back();
     template <typename X1> PersistentPtr<object_type> push_back(const X1& x1);
     template <typename X1, typename X2> PersistentPtr<object_type> push_back(const X1& x1, const X2& x2);
@@ -134,7 +191,20 @@ public:
 
     const PersistentPtr<T>& operator[] (size_t i) const;
 
+    /// STL-compatible (random access) iteration. The persistent data block is only resolved once, rather than
+    /// on every element access as for operator[].
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    /// Remove the element at index i (by moving the last element into its place). The removed element is
+    /// returned, so that the caller can free it if appropriate.
+    PersistentPtr<object_type> erase(size_t i);
+
     void resize(size_t new_size);
+
+    /// If the allocated space is much larger than is required, atomically replace the data with a dense copy.
+    /// Returns true if the data was rewritten.
+    bool compact();
 };
 
 
@@ -175,7 +245,9 @@ public:
 template <typename T>
 PersistentVectorData<T>::PersistentVectorData(size_t max_size) :
     nelem_(0),
-    allocatedSize_(max_size) {
+    allocatedSize_(max_size),
+    eraseIndex_(0),
+    eraseSize_(0) {
 
     for (size_t i = 0; i < allocatedSize_; i++) {
         elements_[i].nullify();
@@ -187,7 +259,9 @@ PersistentVectorData<T>::PersistentVectorData(size_t max_size) :
 template <typename T>
 PersistentVectorData<T>::PersistentVectorData(const PersistentVectorData<T>& source, size_t max_size) :
     nelem_(source.size()), // n.b. using size() enforces consistency check)
-    allocatedSize_(max_size) {
+    allocatedSize_(max_size),
+    eraseIndex_(0),
+    eraseSize_(0) {
 
     ASSERT(allocatedSize_ > nelem_);
 
@@ -274,6 +348,97 @@ void PersistentVectorData<T>::push_back_elem(const PersistentPtr<object_type>& e
 }
 
 
+/// Append an existing element to the list, for concurrent readers.
+///
+/// The element is written (and persisted) into the unused space before the count is updated. Readers (which do not
+/// look beyond the count) see either the old or the new state. If interrupted before the count is updated, the
+/// element is picked up by the next consistency_check().
+template <typename T>
+void PersistentVectorData<T>::publish_back(const PersistentPtr<object_type>& elem) {
+
+    consistency_check();
+
+    if (nelem_ == allocatedSize_)
+        throw eckit::OutOfRange("PersistentVector is full", Here());
+
+    size_t n = nelem_;
+    elements_[n] = elem;
+    ::pmemobj_persist(::pmemobj_pool_by_ptr(&elements_[n]), &elements_[n], sizeof(elem));
+
+    update_nelem(n + 1);
+}
+
+
+template <typename T>
+size_t PersistentVectorData<T>::published_size() const {
+    return nelem_.load(std::memory_order_acquire);
+}
+
+
+/// Remove an element from the list.
+///
+/// The erase is first recorded (and persisted), so that if it is interrupted it can be completed by
+/// consistency_check(). The last element is then moved into the vacated slot, the last slot is nullified and
+/// the element count is reduced. "Null means end" continues to hold throughout.
+template <typename T>
+PersistentPtr<T> PersistentVectorData<T>::erase(size_t i) {
+
+    consistency_check();
+
+    if (i >= nelem_)
+        throw eckit::OutOfRange(i, nelem_, Here());
+
+    PersistentPtr<object_type> removed = elements_[i];
+
+    PMEMobjpool* pool = ::pmemobj_pool_by_ptr(this);
+
+    eraseIndex_ = i;
+    ::pmemobj_persist(pool, &eraseIndex_, sizeof(eraseIndex_));
+
+    // n.b. Writing eraseSize_ commits the erase. From here on it will be completed, even if interrupted.
+    eraseSize_ = nelem_;
+    ::pmemobj_persist(pool, &eraseSize_, sizeof(eraseSize_));
+
+    complete_erase();
+
+    return removed;
+}
+
+
+template <typename T>
+void PersistentVectorData<T>::complete_erase() const {
+
+    ASSERT(eraseSize_ != 0);
+    ASSERT(eraseSize_ <= allocatedSize_);
+    ASSERT(eraseIndex_ < eraseSize_);
+
+    PMEMobjpool* pool = ::pmemobj_pool_by_ptr(this);
+    size_t last = eraseSize_ - 1;
+
+    // n.b. The elements are only modified through the const interface to allow recovery from consistency_check.
+    PersistentPtr<object_type>* elements = const_cast<PersistentPtr<object_type>*>(elements_);
+
+    // i) Move the last element into the vacated slot (unless it has already been moved and nullified).
+
+    if (eraseIndex_ != last && !elements[last].null()) {
+        elements[eraseIndex_] = elements[last];
+        ::pmemobj_persist(pool, &elements[eraseIndex_], sizeof(elements[eraseIndex_]));
+    }
+
+    // ii) Null means end
+
+    elements[last].nullify();
+    ::pmemobj_persist(pool, &elements[last], sizeof(elements[last]));
+
+    // iii) Update the count, and mark the erase as complete.
+
+    update_nelem(last);
+
+    eraseSize_ = 0;
+    ::pmemobj_persist(pool, &eraseSize_, sizeof(eraseSize_));
+}
+
+
 /// Return a given element in the list
 template<typename T>
 const PersistentPtr<T>& PersistentVectorData<T>::operator[] (size_t i) const {
@@ -281,11 +446,27 @@ const PersistentPtr<T>& PersistentVectorData<T>::operator[] (size_t i) const {
 }
 
 
+template<typename T>
+typename PersistentVectorData<T>::const_iterator PersistentVectorData<T>::begin() const {
+    return &elements_[0];
+}
+
+
+template<typename T>
+typename PersistentVectorData<T>::const_iterator PersistentVectorData<T>::end() const {
+    return &elements_[size()];
+}
+
+
 /// As the nelem_ member is updated after allocation has taken place, and hence non-atomically, we need to
 /// be able to check that its value is correct.
 template<typename T>
 void PersistentVectorData<T>::consistency_check() const {
 
+    // If an erase has been interrupted, it needs to be completed first.
+    if (eraseSize_ != 0)
+        complete_erase();
+
     if (nelem_ != 0)
         ASSERT(!elements_[nelem_-1].null());
 
@@ -352,6 +533,42 @@ void PersistentVector<T>::push_back_elem(const PersistentPtr<object_type>& elem)
 }
 
 
+template <typename T>
+void PersistentVector<T>::publish_back(const PersistentPtr<object_type>& elem, EpochManager& epochs) {
+
+    // n.b. Allocating the first copy of the data is not visible to readers as an atomic operation (the pool id of
+    //      the pointer changes as well as the offset). The owner should allocate it before the vector is published.
+    if (PersistentPtr<data_type>::null()) {
+        PersistentPtr<data_type>::allocate(1);
+        ASSERT(size() == 0);
+    }
+
+    // If the space is full, publish a copy with twice the space. The existing data is freed once the readers have
+    // finished with it.
+    if (PersistentPtr<data_type>::get()->full()) {
+        size_t sz = size() * 2;
+        epochs.replace_ctr<data_type>(*this, AtomicConstructor2<data_type, data_type, size_t>(**this, sz));
+    }
+
+    PersistentPtr<data_type>::get()->publish_back(elem);
+}
+
+
+template <typename T>
+std::pair<typename PersistentVector<T>::const_iterator, typename PersistentVector<T>::const_iterator>
+PersistentVector<T>::published() const {
+
+    // Resolve the data once, so that the range is consistent even if a new copy is published meanwhile.
+    PersistentPtr<data_type> data(*this);
+
+    if (data.null())
+        return std::make_pair(const_iterator(0), const_iterator(0));
+
+    const_iterator begin = data->begin();
+    return std::make_pair(begin, begin + data->published_size());
+}
+
+
 template <typename T>
 PersistentPtr<T> PersistentVector<T>::push_back() {
     AtomicConstructor0<T> ctr;
@@ -401,6 +618,28 @@ const PersistentPtr<T>& PersistentVector<T>::operator[] (size_t i) const {
 }
 
 
+template <typename T>
+typename PersistentVector<T>::const_iterator PersistentVector<T>::begin() const {
+    return PersistentPtr<data_type>::null() ? 0 : PersistentPtr<data_type>::get()->begin();
+}
+
+
+template <typename T>
+typename PersistentVector<T>::const_iterator PersistentVector<T>::end() const {
+    return PersistentPtr<data_type>::null() ? 0 : PersistentPtr<data_type>::get()->end();
+}
+
+
+template <typename T>
+PersistentPtr<T> PersistentVector<T>::erase(size_t i) {
+
+    if (PersistentPtr<data_type>::null())
+        throw eckit::OutOfRange(i, 0, Here());
+
+    return PersistentPtr<data_type>::get()->erase(i);
+}
+
+
 template <typename T>
 void PersistentVector<T>::resize(size_t new_size) {
 
@@ -417,6 +656,29 @@ void PersistentVector<T>::resize(size_t new_size) {
 }
 
 
+template <typename T>
+bool PersistentVector<T>::compact() {
+
+    if (PersistentPtr<data_type>::null())
+        return false;
+
+    // Retain the power-of-two growth pattern of push_back, leaving space for at least one more element.
+
+    size_t sz = size();
+    size_t target = 1;
+    while (target <= sz) target *= 2;
+
+    if (target >= allocated_size())
+        return false;
+
+    eckit::Log::debug<LibPMem>() << "Compacting vector from " << allocated_size() << " to "
+                                 << target << " elements" << std::endl;
+
+    resize(target);
+    return true;
+}
+
+
 //----------------------------------------------------------------------------------------------------------------------
 
 
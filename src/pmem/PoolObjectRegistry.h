@@ -0,0 +1,156 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+
+#ifndef pmem_PoolObjectRegistry_H
+#define pmem_PoolObjectRegistry_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+#include "eckit/exception/Exceptions.h"
+#include "eckit/memory/NonCopyable.h"
+
+#include "libpmemobj.h"
+
+
+/*
+ * Modus-operandi:
+ *
+ * Associates one volatile object (e.g. an InternTable or EpochManager) with each open pool, so that objects in the
+ * pool can find it from their own address. Lookups are made on every access to the tree, from many threads at once,
+ * so they take no locks. The entries are a fixed array, scanned up to the highest entry ever used, as only a handful
+ * of pools are open at once.
+ *
+ * An entry is written (under a mutex) with the object first, and then the pool, so a lookup that finds the pool
+ * also finds its object. The object must not be looked up once it starts to be deregistered.
+ */
+
+
+namespace pmem {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+template <typename T>
+class PoolObjectRegistry : private eckit::NonCopyable {
+
+public: // methods
+
+    PoolObjectRegistry();
+
+    /// Register the object for a pool, which must not already have one.
+    void add(PMEMobjpool* pool, T* object);
+
+    void remove(PMEMobjpool* pool);
+
+    /// The object registered for the pool, or null.
+    T* find(PMEMobjpool* pool) const;
+
+private: // types
+
+    struct Entry {
+        std::atomic<PMEMobjpool*> pool;
+        std::atomic<T*> object;
+    };
+
+    static const size_t max_pools = 256;
+
+private: // members
+
+    Entry entries_[max_pools];
+
+    std::atomic<size_t> used_;
+
+    std::mutex mutex_;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+template <typename T>
+PoolObjectRegistry<T>::PoolObjectRegistry() :
+    used_(0) {
+
+    for (size_t i = 0; i < max_pools; i++) {
+        entries_[i].pool.store(0, std::memory_order_relaxed);
+        entries_[i].object.store(0, std::memory_order_relaxed);
+    }
+}
+
+
+template <typename T>
+void PoolObjectRegistry<T>::add(PMEMobjpool* pool, T* object) {
+
+    ASSERT(pool != 0);
+    ASSERT(object != 0);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    ASSERT(find(pool) == 0);
+
+    size_t used = used_.load(std::memory_order_relaxed);
+    size_t i = 0;
+    while (i < used && entries_[i].pool.load(std::memory_order_relaxed) != 0)
+        i++;
+
+    if (i == max_pools)
+        throw eckit::SeriousBug("Too many persistent pools are open at once", Here());
+
+    entries_[i].object.store(object, std::memory_order_release);
+    entries_[i].pool.store(pool, std::memory_order_release);
+
+    if (i == used)
+        used_.store(used + 1, std::memory_order_release);
+}
+
+
+template <typename T>
+void PoolObjectRegistry<T>::remove(PMEMobjpool* pool) {
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    size_t used = used_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < used; i++) {
+        if (entries_[i].pool.load(std::memory_order_relaxed) == pool) {
+            entries_[i].pool.store(0, std::memory_order_release);
+            entries_[i].object.store(0, std::memory_order_release);
+            return;
+        }
+    }
+
+    ASSERT(false);
+}
+
+
+template <typename T>
+T* PoolObjectRegistry<T>::find(PMEMobjpool* pool) const {
+
+    size_t used = used_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < used; i++) {
+        if (entries_[i].pool.load(std::memory_order_acquire) == pool)
+            return entries_[i].object.load(std::memory_order_acquire);
+    }
+
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace pmem
+
+#endif // pmem_PoolObjectRegistry_H
@@ -0,0 +1,192 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+#include <algorithm>
+#include <exception>
+
+#include "eckit/exception/Exceptions.h"
+#include "eckit/log/Log.h"
+
+#include "pmem/LibPMem.h"
+#include "pmem/ThreadPool.h"
+
+using namespace eckit;
+
+
+namespace pmem {
+
+namespace {
+
+thread_local bool isWorkerThread = false;
+
+/// Track the completion of one call to ThreadPool::run()
+
+struct Completion {
+
+    Completion(size_t n) : remaining(n) {}
+
+    void finished(std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (e && !error)
+            error = e;
+        if (--remaining == 0)
+            cv.notify_all();
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t remaining;
+    std::exception_ptr error;
+};
+
+void runTask(ThreadPool::Task& task, Completion& completion) {
+
+    std::exception_ptr error;
+    try {
+        task();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    completion.finished(error);
+}
+
+}
+
+// -------------------------------------------------------------------------------------------------
+
+
+ThreadPool::ThreadPool(size_t nthreads) :
+    stop_(false) {
+
+    Log::debug<LibPMem>() << "Starting thread pool with " << nthreads << " workers" << std::endl;
+
+    workers_.reserve(nthreads);
+    for (size_t i = 0; i < nthreads; i++) {
+        workers_.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+}
+
+
+ThreadPool::~ThreadPool() {
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+
+    for (std::vector<std::thread>::iterator it = workers_.begin(); it != workers_.end(); ++it) {
+        it->join();
+    }
+}
+
+
+ThreadPool& ThreadPool::instance() {
+
+    // The calling thread also does work, so one fewer worker than the number of cores.
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+
+size_t ThreadPool::size() const {
+    return workers_.size();
+}
+
+
+bool ThreadPool::inWorker() {
+    return isWorkerThread;
+}
+
+
+void ThreadPool::run(std::vector<Task>& tasks) {
+
+    // Nested (or trivial) parallelism is run serially in the calling thread.
+
+    if (tasks.size() <= 1 || workers_.empty() || inWorker()) {
+        for (std::vector<Task>::iterator it = tasks.begin(); it != tasks.end(); ++it) {
+            (*it)();
+        }
+        return;
+    }
+
+    Completion completion(tasks.size());
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 1; i < tasks.size(); i++) {
+            Task& task(tasks[i]);
+            queue_.push_back([&task, &completion]() { runTask(task, completion); });
+        }
+    }
+    cv_.notify_all();
+
+    // The calling thread does the first chunk of work, and then helps to drain the queue.
+
+    runTask(tasks[0], completion);
+
+    while (true) {
+
+        Task next;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (queue_.empty())
+                break;
+            next = queue_.front();
+            queue_.pop_front();
+        }
+        next();
+    }
+
+    std::unique_lock<std::mutex> lock(completion.mutex);
+    while (completion.remaining != 0) {
+        completion.cv.wait(lock);
+    }
+
+    if (completion.error)
+        std::rethrow_exception(completion.error);
+}
+
+
+void ThreadPool::workerLoop() {
+
+    isWorkerThread = true;
+
+    while (true) {
+
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!stop_ && queue_.empty()) {
+                cv_.wait(lock);
+            }
+
+            if (stop_ && queue_.empty())
+                return;
+
+            task = queue_.front();
+            queue_.pop_front();
+        }
+
+        task();
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+} // namespace pmem
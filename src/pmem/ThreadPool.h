@@ -0,0 +1,86 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+#ifndef pmem_ThreadPool_H
+#define pmem_ThreadPool_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "eckit/memory/NonCopyable.h"
+
+
+namespace pmem {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// A fixed-size pool of worker threads, used to spread scans over large persistent containers across cores.
+///
+/// @note The calling thread participates in run(), so a pool of N workers gives N+1 way parallelism. If run() is
+///       called from inside one of the workers (i.e. nested parallelism) the tasks are executed serially in the
+///       calling thread, to avoid deadlocking the pool.
+
+class ThreadPool : private eckit::NonCopyable {
+
+public: // types
+
+    typedef std::function<void()> Task;
+
+public: // methods
+
+    ThreadPool(size_t nthreads);
+    ~ThreadPool();
+
+    /// A process-wide pool, sized to the hardware concurrency.
+    static ThreadPool& instance();
+
+    /// The number of worker threads (excluding the caller).
+    size_t size() const;
+
+    /// Execute all of the supplied tasks, and return once they have all completed. If any of the tasks throws,
+    /// the first exception is rethrown in the calling thread once all of the tasks have finished.
+    void run(std::vector<Task>& tasks);
+
+    /// Is the current thread one of the workers of a ThreadPool?
+    static bool inWorker();
+
+private: // methods
+
+    void workerLoop();
+
+private: // members
+
+    std::vector<std::thread> workers_;
+
+    std::deque<Task> queue_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+    bool stop_;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace pmem
+
+#endif // pmem_ThreadPool_H
@@ -0,0 +1,515 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "eckit/exception/Exceptions.h"
+#include "eckit/filesystem/PathName.h"
+#include "eckit/io/MemoryHandle.h"
+#include "eckit/log/Bytes.h"
+#include "eckit/log/Log.h"
+#include "eckit/memory/ScopedPtr.h"
+#include "eckit/option/CmdArgs.h"
+#include "eckit/option/SimpleOption.h"
+#include "eckit/parser/JSONDataBlob.h"
+#include "eckit/runtime/Tool.h"
+
+#include "pmem/Hash.h"
+#include "pmem/PersistentBuffer.h"
+#include "pmem/PersistentPool.h"
+#include "pmem/PersistentPtr.h"
+
+#include "pmem/tree/TreeNode.h"
+#include "pmem/tree/TreePool.h"
+#include "pmem/tree/TreeRoot.h"
+#include "pmem/tree/TreeSchema.h"
+
+using namespace eckit;
+using namespace eckit::option;
+using namespace pmem;
+
+/*
+ * Measure the capacity/throughput tradeoff of compressing and deduplicating leaf payloads.
+ *
+ * A scratch pool is created, and the same synthetic field is stored repeatedly via TreeNode::allocateLeaf, first
+ * uncompressed and then compressed. The payload mimics a precipitation-like field with simple packing: zero over
+ * roughly half of the domain, and elsewhere a smooth field plus a little noise, quantised to 12 bits.
+ *
+ * Finally, leaves are added to the tree with deduplication enabled, drawing their payloads from a smaller set of
+ * distinct fields (as for e.g. invariant fields written at every step), to compare the cost of hashing with the
+ * capacity saved.
+ *
+ * The same leaves are then looked up from increasing numbers of reader threads, while a single writer thread
+ * continues to insert small leaves, to show how lookup throughput scales with the number of readers.
+ *
+ * Lastly, small leaves are inserted from increasing numbers of writer threads, each writing its own params (as
+ * separate ingest processes would), to show how insertion throughput scales with the number of writers.
+ *
+ * The resulting tree is then searched with partial keys, which select many subtrees, serially and in parallel
+ * (with and without preserving the order of the results).
+ */
+
+namespace tree {
+
+// -------------------------------------------------------------------------------------------------
+
+
+class TreeBench : public Tool {
+
+public: // methods
+
+    TreeBench(int argc, char** argv);
+    virtual ~TreeBench();
+
+    virtual void run();
+
+    static void usage(const std::string& tool);
+
+private: // methods
+
+    void bench(PersistentPool& pool, const std::vector<char>& payload, size_t count, bool compress);
+
+    void benchDedup(TreeObject& tree, size_t count, size_t distinct, size_t field_size);
+
+    void benchLookup(TreeObject& tree, size_t count, size_t lookups);
+
+    void benchInsert(TreeObject& tree, size_t inserts);
+
+    void benchPartialLookup(TreeObject& tree, size_t count);
+};
+
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+TreeBench::TreeBench(int argc, char** argv) :
+    Tool(argc, argv) {}
+
+
+TreeBench::~TreeBench() {}
+
+
+void TreeBench::usage(const std::string& tool) {
+
+    Log::info() << std::endl;
+    Log::info() << "Usage: " << tool << " [--count=N] [--distinct=N] [--field-size=bytes] [--lookups=N] [--inserts=N] <scratch_pool_file>" << std::endl;
+    Log::info() << std::flush;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+static std::vector<char> synthetic_field(size_t bytes, uint32_t seed = 12345) {
+
+    const size_t nx = 1024;
+    size_t npoints = bytes / sizeof(uint16_t);
+
+    std::vector<char> payload(npoints * sizeof(uint16_t));
+
+    for (size_t i = 0; i < npoints; i++) {
+
+        double x = double(i % nx);
+        double y = double(i / nx);
+        double value = std::sin(x / 37.0) * std::cos(y / 23.0) + 0.3 * std::sin((x + y) / 11.0);
+
+        // A little noise, from a simple LCG.
+        seed = seed * 1664525 + 1013904223;
+        value += double(seed >> 24) / (256.0 * 64.0);
+
+        uint16_t packed = value <= 0 ? 0 : static_cast<uint16_t>(value * 4095.0 / 1.3);
+        ::memcpy(&payload[i * sizeof(packed)], &packed, sizeof(packed));
+    }
+
+    return payload;
+}
+
+
+void TreeBench::bench(PersistentPool& pool, const std::vector<char>& payload, size_t count, bool compress) {
+
+    const void* data = &payload[0];
+    size_t length = payload.size();
+
+    std::vector<PersistentPtr<TreeNode> > nodes;
+    nodes.reserve(count);
+
+    PersistentPool::CompressionStats before = pool.compressionStats();
+
+    // Store the leaves
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < count; i++) {
+        std::ostringstream value;
+        value << i;
+        if (compress) {
+            nodes.push_back(TreeNode::allocateLeaf(pool, value.str(), PersistentBuffer::CompressedConstructor(data, length)));
+        } else {
+            nodes.push_back(TreeNode::allocateLeaf(pool, value.str(),
+                                                   AtomicConstructor2<PersistentBuffer, const void*, size_t>(data, length)));
+        }
+    }
+
+    double write_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // And read them back, checking the contents
+
+    std::vector<char> scratch;
+    start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < count; i++) {
+        const void* p = nodes[i]->buffer()->data(scratch);
+        ASSERT(nodes[i]->dataSize() == length);
+        ASSERT(::memcmp(p, data, length) == 0);
+    }
+
+    double read_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t stored = 0;
+    for (size_t i = 0; i < count; i++)
+        stored += nodes[i]->buffer()->storedSize();
+
+    size_t total = count * length;
+
+    Log::info() << (compress ? "Compressed" : "Uncompressed") << std::endl;
+    Log::info() << "    stored:  " << Bytes(stored) << " for " << Bytes(total)
+                << " (ratio " << double(total) / double(stored) << ")" << std::endl;
+    Log::info() << "    write:   " << Bytes(total, write_time) << std::endl;
+    Log::info() << "    read:    " << Bytes(total, read_time) << std::endl;
+
+    if (compress) {
+        PersistentPool::CompressionStats after = pool.compressionStats();
+        ASSERT(after.buffers - before.buffers == count);
+        Log::info() << "    pool:    " << after.buffers << " compressed buffers, ratio " << after.ratio() << std::endl;
+    }
+}
+
+
+void TreeBench::benchDedup(TreeObject& tree, size_t count, size_t distinct, size_t field_size) {
+
+    std::vector<std::vector<char> > payloads;
+    for (size_t i = 0; i < distinct; i++)
+        payloads.push_back(synthetic_field(field_size, 12345 + i));
+
+    size_t length = payloads[0].size();
+    size_t total = count * length;
+
+    // The cost of the digests alone
+
+    uint64_t check = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < count; i++)
+        check ^= hash64(&payloads[i % distinct][0], length);
+
+    double hash_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // And of adding the leaves to the tree, including the digests and the comparisons with existing buffers
+
+    tree.dedup(true);
+
+    start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < count; i++) {
+        std::ostringstream value;
+        value << i;
+        StringDict key;
+        key["param"] = "2t";
+        key["step"] = value.str();
+
+        MemoryHandle handle(&payloads[i % distinct][0], length);
+        tree.addNode(key, handle);
+    }
+
+    double write_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    TreeDedupStore::Stats stats = tree.dedupStats();
+    ASSERT(stats.buffers == distinct);
+    ASSERT(stats.references == count);
+
+    Log::info() << "Deduplicated (" << distinct << " distinct fields, digest " << std::hex << check << std::dec
+                << ")" << std::endl;
+    Log::info() << "    stored:  " << Bytes(stats.storedBytes) << " for " << Bytes(total)
+                << " (saved " << Bytes(stats.savedBytes) << ")" << std::endl;
+    Log::info() << "    hash:    " << Bytes(total, hash_time) << std::endl;
+    Log::info() << "    write:   " << Bytes(total, write_time) << std::endl;
+}
+
+
+void TreeBench::benchLookup(TreeObject& tree, size_t count, size_t lookups) {
+
+    size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    // n.b. The writer's keys follow on from those already in the tree, and continue to increase between passes.
+
+    size_t next_insert = count;
+    const char small_payload[] = "small leaf, stored inline";
+
+    tree.dedup(false);
+
+    Log::info() << "Lookups (" << lookups << " per reader thread, with one concurrent writer)" << std::endl;
+
+    for (size_t nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+
+        std::atomic<bool> done(false);
+        std::atomic<size_t> found(0);
+        size_t inserted = 0;
+
+        std::thread writer([&]() {
+            while (!done && inserted < count) {
+                std::ostringstream value;
+                value << next_insert++;
+                StringDict key;
+                key["param"] = "tp";
+                key["step"] = value.str();
+                MemoryHandle handle(small_payload, sizeof(small_payload));
+                tree.addNode(key, handle);
+                inserted++;
+            }
+        });
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> readers;
+        for (size_t t = 0; t < nthreads; t++) {
+            readers.push_back(std::thread([&tree, &found, count, lookups, t]() {
+                size_t n = 0;
+                for (size_t i = 0; i < lookups; i++) {
+                    std::ostringstream value;
+                    value << (i * 7919 + t) % count;
+                    StringDict key;
+                    key["param"] = "2t";
+                    key["step"] = value.str();
+                    n += tree.lookup(key).size();
+                }
+                found += n;
+            }));
+        }
+
+        for (size_t t = 0; t < nthreads; t++)
+            readers[t].join();
+
+        double read_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        done = true;
+        writer.join();
+
+        ASSERT(found == nthreads * lookups);
+
+        Log::info() << "    " << nthreads << " thread(s): " << size_t(double(nthreads * lookups) / read_time)
+                    << " lookups/s (" << inserted << " concurrent insertions)" << std::endl;
+    }
+}
+
+
+void TreeBench::benchInsert(TreeObject& tree, size_t inserts) {
+
+    size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    const char small_payload[] = "small leaf, stored inline";
+
+    Log::info() << "Insertions (" << inserts << " per writer thread)" << std::endl;
+
+    for (size_t nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> writers;
+        for (size_t t = 0; t < nthreads; t++) {
+            writers.push_back(std::thread([&tree, &small_payload, inserts, nthreads, t]() {
+
+                std::ostringstream param;
+                param << "w" << nthreads << "." << t;
+
+                for (size_t i = 0; i < inserts; i++) {
+                    std::ostringstream value;
+                    value << i;
+                    StringDict key;
+                    key["param"] = param.str();
+                    key["step"] = value.str();
+                    JSONDataBlob blob(small_payload, sizeof(small_payload));
+                    tree.addNode(key, blob);
+                }
+            }));
+        }
+
+        for (size_t t = 0; t < nthreads; t++)
+            writers[t].join();
+
+        double write_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        Log::info() << "    " << nthreads << " thread(s): " << size_t(double(nthreads * inserts) / write_time)
+                    << " insertions/s" << std::endl;
+    }
+}
+
+
+void TreeBench::benchPartialLookup(TreeObject& tree, size_t count) {
+
+    const size_t repeats = 20;
+
+    // Select one leaf from every param, and then every leaf in the tree.
+
+    std::vector<StringDict> keys(2);
+    keys[0]["step"] = "7";
+
+    Log::info() << "Partial lookups (" << repeats << " of each)" << std::endl;
+
+    for (size_t k = 0; k < keys.size(); k++) {
+
+        const char* modes[] = { "serial", "parallel", "parallel, unordered" };
+
+        for (size_t mode = 0; mode < 3; mode++) {
+
+            tree.parallelLookup(mode != 0, mode != 2);
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            size_t found = 0;
+            for (size_t i = 0; i < repeats; i++)
+                found += tree.lookup(keys[k]).size();
+
+            double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            Log::info() << "    " << keys[k] << " (" << modes[mode] << "): " << found / repeats << " leaves in "
+                        << (1000 * time / repeats) << " ms" << std::endl;
+        }
+    }
+
+    tree.parallelLookup(false);
+
+    // A request for every other step, as one list of values and as a lookup for each value separately.
+
+    std::ostringstream steps;
+    steps << "0/to/" << (count - 1) << "/by/2";
+
+    StringDict request;
+    request["param"] = "2t";
+    request["step"] = steps.str();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    size_t found = 0;
+    for (size_t i = 0; i < repeats; i++)
+        found += tree.lookup(tree.parse(request)).size();
+
+    double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+
+    size_t separate = 0;
+    for (size_t i = 0; i < repeats; i++) {
+        for (size_t step = 0; step < count; step += 2) {
+            std::ostringstream value;
+            value << step;
+            StringDict key;
+            key["param"] = "2t";
+            key["step"] = value.str();
+            separate += tree.lookup(key).size();
+        }
+    }
+
+    double separate_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    ASSERT(found == separate);
+
+    Log::info() << "    " << request << ": " << found / repeats << " leaves in " << (1000 * time / repeats)
+                << " ms (" << (1000 * separate_time / repeats) << " ms as separate lookups)" << std::endl;
+}
+
+
+void TreeBench::run() {
+
+    std::vector<Option*> options;
+
+    options.push_back(new SimpleOption<size_t>("count", "The number of leaves to store in each pass (default 200)"));
+    options.push_back(new SimpleOption<size_t>("distinct", "The number of distinct fields in the deduplication pass (default count/4)"));
+    options.push_back(new SimpleOption<size_t>("field-size", "The size in bytes of each leaf payload (default 256KiB)"));
+    options.push_back(new SimpleOption<size_t>("lookups", "The number of lookups made by each reader thread (default 100000)"));
+    options.push_back(new SimpleOption<size_t>("inserts", "The number of leaves inserted by each writer thread (default 10000)"));
+
+    CmdArgs args(&usage, options, 1);
+
+    size_t count = args.getLong("count", 200);
+    size_t field_size = args.getLong("field-size", 256 * 1024);
+    size_t distinct = std::max(size_t(args.getLong("distinct", count / 4)), size_t(1));
+    size_t lookups = args.getLong("lookups", 100000);
+    size_t inserts = args.getLong("inserts", 10000);
+
+    if (distinct > count)
+        throw UserError("More distinct fields requested than leaves", Here());
+
+    PathName path = args(0);
+    if (path.exists())
+        throw UserError(std::string("Scratch pool already exists: ") + path.asString(), Here());
+
+    // Enough space for all the passes, plus overheads. The insertion pass writes just under twice as many leaves
+    // as there are threads on the largest pass.
+
+    size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    size_t pool_size = (2 * count + distinct) * (field_size + 4096) + 2 * max_threads * inserts * 512
+                       + 64 * 1024 * 1024;
+
+    std::istringstream schema_str("[\"param\", \"step\"]");
+    TreeSchema schema(schema_str);
+
+    ScopedPtr<TreePool> pool(new TreePool(path, pool_size, schema));
+
+    std::vector<char> payload = synthetic_field(field_size);
+
+    Log::info() << "Storing " << count << " leaves of " << Bytes(payload.size()) << std::endl;
+
+    try {
+        // n.b. The TreeObject opens the intern table of the pool, which is also needed to allocate leaves directly.
+        TreeObject tree(*pool->root());
+
+        bench(*pool, payload, count, false);
+        bench(*pool, payload, count, true);
+        benchDedup(tree, count, distinct, field_size);
+        benchLookup(tree, count, lookups);
+        benchInsert(tree, inserts);
+        benchPartialLookup(tree, count);
+    } catch (...) {
+        pool->remove();
+        throw;
+    }
+
+    pool->remove();
+}
+
+// -------------------------------------------------------------------------------------------------
+
+} // namespace tree
+
+
+int main(int argc, char** argv) {
+
+    tree::TreeBench app(argc, argv);
+
+    app.start();
+
+    return 0;
+}
@@ -0,0 +1,256 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+#include <cstring>
+#include <vector>
+
+#include "eckit/exception/Exceptions.h"
+#include "eckit/log/Log.h"
+
+#include "pmem/Hash.h"
+#include "pmem/LibPMem.h"
+
+#include "pmem/tree/TreeDedupStore.h"
+
+using namespace eckit;
+using namespace pmem;
+
+
+namespace tree {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+TreeDedupStore::Constructor::Constructor(size_t capacity) :
+    source_(0),
+    capacity_(capacity) {
+
+    ASSERT(capacity > 0);
+}
+
+
+TreeDedupStore::Constructor::Constructor(const TreeDedupStore& source, size_t capacity) :
+    source_(&source),
+    capacity_(capacity) {
+
+    ASSERT(capacity >= source.stats().buffers);
+}
+
+
+void TreeDedupStore::Constructor::make(TreeDedupStore& object) const {
+
+    object.capacity_ = capacity_;
+    object.occupied_ = 0;
+
+    for (size_t i = 0; i < capacity_; i++) {
+        object.entries_[i].digest = 0;
+        object.entries_[i].refcount = 0;
+        object.entries_[i].buffer.nullify();
+    }
+
+    // Copy across the used entries. The buffers are now referenced from both tables, but only one of them will
+    // survive the replacement.
+
+    if (source_) {
+        for (size_t i = 0; i < source_->capacity_; i++) {
+
+            const Entry& e(source_->entries_[i]);
+            if (e.digest == 0 || e.refcount == 0)
+                continue;
+
+            size_t slot = e.digest % capacity_;
+            while (object.entries_[slot].digest != 0)
+                slot = (slot + 1) % capacity_;
+
+            object.entries_[slot] = e;
+            object.occupied_++;
+        }
+    }
+}
+
+
+size_t TreeDedupStore::Constructor::size() const {
+    return sizeof(TreeDedupStore) + (capacity_ - 1) * sizeof(Entry);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+uint64_t TreeDedupStore::digest(const void* data, size_t length) {
+
+    uint64_t d = hash64(data, length);
+    return d == 0 ? 1 : d;
+}
+
+
+PersistentPtr<PersistentBuffer> TreeDedupStore::acquire(const void* data, size_t length, uint64_t digest) {
+
+    size_t slot = find(data, length, digest);
+    if (slot == capacity_)
+        return PersistentPtr<PersistentBuffer>();
+
+    Entry& e(entries_[slot]);
+    e.refcount++;
+    persist(&e.refcount, sizeof(e.refcount));
+
+    return e.buffer;
+}
+
+
+PersistentPtr<PersistentBuffer> TreeDedupStore::insert(uint64_t digest, const AtomicConstructor<PersistentBuffer>& ctr) {
+
+    ASSERT(digest != 0);
+    ASSERT(!full());
+
+    // Find the first empty slot along the probe sequence. Deleted slots are not reused, as they may still hold a
+    // buffer from an interrupted operation (until recover() is called), and the table is rebuilt without them when
+    // it grows.
+
+    size_t slot = digest % capacity_;
+    while (entries_[slot].digest != 0)
+        slot = (slot + 1) % capacity_;
+
+    Entry& e(entries_[slot]);
+
+    e.digest = digest;
+    persist(&e.digest, sizeof(e.digest));
+
+    occupied_++;
+    persist(&occupied_, sizeof(occupied_));
+
+    e.buffer.allocate_ctr(ctr);
+
+    e.refcount = 1;
+    persist(&e.refcount, sizeof(e.refcount));
+
+    return e.buffer;
+}
+
+
+bool TreeDedupStore::release(const PersistentPtr<PersistentBuffer>& buffer) {
+
+    ASSERT(!buffer.null());
+
+    std::vector<char> scratch;
+    const void* data = buffer->data(scratch);
+    size_t length = buffer->size();
+
+    // Look for the slot that holds this specific buffer (there may be more than one with the same contents, if it
+    // has been added by other means).
+
+    uint64_t d = digest(data, length);
+    for (size_t slot = d % capacity_, n = 0; n < capacity_ && entries_[slot].digest != 0;
+                    slot = (slot + 1) % capacity_, n++) {
+
+        Entry& e(entries_[slot]);
+        if (e.digest == d && e.refcount != 0 && e.buffer == buffer) {
+
+            e.refcount--;
+            persist(&e.refcount, sizeof(e.refcount));
+
+            if (e.refcount == 0)
+                e.buffer.free();
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+size_t TreeDedupStore::recover() {
+
+    size_t freed = 0;
+
+    for (size_t i = 0; i < capacity_; i++) {
+        Entry& e(entries_[i]);
+        if (e.refcount == 0 && !e.buffer.null()) {
+            e.buffer.free();
+            freed++;
+        }
+    }
+
+    if (freed != 0)
+        Log::warning() << "Freed " << freed << " orphaned buffers from deduplication store" << std::endl;
+
+    return freed;
+}
+
+
+bool TreeDedupStore::full() const {
+
+    // Keep the load factor (including deleted slots) below 3/4, so that the probe sequences remain short.
+    return 4 * (occupied_ + 1) > 3 * capacity_;
+}
+
+
+size_t TreeDedupStore::capacity() const {
+    return capacity_;
+}
+
+
+TreeDedupStore::Stats TreeDedupStore::stats() const {
+
+    Stats s = { 0, 0, 0, 0 };
+
+    for (size_t i = 0; i < capacity_; i++) {
+        const Entry& e(entries_[i]);
+        if (e.digest != 0 && e.refcount != 0) {
+            size_t stored = e.buffer->storedSize();
+            s.buffers++;
+            s.references += e.refcount;
+            s.storedBytes += stored;
+            s.savedBytes += (e.refcount - 1) * stored;
+        }
+    }
+
+    return s;
+}
+
+
+size_t TreeDedupStore::find(const void* data, size_t length, uint64_t digest) const {
+
+    ASSERT(digest != 0);
+
+    std::vector<char> scratch;
+
+    for (size_t slot = digest % capacity_, n = 0; n < capacity_ && entries_[slot].digest != 0;
+                    slot = (slot + 1) % capacity_, n++) {
+
+        const Entry& e(entries_[slot]);
+        if (e.digest == digest && e.refcount != 0 && e.buffer->size() == length) {
+
+            // Confirm that the contents really are the same.
+
+            if (length == 0 || ::memcmp(e.buffer->data(scratch), data, length) == 0)
+                return slot;
+        }
+    }
+
+    return capacity_;
+}
+
+
+void TreeDedupStore::persist(const void* addr, size_t len) const {
+    ::pmemobj_persist(::pmemobj_pool_by_ptr(addr), addr, len);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace tree
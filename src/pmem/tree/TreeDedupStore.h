@@ -0,0 +1,151 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+
+#ifndef tree_TreeDedupStore_H
+#define tree_TreeDedupStore_H
+
+#include <cstddef>
+#include <stdint.h>
+
+#include "pmem/AtomicConstructor.h"
+#include "pmem/PersistentBuffer.h"
+#include "pmem/PersistentPtr.h"
+#include "pmem/PersistentType.h"
+
+
+/*
+ * Modus-operandi:
+ *
+ * A persistent hash table (open addressing, linear probing) from the digest of a payload to a reference counted
+ * PersistentBuffer holding it. Leaves with identical payloads share one buffer. Digests only select candidates, and
+ * the contents are always compared before a buffer is shared, so collisions are harmless.
+ *
+ * Each slot is in one of three states:
+ *
+ *   - empty:   digest == 0 (a freshly allocated table is all empty). Probing stops here.
+ *   - used:    digest != 0, refcount > 0, buffer valid.
+ *   - deleted: digest != 0, refcount == 0. Probing continues past these.
+ *
+ * (A digest of zero is stored as one.)
+ *
+ * Adding a new buffer to a slot:
+ *
+ *   i)   The digest is written (leaving the slot deleted, as the refcount is zero).
+ *   ii)  The buffer is allocated atomically into the slot.
+ *   iii) The refcount is set to one. This publishes the entry.
+ *
+ * Releasing the last reference sets the refcount to zero (the slot becomes deleted), and then frees the buffer.
+ *
+ * If interrupted, a deleted slot may still hold a buffer. recover() frees these. References are taken before a leaf
+ * is linked into the tree, and dropped after it is unlinked, so an interruption may leave a refcount too high (and
+ * the buffer leaked), but never too low.
+ *
+ * When the table becomes too full, it is copied into a larger one (dropping deleted slots), which atomically
+ * replaces the original (see TreeObject::insertShared).
+ */
+
+
+namespace tree {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// N.B. This is to be stored in PersistentPtr --> NO virtual behaviour.
+
+class TreeDedupStore : public pmem::PersistentType<TreeDedupStore> {
+
+public: // types
+
+    struct Stats {
+        size_t buffers;
+        size_t references;
+
+        /// The bytes occupied by the stored buffers, and the bytes that would have been needed without sharing.
+        size_t storedBytes;
+        size_t savedBytes;
+    };
+
+    class Constructor : public pmem::AtomicConstructor<TreeDedupStore> {
+    public: // methods
+        Constructor(size_t capacity);
+        /// Copy the used entries of an existing table into a new one
+        Constructor(const TreeDedupStore& source, size_t capacity);
+        virtual void make(TreeDedupStore& object) const;
+        virtual size_t size() const;
+    private: // members
+        const TreeDedupStore* source_;
+        size_t capacity_;
+    };
+
+public: // methods
+
+    /// The digest used to select entries (never zero).
+    static uint64_t digest(const void* data, size_t length);
+
+    /// Find a buffer with identical contents, and take a reference to it. Returns a null pointer if there is none.
+    pmem::PersistentPtr<pmem::PersistentBuffer> acquire(const void* data, size_t length, uint64_t digest);
+
+    /// Add a new buffer, with one reference, built by the supplied constructor. There must be space (see full()).
+    pmem::PersistentPtr<pmem::PersistentBuffer> insert(uint64_t digest,
+                                                       const pmem::AtomicConstructor<pmem::PersistentBuffer>& ctr);
+
+    /// Drop a reference to a buffer, freeing it if it was the last one. Returns false if the buffer is not in the
+    /// table.
+    bool release(const pmem::PersistentPtr<pmem::PersistentBuffer>& buffer);
+
+    /// Free any buffers left over from interrupted operations. Returns the number freed.
+    size_t recover();
+
+    /// Does the table need to be grown before a further insertion?
+    bool full() const;
+
+    size_t capacity() const;
+
+    Stats stats() const;
+
+private: // types
+
+    struct Entry {
+        uint64_t digest;
+        uint64_t refcount;
+        pmem::PersistentPtr<pmem::PersistentBuffer> buffer;
+    };
+
+private: // methods
+
+    /// Find the used slot holding the given contents, or the capacity if there is none.
+    size_t find(const void* data, size_t length, uint64_t digest) const;
+
+    void persist(const void* addr, size_t len) const;
+
+private: // members
+
+    uint64_t capacity_;
+
+    /// The number of slots that are not empty (used or deleted). This determines the load factor.
+    uint64_t occupied_;
+
+    // The allocator/constructor will make the TreeDedupStore the right size.
+    Entry entries_[1];
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace tree
+
+#endif // tree_TreeDedupStore_H
@@ -0,0 +1,460 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+
+#include <chrono>
+#include <ostream>
+
+#include "eckit/exception/Exceptions.h"
+#include "eckit/log/Bytes.h"
+#include "eckit/log/Log.h"
+
+#include "pmem/EpochManager.h"
+#include "pmem/InternTable.h"
+#include "pmem/Parallel.h"
+
+#include "pmem/tree/TreeIndex.h"
+
+using namespace eckit;
+using namespace pmem;
+
+
+namespace tree {
+
+namespace {
+
+class ReadLock : private NonCopyable {
+public:
+    ReadLock(pthread_rwlock_t& lock) : lock_(lock) {
+        int rc = ::pthread_rwlock_rdlock(&lock_);
+        ASSERT(rc == 0);
+    }
+    ~ReadLock() { ::pthread_rwlock_unlock(&lock_); }
+private:
+    pthread_rwlock_t& lock_;
+};
+
+
+class WriteLock : private NonCopyable {
+public:
+    WriteLock(pthread_rwlock_t& lock) : lock_(lock) {
+        int rc = ::pthread_rwlock_wrlock(&lock_);
+        ASSERT(rc == 0);
+    }
+    ~WriteLock() { ::pthread_rwlock_unlock(&lock_); }
+private:
+    pthread_rwlock_t& lock_;
+};
+
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+TreeIndex::Options::Options() :
+    enabled(false),
+    lazy(false),
+    budget(0) {}
+
+
+TreeIndex::TreeIndex(const InternTable& symbols, size_t budget) :
+    symbols_(symbols),
+    budget_(budget),
+    top_(0),
+    built_(false),
+    discarded_(false),
+    bytes_(0) {
+
+    int rc = ::pthread_rwlock_init(&lock_, 0);
+    ASSERT(rc == 0);
+}
+
+
+TreeIndex::~TreeIndex() {
+    destroy(top_);
+    ::pthread_rwlock_destroy(&lock_);
+}
+
+
+bool TreeIndex::build(const PersistentPtr<TreeNode>& root, ThreadPool& pool) {
+
+    if (built_ || discarded_)
+        return available();
+
+    WriteLock lock(lock_);
+
+    if (built_ || discarded_)
+        return available();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    if (!root.null()) {
+
+        // The subtrees are copied in parallel. Each item fills in the branch pointer of the entry for its node,
+        // which does not move once the (parent) branch has been created.
+
+        struct Item {
+            const TreeNode* node;
+            Branch** slot;
+        };
+
+        EpochGuard guard(EpochManager::lookup(root.get()));
+
+        WorkStealingScheduler<Item> scheduler(pool);
+        std::atomic<bool> exceeded(false);
+
+        Item top = { root.get(), &top_ };
+
+        scheduler.run(std::vector<Item>(1, top), [&](const Item& item, WorkStealingScheduler<Item>::Worker& worker) {
+
+            if (exceeded)
+                return;
+
+            *item.slot = mirror(*item.node, [&worker](const TreeNode& node, Branch*& slot) {
+                Item sub = { &node, &slot };
+                worker.spawn(sub);
+            });
+
+            if (*item.slot == 0)
+                exceeded = true;
+        });
+
+        if (exceeded) {
+            discard();
+            return false;
+        }
+
+        root_ = root;
+    }
+
+    built_ = true;
+
+    double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Log::info() << "Built tree index of " << Bytes(bytes_) << " in " << time << "s" << std::endl;
+
+    return true;
+}
+
+
+void TreeIndex::add(const PersistentPtr<TreeNode>& root, const TreeNode::KeyType& key) {
+
+    // n.b. built_ is only tested under the lock. A lazy build holds the lock for writing, and may already have
+    //      copied the leaf's parent, so the leaf must wait for it to finish. If the build has not started, it will
+    //      find the leaf in the tree.
+
+    if (discarded_)
+        return;
+
+    // Leaves that replace an existing one, or that were copied with their subtree (by build, or by adding a leaf
+    // that created it), are already indexed. The path is checked under the read lock, so that these insertions do
+    // not exclude lookups. Only new entries are added under the write lock.
+
+    {
+        ReadLock lock(lock_);
+        if (!built_ || discarded_ || indexed(key))
+            return;
+    }
+
+    EpochGuard guard(EpochManager::lookup(root.get()));
+    WriteLock lock(lock_);
+
+    if (!built_ || discarded_)
+        return;
+
+    // If the tree was empty, this is its first leaf.
+
+    if (top_ == 0) {
+        root_ = root;
+        top_ = mirrorSubtree(*root);
+        if (top_ == 0)
+            discard();
+        return;
+    }
+
+    // Follow the key as far as the index goes, then copy the missing part of the tree. n.b. If another leaf added
+    // the same nodes first, there is nothing to do.
+
+    Branch* branch = top_;
+    PersistentPtr<TreeNode> node = root_;
+
+    for (size_t i = 0; i < key.size(); i++) {
+
+        uint32_t value = symbols_.find(key[i].second);
+        ASSERT(value != InternTable::missing);
+
+        std::vector<Entry>::iterator it = branch->children.begin();
+        while (it != branch->children.end() && it->value != value)
+            ++it;
+
+        if (it == branch->children.end()) {
+
+            Entry entry = { value, node->child(value), 0 };
+            ASSERT(!entry.node.null());
+
+            if (!entry.node->leaf()) {
+                entry.branch = mirrorSubtree(*entry.node);
+                if (entry.branch == 0) {
+                    discard();
+                    return;
+                }
+            }
+
+            size_t capacity = branch->children.capacity();
+            branch->children.push_back(entry);
+
+            size_t total = bytes_ += (branch->children.capacity() - capacity) * sizeof(Entry);
+            if (budget_ != 0 && total > budget_)
+                discard();
+            return;
+        }
+
+        if (it->branch == 0)
+            return;
+
+        branch = it->branch;
+        node = it->node;
+    }
+}
+
+
+bool TreeIndex::indexed(const TreeNode::KeyType& key) const {
+
+    // n.b. As in add, a leaf entry partway along the key ends the path (there is nothing to add beneath it).
+
+    if (top_ == 0)
+        return false;
+
+    const Branch* branch = top_;
+
+    for (size_t i = 0; i < key.size(); i++) {
+
+        uint32_t value = symbols_.find(key[i].second);
+        if (value == InternTable::missing)
+            return false;
+
+        std::vector<Entry>::const_iterator it = branch->children.begin();
+        while (it != branch->children.end() && it->value != value)
+            ++it;
+
+        if (it == branch->children.end())
+            return false;
+
+        if (it->branch == 0)
+            return true;
+
+        branch = it->branch;
+    }
+
+    return true;
+}
+
+
+void TreeIndex::remove(const TreeNode::KeyType& key) {
+
+    WriteLock lock(lock_);
+
+    if (!built_ || discarded_ || top_ == 0)
+        return;
+
+    // Find the path to the leaf, then remove it, and prune the branches left empty (as does TreeNode::removeNode).
+
+    std::vector<std::pair<Branch*, size_t> > path;
+    Branch* branch = top_;
+
+    for (size_t i = 0; i < key.size(); i++) {
+
+        uint32_t value = symbols_.find(key[i].second);
+        if (value == InternTable::missing)
+            return;
+
+        size_t pos = 0;
+        while (pos < branch->children.size() && branch->children[pos].value != value)
+            ++pos;
+
+        if (pos == branch->children.size())
+            return;
+
+        path.push_back(std::make_pair(branch, pos));
+
+        Branch* next = branch->children[pos].branch;
+        if ((next == 0) != (i == key.size() - 1))
+            return;
+
+        branch = next;
+    }
+
+    for (size_t i = path.size(); i > 0; i--) {
+
+        std::vector<Entry>& children(path[i - 1].first->children);
+        std::vector<Entry>::iterator it = children.begin() + path[i - 1].second;
+
+        if (it->branch) {
+            if (!it->branch->children.empty())
+                break;
+            bytes_ -= destroy(it->branch);
+        }
+
+        children.erase(it);
+    }
+}
+
+
+TreeIndex::Result TreeIndex::visit(const TreeQuery& query, const TreeNode::Visitor& visitor) const {
+
+    if (query.stale()) {
+        TreeQuery current(query);
+        current.refresh();
+        return visit(current, visitor);
+    }
+
+    ReadLock lock(lock_);
+
+    if (!built_ || discarded_)
+        return Unavailable;
+
+    if (top_ == 0 || visit(*top_, query, 0, visitor))
+        return Completed;
+
+    return Stopped;
+}
+
+
+bool TreeIndex::visit(const Branch& branch, const TreeQuery& query, size_t depth,
+                      const TreeNode::Visitor& visitor) const {
+
+    // As TreeNode::select, but only the leaves are in persistent memory.
+
+    const TreeQuery::Predicate* pred = query.predicate(branch.key, depth);
+
+    if (pred && pred->none())
+        return true;
+
+    for (std::vector<Entry>::const_iterator it = branch.children.begin(); it != branch.children.end(); ++it) {
+
+        if (pred && !pred->matches(it->value))
+            continue;
+
+        if (!(it->branch ? visit(*it->branch, query, depth + 1, visitor) : visitor(it->node)))
+            return false;
+
+        // n.b. the values of the children are unique.
+        if (pred && pred->unique())
+            break;
+    }
+
+    return true;
+}
+
+
+bool TreeIndex::available() const {
+    return built_ && !discarded_;
+}
+
+
+size_t TreeIndex::size() const {
+    return bytes_;
+}
+
+
+template <typename Function>
+TreeIndex::Branch* TreeIndex::mirror(const TreeNode& node, Function fn) {
+
+    std::vector<PersistentPtr<TreeNode> > children = node.children();
+
+    size_t total = bytes_ += sizeof(Branch) + children.size() * sizeof(Entry);
+    if (budget_ != 0 && total > budget_)
+        return 0;
+
+    Branch* branch = new Branch;
+    branch->key = node.keyId();
+    branch->children.reserve(children.size());
+
+    for (std::vector<PersistentPtr<TreeNode> >::const_iterator it = children.begin(); it != children.end(); ++it) {
+        Entry entry = { (*it)->valueId(), *it, 0 };
+        branch->children.push_back(entry);
+    }
+
+    for (std::vector<Entry>::iterator it = branch->children.begin(); it != branch->children.end(); ++it) {
+        if (!it->node->leaf())
+            fn(*it->node, it->branch);
+    }
+
+    return branch;
+}
+
+
+TreeIndex::Branch* TreeIndex::mirrorSubtree(const TreeNode& node) {
+
+    bool exceeded = false;
+
+    Branch* branch = mirror(node, [this, &exceeded](const TreeNode& child, Branch*& slot) {
+        if (!exceeded) {
+            slot = mirrorSubtree(child);
+            exceeded = (slot == 0);
+        }
+    });
+
+    if (branch && exceeded) {
+        bytes_ -= destroy(branch);
+        return 0;
+    }
+
+    return branch;
+}
+
+
+void TreeIndex::discard() {
+
+    destroy(top_);
+    top_ = 0;
+    root_.nullify();
+
+    bytes_ = 0;
+    discarded_ = true;
+
+    Log::info() << "Tree index exceeds its memory budget of " << Bytes(budget_)
+                << ", so lookups use the tree from now on" << std::endl;
+}
+
+
+size_t TreeIndex::destroy(Branch* branch) {
+
+    if (branch == 0)
+        return 0;
+
+    size_t bytes = sizeof(Branch) + branch->children.capacity() * sizeof(Entry);
+
+    for (std::vector<Entry>::iterator it = branch->children.begin(); it != branch->children.end(); ++it) {
+        bytes += destroy(it->branch);
+    }
+
+    delete branch;
+    return bytes;
+}
+
+
+void TreeIndex::print(std::ostream& os) const {
+    os << "TreeIndex(" << Bytes(bytes_);
+    if (!available())
+        os << ", unavailable";
+    os << ")";
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace tree
@@ -0,0 +1,187 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+
+#ifndef tree_TreeIndex_H
+#define tree_TreeIndex_H
+
+#include <atomic>
+#include <cstddef>
+#include <iosfwd>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "eckit/memory/NonCopyable.h"
+
+#include "pmem/PersistentPtr.h"
+#include "pmem/ThreadPool.h"
+
+#include "pmem/tree/TreeNode.h"
+#include "pmem/tree/TreeQuery.h"
+
+namespace pmem {
+    class InternTable;
+}
+
+
+/*
+ * Modus-operandi:
+ *
+ * A copy of the internal nodes of the tree in volatile memory, so that lookups only touch persistent memory for
+ * the leaves they find. Each branch of the index holds the key id of an internal node, and the value ids of its
+ * children (in the same order), each with a pointer to the child node in the tree and, for internal nodes, the
+ * branch mirroring it. Queries are evaluated exactly as by TreeNode::visit.
+ *
+ * The index is built from the tree in parallel (see pmem::WorkStealingScheduler), either up front or, if lazy, by
+ * the first lookup that needs it. It is kept up to date by the TreeObject, which adds each leaf to the index once it
+ * has been added to the tree, and removes leaves from both together. Adding is idempotent, and copies any nodes
+ * that the index lacks from the tree. It waits for a build in progress, so leaves added while the index is being
+ * built are not lost. Adding first checks the path under the read lock, and only excludes lookups if an entry is
+ * missing.
+ *
+ * The index is limited to a memory budget. If it would exceed it (while being built, or as leaves are added) the
+ * index is discarded, and lookups use the tree directly from then on.
+ *
+ * n.b. Leaves added concurrently to the same node may be indexed in a different order from the tree, so lookups
+ *      may return them in a different order.
+ */
+
+
+namespace tree {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+class TreeIndex : private eckit::NonCopyable {
+
+public: // types
+
+    struct Options {
+        Options();
+
+        bool enabled;
+
+        /// Build the index on first use, rather than when the TreeObject is opened.
+        bool lazy;
+
+        /// The maximum memory used by the index, in bytes. Zero is unlimited.
+        size_t budget;
+    };
+
+    enum Result { Unavailable, Completed, Stopped };
+
+public: // methods
+
+    /// n.b. The index refers to the table, which must remain open while it is used.
+    TreeIndex(const pmem::InternTable& symbols, size_t budget=0);
+    ~TreeIndex();
+
+    /// Copy the tree below the given root node into the index, unless it has already been built (or discarded).
+    /// Returns false if the index is not available. The tree must not be modified other than by adding leaves.
+    bool build(const pmem::PersistentPtr<TreeNode>& root, pmem::ThreadPool& pool=pmem::ThreadPool::instance());
+
+    /// Add a leaf that has been added to the tree, with the same key. Does nothing if the index is not built, or
+    /// already holds the leaf. Only takes the lock for writing if the leaf (or a node above it) is missing.
+    void add(const pmem::PersistentPtr<TreeNode>& root, const TreeNode::KeyType& key);
+
+    /// Remove a leaf (and any branches left empty) that has been removed from the tree.
+    void remove(const TreeNode::KeyType& key);
+
+    /// Pass the leaves matching the query to the visitor, in tree order (see TreeNode::visit). Returns Stopped if
+    /// the visitor stopped the lookup early, or Unavailable (without calling the visitor) if the tree must be
+    /// searched instead.
+    /// n.b. The visitor is called with the lock held for reading, so it must not modify the tree (or the index).
+    ///      Adding or removing a leaf from within the visitor would deadlock.
+    Result visit(const TreeQuery& query, const TreeNode::Visitor& visitor) const;
+
+    /// Has the index been built, and not discarded?
+    bool available() const;
+
+    /// The approximate memory used by the index, in bytes.
+    size_t size() const;
+
+protected: // methods
+
+    void print(std::ostream&) const;
+
+private: // types
+
+    struct Branch;
+
+    struct Entry {
+        uint32_t value;
+        pmem::PersistentPtr<TreeNode> node;
+        Branch* branch;
+    };
+
+    struct Branch {
+        uint32_t key;
+        std::vector<Entry> children;
+    };
+
+private: // methods
+
+    /// Copy the children of a node into a new branch, passing each internal child (and its branch) to fn. Returns
+    /// null if the budget would be exceeded. The caller must hold an EpochGuard.
+    template <typename Function>
+    Branch* mirror(const TreeNode& node, Function fn);
+
+    /// Copy a whole subtree into a new branch, serially. Returns null if the budget would be exceeded.
+    Branch* mirrorSubtree(const TreeNode& node);
+
+    bool visit(const Branch& branch, const TreeQuery& query, size_t depth, const TreeNode::Visitor& visitor) const;
+
+    /// Does the index already hold the path to the leaf with the given key? The lock must be held.
+    bool indexed(const TreeNode::KeyType& key) const;
+
+    /// Free the index, and use the tree from now on. The lock must be held for writing.
+    void discard();
+
+    /// Free a branch, and the branches beneath it. Returns the memory freed.
+    static size_t destroy(Branch* branch);
+
+private: // members
+
+    const pmem::InternTable& symbols_;
+
+    const size_t budget_;
+
+    /// The branch mirroring the root node, or null if the tree was empty.
+    Branch* top_;
+    pmem::PersistentPtr<TreeNode> root_;
+
+    std::atomic<bool> built_;
+    std::atomic<bool> discarded_;
+    std::atomic<size_t> bytes_;
+
+    /// Held for reading by lookups, and for writing by anything that modifies the index.
+    mutable pthread_rwlock_t lock_;
+
+private: // friends
+
+    friend std::ostream& operator<<(std::ostream& os, const TreeIndex& i) {
+        i.print(os);
+        return os;
+    }
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace tree
+
+#endif // tree_TreeIndex_H
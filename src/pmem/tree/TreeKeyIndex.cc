@@ -0,0 +1,347 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+
+#include <algorithm>
+
+#include "eckit/exception/Exceptions.h"
+#include "eckit/log/Log.h"
+
+#include "pmem/Hash.h"
+#include "pmem/LibPMem.h"
+
+#include "pmem/tree/TreeKeyIndex.h"
+
+using namespace eckit;
+using namespace pmem;
+
+
+namespace tree {
+
+namespace {
+
+/// The number of slots in a newly created index. It doubles as required.
+const size_t initial_capacity = 1024;
+
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+TreeKeyIndex::Constructor::Constructor(size_t depth, const PersistentPtr<TreeNode>& root) :
+    source_(0),
+    depth_(depth),
+    capacity_(initial_capacity) {
+
+    ASSERT(depth > 0);
+
+    if (!root.null() && !root->leaf()) {
+        std::vector<uint32_t> key;
+        collect(*root, depth_, key, leaves_);
+    }
+
+    while (4 * (leaves_.size() + 1) > 3 * capacity_)
+        capacity_ *= 2;
+}
+
+
+TreeKeyIndex::Constructor::Constructor(const TreeKeyIndex& source, size_t capacity) :
+    source_(&source),
+    depth_(source.depth_),
+    capacity_(capacity) {
+
+    ASSERT(capacity >= source.capacity_);
+}
+
+
+void TreeKeyIndex::Constructor::make(TreeKeyIndex& object) const {
+
+    object.capacity_ = capacity_;
+    object.depth_ = depth_;
+    object.occupied_ = 0;
+
+    for (size_t i = 0; i < capacity_; i++) {
+        Slot& s(object.slot(i));
+        s.state.store(Empty);
+        s.padding = 0;
+        s.digest = 0;
+        s.leaf.nullify();
+    }
+
+    for (LeafList::const_iterator it = leaves_.begin(); it != leaves_.end(); ++it) {
+        object.insert(it->first, digest(it->first), Linked, it->second);
+    }
+
+    // Copy across the pending and linked slots. Writers find the pending slots again in the new table.
+
+    if (source_) {
+        std::vector<uint32_t> key(depth_);
+        for (size_t i = 0; i < source_->capacity_; i++) {
+
+            const Slot& s(source_->slot(i));
+            State state = State(s.state.load());
+            if (state != Pending && state != Linked)
+                continue;
+
+            std::copy(s.key, s.key + depth_, key.begin());
+            object.insert(key, s.digest, state, s.leaf);
+        }
+    }
+}
+
+
+size_t TreeKeyIndex::Constructor::size() const {
+    return sizeof(TreeKeyIndex) - sizeof(uint64_t) + capacity_ * stride(depth_);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+void TreeKeyIndex::collect(const TreeNode& node, size_t depth, std::vector<uint32_t>& key, LeafList& leaves) {
+
+    std::vector<PersistentPtr<TreeNode> > children = node.children();
+
+    for (std::vector<PersistentPtr<TreeNode> >::const_iterator it = children.begin(); it != children.end(); ++it) {
+
+        key.push_back((*it)->valueId());
+
+        if ((*it)->leaf()) {
+            if (key.size() == depth)
+                leaves.push_back(std::make_pair(key, *it));
+        } else if (key.size() < depth) {
+            collect(**it, depth, key, leaves);
+        }
+
+        key.pop_back();
+    }
+}
+
+
+uint64_t TreeKeyIndex::digest(const std::vector<uint32_t>& key) {
+
+    ASSERT(!key.empty());
+
+    uint64_t d = hash64(&key[0], key.size() * sizeof(uint32_t));
+    return d == 0 ? 1 : d;
+}
+
+
+PersistentPtr<TreeNode> TreeKeyIndex::find(const std::vector<uint32_t>& key, uint64_t digest) const {
+
+    size_t i = search(key, digest);
+
+    // n.b. The leaf is written before the slot is linked, and not modified again while it may be found.
+
+    if (i != capacity_ && slot(i).state.load(std::memory_order_acquire) == Linked)
+        return slot(i).leaf;
+
+    return PersistentPtr<TreeNode>();
+}
+
+
+void TreeKeyIndex::reserve(const std::vector<uint32_t>& key, uint64_t digest) {
+
+    if (search(key, digest) == capacity_)
+        insert(key, digest, Pending, PersistentPtr<TreeNode>());
+}
+
+
+bool TreeKeyIndex::unlink(const std::vector<uint32_t>& key, uint64_t digest) {
+
+    size_t i = search(key, digest);
+    if (i == capacity_ || slot(i).state.load() != Linked)
+        return false;
+
+    setState(slot(i), Pending);
+    return true;
+}
+
+
+void TreeKeyIndex::resolve(const std::vector<uint32_t>& key, uint64_t digest, const PersistentPtr<TreeNode>& node) {
+
+    size_t i = search(key, digest);
+
+    if (i == capacity_) {
+        if (!node.null())
+            insert(key, digest, Linked, node);
+        return;
+    }
+
+    Slot& s(slot(i));
+
+    if (node.null()) {
+        setState(s, Deleted);
+    } else if (s.state.load() != Linked) {
+        s.leaf = node;
+        persist(&s.leaf, sizeof(s.leaf));
+        setState(s, Linked);
+    }
+}
+
+
+size_t TreeKeyIndex::recover(const PersistentPtr<TreeNode>& root) {
+
+    size_t count = 0;
+    std::vector<uint32_t> key(depth_);
+
+    for (size_t i = 0; i < capacity_; i++) {
+
+        Slot& s(slot(i));
+        if (s.state.load() != Pending)
+            continue;
+
+        std::copy(s.key, s.key + depth_, key.begin());
+        resolve(key, s.digest, leaf(root, key));
+        count++;
+    }
+
+    if (count != 0)
+        Log::warning() << "Resolved " << count << " incomplete entries in the key index" << std::endl;
+
+    return count;
+}
+
+
+bool TreeKeyIndex::full() const {
+
+    // Keep the load factor (including deleted slots) below 3/4, so that the probe sequences remain short.
+    return 4 * (occupied_ + 1) > 3 * capacity_;
+}
+
+
+size_t TreeKeyIndex::capacity() const {
+    return capacity_;
+}
+
+
+size_t TreeKeyIndex::depth() const {
+    return depth_;
+}
+
+
+size_t TreeKeyIndex::size() const {
+
+    size_t count = 0;
+    for (size_t i = 0; i < capacity_; i++) {
+        if (slot(i).state.load() == Linked)
+            count++;
+    }
+
+    return count;
+}
+
+
+PersistentPtr<TreeNode> TreeKeyIndex::leaf(const PersistentPtr<TreeNode>& root, const std::vector<uint32_t>& key) {
+
+    PersistentPtr<TreeNode> node = root;
+
+    for (std::vector<uint32_t>::const_iterator it = key.begin(); it != key.end(); ++it) {
+        if (node.null() || node->leaf())
+            return PersistentPtr<TreeNode>();
+        node = node->child(*it);
+    }
+
+    if (node.null() || !node->leaf())
+        return PersistentPtr<TreeNode>();
+
+    return node;
+}
+
+
+size_t TreeKeyIndex::stride(size_t depth) {
+
+    ASSERT(depth > 0);
+
+    size_t bytes = sizeof(Slot) + (depth - 1) * sizeof(uint32_t);
+    return (bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+}
+
+
+TreeKeyIndex::Slot& TreeKeyIndex::slot(size_t i) {
+    ASSERT(i < capacity_);
+    return *reinterpret_cast<Slot*>(reinterpret_cast<char*>(slots_) + i * stride(depth_));
+}
+
+
+const TreeKeyIndex::Slot& TreeKeyIndex::slot(size_t i) const {
+    ASSERT(i < capacity_);
+    return *reinterpret_cast<const Slot*>(reinterpret_cast<const char*>(slots_) + i * stride(depth_));
+}
+
+
+size_t TreeKeyIndex::search(const std::vector<uint32_t>& key, uint64_t digest) const {
+
+    ASSERT(digest != 0);
+    ASSERT(key.size() == depth_);
+
+    for (size_t i = digest % capacity_, n = 0; n < capacity_; i = (i + 1) % capacity_, n++) {
+
+        const Slot& s(slot(i));
+        State state = State(s.state.load(std::memory_order_acquire));
+
+        if (state == Empty)
+            break;
+
+        if ((state == Pending || state == Linked) && s.digest == digest && std::equal(key.begin(), key.end(), s.key))
+            return i;
+    }
+
+    return capacity_;
+}
+
+
+void TreeKeyIndex::insert(const std::vector<uint32_t>& key, uint64_t digest, State state,
+                          const PersistentPtr<TreeNode>& leaf) {
+
+    ASSERT(key.size() == depth_);
+    ASSERT(!full());
+
+    // Find the first empty slot along the probe sequence. As in TreeDedupStore, deleted slots are not reused, and
+    // the table is rebuilt without them when it grows.
+
+    size_t i = digest % capacity_;
+    while (slot(i).state.load() != Empty)
+        i = (i + 1) % capacity_;
+
+    Slot& s(slot(i));
+
+    std::copy(key.begin(), key.end(), s.key);
+    s.digest = digest;
+    s.leaf = leaf;
+    persist(&s, stride(depth_));
+
+    occupied_++;
+    persist(&occupied_, sizeof(occupied_));
+
+    setState(s, state);
+}
+
+
+void TreeKeyIndex::setState(Slot& s, State state) {
+    s.state.store(state, std::memory_order_release);
+    persist(&s.state, sizeof(s.state));
+}
+
+
+void TreeKeyIndex::persist(const void* addr, size_t len) const {
+    ::pmemobj_persist(::pmemobj_pool_by_ptr(addr), addr, len);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace tree
@@ -0,0 +1,193 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+
+#ifndef tree_TreeKeyIndex_H
+#define tree_TreeKeyIndex_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include "pmem/AtomicConstructor.h"
+#include "pmem/PersistentPtr.h"
+#include "pmem/PersistentType.h"
+
+#include "pmem/tree/TreeNode.h"
+
+
+/*
+ * Modus-operandi:
+ *
+ * A persistent hash table (open addressing, linear probing) from each complete key in the tree to its leaf, so that
+ * exact lookups need not walk the tree. A key is encoded canonically as the ids (in the InternTable of the pool) of
+ * its values, in the order of the keys of the TreeSchema. The slots hold the encoded key as well as its digest, so
+ * collisions are resolved without touching the tree.
+ *
+ * Each slot is in one of four states:
+ *
+ *   - empty:    Probing stops here.
+ *   - pending:  A leaf with the key is being added to (or removed from) the tree.
+ *   - linked:   The slot refers to the leaf with the key. Only linked slots are found by lookups.
+ *   - deleted:  Probing continues past these.
+ *
+ * Adding a leaf:
+ *
+ *   i)   The key is written into an empty slot, which is then marked pending.
+ *   ii)  The leaf is added to the tree.
+ *   iii) The pointer to the leaf is written, and the slot marked linked (or deleted, if the leaf was not added).
+ *
+ * Removing a leaf marks its slot pending before it is removed from the tree, and deleted afterwards. Each step is
+ * persisted before the next, so if interrupted only pending slots can be out of date. recover() resolves these from
+ * the tree. The state is written last (with release semantics), so lookups running alongside insertions only see
+ * slots that are complete.
+ *
+ * When the table becomes too full, it is copied into a larger one (dropping deleted slots), which atomically
+ * replaces the original. Lookups may still be using the original, so it is retired (see pmem::EpochManager).
+ * Writers must be serialised, and find the slots they update again after each step, as the table may have been
+ * replaced in between.
+ */
+
+
+namespace tree {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// N.B. This is to be stored in PersistentPtr --> NO virtual behaviour.
+
+class TreeKeyIndex : public pmem::PersistentType<TreeKeyIndex> {
+
+private: // types
+
+    typedef std::vector<std::pair<std::vector<uint32_t>, pmem::PersistentPtr<TreeNode> > > LeafList;
+
+public: // types
+
+    class Constructor : public pmem::AtomicConstructor<TreeKeyIndex> {
+    public: // methods
+        /// Index the leaves of a tree (if any) whose keys have the given number of levels. The caller must hold
+        /// an EpochGuard.
+        Constructor(size_t depth, const pmem::PersistentPtr<TreeNode>& root);
+        /// Copy the pending and linked slots of an existing table into a new one
+        Constructor(const TreeKeyIndex& source, size_t capacity);
+        virtual void make(TreeKeyIndex& object) const;
+        virtual size_t size() const;
+    private: // members
+        const TreeKeyIndex* source_;
+        LeafList leaves_;
+        size_t depth_;
+        size_t capacity_;
+    };
+
+    enum State { Empty = 0, Pending, Linked, Deleted };
+
+public: // methods
+
+    /// The digest used to select slots (never zero) for an encoded key.
+    static uint64_t digest(const std::vector<uint32_t>& key);
+
+    /// The leaf with the given key, or null if it is not (yet) linked.
+    pmem::PersistentPtr<TreeNode> find(const std::vector<uint32_t>& key, uint64_t digest) const;
+
+    /// Mark a new key as pending, before its leaf is added to the tree. There must be space (see full()). A key
+    /// that is already present is left alone (as adding the leaf will fail).
+    void reserve(const std::vector<uint32_t>& key, uint64_t digest);
+
+    /// Mark a linked key as pending, before its leaf is removed from the tree. Returns false if it is not linked.
+    bool unlink(const std::vector<uint32_t>& key, uint64_t digest);
+
+    /// Resolve a pending key once its leaf has been added to (or removed from) the tree, given the leaf with the key
+    /// that the tree now contains (see leaf()), or null. The slot is linked to the leaf, or deleted if there is none.
+    /// A key that is not present is added if there is a leaf (e.g. if another insertion of the same key failed, and
+    /// resolved it first), for which there must be space.
+    void resolve(const std::vector<uint32_t>& key, uint64_t digest, const pmem::PersistentPtr<TreeNode>& leaf);
+
+    /// Resolve any keys left pending by interrupted insertions or removals. Returns the number resolved. The caller
+    /// must hold an EpochGuard.
+    size_t recover(const pmem::PersistentPtr<TreeNode>& root);
+
+    /// Does the table need to be grown before a further key is reserved?
+    bool full() const;
+
+    size_t capacity() const;
+
+    /// The number of levels in each key.
+    size_t depth() const;
+
+    /// The number of linked keys.
+    size_t size() const;
+
+    /// The leaf of the tree with the given key, or null. The caller must hold an EpochGuard.
+    static pmem::PersistentPtr<TreeNode> leaf(const pmem::PersistentPtr<TreeNode>& root,
+                                              const std::vector<uint32_t>& key);
+
+private: // types
+
+    struct Slot {
+        std::atomic<uint32_t> state;
+        uint32_t padding;
+        uint64_t digest;
+        pmem::PersistentPtr<TreeNode> leaf;
+        /// The encoded key. The slots are sized to fit the depth of the table.
+        uint32_t key[1];
+    };
+
+private: // methods
+
+    /// Collect the leaves beneath a node (with their keys) that have the given depth. The caller must hold an
+    /// EpochGuard.
+    static void collect(const TreeNode& node, size_t depth, std::vector<uint32_t>& key, LeafList& leaves);
+
+    /// The size of each slot for keys of the given depth.
+    static size_t stride(size_t depth);
+
+    Slot& slot(size_t i);
+    const Slot& slot(size_t i) const;
+
+    /// Find the pending or linked slot holding the key, or the capacity if there is none.
+    size_t search(const std::vector<uint32_t>& key, uint64_t digest) const;
+
+    /// Write a key into the first empty slot along its probe sequence, with the given state and leaf.
+    void insert(const std::vector<uint32_t>& key, uint64_t digest, State state,
+                const pmem::PersistentPtr<TreeNode>& leaf);
+
+    void setState(Slot& s, State state);
+
+    void persist(const void* addr, size_t len) const;
+
+private: // members
+
+    uint64_t capacity_;
+
+    uint64_t depth_;
+
+    /// The number of slots that are not empty (pending, linked or deleted). This determines the load factor.
+    uint64_t occupied_;
+
+    // The allocator/constructor will make the TreeKeyIndex the right size. n.b. The slots start here, but are
+    // accessed through slot(), as their size depends on the depth.
+    uint64_t slots_[1];
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace tree
+
+#endif // tree_TreeKeyIndex_H
@@ -14,14 +14,23 @@
 /// @author Simon Smart
 /// @date   Feb 2016
 
+#include <cstring>
+#include <deque>
+
+#include "eckit/exception/Exceptions.h"
 #include "eckit/io/DataBlob.h"
 #include "eckit/log/Bytes.h"
 #include "eckit/log/Log.h"
+#include "eckit/thread/AutoLock.h"
 #include "eckit/types/Types.h"
 
 #include "pmem/PersistentBuffer.h"
 #include "pmem/PersistentPtr.h"
 #include "pmem/AtomicConstructor.h"
+#include "pmem/Checksum.h"
+#include "pmem/EpochManager.h"
+#include "pmem/InternTable.h"
+#include "pmem/Parallel.h"
 #include "pmem/PoolRegistry.h"
 
 #include "pmem/tree/TreeNode.h"
@@ -36,56 +45,195 @@ namespace tree {
 TreeNode::LeafExistsError::LeafExistsError(const std::string& msg, const CodeLocation& here) :
     Exception(msg, here) {}
 
+
+TreeNode::InlineConstructor::InlineConstructor(uint32_t value, const void* data, size_t length) :
+    value_(value),
+    data_(data),
+    length_(length) {
+
+    ASSERT(length <= inline_threshold);
+}
+
+
+void TreeNode::InlineConstructor::make(TreeNode& object) const {
+    new (&object) TreeNode(value_, data_, length_);
+}
+
+
+size_t TreeNode::InlineConstructor::size() const {
+    return sizeof(TreeNode) + length_;
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 
 
-TreeNode::TreeNode(const std::string& key, const std::string& value) :
+TreeNode::TreeNode(uint32_t key, uint32_t value) :
     value_(value),
-    key_(key) {
+    key_(key),
+    inlineLength_(0),
+    inlineChecksum_(0),
+    shared_(false),
+    inlined_(false) {
 
     items_.nullify();
     data_.nullify();
 }
 
 
-TreeNode::TreeNode(const std::string& value, const PersistentPtr<PersistentBuffer>& dataBlob) :
+TreeNode::TreeNode(uint32_t value, const PersistentPtr<PersistentBuffer>& dataBlob, bool shared) :
     data_(dataBlob),
     value_(value),
-    key_("") {
+    key_(InternTable::missing),
+    inlineLength_(0),
+    inlineChecksum_(0),
+    shared_(shared),
+    inlined_(false) {
+
+    items_.nullify();
+}
+
+
+/// n.b. The node must have been allocated with space for the data following it (see InlineConstructor).
+
+TreeNode::TreeNode(uint32_t value, const void* data, size_t length) :
+    value_(value),
+    key_(InternTable::missing),
+    inlineLength_(length),
+    shared_(false),
+    inlined_(true) {
 
     items_.nullify();
+    data_.nullify();
+
+    // The checksum is computed in the same pass as the copy, as for PersistentBuffer.
+
+    uint32_t crc = checksum::crc32c_copy(reinterpret_cast<char*>(this) + sizeof(TreeNode), data, length);
+    inlineChecksum_ = checksum::crc32c(&inlineLength_, sizeof(inlineLength_), crc);
 }
 
 
 PersistentPtr<TreeNode> TreeNode::allocateLeaf(PersistentPool& pool, const std::string& value, const DataBlob& blob) {
+    return allocateLeaf(pool, value, blob.buffer(), blob.length());
+}
+
+
+PersistentPtr<TreeNode> TreeNode::allocateLeaf(PersistentPool& pool,
+                                               const std::string& value,
+                                               const void* data,
+                                               size_t length) {
+    Payload payload = { data, length };
+    return allocateLeaf(pool, value, payload);
+}
+
+
+PersistentPtr<TreeNode> TreeNode::allocateLeaf(PersistentPool& pool, const std::string& value, const Payload& data) {
+
+    // Small payloads are stored inline, in the same allocation as the node.
+
+    if (data.length <= inline_threshold) {
+        uint32_t valueId = InternTable::lookup(pool.raw_pool()).intern(value);
+
+        PersistentPtr<TreeNode> pNode;
+        pNode.allocate_ctr(pool, InlineConstructor(valueId, data.data, data.length));
+        return pNode;
+    }
+
+    // n.b. The data pointer must be passed as a const void*, so that the AtomicConstructor specialisation that
+    //      sizes the allocation for the payload is selected.
+
+    return allocateLeaf(pool, value, AtomicConstructor2<PersistentBuffer, const void*, size_t>(data.data, data.length));
+}
+
+
+PersistentPtr<TreeNode> TreeNode::allocateLeaf(PersistentPool& pool,
+                                               const std::string& value,
+                                               const AtomicConstructor<PersistentBuffer>& data) {
 
     PersistentPtr<PersistentBuffer> pBlob;
-    pBlob = pool.allocate<PersistentBuffer>(blob.buffer(), blob.length());
+    pBlob.allocate_ctr(pool, data);
+
+    uint32_t valueId = InternTable::lookup(pool.raw_pool()).intern(value);
 
     PersistentPtr<TreeNode> pNode;
-    pNode = pool.allocate<TreeNode>(value, pBlob);
+    pNode = pool.allocate<TreeNode>(valueId, pBlob);
 
     return pNode;
 }
 
 
+PersistentPtr<TreeNode> TreeNode::allocateLeaf(PersistentPool& pool,
+                                               const std::string& value,
+                                               const PersistentPtr<PersistentBuffer>& shared) {
+
+    ASSERT(!shared.null());
+
+    uint32_t valueId = InternTable::lookup(pool.raw_pool()).intern(value);
+    return pool.allocate<TreeNode>(valueId, shared, true);
+}
+
+
 /// This is an in-place constructor. Needs to know its pool already.
 
 PersistentPtr<TreeNode> TreeNode::allocateNested(PersistentPool& pool,
                                                  const std::string& value,
                                                  const KeyType& keyChain,
                                                  const DataBlob& blob) {
+    return allocateNested(pool, value, keyChain, blob.buffer(), blob.length());
+}
+
+
+PersistentPtr<TreeNode> TreeNode::allocateNested(PersistentPool& pool,
+                                                 const std::string& value,
+                                                 const KeyType& keyChain,
+                                                 const void* data,
+                                                 size_t length) {
+    Payload payload = { data, length };
+    return allocateNestedImpl(pool, value, keyChain, payload);
+}
+
+
+PersistentPtr<TreeNode> TreeNode::allocateNested(PersistentPool& pool,
+                                                 const std::string& value,
+                                                 const KeyType& keyChain,
+                                                 const Payload& data) {
+    return allocateNestedImpl(pool, value, keyChain, data);
+}
+
+
+PersistentPtr<TreeNode> TreeNode::allocateNested(PersistentPool& pool,
+                                                 const std::string& value,
+                                                 const KeyType& keyChain,
+                                                 const AtomicConstructor<PersistentBuffer>& data) {
+    return allocateNestedImpl(pool, value, keyChain, data);
+}
+
+
+PersistentPtr<TreeNode> TreeNode::allocateNested(PersistentPool& pool,
+                                                 const std::string& value,
+                                                 const KeyType& keyChain,
+                                                 const PersistentPtr<PersistentBuffer>& shared) {
+    return allocateNestedImpl(pool, value, keyChain, shared);
+}
+
+
+template <typename DataSource>
+PersistentPtr<TreeNode> TreeNode::allocateNestedImpl(PersistentPool& pool,
+                                                     const std::string& value,
+                                                     const KeyType& keyChain,
+                                                     const DataSource& data) {
 
     const std::string& leafValue(keyChain.size() == 0 ? value : keyChain.back().second);
 
-    PersistentPtr<TreeNode> pNode = allocateLeaf(pool, leafValue, blob);
+    PersistentPtr<TreeNode> pNode = allocateLeaf(pool, leafValue, data);
 
     if (keyChain.size() != 0) {
 
+        InternTable& symbols(InternTable::lookup(pool.raw_pool()));
+
         for (int i = keyChain.size() - 1; i >= 0; i--) {
 
-            const std::string& k(keyChain[i].first);
-            const std::string& v(i > 0 ? keyChain[i-1].second : value);
+            uint32_t k = symbols.intern(keyChain[i].first);
+            uint32_t v = symbols.intern(i > 0 ? keyChain[i-1].second : value);
 
             // Allocate the relevant node
 
@@ -103,37 +251,170 @@ PersistentPtr<TreeNode> TreeNode::allocateNested(PersistentPool& pool,
 
 
 void TreeNode::addNode(const KeyType& key, const eckit::DataBlob& blob) {
+    addNode(key, blob.buffer(), blob.length());
+}
+
+
+void TreeNode::addNode(const KeyType& key, const void* data, size_t length) {
+    Payload payload = { data, length };
+    addNodeImpl(key, payload);
+}
+
+
+void TreeNode::addNode(const KeyType& key, const Payload& data) {
+    addNodeImpl(key, data);
+}
+
+
+void TreeNode::addNode(const KeyType& key, const AtomicConstructor<PersistentBuffer>& data) {
+    addNodeImpl(key, data);
+}
+
+
+void TreeNode::addNode(const KeyType& key, const PersistentPtr<PersistentBuffer>& shared) {
+    addNodeImpl(key, shared);
+}
+
+
+template <typename DataSource>
+void TreeNode::addNodeImpl(const KeyType& key, const DataSource& data) {
 
     // Check that this is supposed to be a subkey of this element.
     // TODO: What happens if we repeat eter a key --> should fail here. TEST.
+    InternTable& symbols(InternTable::lookup(this));
+
     ASSERT(key.size() > 0);
-    ASSERT(key_ == key[0].first);
+    ASSERT(key_ == symbols.find(key[0].first));
 
     // May not add subnodes to a leaf node.
-    ASSERT(data_.null());
+    ASSERT(!leaf());
 
-    // Find the sub-node, and recurse down into that to do the additions.
-    FixedString<12> value = key[0].second;
-    for (size_t i = 0; i < items_.size(); i++) {
-        if (items_[i]->value() == value) {
+    // Find the sub-node, and recurse down into that to do the additions. If the value has never been interned,
+    // there cannot be a matching sub-node (and n.b. no node has the id missing).
+    //
+    // n.b. Most insertions descend through nodes that already exist, so the search is made without locking. Nodes
+    //      are not freed while insertions are running (see removeNode), so the sub-node remains valid.
+
+    EpochManager& epochs(EpochManager::lookup(this));
+
+    KeyType subkeys(key.begin()+1, key.end());
+    PersistentPtr<TreeNode> subnode;
+
+    {
+        EpochGuard guard(epochs);
+        subnode = child(symbols.find(key[0].second));
+    }
+
+    if (subnode.null()) {
 
-            KeyType subkeys(key.begin()+1, key.end());
-            if (items_[i]->leaf())
-                throw LeafExistsError(std::string("The leaf ") + std::string(value) + " already exists", Here());
-            items_[i]->addNode(subkeys, blob);
+        // We have reached the bottom of the known tree. Create new nodes from here-on down. Another writer may
+        // have added the sub-node since the search, so it must be repeated once the lock is held (but no guard is
+        // needed, as only the lock holder replaces the list). The new sub-tree is fully constructed before it is
+        // published to readers.
+
+        AutoLock<PersistentMutex> lock(mutex_);
+        subnode = child(symbols.find(key[0].second));
+
+        if (subnode.null()) {
+            PersistentPool& pool(pmem::PoolRegistry::instance().poolFromPointer(this));
+            items_.publish_back(allocateNested(pool, key[0].second, subkeys, data), epochs);
             return;
         }
     }
 
-    // TODO: What happens if we are adding data in again...
+    if (subnode->leaf())
+        throw LeafExistsError(std::string("The leaf ") + key[0].second + " already exists", Here());
 
-    // We have reached the bottom of the known tree. Create new nodes from here-on down.
+    subnode->addNode(subkeys, data);
+}
 
-    KeyType subkeys(key.begin()+1, key.end());
 
-    PersistentPool& pool(pmem::PoolRegistry::instance().poolFromPointer(this));
+PersistentPtr<TreeNode> TreeNode::child(uint32_t value) const {
+
+    std::pair<PersistentVector<TreeNode>::const_iterator,
+              PersistentVector<TreeNode>::const_iterator> range = items_.published();
+
+    for (PersistentVector<TreeNode>::const_iterator it = range.first; it != range.second; ++it) {
+        if ((*it)->valueId() == value)
+            return *it;
+    }
+
+    return PersistentPtr<TreeNode>();
+}
+
+
+std::vector<PersistentPtr<TreeNode> > TreeNode::children() const {
+
+    std::pair<PersistentVector<TreeNode>::const_iterator,
+              PersistentVector<TreeNode>::const_iterator> range = items_.published();
+    return std::vector<PersistentPtr<TreeNode> >(range.first, range.second);
+}
+
+
+bool TreeNode::removeNode(const KeyType& key) {
+
+    InternTable& symbols(InternTable::lookup(this));
 
-    items_.push_back_elem(allocateNested(pool, value, subkeys, blob));
+    ASSERT(key.size() > 0);
+    ASSERT(key_ == symbols.find(key[0].first));
+    ASSERT(!leaf());
+
+    uint32_t value = symbols.find(key[0].second);
+    if (value == InternTable::missing)
+        return false;
+
+    for (size_t i = 0; i < items_.size(); i++) {
+
+        PersistentPtr<TreeNode> child = items_[i];
+        if (child->valueId() == value) {
+
+            if (child->leaf()) {
+                if (key.size() != 1)
+                    return false;
+            } else {
+                KeyType subkeys(key.begin()+1, key.end());
+                if (subkeys.size() == 0 || !child->removeNode(subkeys))
+                    return false;
+
+                // Only prune branches that have been left empty.
+                if (child->nodeCount() != 0)
+                    return true;
+            }
+
+            // Unlink the child before freeing it. If we are interrupted after this point, the storage is
+            // leaked but the tree remains consistent.
+
+            items_.erase(i);
+            child->releaseStorage();
+            child.free();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void TreeNode::releaseStorage() {
+
+    if (!data_.null() && !shared_)
+        data_.free();
+
+    if (!items_.null())
+        items_.free();
+}
+
+
+size_t TreeNode::compact() {
+
+    size_t count = items_.compact() ? 1 : 0;
+
+    for (PersistentVector<TreeNode>::const_iterator it = items_.begin(), end = items_.end(); it != end; ++it) {
+        if (!(*it)->leaf())
+            count += (*it)->compact();
+    }
+
+    return count;
 }
 
 
@@ -142,79 +423,303 @@ size_t TreeNode::nodeCount() const {
 }
 
 
-const eckit::FixedString<12>& TreeNode::key() const {
+const std::string& TreeNode::key() const {
+
+    // Leaf nodes have no key.
+    static const std::string none;
+    return key_ == InternTable::missing ? none : InternTable::lookup(this).string(key_);
+}
+
+
+const std::string& TreeNode::value() const {
+    return InternTable::lookup(this).string(value_);
+}
+
+
+uint32_t TreeNode::keyId() const {
     return key_;
 }
 
 
-const eckit::FixedString<12>& TreeNode::value() const {
+uint32_t TreeNode::valueId() const {
     return value_;
 }
 
 
 bool TreeNode::leaf() const {
-    return !data_.null();
+    return inlined_ || !data_.null();
 }
 
 
 const void * TreeNode::data() const {
-    return data_.null() ? 0 : data_->data();
+    if (inlined_)
+        return reinterpret_cast<const char*>(this) + sizeof(TreeNode);
+    if (data_.null())
+        return 0;
+    if (data_->compressed())
+        throw UserError("The data of leaf " + value() + " is compressed, and must be read with data(scratch)",
+                        Here());
+    return data_->data();
+}
+
+
+const void * TreeNode::data(std::vector<char>& scratch) const {
+    if (inlined_)
+        return data();
+    return data_.null() ? 0 : data_->data(scratch);
 }
 
 
 size_t TreeNode::dataSize() const {
+    if (inlined_)
+        return inlineLength_;
     return data_.null() ? 0 : data_->size();
 }
 
 
+const PersistentPtr<PersistentBuffer>& TreeNode::buffer() const {
+    return data_;
+}
+
+
+bool TreeNode::shared() const {
+    return shared_;
+}
+
+
+bool TreeNode::inlined() const {
+    return inlined_;
+}
+
+
+bool TreeNode::verify() const {
+
+    if (!inlined_)
+        return data_.null() || data_->verify();
+
+    uint32_t crc = checksum::crc32c(data(), inlineLength_);
+    bool ok = checksum::crc32c(&inlineLength_, sizeof(inlineLength_), crc) == inlineChecksum_;
+
+    if (!ok) {
+        Log::error() << "Checksum mismatch in inline leaf of " << inlineLength_ << " bytes at " << this
+                     << std::endl;
+    }
+
+    return ok;
+}
+
+
 const pmem::PersistentVector<TreeNode>& TreeNode::items() const {
     return items_;
 }
 
 
-std::vector<PersistentPtr<TreeNode> >
-TreeNode::lookup(const StringDict& request) {
+template <typename Function>
+bool TreeNode::select(const TreeQuery& query, size_t depth, Function fn) const {
 
     // Look through subnodes. Return depends on conditions
     //
-    // i) If the current key() is found in the request, then find matching values() in subnodes
-    // ii) If the current key() is not found in the request, consider all subnodes
+    // i) If the current key() is constrained by the query, then find the subnodes with matching values()
+    // ii) Otherwise consider all subnodes
     //
-    // - All relevant leaf() subnodes should be added to the result
-    // - The lookup should be propagated down into relevant non-leaf subnodes.
+    // n.b. No locks are taken. The subnodes are examined as most recently published, so insertions that complete
+    //      during the lookup may or may not be included.
 
     ASSERT(!leaf());
 
-    std::vector<PersistentPtr<TreeNode> > result;
+    const TreeQuery::Predicate* pred = query.predicate(key_, depth);
+
+    std::pair<PersistentVector<TreeNode>::const_iterator,
+              PersistentVector<TreeNode>::const_iterator> range = items_.published();
+
+    if (pred == 0) {
+
+        // Include all sub-nodes
+        for (PersistentVector<TreeNode>::const_iterator node = range.first; node != range.second; ++node) {
+            if (!fn(*node))
+                return false;
+        }
+
+    } else if (pred->unique()) {
 
-    if (request.find(key_) != request.end()) {
+        // A single value. n.b. the values of the subnodes are unique.
+        PersistentPtr<TreeNode> subnode = child(pred->ids[0]);
+        if (!subnode.null())
+            return fn(subnode);
+
+    } else if (!pred->none()) {
 
         // Test subnodes, and include those that match.
-        FixedString<12> value = request.find(key_)->second;
-        for (size_t i = 0; i < items_.size(); i++) {
-            if (items_[i]->value() == value) {
-                if (items_[i]->leaf()) {
-                    result.push_back(items_[i]);
+        for (PersistentVector<TreeNode>::const_iterator node = range.first; node != range.second; ++node) {
+            if (pred->matches((*node)->valueId()) && !fn(*node))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+
+std::vector<PersistentPtr<TreeNode> >
+TreeNode::lookup(const StringDict& request) {
+    return lookup(TreeQuery(InternTable::lookup(this), request));
+}
+
+
+std::vector<PersistentPtr<TreeNode> >
+TreeNode::lookup(const TreeQuery& query) {
+
+    std::vector<PersistentPtr<TreeNode> > result;
+
+    visit(query, [&result](const PersistentPtr<TreeNode>& leaf) {
+        result.push_back(leaf);
+        return true;
+    });
 
-                    // TODO: If we have unique names, this can exit the loop here.
+    return result;
+}
+
+
+bool TreeNode::visit(const StringDict& request, const Visitor& visitor) {
+    return visit(TreeQuery(InternTable::lookup(this), request), visitor);
+}
+
+
+bool TreeNode::visit(const TreeQuery& query, const Visitor& visitor) {
+
+    // A query compiled before strings were added to the table may not select them, so use an up to date copy.
+
+    if (query.stale()) {
+        TreeQuery current(query);
+        current.refresh();
+        return visit(current, visitor);
+    }
+
+    // The child lists that are examined are not freed before the lookup completes, even if they are replaced.
+
+    EpochGuard guard(EpochManager::lookup(this));
+
+    return visit(query, 0, visitor);
+}
+
+
+bool TreeNode::visit(const TreeQuery& query, size_t depth, const Visitor& visitor) {
+
+    // - All relevant leaf() subnodes should be passed to the visitor
+    // - The lookup should be propagated down into relevant non-leaf subnodes.
+    // - Once the visitor returns false, nothing further is examined.
+
+    return select(query, depth, [&query, depth, &visitor](const PersistentPtr<TreeNode>& node) {
+        return node->leaf() ? visitor(node) : node->visit(query, depth + 1, visitor);
+    });
+}
+
+
+namespace {
+
+/// The matches found beneath one node by an ordered parallel lookup, in the order of the children of the node.
+/// Each entry is either a leaf, or the matches beneath a subnode (which may be filled in by another thread).
+struct OrderedMatches {
+    std::vector<std::pair<PersistentPtr<TreeNode>, const OrderedMatches*> > entries;
+};
+
+
+/// A subtree to search. The matches are only recorded in tree order for ordered lookups.
+struct Subtree {
+    TreeNode* node;
+    size_t depth;
+    OrderedMatches* matches;
+};
+
+
+void flatten(const OrderedMatches& matches, std::vector<PersistentPtr<TreeNode> >& result) {
+
+    std::vector<std::pair<PersistentPtr<TreeNode>, const OrderedMatches*> >::const_iterator it;
+    for (it = matches.entries.begin(); it != matches.entries.end(); ++it) {
+        if (it->second)
+            flatten(*it->second, result);
+        else
+            result.push_back(it->first);
+    }
+}
+
+}
+
+
+std::vector<PersistentPtr<TreeNode> >
+TreeNode::parallelLookup(const StringDict& request, bool ordered, ThreadPool& pool) {
+    return parallelLookup(TreeQuery(InternTable::lookup(this), request), ordered, pool);
+}
+
+
+std::vector<PersistentPtr<TreeNode> >
+TreeNode::parallelLookup(const TreeQuery& query, bool ordered, ThreadPool& pool) {
+
+    if (query.stale()) {
+        TreeQuery current(query);
+        current.refresh();
+        return parallelLookup(current, ordered, pool);
+    }
+
+    // The workers only examine the tree while the calling thread is inside run(), so its guard covers them too.
+
+    EpochGuard guard(EpochManager::lookup(this));
+
+    WorkStealingScheduler<Subtree> scheduler(pool);
+    size_t participants = scheduler.participants();
+
+    // Each participant accumulates its matches separately, so the workers share nothing but the scheduler. For
+    // ordered lookups the matches of each subtree are kept apart (in deques, so they do not move), and are only
+    // assembled in tree order once the search is complete.
+
+    std::vector<std::vector<PersistentPtr<TreeNode> > > found(participants);
+    std::vector<std::deque<OrderedMatches> > subtrees(participants);
+    std::vector<size_t> counts(participants, 0);
+
+    OrderedMatches top;
+    Subtree root = { this, 0, ordered ? &top : 0 };
+
+    scheduler.run(std::vector<Subtree>(1, root),
+                  [&](const Subtree& subtree, WorkStealingScheduler<Subtree>::Worker& worker) {
+
+        size_t w = worker.index();
+
+        subtree.node->select(query, subtree.depth, [&](const PersistentPtr<TreeNode>& node) {
+
+            if (node->leaf()) {
+                if (subtree.matches) {
+                    subtree.matches->entries.push_back(std::make_pair(node, static_cast<OrderedMatches*>(0)));
+                    counts[w]++;
                 } else {
-                    std::vector<PersistentPtr<TreeNode> > tmp_nodes = items_[i]->lookup(request);
-                    result.insert(result.end(), tmp_nodes.begin(), tmp_nodes.end());
+                    found[w].push_back(node);
+                }
+            } else {
+                Subtree sub = { node.get(), subtree.depth + 1, 0 };
+                if (subtree.matches) {
+                    subtrees[w].push_back(OrderedMatches());
+                    sub.matches = &subtrees[w].back();
+                    subtree.matches->entries.push_back(std::make_pair(node, sub.matches));
                 }
+                worker.spawn(sub);
             }
-        }
+            return true;
+        });
+    });
 
-    } else {
+    // Assemble the result with a single copy of each match.
 
-        // Include all sub-nodes
-        for (size_t i = 0; i < items_.size(); i++) {
-            if (items_[i]->leaf()) {
-                result.push_back(items_[i]);
-            } else {
-                std::vector<PersistentPtr<TreeNode> > tmp_nodes = items_[i]->lookup(request);
-                result.insert(result.end(), tmp_nodes.begin(), tmp_nodes.end());
-            }
-        }
+    std::vector<PersistentPtr<TreeNode> > result;
+
+    if (ordered) {
+        size_t total = 0;
+        for (size_t i = 0; i < participants; i++) total += counts[i];
+        result.reserve(total);
+        flatten(top, result);
+    } else {
+        size_t total = 0;
+        for (size_t i = 0; i < participants; i++) total += found[i].size();
+        result.reserve(total);
+        for (size_t i = 0; i < participants; i++) result.insert(result.end(), found[i].begin(), found[i].end());
     }
 
     return result;
@@ -228,19 +733,31 @@ void TreeNode::printTree(std::ostream& os, std::string pad) const {
     std::string pad2(pad + "  ");
 
     if (leaf()) {
-        os << pad2 << "data: " << Bytes(dataSize()) << std::endl;
+        os << pad2 << "data: " << Bytes(dataSize());
+        if (inlined_)
+            os << " (inline)";
+        else if (data_->compressed())
+            os << " (compressed to " << Bytes(data_->storedSize()) << ")";
+        if (shared_)
+            os << " (shared)";
+        os << std::endl;
     } else {
-        os << pad2 << "key: " << key_ << "," << std::endl;
+        os << pad2 << "key: " << key() << "," << std::endl;
         os << pad2 << "items: [";
 
         std::string pad4(pad2 + "  ");
-        for (size_t i = 0; i < items_.size(); i++) {
-            if (i > 0) os << ",";
-            os << std::endl << pad4 << std::string(items_[i]->value()) << ": ";
-            items_[i]->printTree(os, pad4);
+        std::vector<PersistentPtr<TreeNode> > nodes;
+        {
+            EpochGuard guard(EpochManager::lookup(this));
+            nodes = children();
+        }
+        for (std::vector<PersistentPtr<TreeNode> >::const_iterator it = nodes.begin(); it != nodes.end(); ++it) {
+            if (it != nodes.begin()) os << ",";
+            os << std::endl << pad4 << (*it)->value() << ": ";
+            (*it)->printTree(os, pad4);
         }
 
-        if (items_.size() > 0) os << std::endl << pad2;
+        if (nodes.size() > 0) os << std::endl << pad2;
         os << "]" << std::endl;
     }
 
@@ -251,7 +768,7 @@ void TreeNode::printTree(std::ostream& os, std::string pad) const {
 
 std::ostream& operator<< (std::ostream& os, const TreeNode& node) {
     os << "TreeNode(key=" << node.key()
-       << ", data=" << (node.data_.null() ? "missing" : "present")
+       << ", data=" << (node.leaf() ? "present" : "missing")
        << ")";
     return os;
 }
@@ -20,17 +20,22 @@
 #ifndef tree_TreeNode_H
 #define tree_TreeNode_H
 
+#include <functional>
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
+#include <stdint.h>
 
-#include "eckit/types/FixedString.h"
 #include "eckit/types/Types.h"
 
+#include "pmem/PersistentMutex.h"
 #include "pmem/PersistentPtr.h"
 #include "pmem/PersistentVector.h"
 #include "pmem/PersistentBuffer.h"
+#include "pmem/ThreadPool.h"
+
+#include "pmem/tree/TreeQuery.h"
 
 namespace eckit {
     class DataBlob;
@@ -51,26 +56,105 @@ public: // types
         LeafExistsError(const std::string&, const eckit::CodeLocation&);
     };
 
+    /// Construct a leaf with its data stored inline, at the end of the node. The allocation is sized to fit.
+    class InlineConstructor : public pmem::AtomicConstructor<TreeNode> {
+    public: // methods
+        InlineConstructor(uint32_t value, const void* data, size_t length);
+        virtual void make(TreeNode& object) const;
+        virtual size_t size() const;
+    private: // members
+        uint32_t value_;
+        const void* data_;
+        size_t length_;
+    };
+
+    /// Called with each leaf matching a lookup. Returns false to stop the lookup.
+    typedef std::function<bool(const pmem::PersistentPtr<TreeNode>&)> Visitor;
+
+    /// Payloads of at most this many bytes, supplied from memory, are stored inline in the leaf node rather than in
+    /// a separate PersistentBuffer. This saves an allocation, and a pointer hop on every access. The data carries a
+    /// CRC32C checksum, as do PersistentBuffers.
+    static const size_t inline_threshold = 256;
+
 public: // methods
 
-    TreeNode(const std::string& key, const std::string& value);
-    TreeNode(const std::string& value, const pmem::PersistentPtr<pmem::PersistentBuffer>& dataBlob);
+    /// n.b. Keys and values are stored as ids in the intern table of the pool (see pmem::InternTable), which
+    ///      must be open before nodes are created or examined.
+
+    TreeNode(uint32_t key, uint32_t value);
+    TreeNode(uint32_t value, const pmem::PersistentPtr<pmem::PersistentBuffer>& dataBlob, bool shared=false);
+    TreeNode(uint32_t value, const void* data, size_t length);
+
+    /// The data for a leaf may be supplied either as a DataBlob (which is copied), as a constructor for the
+    /// PersistentBuffer (e.g. PersistentBuffer::StreamConstructor to read data directly into persistent memory), or
+    /// as an existing buffer that is shared with other leaves. Shared buffers are not owned by the leaf, and are not
+    /// freed when it is removed (see TreeDedupStore). Small payloads supplied from memory (or as a DataBlob) are
+    /// stored inline (see inline_threshold).
 
     static pmem::PersistentPtr<TreeNode> allocateLeaf(pmem::PersistentPool& pool,
                                                       const std::string& value,
                                                       const eckit::DataBlob& blob);
 
+    static pmem::PersistentPtr<TreeNode> allocateLeaf(pmem::PersistentPool& pool,
+                                                      const std::string& value,
+                                                      const void* data,
+                                                      size_t length);
+
+    static pmem::PersistentPtr<TreeNode> allocateLeaf(pmem::PersistentPool& pool,
+                                                      const std::string& value,
+                                                      const pmem::AtomicConstructor<pmem::PersistentBuffer>& data);
+
+    static pmem::PersistentPtr<TreeNode> allocateLeaf(pmem::PersistentPool& pool,
+                                                      const std::string& value,
+                                                      const pmem::PersistentPtr<pmem::PersistentBuffer>& shared);
+
     static pmem::PersistentPtr<TreeNode> allocateNested(pmem::PersistentPool& pool,
                                                         const std::string& value,
                                                         const KeyType& keyChain,
                                                         const eckit::DataBlob& blob);
 
+    static pmem::PersistentPtr<TreeNode> allocateNested(pmem::PersistentPool& pool,
+                                                        const std::string& value,
+                                                        const KeyType& keyChain,
+                                                        const void* data,
+                                                        size_t length);
+
+    static pmem::PersistentPtr<TreeNode> allocateNested(pmem::PersistentPool& pool,
+                                                        const std::string& value,
+                                                        const KeyType& keyChain,
+                                                        const pmem::AtomicConstructor<pmem::PersistentBuffer>& data);
+
+    static pmem::PersistentPtr<TreeNode> allocateNested(pmem::PersistentPool& pool,
+                                                        const std::string& value,
+                                                        const KeyType& keyChain,
+                                                        const pmem::PersistentPtr<pmem::PersistentBuffer>& shared);
+
     /// Add a new node
     /// @param key - The value used to select this sub-node from the current node
     /// @param name - Select which key-value pair is examined to select sub-sub-nodes
 //    void addNode(const std::string& key, const std::string& name, const eckit::DataBlob& blob);
 
+    /// Nodes may be added from several threads at once, alongside lookups. Lookups take no locks, as the children
+    /// are published atomically (see PersistentVector::publish_back), and the child lists they replace are freed by
+    /// the EpochManager of the pool once no lookup can be using them. Writers only lock a node while adding a child
+    /// to it, so insertions into different subtrees do not contend.
+    ///
+    /// n.b. The EpochManager (as well as the InternTable) of the pool must be open.
+
     void addNode(const KeyType& key, const eckit::DataBlob& blob);
+    void addNode(const KeyType& key, const void* data, size_t length);
+    void addNode(const KeyType& key, const pmem::AtomicConstructor<pmem::PersistentBuffer>& data);
+    void addNode(const KeyType& key, const pmem::PersistentPtr<pmem::PersistentBuffer>& shared);
+
+    /// Remove the leaf identified by the key (and any branches that are left empty), freeing its storage (except
+    /// for shared data, which the caller must release). Returns false if no such leaf exists.
+    /// @note Nodes are freed without regard to the node locks, so no other thread may be using the tree.
+    bool removeNode(const KeyType& key);
+
+    /// Rewrite any sparsely populated child lists in this subtree into dense ones. Returns the number of child lists
+    /// that were rewritten.
+    /// @note As for removeNode, no other thread may be using the tree.
+    size_t compact();
 
     /// How many subnodes are there to this node?
     size_t nodeCount() const;
@@ -79,39 +163,144 @@ public: // methods
     //      built on.
     std::vector<pmem::PersistentPtr<TreeNode> > lookup(const eckit::StringDict& key);
 
+    /// Look up the leaves selected by a compiled query (see TreeQuery), which may be reused for repeated lookups.
+    std::vector<pmem::PersistentPtr<TreeNode> > lookup(const TreeQuery& query);
+
+    /// Pass each leaf matching the key to the visitor as soon as it is found (in the same order as lookup), rather
+    /// than collecting them, so that large result sets can be processed in constant memory. The visitor returns
+    /// false to stop the lookup early, in which case visit returns false.
+    /// n.b. The visitor is called while the child lists are protected from reclamation (see pmem::EpochGuard), so
+    ///      it must not call EpochManager::synchronize.
+    bool visit(const eckit::StringDict& key, const Visitor& visitor);
+    bool visit(const TreeQuery& query, const Visitor& visitor);
+
+    /// As lookup, but the selected subtrees are searched in parallel (see pmem::WorkStealingScheduler). This pays off
+    /// for partial keys, which select many subtrees. If ordered, the leaves are returned in the same order as by
+    /// lookup, otherwise in the order they are found (which saves assembling the results in tree order).
+    std::vector<pmem::PersistentPtr<TreeNode> > parallelLookup(const eckit::StringDict& key, bool ordered=true,
+                                                               pmem::ThreadPool& pool=pmem::ThreadPool::instance());
+    std::vector<pmem::PersistentPtr<TreeNode> > parallelLookup(const TreeQuery& query, bool ordered=true,
+                                                               pmem::ThreadPool& pool=pmem::ThreadPool::instance());
+
     void printTree(std::ostream& os, std::string pad="") const;
 
     /// The value by which this node is associated to its _parent's_ key.
-    const eckit::FixedString<12>& value() const;
+    const std::string& value() const;
 
     /// The key by which child nodes are selected
-    const eckit::FixedString<12>& key() const;
+    const std::string& key() const;
+
+    /// The ids of the value and key in the intern table of the pool.
+    uint32_t valueId() const;
+    uint32_t keyId() const;
 
     /// Does this node contain data?
     bool leaf() const;
 
+    /// Direct access to the data. Throws eckit::UserError for compressed leaves, which must be read via
+    /// data(scratch).
     const void * data() const;
 
+    /// Access to the data, which is decompressed into the scratch space if need be.
+    const void * data(std::vector<char>& scratch) const;
+
     size_t dataSize() const;
 
+    /// The buffer holding the data. This is null if the data is stored inline.
+    const pmem::PersistentPtr<pmem::PersistentBuffer>& buffer() const;
+
+    /// Is the data stored inline in this node?
+    bool inlined() const;
+
+    /// Verify the checksum of the data, whether it is stored inline or in a buffer.
+    bool verify() const;
+
+    /// Is the data shared with other leaves?
+    bool shared() const;
+
 protected: //
 
     /// A utility method to facilitate testing.
     const pmem::PersistentVector<TreeNode>& items() const;
 
+private: // types
+
+    /// Data supplied from memory, which may be stored inline.
+    struct Payload {
+        const void* data;
+        size_t length;
+    };
+
+private: // methods
+
+    /// Visit the leaves beneath this node, which is at the given depth in the tree. The query must be resolved.
+    bool visit(const TreeQuery& query, size_t depth, const Visitor& visitor);
+
+    /// Pass each of the children selected by the query to fn, until it returns false. Returns false if stopped.
+    /// The caller must hold an EpochGuard.
+    template <typename Function>
+    bool select(const TreeQuery& query, size_t depth, Function fn) const;
+
+    /// The child selected by the given value id (or null). The caller must hold an EpochGuard.
+    pmem::PersistentPtr<TreeNode> child(uint32_t value) const;
+
+    /// A copy of the list of children, as currently published. The caller must hold an EpochGuard.
+    std::vector<pmem::PersistentPtr<TreeNode> > children() const;
+
+    static pmem::PersistentPtr<TreeNode> allocateLeaf(pmem::PersistentPool& pool,
+                                                      const std::string& value,
+                                                      const Payload& data);
+
+    static pmem::PersistentPtr<TreeNode> allocateNested(pmem::PersistentPool& pool,
+                                                        const std::string& value,
+                                                        const KeyType& keyChain,
+                                                        const Payload& data);
+
+    void addNode(const KeyType& key, const Payload& data);
+
+    template <typename DataSource>
+    static pmem::PersistentPtr<TreeNode> allocateNestedImpl(pmem::PersistentPool& pool,
+                                                            const std::string& value,
+                                                            const KeyType& keyChain,
+                                                            const DataSource& data);
+
+    template <typename DataSource>
+    void addNodeImpl(const KeyType& key, const DataSource& data);
+
+    /// Free the storage owned by this node (but not the node itself), once it has been unlinked from the tree.
+    void releaseStorage();
+
 private: // members
 
     pmem::PersistentVector<TreeNode> items_;
 
     pmem::PersistentPtr<pmem::PersistentBuffer> data_;
 
-    eckit::FixedString<12> value_;
+    uint32_t value_;
+
+    uint32_t key_;
+
+    /// The length of the data stored inline (immediately after the node), if inlined_ is set.
+    uint32_t inlineLength_;
+
+    /// The CRC32C checksum of the inline data (and its length), computed as it is copied in.
+    uint32_t inlineChecksum_;
 
-    eckit::FixedString<12> key_;
+    bool shared_;
+
+    bool inlined_;
+
+    /// Serialises the writers that add children to items_. n.b. the other members are not modified once the node
+    /// is constructed.
+    pmem::PersistentMutex mutex_;
 
 private:
 
     friend std::ostream& operator<< (std::ostream&, const TreeNode&);
+
+    /// The indexes follow the child lists (see TreeIndex and TreeKeyIndex).
+    friend class TreeIndex;
+    friend class TreeKeyIndex;
 };
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -18,6 +18,7 @@
 
 #include "pmem/PersistentPtr.h"
 #include "pmem/AtomicConstructor.h"
+#include "pmem/EpochManager.h"
 #include "pmem/PersistentString.h"
 
 #include "pmem/tree/TreePool.h"
@@ -43,6 +44,16 @@ template<> uint64_t pmem::PersistentType<pmem::PersistentVectorData<tree::TreeNo
 
 template<> uint64_t pmem::PersistentType<pmem::PersistentBuffer>::type_id = 3;
 
+template<> uint64_t pmem::PersistentType<tree::TreeDedupStore>::type_id = 4;
+
+template<> uint64_t pmem::PersistentType<pmem::PersistentString>::type_id = 5;
+
+template<> uint64_t pmem::PersistentType<pmem::PersistentVectorData<pmem::PersistentString> >::type_id = 6;
+
+template<> uint64_t pmem::PersistentType<pmem::PersistentRetireList>::type_id = 7;
+
+template<> uint64_t pmem::PersistentType<tree::TreeKeyIndex>::type_id = 8;
+
 
 
 namespace tree {
@@ -0,0 +1,390 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+
+#include "eckit/exception/Exceptions.h"
+
+#include "pmem/InternTable.h"
+
+#include "pmem/tree/TreeQuery.h"
+
+using namespace eckit;
+using namespace pmem;
+
+
+namespace tree {
+
+namespace {
+
+/// Parse a value as a number. Returns false if the whole string is not a number.
+bool numeric(const std::string& str, double& value) {
+
+    if (str.empty())
+        return false;
+
+    const char* begin = str.c_str();
+    char* end;
+    value = ::strtod(begin, &end);
+
+    return end == begin + str.length() && std::isfinite(value);
+}
+
+
+/// Split a MARS style list of values (separated by slashes), trimming any whitespace around them.
+std::vector<std::string> split(const std::string& values) {
+
+    std::vector<std::string> tokens;
+
+    for (size_t start = 0; start <= values.length(); ) {
+
+        size_t end = values.find('/', start);
+        if (end == std::string::npos) end = values.length();
+
+        size_t first = start;
+        size_t last = end;
+        while (first < last && std::isspace(static_cast<unsigned char>(values[first]))) ++first;
+        while (last > first && std::isspace(static_cast<unsigned char>(values[last - 1]))) --last;
+
+        tokens.push_back(values.substr(first, last - first));
+        start = end + 1;
+    }
+
+    return tokens;
+}
+
+
+/// Does the token match the (lower case) keyword, in any case?
+bool keyword(const std::string& token, const char* word) {
+
+    if (token.length() != ::strlen(word))
+        return false;
+
+    for (size_t i = 0; i < token.length(); i++) {
+        if (std::tolower(static_cast<unsigned char>(token[i])) != word[i])
+            return false;
+    }
+
+    return true;
+}
+
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+TreeQuery::Predicate::Predicate(const std::string& k) :
+    key(k),
+    type(Any),
+    lower(0),
+    upper(0),
+    step(0),
+    keyId(InternTable::missing),
+    symbols(0) {}
+
+
+bool TreeQuery::Predicate::matches(uint32_t value) const {
+
+    switch (type) {
+
+    case Any:
+        return true;
+
+    case Exact:
+    case Set:
+        return std::binary_search(ids.begin(), ids.end(), value);
+
+    case Range: {
+
+        ASSERT(symbols);
+
+        double number;
+        if (!symbols->number(value, number) || number < lower || number > upper)
+            return false;
+
+        if (step != 0) {
+            double steps = (number - lower) / step;
+            if (std::fabs(steps - std::floor(steps + 0.5)) > 1e-9)
+                return false;
+        }
+
+        return true;
+    }
+    }
+
+    return false;
+}
+
+
+bool TreeQuery::Predicate::none() const {
+    return (type == Exact || type == Set) && ids.empty();
+}
+
+
+bool TreeQuery::Predicate::unique() const {
+    return (type == Exact || type == Set) && ids.size() == 1;
+}
+
+
+TreeQuery::TreeQuery(const InternTable& symbols, const std::vector<std::string>& levels) :
+    symbols_(&symbols),
+    predicates_(levels.begin(), levels.end()),
+    levels_(levels.size()),
+    resolved_(0) {
+
+    refresh();
+}
+
+
+TreeQuery::TreeQuery(const InternTable& symbols,
+                     const StringDict& request,
+                     const std::vector<std::string>& levels,
+                     bool lists) :
+    symbols_(&symbols),
+    predicates_(levels.begin(), levels.end()),
+    levels_(levels.size()),
+    resolved_(0) {
+
+    for (StringDict::const_iterator it = request.begin(); it != request.end(); ++it) {
+        if (lists)
+            parse(it->first, it->second);
+        else
+            exact(it->first, it->second);
+    }
+
+    refresh();
+}
+
+
+TreeQuery::Predicate& TreeQuery::constrain(const std::string& key, MatchType type) {
+
+    std::vector<Predicate>::iterator it = predicates_.begin();
+    while (it != predicates_.end() && it->key != key)
+        ++it;
+
+    if (it == predicates_.end()) {
+        predicates_.push_back(Predicate(key));
+        it = predicates_.end() - 1;
+    }
+
+    Predicate& pred(*it);
+    pred.type = type;
+    pred.values.clear();
+    pred.lower = pred.upper = pred.step = 0;
+
+    return pred;
+}
+
+
+TreeQuery& TreeQuery::any(const std::string& key) {
+    resolve(constrain(key, Any));
+    return *this;
+}
+
+
+TreeQuery& TreeQuery::exact(const std::string& key, const std::string& value) {
+    Predicate& pred(constrain(key, Exact));
+    pred.values.push_back(value);
+    resolve(pred);
+    return *this;
+}
+
+
+TreeQuery& TreeQuery::set(const std::string& key, const std::vector<std::string>& values) {
+    Predicate& pred(constrain(key, Set));
+    pred.values = values;
+    resolve(pred);
+    return *this;
+}
+
+
+TreeQuery& TreeQuery::range(const std::string& key, double lower, double upper, double step) {
+
+    if (step < 0)
+        throw BadParameter("Negative step in range for key " + key, Here());
+
+    Predicate& pred(constrain(key, Range));
+    pred.lower = lower;
+    pred.upper = upper;
+    pred.step = step;
+    resolve(pred);
+    return *this;
+}
+
+
+TreeQuery& TreeQuery::parse(const std::string& key, const std::string& values) {
+
+    std::vector<std::string> tokens = split(values);
+
+    if (std::find(tokens.begin(), tokens.end(), std::string()) != tokens.end())
+        throw BadParameter("Empty value in request for key " + key + ": " + values, Here());
+
+    // A range: lower/to/upper, or lower/to/upper/by/step
+
+    if (tokens.size() > 1 && keyword(tokens[1], "to")) {
+
+        double lower, upper, step = 0;
+
+        if ((tokens.size() != 3 && (tokens.size() != 5 || !keyword(tokens[3], "by"))) ||
+            !numeric(tokens[0], lower) || !numeric(tokens[2], upper) ||
+            (tokens.size() == 5 && !numeric(tokens[4], step))) {
+            throw BadParameter("Invalid range in request for key " + key + ": " + values, Here());
+        }
+
+        return range(key, lower, upper, step);
+    }
+
+    if (tokens.size() == 1)
+        return exact(key, tokens[0]);
+
+    return set(key, tokens);
+}
+
+
+bool TreeQuery::complete() const {
+
+    for (size_t i = 0; i < levels_; i++) {
+        const Predicate& pred(predicates_[i]);
+        if (pred.type != Exact && (pred.type != Set || pred.values.size() != 1))
+            return false;
+    }
+
+    return true;
+}
+
+
+bool TreeQuery::path(std::vector<uint32_t>& ids) const {
+
+    ASSERT(complete());
+
+    ids.clear();
+    ids.reserve(levels_);
+
+    for (size_t i = 0; i < levels_; i++) {
+        if (predicates_[i].ids.empty())
+            return false;
+        ids.push_back(predicates_[i].ids[0]);
+    }
+
+    return true;
+}
+
+
+bool TreeQuery::stale() const {
+    return symbols_->size() != resolved_;
+}
+
+
+void TreeQuery::refresh() {
+
+    size_t size = symbols_->size();
+
+    for (std::vector<Predicate>::iterator it = predicates_.begin(); it != predicates_.end(); ++it) {
+        resolve(*it);
+    }
+
+    resolved_ = size;
+}
+
+
+void TreeQuery::resolve(Predicate& pred) const {
+
+    pred.keyId = symbols_->find(pred.key);
+    pred.symbols = symbols_;
+    pred.ids.clear();
+
+    switch (pred.type) {
+
+    case Any:
+    case Range:
+        break;
+
+    case Exact:
+    case Set:
+
+        // Values that have not been interned cannot match any node, so are left out.
+
+        for (std::vector<std::string>::const_iterator it = pred.values.begin(); it != pred.values.end(); ++it) {
+            uint32_t id = symbols_->find(*it);
+            if (id != InternTable::missing)
+                pred.ids.push_back(id);
+        }
+        break;
+    }
+
+    std::sort(pred.ids.begin(), pred.ids.end());
+    pred.ids.erase(std::unique(pred.ids.begin(), pred.ids.end()), pred.ids.end());
+}
+
+
+const TreeQuery::Predicate* TreeQuery::predicate(uint32_t key, size_t depth) const {
+
+    // Normally the key is the one expected at this depth. Otherwise search for it.
+
+    const Predicate* pred = 0;
+
+    if (depth < levels_ && predicates_[depth].keyId == key) {
+        pred = &predicates_[depth];
+    } else {
+        for (std::vector<Predicate>::const_iterator it = predicates_.begin(); it != predicates_.end(); ++it) {
+            if (it->keyId == key) {
+                pred = &*it;
+                break;
+            }
+        }
+    }
+
+    return (pred && pred->type != Any) ? pred : 0;
+}
+
+
+void TreeQuery::print(std::ostream& os) const {
+
+    os << "TreeQuery(";
+
+    const char* sep = "";
+    for (std::vector<Predicate>::const_iterator it = predicates_.begin(); it != predicates_.end(); ++it) {
+
+        if (it->type == Any)
+            continue;
+
+        os << sep << it->key << "=";
+        sep = ", ";
+
+        if (it->type == Range) {
+            os << it->lower << "/to/" << it->upper;
+            if (it->step != 0) os << "/by/" << it->step;
+        } else {
+            for (size_t i = 0; i < it->values.size(); i++) {
+                os << (i == 0 ? "" : "/") << it->values[i];
+            }
+        }
+    }
+
+    os << ")";
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace tree
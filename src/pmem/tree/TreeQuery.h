@@ -0,0 +1,185 @@
+/*
+ * (C) Copyright 1996-2017 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation
+ * nor does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+/// @author Simon Smart
+/// @date   Oct 2026
+
+
+#ifndef tree_TreeQuery_H
+#define tree_TreeQuery_H
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "eckit/types/Types.h"
+
+namespace pmem {
+    class InternTable;
+}
+
+
+/*
+ * Modus-operandi:
+ *
+ * A lookup request, compiled into a plan that the tree nodes can evaluate without touching any strings. The plan
+ * holds one predicate for each level of the tree (in the order of the keys of the TreeSchema), so the predicate for
+ * a node is found by its depth. Each predicate selects the children of a node by their value:
+ *
+ *   - any:   all of the children.
+ *   - exact: the child with the given value.
+ *   - set:   the children with any of the given values.
+ *   - range: the children whose values are numbers in the given (inclusive) range, optionally in steps.
+ *
+ * Requests may be written in the style of MARS, with a list of values (e.g. param=t/u/v) or a range (e.g.
+ * step=0/to/240/by/6) for each key (see parse). However many combinations of values a request describes, it is
+ * evaluated in a single traversal of the tree.
+ *
+ * When the plan is resolved, the keys and values are translated into ids in the InternTable of the pool, and exact
+ * and set predicates are reduced to a sorted list of the value ids that they match. Their children are then tested
+ * with integer comparisons only. Ranges are not expanded (which would mean examining every string in the table);
+ * instead each child is tested against the bounds using the numeric value that the table caches for its value id.
+ *
+ * A plan may be reused for any number of lookups. The strings it refers to may not have been interned when it was
+ * resolved, so a plan goes stale once strings are added to the table. Lookups then resolve a copy of the plan.
+ * refresh() brings the plan itself up to date.
+ *
+ * n.b. The depth of a node is only a hint. If a node's key is not the one expected at its depth (e.g. the plan was
+ *      compiled without the schema), the predicates are searched for its key instead.
+ */
+
+
+namespace tree {
+
+//----------------------------------------------------------------------------------------------------------------------
+
+class TreeQuery {
+
+public: // types
+
+    enum MatchType { Any, Exact, Set, Range };
+
+    /// The selection made at one level of the tree.
+    struct Predicate {
+
+        Predicate(const std::string& key);
+
+        /// Does the predicate select the child with the given value id? The predicate must be resolved.
+        bool matches(uint32_t value) const;
+
+        /// Is it known, without testing the children, that the predicate selects none of them, or at most the one
+        /// with the value ids[0]? Never true for ranges, whose children are always tested.
+        bool none() const;
+        bool unique() const;
+
+        std::string key;
+        MatchType type;
+
+        /// The values for exact and set predicates.
+        std::vector<std::string> values;
+
+        /// The bounds and step for range predicates. A step of zero includes every number in the range.
+        double lower;
+        double upper;
+        double step;
+
+        /// The id of the key, and the sorted ids of the values that match (for exact and set predicates). Set when
+        /// the plan is resolved.
+        uint32_t keyId;
+        std::vector<uint32_t> ids;
+
+        /// The table that holds the numeric values of the ids (for range predicates).
+        const pmem::InternTable* symbols;
+    };
+
+public: // methods
+
+    /// A plan that matches everything, for the tree using the given table. The levels are the keys of the tree, in
+    /// order from the root (see TreeSchema::keys).
+    /// n.b. The plan refers to the table, which must remain open while it is used.
+    TreeQuery(const pmem::InternTable& symbols,
+              const std::vector<std::string>& levels=std::vector<std::string>());
+
+    /// Compile a request with a single value for each of its keys, or (if lists is set) a MARS style
+    /// specification (see parse).
+    TreeQuery(const pmem::InternTable& symbols,
+              const eckit::StringDict& request,
+              const std::vector<std::string>& levels=std::vector<std::string>(),
+              bool lists=false);
+
+    /// Constrain a key. Each replaces any earlier constraint on the same key.
+    TreeQuery& any(const std::string& key);
+    TreeQuery& exact(const std::string& key, const std::string& value);
+    TreeQuery& set(const std::string& key, const std::vector<std::string>& values);
+    TreeQuery& range(const std::string& key, double lower, double upper, double step=0);
+
+    /// Constrain a key with a MARS style specification: a single value, a list of values separated by slashes
+    /// (t/u/v), or a numeric range with an optional step (0/to/240 or 0/to/240/by/6).
+    TreeQuery& parse(const std::string& key, const std::string& values);
+
+    /// Does the plan select a single value of every level (so that it matches at most one leaf)?
+    bool complete() const;
+
+    /// For a complete plan, the id of the value selected at each level (see TreeKeyIndex). Returns false if any of
+    /// the values has not been interned, so that no leaf can match. The plan must be resolved.
+    bool path(std::vector<uint32_t>& ids) const;
+
+    /// Have strings been added to the table since the plan was resolved?
+    bool stale() const;
+
+    /// Resolve the plan against the current contents of the table.
+    void refresh();
+
+    /// The predicate for a node with the given key id at the given depth, or null if its children are not
+    /// constrained. The plan must be resolved.
+    const Predicate* predicate(uint32_t key, size_t depth) const;
+
+protected: // methods
+
+    void print(std::ostream&) const;
+
+private: // methods
+
+    Predicate& constrain(const std::string& key, MatchType type);
+
+    void resolve(Predicate& predicate) const;
+
+private: // members
+
+    const pmem::InternTable* symbols_;
+
+    /// The predicates for each level of the tree, followed by those for any other keys that are constrained.
+    std::vector<Predicate> predicates_;
+
+    size_t levels_;
+
+    /// The size of the table when the plan was last resolved.
+    size_t resolved_;
+
+private: // friends
+
+    friend std::ostream& operator<<(std::ostream& os, const TreeQuery& q) {
+        q.print(os);
+        return os;
+    }
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+} // namespace tree
+
+#endif // tree_TreeQuery_H
@@ -14,12 +14,19 @@
 /// @author Simon Smart
 /// @date   Feb 2016
 
+#include <exception>
+
 #include "eckit/io/DataBlob.h"
+#include "eckit/io/DataHandle.h"
 #include "eckit/log/Log.h"
+#include "eckit/memory/ScopedPtr.h"
 #include "eckit/parser/JSONDataBlob.h"
 #include "eckit/types/Types.h"
 
+#include "pmem/Exceptions.h"
+#include "pmem/LibPMem.h"
 #include "pmem/PersistentBuffer.h"
+#include "pmem/PersistentBufferHandle.h"
 #include "pmem/PoolRegistry.h"
 
 #include "pmem/tree/TreeNode.h"
@@ -44,6 +51,11 @@ void TreeRoot::Constructor::make(TreeRoot& object) const {
     object.tag_ = TreeRootTag;
     object.node_.nullify();
     object.schema_.nullify();
+    object.dedup_.nullify();
+    object.keys_.nullify();
+    object.symbols_.nullify();
+    object.retired_.nullify();
+    object.lock_.zero();
 
     // Creata a data blob from the schema, so we can store it
     std::string json = schema_.json_str();
@@ -56,7 +68,7 @@ void TreeRoot::Constructor::make(TreeRoot& object) const {
 /*
  * We can use whatever knowledge we have to test the validity of the structure.
  *
- * For now, we just check that the tag is set (i.e. it is initialised).
+ * For now, we just check that the tag is set (i.e. it is initialised), and that it matches the current layout.
  */
 bool TreeRoot::valid() const {
 
@@ -72,10 +84,33 @@ PersistentPtr<TreeNode> TreeRoot::rootNode() const {
 
 
 void TreeRoot::addNode(const KeyType& key, const eckit::DataBlob& blob) {
+    addNode(key, blob.buffer(), blob.length());
+}
+
+
+void TreeRoot::addNode(const KeyType& key, const void* data, size_t length) {
+
+    ASSERT(key.size() != 0);
+
+    Log::debug<LibPMem>() << "addNode: " << key << std::endl;
+
+    // n.b. Small payloads are stored inline in the leaf node.
+
+    if (node_.null()) {
+        PersistentPool& pool(pmem::PoolRegistry::instance().poolFromPointer(this));
+        node_ = TreeNode::allocateNested(pool, key.front().first, key, data, length);
+    } else {
+        ASSERT(node_->key() == key[0].first);
+        node_->addNode(key, data, length);
+    }
+}
+
+
+void TreeRoot::addNode(const KeyType& key, const AtomicConstructor<PersistentBuffer>& data) {
 
     ASSERT(key.size() != 0);
 
-    Log::info() << "addNode: " << key << std::endl << std::flush;
+    Log::debug<LibPMem>() << "addNode: " << key << std::endl;
 
     // If we don't yet have a root node, we need to create it.
     // n.b. This could in principle be done in the TreeRoot constructor, if we assumed we
@@ -84,18 +119,86 @@ void TreeRoot::addNode(const KeyType& key, const eckit::DataBlob& blob) {
 
         // TODO: PERSIST THIS
         PersistentPool& pool(pmem::PoolRegistry::instance().poolFromPointer(this));
-        node_ = TreeNode::allocateNested(pool, key.front().first, key, blob);
+        node_ = TreeNode::allocateNested(pool, key.front().first, key, data);
 
     } else {
         ASSERT(node_->key() == key[0].first);
-        node_->addNode(key, blob);
+        node_->addNode(key, data);
     }
 }
 
+
+void TreeRoot::addNode(const KeyType& key, const PersistentPtr<PersistentBuffer>& shared) {
+
+    ASSERT(key.size() != 0);
+
+    Log::debug<LibPMem>() << "addNode (shared): " << key << std::endl;
+
+    if (node_.null()) {
+        PersistentPool& pool(pmem::PoolRegistry::instance().poolFromPointer(this));
+        node_ = TreeNode::allocateNested(pool, key.front().first, key, shared);
+    } else {
+        ASSERT(node_->key() == key[0].first);
+        node_->addNode(key, shared);
+    }
+}
+
+
+bool TreeRoot::removeNode(const KeyType& key) {
+
+    ASSERT(key.size() != 0);
+
+    if (node_.null())
+        return false;
+
+    ASSERT(node_->key() == key[0].first);
+    return node_->removeNode(key);
+}
+
 // -------------------------------------------------------------------------------------------------
 
-TreeObject::TreeObject(TreeRoot &root) :
-    root_(root) {
+/// The number of slots in a newly created deduplication store. It doubles as required.
+static const size_t initial_dedup_capacity = 1024;
+
+
+namespace {
+
+/// Insertions may run in parallel with each other (and with lookups), as TreeNode locks the nodes individually as
+/// they are modified. The exception is the creation of the root node, which requires exclusive access to the tree.
+
+class InsertLock : private NonCopyable {
+public:
+    InsertLock(PersistentRWLock& lock, const TreeRoot& root) : lock_(lock) {
+        lock_.lockRead();
+        if (root.rootNode().null()) {
+            lock_.unlock();
+            lock_.lockWrite();
+        }
+    }
+    ~InsertLock() { lock_.unlock(); }
+private:
+    PersistentRWLock& lock_;
+};
+
+}
+
+
+TreeObject::TreeObject(TreeRoot &root, const TreeIndex::Options& index) :
+    root_(root),
+    symbols_(root.symbols_),
+    epochs_(root.retired_),
+    compress_(false),
+    dedup_(false),
+    parallelLookup_(false),
+    orderedLookup_(true) {
+
+    // Nothing in the pool can be read unless it has the current layout.
+
+    if (!root_.valid()) {
+        throw PersistentError("Tree pool has tag \"" + root_.tag_.asString() + "\" (expected \"" +
+                              TreeRootTag.asString() + "\"). It is not initialised, or was written by an " +
+                              "incompatible version, and must be recreated", Here());
+    }
 
     std::string str_schema(reinterpret_cast<const char*>(root_.schema_->data()), root_.schema_->size());
     std::istringstream iss(str_schema);
@@ -103,6 +206,24 @@ TreeObject::TreeObject(TreeRoot &root) :
 
     Log::info() << "Created TreeObject wrapper." << std::endl;
     Log::info() << "Schema: " << schema_ << std::endl;
+
+    // Tidy up after any deduplicated insertions or removals that were interrupted.
+    if (!root_.dedup_.null())
+        root_.dedup_->recover();
+
+    // And bring the key index up to date with the tree.
+    if (!root_.keys_.null()) {
+        EpochGuard guard(epochs_);
+        root_.keys_->recover(root_.rootNode());
+    }
+
+    if (index.enabled) {
+        index_.reset(new TreeIndex(symbols_, index.budget));
+        if (!index.lazy) {
+            AutoReadLock lock(root_.lock_);
+            index_->build(root_.rootNode());
+        }
+    }
 }
 
 TreeObject::~TreeObject() {}
@@ -111,14 +232,309 @@ void TreeObject::print(std::ostream& os) const {
     os << "TreeObject [TreeRoot wrapper]";
 }
 
+template <typename Function>
+void TreeObject::addLeaf(const KeyType& key, Function fn) {
+
+    if (!root_.keys_.null()) {
+
+        // The key is reserved in the key index before the leaf is added, so that if interrupted it is left pending
+        // (and resolved from the tree when the pool is next opened). Once added (or not, if it fails) the key is
+        // resolved from the tree, as the table may have been replaced meanwhile.
+
+        std::vector<uint32_t> ids = encode(key);
+        uint64_t digest = TreeKeyIndex::digest(ids);
+
+        {
+            std::lock_guard<std::mutex> lock(keysMutex_);
+            reserveKeySpace();
+            root_.keys_->reserve(ids, digest);
+        }
+
+        std::exception_ptr error;
+
+        try {
+            fn();
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        {
+            EpochGuard guard(epochs_);
+            PersistentPtr<TreeNode> leaf = TreeKeyIndex::leaf(root_.rootNode(), ids);
+
+            std::lock_guard<std::mutex> lock(keysMutex_);
+            reserveKeySpace();
+            root_.keys_->resolve(ids, digest, leaf);
+        }
+
+        if (error)
+            std::rethrow_exception(error);
+    } else {
+        fn();
+    }
+
+    if (index_)
+        index_->add(root_.rootNode(), key);
+}
+
+
 void TreeObject::addNode(const StringDict& key, const DataBlob &blob) {
 
-    root_.addNode(schema_.processInsertKey(key), blob);
+    KeyType insertKey = schema_.processInsertKey(key);
+
+    InsertLock lock(root_.lock_, root_);
+    addLeaf(insertKey, [&]() { insert(insertKey, blob.buffer(), blob.length()); });
+}
+
+
+void TreeObject::addNode(const StringDict& key, DataHandle& handle) {
+
+    KeyType insertKey = schema_.processInsertKey(key);
+
+    size_t length = handle.openForRead();
+
+    try {
+        if (compress_ || dedup_ || length == 0) {
+
+            // A handle that does not know its length reports zero, so it is read until it is exhausted (rather
+            // than stored as an empty leaf).
+
+            bool unknown = (length == 0);
+            std::vector<char> data(unknown ? PersistentBuffer::stream_chunk_size : length);
+
+            size_t pos = 0;
+            while (pos < data.size()) {
+                long n = handle.read(&data[pos], data.size() - pos);
+                if (n < 0 || (n == 0 && !unknown))
+                    throw ReadError(std::string("Short read from ") + handle.title(), Here());
+                if (n == 0)
+                    break;
+                pos += n;
+                if (unknown && pos == data.size())
+                    data.resize(2 * data.size());
+            }
+
+            length = pos;
+
+            InsertLock lock(root_.lock_, root_);
+            addLeaf(insertKey, [&]() { insert(insertKey, data.empty() ? 0 : &data[0], length); });
+        } else {
+            InsertLock lock(root_.lock_, root_);
+            addLeaf(insertKey, [&]() {
+                root_.addNode(insertKey, PersistentBuffer::StreamConstructor(handle, length));
+            });
+        }
+    } catch (...) {
+        handle.close();
+        throw;
+    }
+
+    handle.close();
+}
+
+
+void TreeObject::insert(const KeyType& key, const void* data, size_t length) {
+
+    if (dedup_) {
+        insertShared(key, data, length);
+    } else if (compress_) {
+        root_.addNode(key, PersistentBuffer::CompressedConstructor(data, length));
+    } else {
+        root_.addNode(key, data, length);
+    }
+}
+
+
+void TreeObject::insertShared(const KeyType& key, const void* data, size_t length) {
+
+    // Take a reference to the shared buffer (adding it if need be) before it is linked into the tree. An
+    // interruption before the leaf is linked in can then only leak the buffer, rather than free one in use.
+    //
+    // n.b. Only the deduplication store is locked here. Adding the leaf to the tree can proceed in parallel.
+
+    uint64_t digest = TreeDedupStore::digest(data, length);
+    PersistentPtr<PersistentBuffer> buffer;
+
+    {
+        std::lock_guard<std::mutex> lock(dedupMutex_);
+
+        if (root_.dedup_.null())
+            root_.dedup_.allocate_ctr(TreeDedupStore::Constructor(initial_dedup_capacity));
+
+        buffer = root_.dedup_->acquire(data, length, digest);
+
+        if (buffer.null()) {
+
+            if (root_.dedup_->full()) {
+                size_t capacity = 2 * root_.dedup_->capacity();
+                Log::debug<LibPMem>() << "Growing deduplication store to " << capacity << " slots" << std::endl;
+                root_.dedup_->recover();
+                root_.dedup_.replace_ctr(TreeDedupStore::Constructor(*root_.dedup_, capacity));
+            }
+
+            if (compress_) {
+                buffer = root_.dedup_->insert(digest, PersistentBuffer::CompressedConstructor(data, length));
+            } else {
+                buffer = root_.dedup_->insert(digest, AtomicConstructor2<PersistentBuffer, const void*, size_t>(data, length));
+            }
+        }
+    }
+
+    try {
+        root_.addNode(key, buffer);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(dedupMutex_);
+        root_.dedup_->release(buffer);
+        throw;
+    }
+}
+
+
+void TreeObject::compress(bool on) {
+    compress_ = on;
+}
+
+
+void TreeObject::dedup(bool on) {
+    dedup_ = on;
+}
+
+
+void TreeObject::parallelLookup(bool on, bool ordered) {
+    parallelLookup_ = on;
+    orderedLookup_ = ordered;
+}
+
+
+void TreeObject::keyIndex(bool on) {
+
+    AutoWriteLock lock(root_.lock_);
+
+    if (on && root_.keys_.null()) {
+
+        EpochGuard guard(epochs_);
+        root_.keys_.allocate_ctr(TreeKeyIndex::Constructor(schema_.keys().size(), root_.rootNode()));
+
+        Log::info() << "Created key index of " << root_.keys_->size() << " leaves" << std::endl;
+
+    } else if (!on && !root_.keys_.null()) {
+
+        // n.b. No lookups can be using the index while the lock is held.
+        root_.keys_.free();
+    }
+}
+
+
+bool TreeObject::keyIndex() const {
+    return !root_.keys_.null();
+}
+
+
+std::vector<uint32_t> TreeObject::encode(const KeyType& key) {
+
+    std::vector<uint32_t> ids;
+    ids.reserve(key.size());
+
+    for (KeyType::const_iterator it = key.begin(); it != key.end(); ++it) {
+        ids.push_back(symbols_.intern(it->second));
+    }
+
+    return ids;
+}
+
+
+void TreeObject::reserveKeySpace() {
+
+    // Lookups may still be using the table, so it is only freed once they are done.
+
+    if (root_.keys_->full()) {
+        size_t capacity = 2 * root_.keys_->capacity();
+        Log::debug<LibPMem>() << "Growing key index to " << capacity << " slots" << std::endl;
+        epochs_.replace_ctr(root_.keys_, TreeKeyIndex::Constructor(*root_.keys_, capacity));
+    }
+}
+
+
+const TreeIndex* TreeObject::index() const {
+    return index_.get();
+}
+
+
+TreeDedupStore::Stats TreeObject::dedupStats() const {
+
+    std::lock_guard<std::mutex> lock(dedupMutex_);
+
+    if (root_.dedup_.null()) {
+        TreeDedupStore::Stats s = { 0, 0, 0, 0 };
+        return s;
+    }
+
+    return root_.dedup_->stats();
+}
+
+
+bool TreeObject::removeNode(const StringDict& key) {
+
+    // If the leaf shares its data, the reference is only dropped once it has been unlinked from the tree.
+
+    PersistentPtr<PersistentBuffer> shared;
+
+    KeyType removeKey = schema_.processInsertKey(key);
+
+    AutoWriteLock lock(root_.lock_);
+
+    TreeQuery query = compile(key);
+
+    std::vector<PersistentPtr<TreeNode> > nodes = find(query);
+    if (nodes.size() == 1 && nodes[0]->leaf() && nodes[0]->shared())
+        shared = nodes[0]->buffer();
+
+    // The key is left pending in the key index while the leaf is removed, and then resolved from the tree.
+
+    std::vector<uint32_t> ids;
+    bool unlinked = !root_.keys_.null() && query.complete() && query.path(ids) &&
+                    ids.size() == root_.keys_->depth() && root_.keys_->unlink(ids, TreeKeyIndex::digest(ids));
+
+    bool removed = root_.removeNode(removeKey);
+
+    if (unlinked) {
+        EpochGuard guard(epochs_);
+        root_.keys_->resolve(ids, TreeKeyIndex::digest(ids), TreeKeyIndex::leaf(root_.rootNode(), ids));
+    }
+
+    if (!removed)
+        return false;
+
+    if (index_)
+        index_->remove(removeKey);
+
+    if (!shared.null()) {
+        ASSERT(!root_.dedup_.null());
+        root_.dedup_->release(shared);
+    }
+
+    return true;
+}
+
+
+size_t TreeObject::compact() {
+
+    AutoWriteLock lock(root_.lock_);
+
+    PersistentPtr<TreeNode> rootNode = root_.rootNode();
+    if (rootNode.null())
+        return 0;
+
+    size_t count = rootNode->compact();
+    Log::info() << "Compacted " << count << " child lists" << std::endl;
+    return count;
 }
 
 
 void TreeObject::printTree(std::ostream& os) const {
 
+    AutoReadLock lock(root_.lock_);
+
     PersistentPtr<TreeNode> rootNode = root_.rootNode();
     if (!rootNode.null())
         rootNode->printTree(os);
@@ -126,11 +542,133 @@ void TreeObject::printTree(std::ostream& os) const {
 
 
 std::vector<PersistentPtr<TreeNode> > TreeObject::lookup(const StringDict &key) {
+    return lookup(compile(key));
+}
+
+
+TreeQuery TreeObject::compile(const StringDict& key) const {
+    return TreeQuery(symbols_, key, schema_.keys());
+}
+
+
+TreeQuery TreeObject::parse(const StringDict& request) const {
+    return TreeQuery(symbols_, request, schema_.keys(), true);
+}
+
+
+std::vector<PersistentPtr<TreeNode> > TreeObject::lookup(const TreeQuery& query) {
+    AutoReadLock lock(root_.lock_);
+    return find(query);
+}
+
+
+std::vector<PersistentPtr<TreeNode> > TreeObject::find(const TreeQuery& query) const {
+
+    // n.b. Building a lazy index here means that it is used in preference to a parallel search of the tree.
+
     PersistentPtr<TreeNode> rootNode = root_.rootNode();
-    if (!rootNode.null())
-        return rootNode->lookup(key);
-    else
-        return std::vector<PersistentPtr<TreeNode> >();
+    bool indexed = index_ && index_->build(rootNode);
+
+    if (!indexed && parallelLookup_ && !query.complete() && !rootNode.null())
+        return rootNode->parallelLookup(query, orderedLookup_);
+
+    std::vector<PersistentPtr<TreeNode> > result;
+
+    visitLeaves(query, [&result](const PersistentPtr<TreeNode>& leaf) {
+        result.push_back(leaf);
+        return true;
+    });
+
+    return result;
+}
+
+
+bool TreeObject::visitLeaves(const TreeQuery& query, const TreeNode::Visitor& visitor) const {
+
+    PersistentPtr<TreeNode> leaf;
+    if (findKey(query, leaf))
+        return leaf.null() || visitor(leaf);
+
+    PersistentPtr<TreeNode> rootNode = root_.rootNode();
+
+    // If the index has been discarded (e.g. for exceeding its budget) the tree is searched instead.
+
+    if (index_ && index_->build(rootNode)) {
+        TreeIndex::Result result = index_->visit(query, visitor);
+        if (result != TreeIndex::Unavailable)
+            return result == TreeIndex::Completed;
+    }
+
+    return rootNode.null() || rootNode->visit(query, visitor);
+}
+
+
+bool TreeObject::findKey(const TreeQuery& query, PersistentPtr<TreeNode>& leaf) const {
+
+    if (root_.keys_.null() || !query.complete())
+        return false;
+
+    if (query.stale()) {
+        TreeQuery current(query);
+        current.refresh();
+        return findKey(current, leaf);
+    }
+
+    // The table is not freed while it is in use, even if it is replaced as it grows.
+
+    EpochGuard guard(EpochManager::lookup(&root_));
+    PersistentPtr<TreeKeyIndex> keys = root_.keys_;
+
+    std::vector<uint32_t> ids;
+
+    if (!query.path(ids)) {
+        leaf.nullify();
+        return true;
+    }
+
+    // A plan compiled without the levels of the schema cannot be encoded.
+
+    if (ids.size() != keys->depth())
+        return false;
+
+    leaf = keys->find(ids, TreeKeyIndex::digest(ids));
+    return true;
+}
+
+
+bool TreeObject::visit(const StringDict& key, const TreeNode::Visitor& visitor) {
+    return visit(compile(key), visitor);
+}
+
+
+bool TreeObject::visit(const TreeQuery& query, const TreeNode::Visitor& visitor) {
+
+    AutoReadLock lock(root_.lock_);
+    return visitLeaves(query, visitor);
+}
+
+
+PersistentBufferHandle* TreeObject::lookupHandle(const StringDict& key, bool verify) {
+    return lookupHandle(compile(key), verify);
+}
+
+
+PersistentBufferHandle* TreeObject::lookupHandle(const TreeQuery& query, bool verify) {
+
+    ScopedPtr<PersistentBufferHandle> handle(new PersistentBufferHandle);
+    handle->verifyChecksums(verify);
+
+    visit(query, [&handle, verify](const PersistentPtr<TreeNode>& leaf) {
+        if (leaf->inlined()) {
+            if (verify && !leaf->verify())
+                throw PersistentError("Checksum mismatch in inline leaf added to PersistentBufferHandle", Here());
+            handle->add(leaf->data(), leaf->dataSize());
+        } else
+            handle->add(leaf->buffer());
+        return true;
+    });
+
+    return handle.release();
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -20,21 +20,33 @@
 #ifndef tree_TreeRoot_H
 #define tree_TreeRoot_H
 
+#include <mutex>
+
 #include "eckit/memory/NonCopyable.h"
+#include "eckit/memory/ScopedPtr.h"
 #include "eckit/types/FixedString.h"
 #include "eckit/types/Types.h"
 
+#include "pmem/EpochManager.h"
+#include "pmem/InternTable.h"
+#include "pmem/PersistentRWLock.h"
 #include "pmem/PersistentVector.h"
 
+#include "pmem/tree/TreeDedupStore.h"
+#include "pmem/tree/TreeIndex.h"
+#include "pmem/tree/TreeKeyIndex.h"
 #include "pmem/tree/TreeNode.h"
+#include "pmem/tree/TreeQuery.h"
 #include "pmem/tree/TreeSchema.h"
 
 namespace eckit {
     class DataBlob;
+    class DataHandle;
 }
 
 namespace pmem {
     class PersistentBuffer;
+    class PersistentBufferHandle;
 }
 
 
@@ -68,6 +80,11 @@ public: // methods
     bool valid() const;
 
     void addNode(const KeyType& key, const eckit::DataBlob& blob);
+    void addNode(const KeyType& key, const void* data, size_t length);
+    void addNode(const KeyType& key, const pmem::AtomicConstructor<pmem::PersistentBuffer>& data);
+    void addNode(const KeyType& key, const pmem::PersistentPtr<pmem::PersistentBuffer>& shared);
+
+    bool removeNode(const KeyType& key);
 
     pmem::PersistentPtr<TreeNode> rootNode() const;
 
@@ -79,20 +96,56 @@ private: // members
 
     pmem::PersistentPtr<pmem::PersistentBuffer> schema_;
 
+    /// Only allocated once deduplication is first used.
+    pmem::PersistentPtr<TreeDedupStore> dedup_;
+
+    /// Only allocated while the key index is enabled (see TreeObject::keyIndex).
+    pmem::PersistentPtr<TreeKeyIndex> keys_;
+
+    /// The strings used as keys and values in the tree. See pmem::InternTable.
+    pmem::InternTable::storage_type symbols_;
+
+    /// The child lists that have been replaced by insertions, but may still be in use by lookups. See
+    /// pmem::EpochManager.
+    pmem::EpochManager::storage_type retired_;
+
+    /// Held for reading by lookups and insertions (which lock the nodes individually), and for writing by
+    /// anything that frees nodes, or creates the root node (see TreeObject).
+    pmem::PersistentRWLock lock_;
+
 private: // friends
 
     friend class TreeObject;
 };
 
 
-// A consistent definition of the tag for comparison purposes.
-const eckit::FixedString<8> TreeRootTag = "999TREE9";
+// A consistent definition of the tag for comparison purposes. The tag also identifies the layout of the objects in
+// the pool, and must be changed whenever that changes, so that pools written with an earlier layout are refused
+// rather than misread.
+//
+//   999TREE9: The original layout.
+//   999TREEA: Erasure state in PersistentVectorData, the checksum and compression header in PersistentBuffer, and
+//             in TreeNode, interned key and value ids, checksummed inline leaves, the shared flag and a mutex. The
+//             dedup store, key index, symbol table, retired epochs and lock in TreeRoot.
+const eckit::FixedString<8> TreeRootTag = "999TREEA";
 
 
 // -------------------------------------------------------------------------------------------------
 
 /// A volatile tree object, which wraps TreeRoot and allows it to perform in memory caching, schema management,
 /// etc. that is decoupled to some degree from the format of what is stored.
+///
+/// The methods may be called from multiple threads. Any number of lookups and insertions may run in parallel.
+/// Lookups take no locks on the tree nodes, and insertions only lock the nodes they add children to (see
+/// TreeNode::addNode). Removals and compaction free nodes, so they are serialised, and exclude all other access
+/// while they run.
+///
+/// Optionally, the internal nodes of the tree are indexed in volatile memory (see TreeIndex), so that lookups only
+/// touch persistent memory for the leaves. The index is built when the TreeObject is opened (or, if lazy, by the
+/// first lookup), and is kept up to date as leaves are added and removed.
+///
+/// @note The nodes (and handles) returned by lookups refer directly to persistent memory. They remain valid until
+///       the leaves are removed, so removals should not run concurrently with code that uses them.
 
 class TreeObject : private eckit::NonCopyable {
 
@@ -102,24 +155,130 @@ public: // types
 
 public: // methods
 
-    TreeObject(TreeRoot& root);
+    TreeObject(TreeRoot& root, const TreeIndex::Options& index=TreeIndex::Options());
     ~TreeObject();
 
     void addNode(const eckit::StringDict& key, const eckit::DataBlob& blob);
 
+    /// Add a node, streaming the data directly from the DataHandle into persistent memory (without an intermediate
+    /// copy in volatile memory). The handle should not be open. If the handle does not know its length, the data is
+    /// read (until the handle is exhausted) into volatile memory first.
+    void addNode(const eckit::StringDict& key, eckit::DataHandle& handle);
+
+    /// Compress the data of leaves added from now on. Compression needs the whole payload in memory, so leaves
+    /// added from a DataHandle are no longer streamed directly into persistent memory.
+    void compress(bool on);
+
+    /// Share the storage of leaves added from now on with any existing leaves (added with deduplication enabled)
+    /// that have identical contents. As for compression, leaves added from a DataHandle are no longer streamed.
+    void dedup(bool on);
+
+    /// Maintain a persistent index from each complete key to its leaf (see TreeKeyIndex), which exact lookups use
+    /// rather than walking the tree. The index is built from the existing leaves, and is stored in the pool, so it
+    /// is used (and maintained) whenever the tree is opened, until it is turned off (which frees it).
+    void keyIndex(bool on);
+
+    /// Is there a key index?
+    bool keyIndex() const;
+
+    /// Search the subtrees selected by partial keys in parallel (see TreeNode::parallelLookup). Unless ordered, the
+    /// matching leaves are returned in no particular order. Complete keys, and lookups that use the index, are always
+    /// looked up serially.
+    void parallelLookup(bool on, bool ordered=true);
+
+    /// The volatile index of the tree, or null if it is not enabled.
+    const TreeIndex* index() const;
+
+    /// Statistics on the buffers shared by deduplication.
+    TreeDedupStore::Stats dedupStats() const;
+
+    /// Remove a (fully specified) leaf from the tree. Returns false if it is not present.
+    bool removeNode(const eckit::StringDict& key);
+
+    /// Maintenance pass to rewrite sparse child lists (e.g. after removals) into dense ones.
+    size_t compact();
+
     void printTree(std::ostream& os) const;
 
     std::vector<pmem::PersistentPtr<TreeNode> > lookup(const eckit::StringDict& key);
 
+    /// Compile a request into a plan (see TreeQuery), which may be further refined (e.g. with sets or ranges of
+    /// values), and reused for any number of lookups.
+    TreeQuery compile(const eckit::StringDict& key) const;
+
+    /// Compile a MARS style request, in which the value for each key may be a list (e.g. param=t/u/v) or a numeric
+    /// range (e.g. step=0/to/240/by/6). See TreeQuery::parse.
+    TreeQuery parse(const eckit::StringDict& request) const;
+
+    std::vector<pmem::PersistentPtr<TreeNode> > lookup(const TreeQuery& query);
+
+    /// Stream the leaves matching a key to the visitor as they are found, in tree order, without collecting them
+    /// (see TreeNode::visit). Returns false if the visitor stopped the lookup early.
+    /// n.b. The visitor must not modify the tree, as lookups exclude removals (and may be excluded by them), and
+    ///      the index (see TreeIndex::visit) calls the visitor with its lock held, which an insertion would deadlock
+    ///      on.
+    bool visit(const eckit::StringDict& key, const TreeNode::Visitor& visitor);
+    bool visit(const TreeQuery& query, const TreeNode::Visitor& visitor);
+
+    /// Perform a lookup, and return a handle that reads the data of all the matching leaves (concatenated) directly
+    /// from persistent memory, optionally verifying their checksums first. The caller takes ownership of the handle.
+    pmem::PersistentBufferHandle* lookupHandle(const eckit::StringDict& key, bool verify=false);
+    pmem::PersistentBufferHandle* lookupHandle(const TreeQuery& query, bool verify=false);
+
 protected: // methods
 
     void print(std::ostream&) const;
 
+private: // methods
+
+    /// Find the leaves matching a query. The lock must be held.
+    std::vector<pmem::PersistentPtr<TreeNode> > find(const TreeQuery& query) const;
+
+    /// Visit the leaves matching a query, using the indexes if they are available. The lock must be held.
+    bool visitLeaves(const TreeQuery& query, const TreeNode::Visitor& visitor) const;
+
+    /// Look up a complete query in the key index. Returns false if there is no key index (or the query is not
+    /// complete), otherwise sets the leaf (which is null if there is no match). The lock must be held.
+    bool findKey(const TreeQuery& query, pmem::PersistentPtr<TreeNode>& leaf) const;
+
+    /// Add a leaf to the tree with fn(), keeping the indexes up to date. The lock must be held (see InsertLock).
+    template <typename Function>
+    void addLeaf(const KeyType& key, Function fn);
+
+    /// Encode a key for the key index.
+    std::vector<uint32_t> encode(const KeyType& key);
+
+    /// Make room in the key index for a further key. The key mutex must be held.
+    void reserveKeySpace();
+
+    /// Add a node from data in memory, applying compression and deduplication as configured. The lock must be
+    /// held (see InsertLock in TreeRoot.cc).
+    void insert(const KeyType& key, const void* data, size_t length);
+
+    void insertShared(const KeyType& key, const void* data, size_t length);
+
 private: // members
 
     TreeRoot& root_;
     TreeSchema schema_;
 
+    /// n.b. The tree nodes find these through the pool, so only one TreeObject may be open for each pool.
+    pmem::InternTable symbols_;
+    pmem::EpochManager epochs_;
+
+    bool compress_;
+    bool dedup_;
+    bool parallelLookup_;
+    bool orderedLookup_;
+
+    eckit::ScopedPtr<TreeIndex> index_;
+
+    /// Serialises the (volatile and persistent) updates to the deduplication store by concurrent insertions.
+    mutable std::mutex dedupMutex_;
+
+    /// Serialises the updates to the key index by concurrent insertions.
+    std::mutex keysMutex_;
+
 private: // friends
 
     friend std::ostream& operator<<(std::ostream& os, const TreeObject& p) {
@@ -22,6 +22,8 @@
 #include "eckit/parser/JSONParser.h"
 #include "eckit/value/Value.h"
 
+#include "pmem/LibPMem.h"
+
 #include "pmem/tree/TreeSchema.h"
 
 using namespace eckit;
@@ -92,11 +94,16 @@ std::vector<std::pair<std::string, std::string> > TreeSchema::processInsertKey(c
         key.push_back(std::make_pair(*key_it, value->second));
     }
 
-    Log::info() << "Processed key: " << key << std::endl;
+    Log::debug<pmem::LibPMem>() << "Processed key: " << key << std::endl;
     return key;
 }
 
 
+const std::vector<std::string>& TreeSchema::keys() const {
+    return keys_;
+}
+
+
 std::string TreeSchema::json_str() const {
 
     std::stringstream json_stream;
@@ -51,6 +51,9 @@ public: // methods
 
     std::vector<std::pair<std::string, std::string> > processInsertKey(const eckit::StringDict& key) const;
 
+    /// The keys of the tree, in order from the root.
+    const std::vector<std::string>& keys() const;
+
 protected: // methods
 
     void print(std::ostream&) const;
@@ -13,7 +13,9 @@
  * (Project ID: 671951) www.nextgenio.eu
  */
 
+#include <fcntl.h>
 #include <iterator>
+#include <unistd.h>
 
 #include "eckit/config/JSONConfiguration.h"
 #include "eckit/config/Resource.h"
@@ -21,6 +23,7 @@
 #include "eckit/filesystem/PathName.h"
 #include "eckit/io/DataBlob.h"
 #include "eckit/io/FileHandle.h"
+#include "eckit/log/Bytes.h"
 #include "eckit/memory/ScopedPtr.h"
 #include "eckit/option/CmdArgs.h"
 #include "eckit/option/Separator.h"
@@ -30,6 +33,9 @@
 #include "eckit/runtime/Tool.h"
 #include "eckit/types/Types.h"
 
+#include "pmem/BufferVerifier.h"
+#include "pmem/Exceptions.h"
+#include "pmem/PersistentBufferHandle.h"
 #include "pmem/PersistentPool.h"
 #include "pmem/PersistentPtr.h"
 
@@ -81,6 +87,7 @@ void TreeTool::usage(const std::string& tool) {
 //----------------------------------------------------------------------------------------------------------------------
 
 // This functionality has been removed from JSONParser.
+// n.b. Lists of values are joined with slashes, as in MARS style lookup requests (see TreeQuery::parse).
 
 void value_to_string_dict(const Value& v, StringDict& d) {
 
@@ -88,7 +95,16 @@ void value_to_string_dict(const Value& v, StringDict& d) {
     ValueMap m(v);
 
     for( ValueMap::iterator it = m.begin(); it != m.end(); ++it) {
-        d[it->first] = std::string(it->second);
+        if (it->second.isList()) {
+            ValueList values = it->second.as<ValueList>();
+            std::string joined;
+            for (ValueList::const_iterator val = values.begin(); val != values.end(); ++val) {
+                joined += (val == values.begin() ? "" : "/") + std::string(*val);
+            }
+            d[it->first] = joined;
+        } else {
+            d[it->first] = std::string(it->second);
+        }
     }
 }
 
@@ -110,10 +126,24 @@ void TreeTool::run() {
     options.push_back(new SimpleOption<bool>("insert", "Insert an element as specified by the pool and data keys"));
     options.push_back(new SimpleOption<std::string>("key", "The key to insert. This is a json object of key-value pairs"));
     options.push_back(new SimpleOption<PathName>("data", "The file containing the data to insert"));
+    options.push_back(new SimpleOption<bool>("compress", "Compress the data of inserted leaves"));
+    options.push_back(new SimpleOption<bool>("dedup", "Share the storage of leaves with identical data"));
+
+    options.push_back(new Separator("Options for maintaining the tree"));
+    options.push_back(new SimpleOption<std::string>("remove", "Remove the leaf with the specified key (as JSON)"));
+    options.push_back(new SimpleOption<bool>("compact", "Rewrite sparse child lists in the tree into dense ones"));
+    options.push_back(new SimpleOption<bool>("verify", "Verify the checksums of all the data in the pool (and of data read by lookups)"));
 
     options.push_back(new Separator("Options for inspecting the tree"));
     options.push_back(new SimpleOption<bool>("print", "Prints the tree in its entirety to stdout"));
-    options.push_back(new SimpleOption<std::string>("lookup", "Specify a (partial) key (as JSON) to perform a lookup"));
+    options.push_back(new SimpleOption<std::string>("lookup", "Specify a (partial) key (as JSON) to perform a lookup. Values may be lists (\"t/u/v\") or ranges (\"0/to/240/by/6\")"));
+    options.push_back(new SimpleOption<PathName>("output", "Write the data matching the lookup to a file, rather than printing it"));
+    options.push_back(new SimpleOption<bool>("parallel", "Search the tree in parallel for lookups of partial keys"));
+    options.push_back(new SimpleOption<bool>("unordered", "Return the results of parallel lookups in any order"));
+    options.push_back(new SimpleOption<bool>("index", "Index the tree in memory when it is opened, so lookups only touch persistent memory for the leaves"));
+    options.push_back(new SimpleOption<size_t>("index-budget", "The maximum memory (in bytes) used by the index, beyond which the tree is used instead (default unlimited)"));
+    options.push_back(new SimpleOption<bool>("lazy-index", "Build the index on the first lookup, rather than when the tree is opened"));
+    options.push_back(new SimpleOption<bool>("key-index", "Maintain a persistent index of complete keys for exact lookups (--key-index=false removes it)"));
 
     CmdArgs args(&usage, options, 1);
 
@@ -145,7 +175,18 @@ void TreeTool::run() {
 
     Log::info() << "Valid: " << (root->valid() ? "true" : "false") << std::endl;
 
-    TreeObject tree(*root);
+    TreeIndex::Options index;
+    index.lazy = args.getBool("lazy-index", false);
+    index.enabled = args.getBool("index", false) || index.lazy;
+    index.budget = args.getLong("index-budget", 0);
+
+    TreeObject tree(*root, index);
+    tree.compress(args.getBool("compress", false));
+    tree.dedup(args.getBool("dedup", false));
+    tree.parallelLookup(args.getBool("parallel", false), !args.getBool("unordered", false));
+
+    if (args.has("key-index"))
+        tree.keyIndex(args.getBool("key-index", false));
 
     // Do an insertion request
 
@@ -157,14 +198,80 @@ void TreeTool::run() {
         StringDict key;
         value_to_string_dict(parser.parse(), key);
 
-        // Get the data to store into a blob.
+        // Stream the data directly from the file into persistent memory (unless it is being compressed or
+        // deduplicated).
         PathName data_path(args.getString("data"));
         ScopedPtr<DataHandle> data_file(data_path.fileHandle());
-        Length len = data_file->openForRead();
 
-        JSONDataBlob blob(*data_file, len);
-        tree.addNode(key, blob);
+        tree.addNode(key, *data_file);
+
+        if (args.getBool("compress", false)) {
+            PersistentPool::CompressionStats stats = pool->compressionStats();
+            Log::info() << "Compressed " << Bytes(stats.originalBytes) << " to " << Bytes(stats.storedBytes)
+                        << " (ratio " << stats.ratio() << ")" << std::endl;
+        }
+
+        if (args.getBool("dedup", false)) {
+            TreeDedupStore::Stats stats = tree.dedupStats();
+            Log::info() << stats.references << " deduplicated leaves share " << stats.buffers << " buffers ("
+                        << Bytes(stats.storedBytes) << "), saving " << Bytes(stats.savedBytes) << std::endl;
+        }
+    }
+
+    // Maintenance operations
+
+    std::string remove = args.getString("remove", "");
+    if (remove != "") {
+
+        std::istringstream iss(remove);
+        JSONParser parser(iss);
+
+        StringDict key;
+        value_to_string_dict(parser.parse(), key);
+
+        if (!tree.removeNode(key))
+            Log::warning() << "No leaf found to remove for key: " << remove << std::endl;
+    }
+
+    if (args.getBool("compact", false)) {
+        tree.compact();
+    }
+
+    bool verify = args.getBool("verify", false);
+    if (verify) {
+
+        BufferVerifier verifier;
+        size_t corrupt = verifier.verify(*pool);
+
+        Log::info() << "Verified " << verifier.buffers() << " buffers (" << Bytes(verifier.bytes()) << "): "
+                    << corrupt << " corrupt" << std::endl;
+
+        for (std::vector<PersistentPtr<PersistentBuffer> >::const_iterator it = verifier.corrupt().begin();
+             it != verifier.corrupt().end(); ++it) {
+            Log::error() << "Corrupt buffer: " << *it << std::endl;
+        }
+
+        // Small payloads are stored inline in the leaves, rather than in buffers.
 
+        std::vector<PersistentPtr<TreeNode> > nodes = pool->objects<TreeNode>();
+
+        size_t leaves = 0;
+        size_t bytes = 0;
+        size_t corruptLeaves = 0;
+
+        for (std::vector<PersistentPtr<TreeNode> >::const_iterator it = nodes.begin(); it != nodes.end(); ++it) {
+            if ((*it)->inlined()) {
+                leaves++;
+                bytes += (*it)->dataSize();
+                if (!(*it)->verify()) {
+                    corruptLeaves++;
+                    Log::error() << "Corrupt inline leaf: " << *it << std::endl;
+                }
+            }
+        }
+
+        Log::info() << "Verified " << leaves << " inline leaves (" << Bytes(bytes) << "): "
+                    << corruptLeaves << " corrupt" << std::endl;
     }
 
     // Doing lookup requests
@@ -187,17 +294,50 @@ void TreeTool::run() {
         StringDict key;
         value_to_string_dict(parser.parse(), key);
 
-        std::vector<PersistentPtr<TreeNode> > nodes = tree.lookup(key);
+        // All the combinations of values in the request are found in one pass over the tree.
+        TreeQuery query = tree.parse(key);
+        Log::info() << "Lookup: " << query << std::endl;
+
+        std::string output = args.getString("output", "");
+        if (output != "") {
+
+            // Write the matching data straight from persistent memory into the file, without copying it.
+
+            ScopedPtr<PersistentBufferHandle> handle(tree.lookupHandle(query, verify));
+
+            int fd = ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (fd < 0)
+                throw FailedSystemCall("open(" + output + ")", Here());
 
-        Log::info() << "Matching data" << std::endl;
-        Log::info() << "=============" << std::endl;
-        // TODO: We should probably output the matching keys as well as the data.
-        for (std::vector<PersistentPtr<TreeNode> >::const_iterator it = nodes.begin();
-             it != nodes.end(); ++it) {
-            if ((*it)->leaf()) {
-                std::string tmp(static_cast<const char*>((*it)->data()), (*it)->dataSize());
-                Log::info() << tmp << std::endl;
+            Length len;
+            try {
+                len = handle->writeTo(fd);
+            } catch (...) {
+                ::close(fd);
+                throw;
             }
+
+            // Errors writing the data back may only be reported when the file is closed.
+            if (::close(fd) != 0)
+                throw FailedSystemCall("close(" + output + ")", Here());
+
+            Log::info() << "Wrote " << len << " bytes from " << handle->regionCount() << " leaves to " << output << std::endl;
+
+        } else {
+
+            Log::info() << "Matching data" << std::endl;
+            Log::info() << "=============" << std::endl;
+
+            // Print the leaves as they are found, rather than collecting them first.
+            // TODO: We should probably output the matching keys as well as the data.
+            std::vector<char> scratch;
+            tree.visit(query, [&scratch, verify](const PersistentPtr<TreeNode>& leaf) {
+                if (verify && !leaf->verify())
+                    throw PersistentError("Checksum mismatch in data matching lookup", Here());
+                Log::info().write(static_cast<const char*>(leaf->data(scratch)), leaf->dataSize());
+                Log::info() << std::endl;
+                return true;
+            });
         }
     }
 
@@ -240,7 +380,7 @@ void TreeTool::run() {
                 StringDict key;
                 value_to_string_dict(request["key"], key);
 
-                std::vector<PersistentPtr<TreeNode> > nodes = tree.lookup(key);
+                std::vector<PersistentPtr<TreeNode> > nodes = tree.lookup(tree.parse(key));
 
                 Log::info() << "Matching data" << std::endl;
                 Log::info() << "=====================================" << std::endl;
@@ -248,7 +388,8 @@ void TreeTool::run() {
                 for (std::vector<PersistentPtr<TreeNode> >::const_iterator it = nodes.begin();
                      it != nodes.end(); ++it) {
                     if ((*it)->leaf()) {
-                        std::string tmp(static_cast<const char*>((*it)->data()), (*it)->dataSize());
+                        std::vector<char> scratch;
+                        std::string tmp(static_cast<const char*>((*it)->data(scratch)), (*it)->dataSize());
                         Log::info() << tmp << std::endl;
                     }
                 }
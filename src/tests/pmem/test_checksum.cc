@@ -0,0 +1,92 @@
+/*
+ * (C) Copyright 1996-2015 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation nor
+ * does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "eckit/testing/Test.h"
+
+#include "pmem/Checksum.h"
+
+using namespace std;
+using namespace pmem;
+using namespace eckit;
+using namespace eckit::testing;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CASE( "test_pmem_crc32c_reference_values" )
+{
+    EXPECT(checksum::crc32c("", 0) == uint32_t(0));
+    EXPECT(checksum::crc32c("123456789", 9) == uint32_t(0xe3069283));
+
+    // From RFC 3720 (iSCSI), B.4
+
+    std::vector<unsigned char> zeros(32, 0);
+    EXPECT(checksum::crc32c(&zeros[0], zeros.size()) == uint32_t(0x8a9136aa));
+
+    std::vector<unsigned char> ones(32, 0xff);
+    EXPECT(checksum::crc32c(&ones[0], ones.size()) == uint32_t(0x62a8ab43));
+
+    std::vector<unsigned char> incrementing(32);
+    for (size_t i = 0; i < incrementing.size(); i++) incrementing[i] = i;
+    EXPECT(checksum::crc32c(&incrementing[0], incrementing.size()) == uint32_t(0x46dd794e));
+}
+
+CASE( "test_pmem_crc32c_chaining" )
+{
+    // Cover the interleaved (large block) and tail paths
+
+    std::vector<char> data(100000);
+    for (size_t i = 0; i < data.size(); i++) data[i] = char((i * 31) ^ (i >> 7));
+
+    uint32_t whole = checksum::crc32c(&data[0], data.size());
+
+    size_t splits[] = { 0, 1, 7, 8, 4096, 12289, 50000, 99999, 100000 };
+    for (size_t i = 0; i < sizeof(splits) / sizeof(splits[0]); i++) {
+        size_t s = splits[i];
+        uint32_t first = checksum::crc32c(&data[0], s);
+        EXPECT(checksum::crc32c(&data[s], data.size() - s, first) == whole);
+    }
+
+    // Every byte contributes
+
+    data[54321] ^= 0x01;
+    EXPECT(checksum::crc32c(&data[0], data.size()) != whole);
+}
+
+CASE( "test_pmem_crc32c_copy" )
+{
+    std::vector<char> data(3 * 4096 * 5 + 17);
+    for (size_t i = 0; i < data.size(); i++) data[i] = char(i % 253);
+
+    for (size_t length = 0; length < data.size(); length = 2 * length + 3) {
+
+        std::vector<char> out(length + 1, 'x');
+        uint32_t crc = checksum::crc32c_copy(&out[0], &data[0], length);
+
+        EXPECT(crc == checksum::crc32c(&data[0], length));
+        EXPECT(::memcmp(&out[0], &data[0], length) == 0);
+        EXPECT(out[length] == 'x');
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    return run_tests(argc, argv);
+}
@@ -0,0 +1,151 @@
+/*
+ * (C) Copyright 1996-2015 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation nor
+ * does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "eckit/testing/Test.h"
+
+#include "pmem/Compression.h"
+#include "pmem/Exceptions.h"
+
+using namespace std;
+using namespace pmem;
+using namespace eckit;
+using namespace eckit::testing;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Compress and decompress, checking that the data survives. Returns the compressed size.
+
+static size_t round_trip(const std::vector<char>& input) {
+
+    std::vector<char> compressed(compression::bound(input.size()));
+    size_t n = compression::compress(input.empty() ? 0 : &input[0], input.size(), &compressed[0], compressed.size());
+    EXPECT(n != 0);
+    EXPECT(n <= compressed.size());
+
+    std::vector<char> output(input.size() + 1, 'x');
+    compression::decompress(&compressed[0], n, &output[0], input.size());
+
+    EXPECT(::memcmp(&output[0], input.empty() ? "" : &input[0], input.size()) == 0);
+    EXPECT(output[input.size()] == 'x');
+
+    return n;
+}
+
+
+static std::vector<char> random_bytes(size_t n, uint32_t seed) {
+
+    std::vector<char> data(n);
+    for (size_t i = 0; i < n; i++) {
+        seed = seed * 1664525 + 1013904223;
+        data[i] = char(seed >> 24);
+    }
+    return data;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CASE( "test_pmem_compression_small_inputs" )
+{
+    // Inputs too short to contain a match are stored as literals
+
+    for (size_t n = 0; n < 40; n++) {
+        std::vector<char> data(n, 'a');
+        round_trip(data);
+        round_trip(random_bytes(n, n));
+    }
+}
+
+CASE( "test_pmem_compression_repetitive" )
+{
+    // A short repeating pattern exercises overlapping matches, and long match lengths
+
+    std::string pattern("abcabcabd");
+    std::vector<char> data;
+    for (size_t i = 0; i < 10000; i++)
+        data.insert(data.end(), pattern.begin(), pattern.end());
+
+    size_t n = round_trip(data);
+    EXPECT(n < data.size() / 50);
+
+    std::vector<char> zeros(1024 * 1024, 0);
+    EXPECT(round_trip(zeros) < zeros.size() / 100);
+}
+
+CASE( "test_pmem_compression_incompressible" )
+{
+    // Random data includes long runs of literals, and should not expand by more than the bound allows
+
+    std::vector<char> data = random_bytes(100000, 42);
+    size_t n = round_trip(data);
+    EXPECT(n > data.size());
+    EXPECT(n <= compression::bound(data.size()));
+}
+
+CASE( "test_pmem_compression_mixed" )
+{
+    // Alternate compressible and incompressible stretches, with matches at all sorts of distances (including
+    // beyond the 64KiB window)
+
+    std::vector<char> data;
+    std::vector<char> block = random_bytes(1000, 7);
+    for (size_t i = 0; i < 200; i++) {
+        std::vector<char> noise = random_bytes(i * 37 % 1500, uint32_t(i));
+        data.insert(data.end(), noise.begin(), noise.end());
+        data.insert(data.end(), block.begin(), block.begin() + (i * 13 % block.size()));
+    }
+
+    round_trip(data);
+}
+
+CASE( "test_pmem_compression_output_too_small" )
+{
+    std::vector<char> data = random_bytes(1000, 1);
+    std::vector<char> compressed(500);
+
+    EXPECT(compression::compress(&data[0], data.size(), &compressed[0], compressed.size()) == size_t(0));
+}
+
+CASE( "test_pmem_compression_corrupt_input" )
+{
+    std::vector<char> data(10000, 'z');
+    std::vector<char> compressed(compression::bound(data.size()));
+    size_t n = compression::compress(&data[0], data.size(), &compressed[0], compressed.size());
+
+    std::vector<char> output(data.size());
+
+    // Truncated
+
+    EXPECT_THROWS_AS(compression::decompress(&compressed[0], n - 1, &output[0], output.size()), PersistentError);
+
+    // The wrong expected length
+
+    EXPECT_THROWS_AS(compression::decompress(&compressed[0], n, &output[0], output.size() - 1), PersistentError);
+
+    // A match offset pointing before the start of the output
+
+    const char bad[] = { 0x10, 'a', 0x05, 0x00, 0x00 };
+    EXPECT_THROWS_AS(compression::decompress(bad, sizeof(bad), &output[0], output.size()), PersistentError);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    return run_tests(argc, argv);
+}
@@ -0,0 +1,302 @@
+/*
+ * (C) Copyright 1996-2015 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation nor
+ * does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "eckit/testing/Test.h"
+
+#include "pmem/EpochManager.h"
+#include "pmem/PersistentPtr.h"
+#include "pmem/PersistentType.h"
+
+#include "test_persistent_helpers.h"
+
+using namespace std;
+using namespace pmem;
+using namespace eckit;
+using namespace eckit::testing;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// A custom type to allocate objects in the tests
+
+class CustomType : public PersistentType<CustomType> {
+
+public: // methods
+
+    CustomType(uint64_t value) : value_(value), check_(~value) {}
+
+    /// Is the object intact (i.e. not freed and overwritten)?
+    bool intact() const { return check_ == ~value_; }
+
+public: // members
+
+    uint64_t value_;
+    uint64_t check_;
+};
+
+
+/// Define a root type. Each test that does allocation should use a different element in the root object.
+
+const size_t root_elems = 6;
+
+
+class RootType : public PersistentType<RootType> {
+
+public: // constructor
+
+    class Constructor : public AtomicConstructor<RootType> {
+        virtual void make(RootType &object) const {
+            for (size_t i = 0; i < root_elems; i++) {
+                object.data_[i].nullify();
+            }
+            object.retired_.nullify();
+        }
+    };
+
+public: // members
+
+    PersistentPtr<CustomType> data_[root_elems];
+    EpochManager::storage_type retired_;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// And structure the pool with types
+
+template<> uint64_t pmem::PersistentType<RootType>::type_id = POBJ_ROOT_TYPE_NUM;
+template<> uint64_t pmem::PersistentType<CustomType>::type_id = 1;
+template<> uint64_t pmem::PersistentType<PersistentRetireList>::type_id = 2;
+
+// Create a global fixture, so that this pool is only created once, and destroyed once.
+
+AutoPool globalAutoPool((RootType::Constructor()));
+
+struct GlobalRootFixture : public PersistentPtr<RootType> {
+ GlobalRootFixture() : PersistentPtr<RootType>(globalAutoPool.pool_.getRoot<RootType>()) {}
+    ~GlobalRootFixture() { nullify(); }
+};
+
+GlobalRootFixture global_root;
+
+
+/// The number of CustomType objects allocated in the pool.
+
+static size_t object_count() {
+    size_t count = 0;
+    for (PMEMoid oid = ::pmemobj_first(globalAutoPool.pool_.raw_pool()); !OID_IS_NULL(oid); oid = ::pmemobj_next(oid)) {
+        if (::pmemobj_type_num(oid) == PersistentType<CustomType>::type_id)
+            count++;
+    }
+    return count;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CASE( "test_pmem_epoch_manager_readers_delay_reclaim" )
+{
+    PersistentPtr<CustomType>& ptr(global_root->data_[0]);
+    ptr.allocate(uint64_t(1));
+
+    EpochManager epochs(global_root->retired_, false);
+    EXPECT(&EpochManager::lookup(&ptr) == &epochs);
+
+    size_t before = object_count();
+
+    // The original remains intact while a reader that may have seen it is active
+
+    {
+        EpochGuard guard(epochs);
+
+        CustomType* original = ptr.get();
+        epochs.replace_ctr(ptr, AtomicConstructor1<CustomType, uint64_t>(2));
+
+        EXPECT(ptr->value_ == uint64_t(2));
+        EXPECT(epochs.pending() == size_t(1));
+        EXPECT(epochs.reclaim() == size_t(0));
+        EXPECT(original->intact());
+        EXPECT(original->value_ == uint64_t(1));
+        EXPECT(object_count() == before + 1);
+    }
+
+    // Readers that enter afterwards cannot see it, so do not delay it
+
+    {
+        EpochGuard guard(epochs);
+        EXPECT(epochs.reclaim() == size_t(1));
+    }
+
+    EXPECT(epochs.pending() == size_t(0));
+    EXPECT(object_count() == before);
+
+    // Retiring the object unlinks it immediately
+
+    epochs.retire(ptr);
+    EXPECT(ptr.null());
+    EXPECT(epochs.pending() == size_t(1));
+    EXPECT(epochs.reclaim() == size_t(1));
+    EXPECT(object_count() == before - 1);
+}
+
+
+CASE( "test_pmem_epoch_manager_growth" )
+{
+    PersistentPtr<CustomType>& ptr(global_root->data_[1]);
+    ptr.allocate(uint64_t(0));
+
+    EpochManager epochs(global_root->retired_, false);
+
+    // Retire more objects than the list initially holds
+
+    const size_t count = 3 * EpochManager::initial_capacity;
+
+    {
+        EpochGuard guard(epochs);
+        for (size_t i = 1; i <= count; i++)
+            epochs.replace_ctr(ptr, AtomicConstructor1<CustomType, uint64_t>(i));
+
+        EXPECT(epochs.pending() == count);
+        EXPECT(epochs.reclaim() == size_t(0));
+        EXPECT(global_root->retired_->capacity() >= count);
+    }
+
+    EXPECT(epochs.reclaim() == count);
+    EXPECT(ptr->value_ == uint64_t(count));
+}
+
+
+CASE( "test_pmem_epoch_manager_background" )
+{
+    PersistentPtr<CustomType>& ptr(global_root->data_[2]);
+    ptr.allocate(uint64_t(0));
+
+    EpochManager epochs(global_root->retired_);
+
+    for (size_t i = 1; i <= EpochManager::reclaim_batch; i++)
+        epochs.replace_ctr(ptr, AtomicConstructor1<CustomType, uint64_t>(i));
+
+    // The background thread frees the objects without being asked
+
+    for (size_t i = 0; i < 100 && epochs.pending() != 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    EXPECT(epochs.pending() == size_t(0));
+}
+
+
+CASE( "test_pmem_epoch_manager_recovery" )
+{
+    PersistentPtr<CustomType>& unlinked(global_root->data_[3]);
+    PersistentPtr<CustomType>& linked(global_root->data_[4]);
+
+    unlinked.allocate(uint64_t(1));
+    linked.allocate(uint64_t(2));
+
+    {
+        EpochManager epochs(global_root->retired_, false);
+    }
+
+    size_t before = object_count();
+
+    // Simulate a retired object, an unlink that completed but was not committed, and one that never happened.
+
+    PersistentPtr<CustomType> retired;
+    retired.allocate_ctr(globalAutoPool.pool_, AtomicConstructor1<CustomType, uint64_t>(3));
+
+    PersistentPtr<CustomType> replaced = unlinked;
+    unlinked.setPersist(PersistentPtr<CustomType>());
+
+    PersistentRetireList& list(*global_root->retired_);
+
+    list[0].object = retired.raw();
+    list[1].object = replaced.raw();
+    list[1].location = ::pmemobj_oid(&unlinked);
+    list[2].object = linked.raw();
+    list[2].location = ::pmemobj_oid(&linked);
+
+    EXPECT(object_count() == before + 1);
+
+    // Opening the manager frees the objects that were unlinked, but not the one still in use
+
+    {
+        EpochManager epochs(global_root->retired_, false);
+
+        EXPECT(epochs.pending() == size_t(0));
+        EXPECT(object_count() == before - 1);
+
+        EXPECT(OID_IS_NULL(list[0].object));
+        EXPECT(OID_IS_NULL(list[1].object));
+        EXPECT(OID_IS_NULL(list[2].object));
+
+        EXPECT(linked->intact());
+        EXPECT(linked->value_ == uint64_t(2));
+    }
+}
+
+
+CASE( "test_pmem_epoch_manager_concurrent" )
+{
+    PersistentPtr<CustomType>& ptr(global_root->data_[5]);
+    ptr.allocate(uint64_t(0));
+
+    EpochManager epochs(global_root->retired_);
+
+    // Readers never see an object that has been freed, while a writer replaces it repeatedly
+
+    const size_t nreaders = 4;
+    const size_t count = 2000;
+
+    std::atomic<bool> done(false);
+    std::atomic<bool> consistent(true);
+
+    std::vector<std::thread> readers;
+    for (size_t t = 0; t < nreaders; t++) {
+        readers.push_back(std::thread([&]() {
+            uint64_t last = 0;
+            while (!done) {
+                EpochGuard guard(epochs);
+                const CustomType* obj = PersistentPtr<CustomType>(ptr).get();
+                for (size_t i = 0; i < 10; i++) {
+                    if (!obj->intact() || obj->value_ < last)
+                        consistent = false;
+                }
+                last = obj->value_;
+            }
+        }));
+    }
+
+    for (size_t i = 1; i <= count; i++)
+        epochs.replace_ctr(ptr, AtomicConstructor1<CustomType, uint64_t>(i));
+
+    done = true;
+    for (size_t t = 0; t < nreaders; t++)
+        readers[t].join();
+
+    EXPECT(consistent);
+    EXPECT(ptr->value_ == uint64_t(count));
+
+    epochs.synchronize();
+    epochs.reclaim();
+    EXPECT(epochs.pending() == size_t(0));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    return run_tests(argc, argv);
+}
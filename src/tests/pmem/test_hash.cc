@@ -0,0 +1,80 @@
+/*
+ * (C) Copyright 1996-2015 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation nor
+ * does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "eckit/testing/Test.h"
+
+#include "pmem/Hash.h"
+
+using namespace std;
+using namespace pmem;
+using namespace eckit;
+using namespace eckit::testing;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CASE( "test_pmem_hash64_reference_values" )
+{
+    // The digests may be stored persistently, so they must match the reference implementation exactly.
+
+    EXPECT(hash64("", 0) == uint64_t(0xef46db3751d8e999ULL));
+    EXPECT(hash64("abc", 3) == uint64_t(0x44bc2cf5ad770999ULL));
+
+    std::string s("Nobody inspects the spammish repetition");
+    EXPECT(hash64(s.c_str(), s.length()) == uint64_t(0xfbcea83c8a378bf1ULL));
+}
+
+CASE( "test_pmem_hash64_sensitivity" )
+{
+    // Cover the bulk (32 byte stripes) and tail paths, and check that every byte contributes.
+
+    std::vector<char> data(100);
+    for (size_t i = 0; i < data.size(); i++) data[i] = char(i * 7);
+
+    for (size_t length = 0; length <= data.size(); length++) {
+
+        uint64_t h = hash64(&data[0], length);
+        EXPECT(h == hash64(&data[0], length));
+        EXPECT(h != hash64(&data[0], length, 1));
+
+        for (size_t i = 0; i < length; i++) {
+            data[i] ^= 1;
+            EXPECT(hash64(&data[0], length) != h);
+            data[i] ^= 1;
+        }
+    }
+}
+
+CASE( "test_pmem_hash64_unaligned" )
+{
+    std::vector<char> data(200);
+    for (size_t i = 0; i < data.size(); i++) data[i] = char(i);
+
+    std::vector<char> copy(data.size() + 8);
+    for (size_t offset = 1; offset < 8; offset++) {
+        ::memcpy(&copy[offset], &data[0], data.size());
+        EXPECT(hash64(&copy[offset], data.size()) == hash64(&data[0], data.size()));
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    return run_tests(argc, argv);
+}
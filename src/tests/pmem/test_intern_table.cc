@@ -0,0 +1,253 @@
+/*
+ * (C) Copyright 1996-2015 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation nor
+ * does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "eckit/exception/Exceptions.h"
+#include "eckit/testing/Test.h"
+
+#include "pmem/InternTable.h"
+
+#include "test_persistent_helpers.h"
+
+using namespace std;
+using namespace pmem;
+using namespace eckit;
+using namespace eckit::testing;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Define a root type.
+
+class RootType : public PersistentType<RootType> {
+
+public: // constructor
+
+    class Constructor : public AtomicConstructor<RootType> {
+        virtual void make(RootType &object) const {
+            object.symbols_.nullify();
+        }
+    };
+
+public: // members
+
+    InternTable::storage_type symbols_;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// And structure the pool with types
+
+template<> uint64_t pmem::PersistentType<RootType>::type_id = POBJ_ROOT_TYPE_NUM;
+template<> uint64_t pmem::PersistentType<PersistentString>::type_id = 1;
+template<> uint64_t pmem::PersistentType<pmem::PersistentVectorData<PersistentString> >::type_id = 2;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CASE( "test_pmem_intern_table_ids" )
+{
+    AutoPool ap((RootType::Constructor()));
+    PersistentPtr<RootType> root = ap.pool_.getRoot<RootType>();
+
+    InternTable table(root->symbols_);
+
+    EXPECT(table.size() == size_t(0));
+    EXPECT(table.find("step") == InternTable::missing);
+
+    // Ids are allocated in order, and each string is only stored once
+
+    uint32_t step = table.intern("step");
+    uint32_t param = table.intern("param");
+    uint32_t longer = table.intern("a string that is rather longer than twelve characters");
+
+    EXPECT(step == uint32_t(0));
+    EXPECT(param == uint32_t(1));
+    EXPECT(longer == uint32_t(2));
+
+    EXPECT(table.intern("step") == step);
+    EXPECT(table.find("param") == param);
+    EXPECT(table.size() == size_t(3));
+    EXPECT(root->symbols_.size() == size_t(3));
+
+    EXPECT(table.string(step) == "step");
+    EXPECT(table.string(longer) == "a string that is rather longer than twelve characters");
+    EXPECT_THROWS_AS(table.string(3), OutOfRange);
+
+    // find() does not add strings
+
+    EXPECT(table.find("levelist") == InternTable::missing);
+    EXPECT(table.size() == size_t(3));
+}
+
+
+CASE( "test_pmem_intern_table_rebuilt_on_open" )
+{
+    AutoPool ap((RootType::Constructor()));
+    PersistentPtr<RootType> root = ap.pool_.getRoot<RootType>();
+
+    {
+        InternTable table(root->symbols_);
+        table.intern("param");
+        table.intern("");
+        table.intern("step");
+    }
+
+    // A new table (as when the pool is reopened) rebuilds its cache from the persistent strings.
+
+    InternTable table(root->symbols_);
+
+    EXPECT(table.size() == size_t(3));
+    EXPECT(table.find("param") == uint32_t(0));
+    EXPECT(table.find("") == uint32_t(1));
+    EXPECT(table.find("step") == uint32_t(2));
+    EXPECT(table.string(2) == "step");
+
+    EXPECT(table.intern("levtype") == uint32_t(3));
+}
+
+
+CASE( "test_pmem_intern_table_numbers" )
+{
+    AutoPool ap((RootType::Constructor()));
+    PersistentPtr<RootType> root = ap.pool_.getRoot<RootType>();
+
+    {
+        InternTable table(root->symbols_);
+        table.intern("12");
+        table.intern("-0.5");
+        table.intern("12h");
+        table.intern("");
+        table.intern("nan");
+    }
+
+    // The numeric values are parsed when the strings are cached, including when the cache is rebuilt.
+
+    InternTable table(root->symbols_);
+    table.intern("1e3");
+
+    double value = 0;
+    EXPECT(table.number(0, value) && value == 12);
+    EXPECT(table.number(1, value) && value == -0.5);
+    EXPECT(table.number(5, value) && value == 1000);
+
+    // Only whole strings that are finite numbers count
+
+    EXPECT(!table.number(2, value));
+    EXPECT(!table.number(3, value));
+    EXPECT(!table.number(4, value));
+
+    EXPECT_THROWS_AS(table.number(6, value), OutOfRange);
+}
+
+
+CASE( "test_pmem_intern_table_registered_for_pool" )
+{
+    AutoPool ap((RootType::Constructor()));
+    PersistentPtr<RootType> root = ap.pool_.getRoot<RootType>();
+
+    EXPECT_THROWS_AS(InternTable::lookup(root.get()), SeriousBug);
+
+    {
+        InternTable table(root->symbols_);
+
+        // The table can be found from any object in the pool, or from the pool itself.
+
+        EXPECT(&InternTable::lookup(root.get()) == &table);
+        EXPECT(&InternTable::lookup(ap.pool_.raw_pool()) == &table);
+
+        // But only one table may be open for the pool.
+
+        EXPECT_THROWS_AS(InternTable other(root->symbols_), AssertionFailed);
+    }
+
+    EXPECT_THROWS_AS(InternTable::lookup(root.get()), SeriousBug);
+
+    // The storage must be in persistent memory
+
+    InternTable::storage_type volatile_storage;
+    volatile_storage.nullify();
+    EXPECT_THROWS_AS(InternTable other(volatile_storage), SeriousBug);
+}
+
+
+CASE( "test_pmem_intern_table_concurrent" )
+{
+    AutoPool ap((RootType::Constructor()));
+    PersistentPtr<RootType> root = ap.pool_.getRoot<RootType>();
+
+    InternTable table(root->symbols_);
+    table.intern("first");
+
+    // Strings are resolved without locking while others are added. The references remain valid as the table grows
+    // well beyond its first chunk. Each string is interned by two of the writers, and an id is resolvable as soon as
+    // it has been returned to either of them.
+
+    const std::string& first(table.string(0));
+
+    std::atomic<bool> resolvable(true);
+
+    std::vector<std::thread> writers;
+    for (size_t t = 0; t < 4; t++) {
+        writers.push_back(std::thread([&table, &resolvable, t]() {
+            for (size_t i = 0; i < 1500; i++) {
+                std::ostringstream ss;
+                ss << "value" << (i * 4 + t) % 3000;
+                uint32_t id = table.intern(ss.str());
+                try {
+                    if (table.string(id) != ss.str())
+                        resolvable = false;
+                } catch (OutOfRange&) {
+                    resolvable = false;
+                }
+            }
+        }));
+    }
+
+    bool consistent = true;
+    for (size_t n = 0; n < 1000; n++) {
+        size_t size = table.size();
+        uint32_t id = size - 1;
+        consistent = consistent && table.find(table.string(id)) == id;
+    }
+
+    for (size_t t = 0; t < writers.size(); t++) {
+        writers[t].join();
+    }
+
+    EXPECT(consistent);
+    EXPECT(resolvable);
+    EXPECT(table.size() == size_t(3001));
+    EXPECT(root->symbols_.size() == size_t(3001));
+    EXPECT(first == "first");
+
+    bool found = true;
+    for (size_t i = 0; i < 3000; i++) {
+        std::ostringstream ss;
+        ss << "value" << i;
+        uint32_t id = table.find(ss.str());
+        found = found && id != InternTable::missing && table.string(id) == ss.str();
+    }
+    EXPECT(found);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    return run_tests(argc, argv);
+}
@@ -0,0 +1,178 @@
+/*
+ * (C) Copyright 1996-2015 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation nor
+ * does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include "eckit/testing/Test.h"
+
+#include "pmem/Parallel.h"
+#include "pmem/ThreadPool.h"
+
+using namespace std;
+using namespace pmem;
+using namespace eckit;
+using namespace eckit::testing;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CASE( "test_pmem_thread_pool_runs_all_tasks" )
+{
+    ThreadPool pool(3);
+    EXPECT(pool.size() == size_t(3));
+
+    std::atomic<size_t> counter(0);
+    std::vector<ThreadPool::Task> tasks;
+    for (size_t i = 0; i < 100; i++) {
+        tasks.push_back([&counter, i]() { counter += i; });
+    }
+
+    pool.run(tasks);
+    EXPECT(counter == size_t(4950));
+}
+
+CASE( "test_pmem_thread_pool_propagates_exceptions" )
+{
+    ThreadPool pool(2);
+
+    std::vector<ThreadPool::Task> tasks;
+    tasks.push_back([]() {});
+    tasks.push_back([]() { throw std::runtime_error("task failed"); });
+    tasks.push_back([]() {});
+
+    EXPECT_THROWS_AS(pool.run(tasks), std::runtime_error);
+}
+
+CASE( "test_pmem_parallel_for_each" )
+{
+    ThreadPool pool(4);
+
+    std::vector<size_t> values(10000);
+    for (size_t i = 0; i < values.size(); i++) values[i] = i;
+
+    // Every element is visited exactly once
+
+    std::vector<std::atomic<int> > visited(values.size());
+    for (size_t i = 0; i < visited.size(); i++) visited[i] = 0;
+
+    parallel_for_each(values.begin(), values.end(), [&visited](size_t v) { ++visited[v]; }, 10, pool);
+
+    bool once = true;
+    for (size_t i = 0; i < visited.size(); i++) once = once && (visited[i] == 1);
+    EXPECT(once);
+
+    // An empty range does nothing
+
+    parallel_for_each(values.begin(), values.begin(), [&visited](size_t v) { ++visited[v]; }, 10, pool);
+}
+
+CASE( "test_pmem_parallel_transform_reduce" )
+{
+    ThreadPool pool(4);
+
+    std::vector<uint64_t> values(12345);
+    for (size_t i = 0; i < values.size(); i++) values[i] = i;
+
+    uint64_t expected = 0;
+    for (size_t i = 0; i < values.size(); i++) expected += 2 * values[i];
+
+    // The initial value is only included once, however the range is split
+
+    for (size_t grain = 1; grain < 20000; grain *= 7) {
+        uint64_t sum = parallel_transform_reduce(values.begin(), values.end(), uint64_t(17),
+                                                 [](uint64_t a, uint64_t b) { return a + b; },
+                                                 [](uint64_t v) { return 2 * v; },
+                                                 grain, pool);
+        EXPECT(sum == expected + 17);
+    }
+
+    // And an empty range returns the initial value
+
+    uint64_t empty = parallel_transform_reduce(values.begin(), values.begin(), uint64_t(17),
+                                               [](uint64_t a, uint64_t b) { return a + b; },
+                                               [](uint64_t v) { return v; },
+                                               1, pool);
+    EXPECT(empty == uint64_t(17));
+}
+
+CASE( "test_pmem_work_stealing_scheduler" )
+{
+    ThreadPool pool(4);
+    WorkStealingScheduler<size_t> scheduler(pool);
+    EXPECT(scheduler.participants() == size_t(5));
+
+    // Each item spawns its children in an implicit binary tree, so the work is only discovered as it is done.
+    // Every item is processed exactly once.
+
+    const size_t count = 20000;
+
+    std::vector<std::atomic<int> > visited(count);
+    for (size_t i = 0; i < visited.size(); i++) visited[i] = 0;
+
+    std::vector<size_t> processed(scheduler.participants(), 0);
+
+    scheduler.run(std::vector<size_t>(1, 1), [&](size_t item, WorkStealingScheduler<size_t>::Worker& worker) {
+        ++visited[item];
+        processed[worker.index()]++;
+        if (2 * item < count) worker.spawn(2 * item);
+        if (2 * item + 1 < count) worker.spawn(2 * item + 1);
+    });
+
+    bool once = (visited[0] == 0);
+    for (size_t i = 1; i < visited.size(); i++) once = once && (visited[i] == 1);
+    EXPECT(once);
+
+    size_t total = 0;
+    for (size_t i = 0; i < processed.size(); i++) total += processed[i];
+    EXPECT(total == count - 1);
+
+    // The scheduler may be reused, starting from several items
+
+    std::atomic<size_t> sum(0);
+    std::vector<size_t> items;
+    for (size_t i = 1; i <= 100; i++) items.push_back(i);
+
+    scheduler.run(items, [&sum](size_t item, WorkStealingScheduler<size_t>::Worker&) { sum += item; });
+    EXPECT(sum == size_t(5050));
+}
+
+
+CASE( "test_pmem_work_stealing_scheduler_propagates_exceptions" )
+{
+    ThreadPool pool(3);
+    WorkStealingScheduler<size_t> scheduler(pool);
+
+    EXPECT_THROWS_AS(scheduler.run(std::vector<size_t>(1, 1),
+                                   [](size_t item, WorkStealingScheduler<size_t>::Worker& worker) {
+                                       if (item == 100) throw std::runtime_error("item failed");
+                                       if (item < 1000) worker.spawn(2 * item);
+                                       if (item < 1000) worker.spawn(2 * item + 1);
+                                   }),
+                     std::runtime_error);
+
+    // And the scheduler is left usable
+
+    std::atomic<size_t> count(0);
+    scheduler.run(std::vector<size_t>(10, 0), [&count](size_t, WorkStealingScheduler<size_t>::Worker&) { ++count; });
+    EXPECT(count == size_t(10));
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    return run_tests(argc, argv);
+}
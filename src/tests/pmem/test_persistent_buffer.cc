@@ -13,15 +13,22 @@
  * (Project ID: 671951) www.nextgenio.eu
  */
 
+#include <cstring>
 #include <string>
+#include <vector>
 
+#include "eckit/exception/Exceptions.h"
 #include "eckit/filesystem/PathName.h"
 #include "eckit/io/Buffer.h"
+#include "eckit/io/MemoryHandle.h"
 #include "eckit/memory/NonCopyable.h"
 #include "eckit/testing/Test.h"
 #include "eckit/types/FixedString.h"
 
+#include "pmem/BufferVerifier.h"
+#include "pmem/Checksum.h"
 #include "pmem/PersistentBuffer.h"
+#include "pmem/PersistentPool.h"
 #include "pmem/PersistentPtr.h"
 
 #include "test_persistent_helpers.h"
@@ -36,7 +43,7 @@ using namespace eckit::testing;
 /// Define a root type. Each test that does allocation should use a different element in the root object.
 
 // How many possibilities do we want?
-const size_t root_elems = 1;
+const size_t root_elems = 5;
 
 
 class RootType : public PersistentType<RootType> {
@@ -56,6 +63,15 @@ public: // members
     PersistentPtr<PersistentBuffer> data_[root_elems];
 };
 
+
+/// A handle whose reads fail, as a file on a failing device would.
+
+class FailingHandle : public MemoryHandle {
+public:
+    FailingHandle(const void* data, size_t length) : MemoryHandle(data, length) {}
+    virtual long read(void*, long) { throw ReadError("Device failed", Here()); }
+};
+
 //----------------------------------------------------------------------------------------------------------------------
 
 // And structure the pool with types
@@ -85,14 +101,124 @@ CASE( "test_pmem_persistent_buffer_allocate" )
     EXPECT(get_back == test_string);
 }
 
+CASE( "test_pmem_persistent_buffer_allocate_large" )
+{
+    // Large payloads are copied into the pool via a different (non-temporal) path
+
+    std::vector<char> payload(3 * PersistentBuffer::nontemporal_threshold + 7);
+    for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] = char(i % 251);
+    }
+
+    AutoPool ap((RootType::Constructor()));
+    PersistentPtr<RootType> root = ap.pool_.getRoot<RootType>();
+
+    const void* data = &payload[0];
+    root->data_[1].allocate(data, payload.size());
+
+    EXPECT(root->data_[1]->size() == payload.size());
+    EXPECT(::memcmp(root->data_[1]->data(), &payload[0], payload.size()) == 0);
+}
+
+CASE( "test_pmem_persistent_buffer_stream_from_handle" )
+{
+    // Stream a payload spanning several read chunks directly from a DataHandle
+
+    std::vector<char> payload(2 * PersistentBuffer::stream_chunk_size + 13);
+    for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] = char(i % 253);
+    }
+
+    AutoPool ap((RootType::Constructor()));
+    PersistentPtr<RootType> root = ap.pool_.getRoot<RootType>();
+
+    MemoryHandle handle(&payload[0], payload.size());
+    size_t length = handle.openForRead();
+    root->data_[2].allocate_ctr(ap.pool_, PersistentBuffer::StreamConstructor(handle, length));
+    handle.close();
+
+    EXPECT(root->data_[2]->size() == payload.size());
+    EXPECT(::memcmp(root->data_[2]->data(), &payload[0], payload.size()) == 0);
+
+    // If the handle runs out of data, the allocation is unwound
+
+    MemoryHandle short_handle(&payload[0], 100);
+    short_handle.openForRead();
+
+    PersistentPtr<PersistentBuffer> ptr;
+    EXPECT_THROWS_AS(ptr.allocate_ctr(ap.pool_, PersistentBuffer::StreamConstructor(short_handle, 200)),
+                     AtomicConstructorBase::AllocationError);
+    EXPECT(ptr.null());
+    short_handle.close();
+
+    // As it is if reading from the handle fails
+
+    FailingHandle failing_handle(&payload[0], payload.size());
+    failing_handle.openForRead();
+
+    EXPECT_THROWS_AS(ptr.allocate_ctr(ap.pool_, PersistentBuffer::StreamConstructor(failing_handle, 200)),
+                     AtomicConstructorBase::AllocationError);
+    EXPECT(ptr.null());
+    failing_handle.close();
+}
+
+CASE( "test_pmem_persistent_buffer_compressed" )
+{
+    AutoPool ap((RootType::Constructor()));
+    PersistentPtr<RootType> root = ap.pool_.getRoot<RootType>();
+
+    // A compressible payload is stored compressed, but still reports its original size
+
+    std::string line("temperature 273.15 pressure 1013.25\n");
+    std::string payload;
+    for (size_t i = 0; i < 1000; i++)
+        payload += line;
+
+    root->data_[3].allocate_ctr(ap.pool_, PersistentBuffer::CompressedConstructor(payload.data(), payload.length()));
+
+    EXPECT(root->data_[3]->compressed());
+    EXPECT(root->data_[3]->size() == payload.length());
+    EXPECT(root->data_[3]->storedSize() < payload.length() / 10);
+
+    std::vector<char> scratch;
+    const void* data = root->data_[3]->data(scratch);
+    EXPECT(std::string(static_cast<const char*>(data), payload.length()) == payload);
+
+    std::vector<char> out(payload.length());
+    root->data_[3]->decompress(&out[0], out.size());
+    EXPECT(std::string(&out[0], out.size()) == payload);
+
+    // Data that does not compress is stored as-is
+
+    std::string short_str("short");
+    PersistentPtr<PersistentBuffer> ptr;
+    ptr.allocate_ctr(ap.pool_, PersistentBuffer::CompressedConstructor(short_str.data(), short_str.length()));
+
+    EXPECT(!ptr->compressed());
+    EXPECT(ptr->storedSize() == short_str.length());
+    EXPECT(ptr->data(scratch) == ptr->data());
+    EXPECT(std::string(static_cast<const char*>(ptr->data()), ptr->size()) == short_str);
+
+    // Both allocations are included in the pool statistics
+
+    PersistentPool::CompressionStats stats = ap.pool_.compressionStats();
+    EXPECT(stats.buffers == size_t(2));
+    EXPECT(stats.originalBytes == payload.length() + short_str.length());
+    EXPECT(stats.storedBytes == root->data_[3]->storedSize() + short_str.length());
+    EXPECT(stats.ratio() > 10);
+}
+
 CASE( "test_pmem_persistent_buffer_size" )
 {
     const void* dat = 0;
     size_t len = 1234;
     AtomicConstructor2<PersistentBuffer, const void*, size_t> ctr(dat, len);
 
-    // Check that space is allocated to store the data, and to store the size of the data
-    EXPECT(ctr.size() == 1234 + sizeof(size_t));
+    // Check that space is allocated to store the data, and to store the size and checksum of the data
+    EXPECT(ctr.size() == 1234 + sizeof(size_t) + sizeof(uint64_t));
+
+    // The buffer is made durable in its constructor, so does not need to be persisted again
+    EXPECT(ctr.self_persisting());
 }
 
 
@@ -103,13 +229,14 @@ CASE( "test_pmem_persistent_buffer_size_zero" )
     AtomicConstructor2<PersistentBuffer, const void*, size_t> ctr(dat, len);
 
     // If we specify a zero-sized buffer, then check that the constructor does the right thing...
-    EXPECT(ctr.size() == sizeof(size_t));
+    EXPECT(ctr.size() == sizeof(size_t) + sizeof(uint64_t));
 
     Buffer buf(ctr.size());
     PersistentBuffer& buf_ref(*reinterpret_cast<PersistentBuffer*>((void*)buf));
     ctr.make(buf_ref);
 
     EXPECT(buf_ref.size() == size_t(0));
+    EXPECT(buf_ref.verify());
 }
 
 
@@ -121,7 +248,7 @@ CASE( "test_pmem_persistent_stores_data" )
 
     AtomicConstructor2<PersistentBuffer, const void*, size_t> ctr(data_ptr, len);
 
-    EXPECT(ctr.size() == dat.length() + sizeof(size_t));
+    EXPECT(ctr.size() == dat.length() + sizeof(size_t) + sizeof(uint64_t));
 
     Buffer buf(ctr.size());
     PersistentBuffer& buf_ref(*reinterpret_cast<PersistentBuffer*>((void*)buf));
@@ -129,6 +256,75 @@ CASE( "test_pmem_persistent_stores_data" )
 
     EXPECT(buf_ref.size() == dat.length());
 //    EXPECT(::memcmp(dat.c_str(), buf_ref.data(), buf_ref.size()), 0);
+
+    // The checksum is that of the data, followed by the length
+
+    EXPECT(buf_ref.verify());
+    EXPECT(buf_ref.checksum() == checksum::crc32c(&len, sizeof(len), checksum::crc32c(data_ptr, len)));
+}
+
+CASE( "test_pmem_persistent_buffer_checksum" )
+{
+    AutoPool ap((RootType::Constructor()));
+    PersistentPtr<RootType> root = ap.pool_.getRoot<RootType>();
+
+    // Buffers written by each of the paths carry a valid checksum
+
+    std::vector<char> payload(3 * PersistentBuffer::checksum_block_size + 11);
+    for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] = char((i * 7) % 251);
+    }
+
+    const void* data = &payload[0];
+    root->data_[4].allocate(data, payload.size());
+    EXPECT(root->data_[4]->verify());
+
+    std::string small("A small payload");
+    PersistentPtr<PersistentBuffer> small_ptr;
+    small_ptr.allocate_ctr(ap.pool_, AtomicConstructor2<PersistentBuffer, const void*, size_t>(small.data(), small.length()));
+    EXPECT(small_ptr->verify());
+
+    MemoryHandle handle(&payload[0], payload.size());
+    size_t length = handle.openForRead();
+    PersistentPtr<PersistentBuffer> streamed;
+    streamed.allocate_ctr(ap.pool_, PersistentBuffer::StreamConstructor(handle, length));
+    handle.close();
+    EXPECT(streamed->verify());
+    EXPECT(streamed->checksum() == root->data_[4]->checksum());
+
+    std::string text;
+    for (size_t i = 0; i < 500; i++)
+        text += "temperature 273.15\n";
+    PersistentPtr<PersistentBuffer> compressed;
+    compressed.allocate_ctr(ap.pool_, PersistentBuffer::CompressedConstructor(text.data(), text.length()));
+    EXPECT(compressed->compressed());
+    EXPECT(compressed->verify());
+
+    // The whole pool can be checked at once
+
+    BufferVerifier verifier;
+    EXPECT(verifier.verify(ap.pool_) == size_t(0));
+    EXPECT(verifier.buffers() == size_t(4));
+    EXPECT(verifier.bytes() == payload.size() * 2 + small.length() + compressed->storedSize());
+
+    // Corruption of the data, or of the length, is detected
+
+    char* raw = const_cast<char*>(static_cast<const char*>(streamed->data()));
+    raw[payload.size() / 2] ^= 0x10;
+
+    EXPECT(!streamed->verify());
+    EXPECT(root->data_[4]->verify());
+    EXPECT(verifier.verify(ap.pool_) == size_t(1));
+    EXPECT(verifier.corrupt()[0] == streamed);
+
+    raw[payload.size() / 2] ^= 0x10;
+    EXPECT(streamed->verify());
+
+    size_t* len = reinterpret_cast<size_t*>(small_ptr.get());
+    *len -= 1;
+    EXPECT(!small_ptr->verify());
+    *len += 1;
+    EXPECT(small_ptr->verify());
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,293 @@
+/*
+ * (C) Copyright 1996-2015 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation nor
+ * does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "eckit/exception/Exceptions.h"
+#include "eckit/testing/Test.h"
+
+#include "pmem/Exceptions.h"
+#include "pmem/PersistentBuffer.h"
+#include "pmem/PersistentBufferHandle.h"
+#include "pmem/PersistentPtr.h"
+
+#include "test_persistent_helpers.h"
+
+using namespace std;
+using namespace pmem;
+using namespace eckit;
+using namespace eckit::testing;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Define a root type. Each test that does allocation should use a different element in the root object.
+
+// How many possibilities do we want?
+const size_t root_elems = 5;
+
+
+class RootType : public PersistentType<RootType> {
+
+public: // constructor
+
+    class Constructor : public AtomicConstructor<RootType> {
+        virtual void make(RootType &object) const {
+            for (size_t i = 0; i < root_elems; i++) {
+                object.data_[i].nullify();
+            }
+        }
+    };
+
+public: // members
+
+    PersistentPtr<PersistentBuffer> data_[root_elems];
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// And structure the pool with types
+
+template<> uint64_t pmem::PersistentType<RootType>::type_id = POBJ_ROOT_TYPE_NUM;
+template<> uint64_t pmem::PersistentType<PersistentBuffer>::type_id = 1;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// A pool containing three buffers, whose concatenated contents are known. The remaining root elements are free
+/// for use by the tests.
+
+class BufferFixture {
+
+public: // methods
+
+    BufferFixture() :
+        ap_((RootType::Constructor())),
+        root_(ap_.pool_.getRoot<RootType>()) {
+
+        const char* strings[3] = { "The first buffer. ", "", "And the third buffer." };
+
+        for (size_t i = 0; i < 3; i++) {
+            std::string s(strings[i]);
+            root_->data_[i].allocate(s.data(), s.length());
+            expected_ += s;
+        }
+    }
+
+    std::vector<PersistentPtr<PersistentBuffer> > buffers() const {
+        return std::vector<PersistentPtr<PersistentBuffer> >(root_->data_, root_->data_ + 3);
+    }
+
+public: // members
+
+    AutoPool ap_;
+    PersistentPtr<RootType> root_;
+    std::string expected_;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CASE( "test_pmem_persistent_buffer_handle_read" )
+{
+    BufferFixture f;
+    PersistentBufferHandle handle(f.buffers());
+
+    // The empty buffer is skipped
+
+    EXPECT(handle.regionCount() == size_t(2));
+    EXPECT(size_t(handle.openForRead()) == f.expected_.length());
+    EXPECT(size_t(handle.estimate()) == f.expected_.length());
+
+    // Read in chunks that don't line up with the region boundaries
+
+    std::string result;
+    char buf[7];
+    long n;
+    while ((n = handle.read(buf, sizeof(buf))) > 0) {
+        result.append(buf, n);
+    }
+    handle.close();
+
+    EXPECT(result == f.expected_);
+    EXPECT(size_t(handle.position()) == f.expected_.length());
+    EXPECT(handle.read(buf, sizeof(buf)) == 0);
+
+    // Re-opening starts from the beginning again
+
+    handle.openForRead();
+    EXPECT(handle.read(buf, 3) == 3);
+    EXPECT(std::string(buf, 3) == f.expected_.substr(0, 3));
+    handle.close();
+}
+
+CASE( "test_pmem_persistent_buffer_handle_seek" )
+{
+    BufferFixture f;
+
+    PersistentBufferHandle handle;
+    handle.add(f.root_->data_[2]);
+    handle.add(f.root_->data_[0]);
+
+    std::string expected = f.expected_.substr(18) + f.expected_.substr(0, 18);
+
+    handle.openForRead();
+    EXPECT(handle.canSeek());
+
+    char buf[10];
+    for (size_t pos = 0; pos < expected.length(); pos += 3) {
+        EXPECT(size_t(handle.seek(pos)) == pos);
+        long n = handle.read(buf, sizeof(buf));
+        EXPECT(std::string(buf, n) == expected.substr(pos, sizeof(buf)));
+    }
+
+    // Skipping past the end stops at the end
+
+    handle.rewind();
+    handle.skip(1000);
+    EXPECT(size_t(handle.position()) == expected.length());
+    EXPECT(handle.read(buf, sizeof(buf)) == 0);
+    handle.close();
+}
+
+CASE( "test_pmem_persistent_buffer_handle_write_to_fd" )
+{
+    BufferFixture f;
+    PersistentBufferHandle handle(f.buffers());
+
+    FILE* tmp = ::tmpfile();
+    EXPECT(tmp != 0);
+
+    // Write the remainder of the data, after a partial read
+
+    handle.openForRead();
+    handle.skip(5);
+    EXPECT(size_t(handle.writeTo(::fileno(tmp))) == f.expected_.length() - 5);
+    handle.close();
+
+    std::vector<char> buf(f.expected_.length());
+    ::rewind(tmp);
+    size_t n = ::fread(&buf[0], 1, buf.size(), tmp);
+    ::fclose(tmp);
+
+    EXPECT(std::string(&buf[0], n) == f.expected_.substr(5));
+}
+
+CASE( "test_pmem_persistent_buffer_handle_compressed" )
+{
+    // Compressed buffers are decompressed as they are reached, both for reads and writeTo()
+
+    BufferFixture f;
+
+    std::string compressible;
+    for (size_t i = 0; i < 200; i++)
+        compressible += "A very compressible string. ";
+
+    f.root_->data_[3].allocate_ctr(f.ap_.pool_, PersistentBuffer::CompressedConstructor(compressible.data(),
+                                                                                         compressible.length()));
+    f.root_->data_[4].allocate_ctr(f.ap_.pool_, PersistentBuffer::CompressedConstructor(compressible.data(),
+                                                                                         compressible.length()));
+    EXPECT(f.root_->data_[3]->compressed());
+
+    std::vector<PersistentPtr<PersistentBuffer> > buffers;
+    buffers.push_back(f.root_->data_[3]);
+    buffers.push_back(f.root_->data_[0]);
+    buffers.push_back(f.root_->data_[4]);
+    buffers.push_back(f.root_->data_[2]);
+
+    std::string expected = compressible + f.expected_.substr(0, 18) + compressible + f.expected_.substr(18);
+
+    PersistentBufferHandle handle(buffers);
+    EXPECT(size_t(handle.openForRead()) == expected.length());
+
+    std::string result;
+    char buf[100];
+    long n;
+    while ((n = handle.read(buf, sizeof(buf))) > 0) {
+        result.append(buf, n);
+    }
+    EXPECT(result == expected);
+
+    handle.seek(10);
+
+    FILE* tmp = ::tmpfile();
+    EXPECT(tmp != 0);
+    EXPECT(size_t(handle.writeTo(::fileno(tmp))) == expected.length() - 10);
+    handle.close();
+
+    std::vector<char> out(expected.length());
+    ::rewind(tmp);
+    size_t nread = ::fread(&out[0], 1, out.size(), tmp);
+    ::fclose(tmp);
+
+    EXPECT(std::string(&out[0], nread) == expected.substr(10));
+}
+
+CASE( "test_pmem_persistent_buffer_handle_read_only" )
+{
+    BufferFixture f;
+    PersistentBufferHandle handle(f.root_->data_[0]);
+
+    EXPECT_THROWS_AS(handle.openForWrite(0), NotImplemented);
+    EXPECT_THROWS_AS(handle.openForAppend(0), NotImplemented);
+    EXPECT_THROWS_AS(handle.write("abc", 3), NotImplemented);
+}
+
+CASE( "test_pmem_persistent_buffer_handle_verify_checksums" )
+{
+    BufferFixture f;
+
+    // Corrupt the third buffer
+
+    char* raw = const_cast<char*>(static_cast<const char*>(f.root_->data_[2]->data()));
+    raw[3] ^= 0x20;
+
+    // By default, buffers are not checked
+
+    PersistentBufferHandle unchecked(f.buffers());
+    EXPECT(unchecked.regionCount() == size_t(2));
+
+    // But if requested, the corruption is detected as the buffer is added
+
+    PersistentBufferHandle handle;
+    handle.verifyChecksums(true);
+    handle.add(f.root_->data_[0]);
+    handle.add(f.root_->data_[1]);
+    EXPECT_THROWS_AS(handle.add(f.root_->data_[2]), PersistentError);
+    EXPECT(handle.regionCount() == size_t(1));
+
+    raw[3] ^= 0x20;
+    handle.add(f.root_->data_[2]);
+    EXPECT(handle.regionCount() == size_t(2));
+}
+
+CASE( "test_pmem_persistent_buffer_handle_empty" )
+{
+    PersistentBufferHandle handle;
+
+    char buf[10];
+    EXPECT(handle.openForRead() == Length(0));
+    EXPECT(handle.read(buf, sizeof(buf)) == 0);
+    EXPECT(handle.writeTo(STDOUT_FILENO) == Length(0));
+    handle.close();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    return run_tests(argc, argv);
+}
@@ -0,0 +1,189 @@
+/*
+ * (C) Copyright 1996-2015 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation nor
+ * does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+#include <cstring>
+#include <vector>
+#include <sys/uio.h>
+
+#include "eckit/io/MemoryHandle.h"
+#include "eckit/testing/Test.h"
+
+#include "pmem/PersistentChunkedBuffer.h"
+
+#include "test_persistent_helpers.h"
+
+using namespace std;
+using namespace pmem;
+using namespace eckit;
+using namespace eckit::testing;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Define a root type. Each test that does allocation should use a different element in the root object.
+
+const size_t root_elems = 3;
+
+
+class RootType : public PersistentType<RootType> {
+
+public: // constructor
+
+    class Constructor : public AtomicConstructor<RootType> {
+        virtual void make(RootType &object) const {
+            for (size_t i = 0; i < root_elems; i++) {
+                object.data_[i].nullify();
+            }
+        }
+    };
+
+public: // members
+
+    PersistentChunkedBuffer data_[root_elems];
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// And structure the pool with types
+
+template<> uint64_t pmem::PersistentType<RootType>::type_id = POBJ_ROOT_TYPE_NUM;
+template<> uint64_t pmem::PersistentType<PersistentBuffer>::type_id = 1;
+template<> uint64_t pmem::PersistentType<pmem::PersistentVectorData<PersistentBuffer> >::type_id = 2;
+
+// Create a global fixture, so that this pool is only created once, and destroyed once.
+
+AutoPool globalAutoPool((RootType::Constructor()));
+
+struct GlobalRootFixture : public PersistentPtr<RootType> {
+ GlobalRootFixture() : PersistentPtr<RootType>(globalAutoPool.pool_.getRoot<RootType>()) {}
+    ~GlobalRootFixture() { nullify(); }
+};
+
+GlobalRootFixture global_root;
+
+
+static std::vector<char> test_payload(size_t length) {
+    std::vector<char> payload(length);
+    for (size_t i = 0; i < length; i++)
+        payload[i] = char(i * 7 + i / 251);
+    return payload;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CASE( "test_pmem_chunked_buffer_append" )
+{
+    PersistentChunkedBuffer& buffer(global_root->data_[0]);
+
+    EXPECT(buffer.size() == size_t(0));
+    EXPECT(buffer.extentCount() == size_t(0));
+
+    // The data is split into full extents, and a shorter one for the remainder
+
+    std::vector<char> payload = test_payload(4500);
+    buffer.append(&payload[0], payload.size(), 1000);
+
+    EXPECT(buffer.size() == size_t(4500));
+    EXPECT(buffer.extentCount() == size_t(5));
+    EXPECT(buffer.extent(0)->size() == size_t(1000));
+    EXPECT(buffer.extent(4)->size() == size_t(500));
+
+    // Further appends start new extents
+
+    std::vector<char> payload2 = test_payload(1000);
+    buffer.append(&payload2[0], payload2.size(), 1000);
+
+    EXPECT(buffer.size() == size_t(5500));
+    EXPECT(buffer.extentCount() == size_t(6));
+    EXPECT(buffer.verify());
+
+    // The regions refer directly to the extents
+
+    std::vector<struct iovec> regions;
+    buffer.regions(regions);
+
+    EXPECT(regions.size() == size_t(6));
+    EXPECT(regions[0].iov_base == buffer.extent(0)->data());
+    EXPECT(::pmemobj_pool_by_ptr(regions[3].iov_base) == globalAutoPool.pool_.raw_pool());
+    EXPECT(::memcmp(regions[4].iov_base, &payload[4000], 500) == 0);
+    EXPECT(::memcmp(regions[5].iov_base, &payload2[0], 1000) == 0);
+}
+
+
+CASE( "test_pmem_chunked_buffer_readv" )
+{
+    PersistentChunkedBuffer& buffer(global_root->data_[1]);
+
+    std::vector<char> payload = test_payload(10000);
+    buffer.append(&payload[0], payload.size(), 1024);
+
+    EXPECT(buffer.extentCount() == size_t(10));
+
+    // Scatter the whole contents into iovecs that do not line up with the extents
+
+    std::vector<char> a(3000), b(7), c(6993);
+    struct iovec iov[3] = { { &a[0], a.size() }, { &b[0], b.size() }, { &c[0], c.size() } };
+
+    EXPECT(buffer.readv(iov, 3) == size_t(10000));
+    EXPECT(::memcmp(&a[0], &payload[0], 3000) == 0);
+    EXPECT(::memcmp(&b[0], &payload[3000], 7) == 0);
+    EXPECT(::memcmp(&c[0], &payload[3007], 6993) == 0);
+
+    // Starting part way through, with more space than there is data
+
+    std::vector<char> d(100), e(10000);
+    struct iovec iov2[2] = { { &d[0], d.size() }, { &e[0], e.size() } };
+
+    EXPECT(buffer.readv(iov2, 2, 2050) == size_t(7950));
+    EXPECT(::memcmp(&d[0], &payload[2050], 100) == 0);
+    EXPECT(::memcmp(&e[0], &payload[2150], 7850) == 0);
+
+    // And beyond the end
+
+    EXPECT(buffer.readv(iov2, 2, 10000) == size_t(0));
+}
+
+
+CASE( "test_pmem_chunked_buffer_stream" )
+{
+    PersistentChunkedBuffer& buffer(global_root->data_[2]);
+
+    std::vector<char> payload = test_payload(5000);
+
+    MemoryHandle handle(&payload[0], payload.size());
+    handle.openForRead();
+    buffer.append(handle, payload.size(), 2048);
+    handle.close();
+
+    EXPECT(buffer.extentCount() == size_t(3));
+    EXPECT(buffer.size() == size_t(5000));
+    EXPECT(buffer.verify());
+
+    std::vector<char> out(5000);
+    struct iovec iov = { &out[0], out.size() };
+    EXPECT(buffer.readv(&iov, 1) == size_t(5000));
+    EXPECT(out == payload);
+
+    // And the storage can be released
+
+    buffer.free();
+    EXPECT(buffer.extentCount() == size_t(0));
+    EXPECT(buffer.size() == size_t(0));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    return run_tests(argc, argv);
+}
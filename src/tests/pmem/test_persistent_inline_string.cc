@@ -0,0 +1,194 @@
+/*
+ * (C) Copyright 1996-2015 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation nor
+ * does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#include "eckit/testing/Test.h"
+
+#include "pmem/Hash.h"
+#include "pmem/PersistentInlineString.h"
+#include "pmem/PersistentPtr.h"
+
+#include "test_persistent_helpers.h"
+
+using namespace std;
+using namespace pmem;
+using namespace eckit;
+using namespace eckit::testing;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// An object that owns a string, as e.g. a tree node would.
+
+class Owner : public PersistentType<Owner> {
+
+public: // methods
+
+    Owner(const std::string& str, const PersistentPtr<PersistentString>& heap) : str_(str, heap) {}
+
+public: // members
+
+    PersistentInlineString str_;
+};
+
+
+/// Define a root type.
+
+const size_t root_elems = 4;
+
+
+class RootType : public PersistentType<RootType> {
+
+public: // constructor
+
+    class Constructor : public AtomicConstructor<RootType> {
+        virtual void make(RootType &object) const {
+            for (size_t i = 0; i < root_elems; i++) {
+                object.data_[i].nullify();
+                object.heap_[i].nullify();
+            }
+        }
+    };
+
+public: // members
+
+    PersistentPtr<Owner> data_[root_elems];
+
+    /// The long strings, allocated before their owners.
+    PersistentPtr<PersistentString> heap_[root_elems];
+};
+
+
+/// Allocate an owner, storing its string out of line if need be, as described in PersistentInlineString.h.
+
+static void allocate_owner(PersistentPtr<RootType>& root, size_t i, const std::string& str) {
+
+    PersistentInlineString::allocate(root->heap_[i], str);
+    root->data_[i].allocate(str, root->heap_[i]);
+    root->heap_[i].nullify();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// And structure the pool with types
+
+template<> uint64_t pmem::PersistentType<RootType>::type_id = POBJ_ROOT_TYPE_NUM;
+template<> uint64_t pmem::PersistentType<Owner>::type_id = 1;
+template<> uint64_t pmem::PersistentType<PersistentString>::type_id = 2;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CASE( "test_pmem_persistent_inline_string_size" )
+{
+    EXPECT(sizeof(PersistentInlineString) == size_t(48));
+}
+
+
+CASE( "test_pmem_persistent_inline_string_short" )
+{
+    AutoPool ap((RootType::Constructor()));
+    PersistentPtr<RootType> root = ap.pool_.getRoot<RootType>();
+
+    std::string short_str("step");
+    std::string max_str(PersistentInlineString::inline_capacity, 'x');
+
+    allocate_owner(root, 0, short_str);
+    allocate_owner(root, 1, max_str);
+
+    const PersistentInlineString& s1(root->data_[0]->str_);
+    const PersistentInlineString& s2(root->data_[1]->str_);
+
+    EXPECT(s1.inlined());
+    EXPECT(s2.inlined());
+
+    // The characters are stored within the owning object
+
+    const char* owner = reinterpret_cast<const char*>(root->data_[0].get());
+    EXPECT(s1.c_str() > owner && s1.c_str() < owner + sizeof(Owner));
+
+    EXPECT(s1.size() == size_t(4));
+    EXPECT(s1.length() == size_t(4));
+    EXPECT(::strcmp(s1.c_str(), "step") == 0);
+    EXPECT(s1.str() == short_str);
+    EXPECT(s2.str() == max_str);
+
+    EXPECT(s1.hash() == hash64(short_str.data(), short_str.size()));
+
+    EXPECT(s1 == short_str);
+    EXPECT(short_str == s1);
+    EXPECT(s1 != max_str);
+    EXPECT(s1 != std::string("ste"));
+    EXPECT(s1 != std::string("stex"));
+    EXPECT(s1 != s2);
+
+    std::ostringstream ss;
+    ss << s1;
+    EXPECT(ss.str() == short_str);
+}
+
+
+CASE( "test_pmem_persistent_inline_string_long" )
+{
+    AutoPool ap((RootType::Constructor()));
+    PersistentPtr<RootType> root = ap.pool_.getRoot<RootType>();
+
+    std::string long_str("a string that is too long to store inline");
+    std::string other_str("a string that is too long to store inlinf");
+
+    allocate_owner(root, 0, long_str);
+    allocate_owner(root, 1, long_str);
+    allocate_owner(root, 2, other_str);
+    allocate_owner(root, 3, std::string(""));
+
+    const PersistentInlineString& s1(root->data_[0]->str_);
+    const PersistentInlineString& s2(root->data_[1]->str_);
+    const PersistentInlineString& s3(root->data_[2]->str_);
+    const PersistentInlineString& empty(root->data_[3]->str_);
+
+    EXPECT(!s1.inlined());
+    EXPECT(empty.inlined());
+
+    // The long string is stored separately, in the same pool
+
+    EXPECT(::pmemobj_pool_by_ptr(s1.c_str()) == ap.pool_.raw_pool());
+    EXPECT(s1.size() == long_str.size());
+    EXPECT(::strcmp(s1.c_str(), long_str.c_str()) == 0);
+
+    EXPECT(s1 == s2);
+    EXPECT(s1 == long_str);
+    EXPECT(s1 != s3);
+    EXPECT(s1.hash() != s3.hash());
+    EXPECT(s1 != empty);
+    EXPECT(empty == std::string());
+    EXPECT(empty.size() == size_t(0));
+
+    root->data_[0]->str_.free();
+    root->data_[1]->str_.free();
+    root->data_[2]->str_.free();
+
+    // The storage must match the string
+
+    PersistentPtr<PersistentString> none;
+    none.nullify();
+    EXPECT_THROWS_AS(Owner(long_str, none), AssertionFailed);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    return run_tests(argc, argv);
+}
@@ -15,6 +15,9 @@
 
 #include "eckit/testing/Test.h"
 
+#include <atomic>
+
+#include "pmem/Parallel.h"
 #include "pmem/PersistentPODVector.h"
 #include "pmem/PersistentType.h"
 
@@ -30,7 +33,7 @@ using namespace eckit::testing;
 /// Define a root type. Each test that does allocation should use a different element in the root object.
 
 // How many possibilities do we want?
-const size_t root_elems = 2;
+const size_t root_elems = 4;
 
 
 class RootType : public PersistentType<RootType> {
@@ -218,6 +221,69 @@ CASE( "test_pmem_persistent_pod_vector_resize" )
     EXPECT(pv[6] == uint64_t(3333));
 }
 
+CASE( "test_pmem_persistent_pod_vector_iterators" )
+{
+    PersistentPODVector<uint64_t>& pv(global_root->data_[2]);
+
+    EXPECT(pv.null());
+    EXPECT(pv.begin() == pv.end());
+
+    const size_t count = 10000;
+    pv.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        pv.push_back(i);
+    }
+
+    EXPECT(size_t(pv.end() - pv.begin()) == count);
+    EXPECT(pv.begin() == &pv[0]);
+
+    // Scan the vector in parallel, with a small enough grain that the work is split
+
+    uint64_t sum = parallel_transform_reduce(pv.begin(), pv.end(), uint64_t(0),
+                                             [](uint64_t a, uint64_t b) { return a + b; },
+                                             [](uint64_t v) { return v; },
+                                             100);
+    EXPECT(sum == uint64_t(count * (count - 1) / 2));
+
+    std::atomic<uint64_t> evens(0);
+    parallel_for_each(pv.begin(), pv.end(), [&evens](uint64_t v) { if (v % 2 == 0) ++evens; }, 100);
+    EXPECT(evens == uint64_t(count / 2));
+}
+
+CASE( "test_pmem_persistent_pod_vector_search_reduce" )
+{
+    PersistentPODVector<uint64_t>& pv(global_root->data_[3]);
+
+    // An empty vector has nothing to find
+
+    EXPECT(pv.null());
+    EXPECT(pv.find(1) == size_t(0));
+    EXPECT(pv.count(1) == size_t(0));
+    EXPECT(pv.sum() == uint64_t(0));
+
+    // Offsets, such as we store for fields within a larger object
+
+    for (uint64_t i = 0; i < 1000; i++) {
+        pv.push_back(1000 + 3 * i);
+    }
+
+    EXPECT(pv.find(1000) == size_t(0));
+    EXPECT(pv.find(1300) == size_t(100));
+    EXPECT(pv.find(1301) == pv.size());
+    EXPECT(pv.count(3997) == size_t(1));
+
+    EXPECT(pv.min() == uint64_t(1000));
+    EXPECT(pv.max() == uint64_t(3997));
+    EXPECT(pv.sum() == uint64_t(1000 * 1000 + 3 * (999 * 1000 / 2)));
+
+    std::vector<size_t> indices;
+    EXPECT(pv.count_range(1100, 1200) == size_t(33));
+    EXPECT(pv.filter_range(1100, 1200, indices) == size_t(33));
+    EXPECT(indices.size() == size_t(33));
+    EXPECT(indices.front() == size_t(34));
+    EXPECT(indices.back() == size_t(66));
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 
 int main(int argc, char** argv) {
@@ -0,0 +1,196 @@
+/*
+ * (C) Copyright 1996-2015 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation nor
+ * does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+#include <vector>
+
+#include "eckit/testing/Test.h"
+
+#include "pmem/PersistentRingBuffer.h"
+#include "pmem/PersistentType.h"
+
+#include "test_persistent_helpers.h"
+
+using namespace std;
+using namespace pmem;
+using namespace eckit;
+using namespace eckit::testing;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// A record, such as might be logged for telemetry.
+
+struct Event {
+    uint64_t time;
+    uint32_t id;
+    float value;
+};
+
+
+/// Define a root type. Each test that does allocation should use a different element in the root object.
+
+// How many possibilities do we want?
+const size_t root_elems = 2;
+
+
+class RootType : public PersistentType<RootType> {
+
+public: // constructor
+
+    class Constructor : public AtomicConstructor<RootType> {
+        virtual void make(RootType &object) const {
+            for (size_t i = 0; i < root_elems; i++) {
+                object.data_[i].nullify();
+            }
+        }
+    };
+
+public: // members
+
+    PersistentRingBuffer<Event> data_[root_elems];
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// And structure the pool with types
+
+template<> uint64_t pmem::PersistentType<RootType>::type_id = POBJ_ROOT_TYPE_NUM;
+template<> uint64_t pmem::PersistentType<pmem::PersistentRingBuffer<Event>::data_type>::type_id = 1;
+
+// Create a global fixture, so that this pool is only created once, and destroyed once.
+
+AutoPool globalAutoPool((RootType::Constructor()));
+
+struct GlobalRootFixture : public PersistentPtr<RootType> {
+ GlobalRootFixture() : PersistentPtr<RootType>(globalAutoPool.pool_.getRoot<RootType>()) {}
+    ~GlobalRootFixture() { nullify(); }
+};
+
+GlobalRootFixture global_root;
+
+
+Event make_event(uint64_t i) {
+    Event e = { 1000 + i, uint32_t(i), float(i) / 2 };
+    return e;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CASE( "test_pmem_persistent_ring_buffer_size" )
+{
+    PersistentRingBuffer<Event> rb;
+
+    EXPECT(sizeof(rb) == sizeof(PMEMoid));
+    EXPECT(rb.capacity() == size_t(0));
+    EXPECT(rb.empty());
+    EXPECT(rb.span(0).count == size_t(0));
+
+    EXPECT_THROWS_AS(rb.push_back(make_event(0)), SeriousBug);
+}
+
+
+CASE( "test_pmem_persistent_ring_buffer_append_and_wrap" )
+{
+    PersistentRingBuffer<Event>& rb(global_root->data_[0]);
+
+    rb.allocate(8);
+    EXPECT(rb.capacity() == size_t(8));
+    EXPECT(rb.empty());
+
+    // Publish a batch of records
+
+    std::vector<Event> batch;
+    for (uint64_t i = 0; i < 5; i++) batch.push_back(make_event(i));
+    rb.append(&batch[0], batch.size());
+
+    EXPECT(rb.size() == size_t(5));
+    EXPECT(rb.head() == uint64_t(0));
+    EXPECT(rb.tail() == uint64_t(5));
+
+    PersistentRingBuffer<Event>::Span s = rb.span(0);
+    const Event* storage = s.data;
+    EXPECT(s.first == uint64_t(0));
+    EXPECT(s.count == size_t(5));
+    EXPECT(s.data[4].id == uint32_t(4));
+
+    // Overflow the buffer. The oldest records are overwritten in place, without reallocation.
+
+    batch.clear();
+    for (uint64_t i = 5; i < 11; i++) batch.push_back(make_event(i));
+    rb.append(&batch[0], batch.size());
+
+    EXPECT(rb.size() == size_t(8));
+    EXPECT(rb.head() == uint64_t(3));
+    EXPECT(rb.tail() == uint64_t(11));
+    EXPECT(!rb.valid(2));
+    EXPECT(rb.valid(3));
+    EXPECT(!rb.valid(11));
+
+    // Reading from an overwritten position starts from the head. The valid records wrap around the end of the
+    // storage, so are returned in two contiguous spans.
+
+    s = rb.span(0);
+    EXPECT(s.first == uint64_t(3));
+    EXPECT(s.count == size_t(5));
+    EXPECT(s.data == storage + 3);
+    EXPECT(s.data[0].time == uint64_t(1003));
+
+    s = rb.span(s.first + s.count);
+    EXPECT(s.first == uint64_t(8));
+    EXPECT(s.count == size_t(3));
+    EXPECT(s.data == storage);
+    EXPECT(s.data[2].id == uint32_t(10));
+    EXPECT(s.data[2].value == 5.0);
+
+    s = rb.span(s.first + s.count);
+    EXPECT(s.count == size_t(0));
+
+    // Batches larger than the buffer are refused
+
+    std::vector<Event> big(9, make_event(99));
+    EXPECT_THROWS_AS(rb.append(&big[0], big.size()), AssertionFailed);
+    EXPECT(rb.tail() == uint64_t(11));
+}
+
+
+CASE( "test_pmem_persistent_ring_buffer_discard" )
+{
+    PersistentRingBuffer<Event>& rb(global_root->data_[1]);
+
+    rb.allocate(4);
+    EXPECT_THROWS_AS(rb.allocate(4), AssertionFailed);
+
+    for (uint64_t i = 0; i < 3; i++) rb.push_back(make_event(i));
+
+    rb.discard(2);
+    EXPECT(rb.size() == size_t(1));
+    EXPECT(rb.head() == uint64_t(2));
+    EXPECT(rb.span(0).data->id == uint32_t(2));
+
+    rb.discard(10);
+    EXPECT(rb.empty());
+    EXPECT(rb.head() == uint64_t(3));
+
+    // The record numbers keep increasing after the buffer is emptied
+
+    rb.push_back(make_event(3));
+    EXPECT(rb.span(0).first == uint64_t(3));
+    EXPECT(rb.span(0).data->id == uint32_t(3));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    return run_tests(argc, argv);
+}
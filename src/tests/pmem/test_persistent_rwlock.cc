@@ -0,0 +1,172 @@
+/*
+ * (C) Copyright 1996-2015 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation nor
+ * does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+#include <thread>
+#include <vector>
+
+#include "eckit/testing/Test.h"
+
+#include "pmem/PersistentPtr.h"
+#include "pmem/PersistentRWLock.h"
+#include "pmem/PersistentType.h"
+
+#include "test_persistent_helpers.h"
+
+using namespace std;
+using namespace pmem;
+using namespace eckit;
+using namespace eckit::testing;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Define a root type, containing a lock and the data that it protects.
+
+class RootType : public PersistentType<RootType> {
+
+public: // constructor
+
+    class Constructor : public AtomicConstructor<RootType> {
+        virtual void make(RootType &object) const {
+            object.lock_.zero();
+            object.counter_ = 0;
+        }
+    };
+
+public: // members
+
+    PersistentRWLock lock_;
+
+    size_t counter_;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// And structure the pool with types
+
+template<> uint64_t pmem::PersistentType<RootType>::type_id = POBJ_ROOT_TYPE_NUM;
+
+// Create a global fixture, so that this pool is only created once, and destroyed once.
+
+AutoPool globalAutoPool((RootType::Constructor()));
+
+struct GlobalRootFixture : public PersistentPtr<RootType> {
+ GlobalRootFixture() : PersistentPtr<RootType>(globalAutoPool.pool_.getRoot<RootType>()) {}
+    ~GlobalRootFixture() { nullify(); }
+};
+
+GlobalRootFixture global_root;
+
+
+/// Try to acquire the lock from another thread (a thread may not reacquire a lock that it already holds).
+
+static bool try_read_elsewhere(PersistentRWLock& lock) {
+    bool locked = false;
+    std::thread t([&lock, &locked]() {
+        locked = lock.tryLockRead();
+        if (locked) lock.unlock();
+    });
+    t.join();
+    return locked;
+}
+
+
+static bool try_write_elsewhere(PersistentRWLock& lock) {
+    bool locked = false;
+    std::thread t([&lock, &locked]() {
+        locked = lock.tryLockWrite();
+        if (locked) lock.unlock();
+    });
+    t.join();
+    return locked;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CASE( "test_pmem_rwlock_readers_share" )
+{
+    PersistentRWLock& lock(global_root->lock_);
+
+    {
+        AutoReadLock guard(lock);
+
+        // Other readers may proceed, but a writer may not
+
+        EXPECT(try_read_elsewhere(lock));
+        EXPECT(!try_write_elsewhere(lock));
+    }
+
+    // Once the guard is released, anybody may take the lock
+
+    EXPECT(try_write_elsewhere(lock));
+    EXPECT(try_read_elsewhere(lock));
+}
+
+
+CASE( "test_pmem_rwlock_writer_excludes" )
+{
+    PersistentRWLock& lock(global_root->lock_);
+
+    {
+        AutoWriteLock guard(lock);
+
+        EXPECT(!try_read_elsewhere(lock));
+        EXPECT(!try_write_elsewhere(lock));
+    }
+
+    EXPECT(try_read_elsewhere(lock));
+
+    // The explicit interface behaves in the same way
+
+    EXPECT(lock.tryLockWrite());
+    EXPECT(!try_read_elsewhere(lock));
+    lock.unlock();
+
+    lock.lockRead();
+    EXPECT(!try_write_elsewhere(lock));
+    lock.unlock();
+}
+
+
+CASE( "test_pmem_rwlock_concurrent_writers" )
+{
+    RootType& root(*global_root);
+
+    const size_t nthreads = 8;
+    const size_t increments = 10000;
+
+    // The (non-atomic) counter is only consistent if the writers are serialised.
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < nthreads; t++) {
+        threads.push_back(std::thread([&root, increments]() {
+            for (size_t i = 0; i < increments; i++) {
+                AutoWriteLock guard(root.lock_);
+                root.counter_++;
+            }
+        }));
+    }
+
+    for (size_t t = 0; t < nthreads; t++)
+        threads[t].join();
+
+    AutoReadLock guard(root.lock_);
+    EXPECT(root.counter_ == nthreads * increments);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    return run_tests(argc, argv);
+}
@@ -0,0 +1,208 @@
+/*
+ * (C) Copyright 1996-2015 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation nor
+ * does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "eckit/testing/Test.h"
+
+#include "pmem/PersistentSortedPODVector.h"
+#include "pmem/PersistentType.h"
+
+#include "test_persistent_helpers.h"
+
+using namespace std;
+using namespace pmem;
+using namespace eckit;
+using namespace eckit::testing;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Define a root type. Each test that does allocation should use a different element in the root object.
+
+// How many possibilities do we want?
+const size_t root_elems = 3;
+
+
+class RootType : public PersistentType<RootType> {
+
+public: // constructor
+
+    class Constructor : public AtomicConstructor<RootType> {
+        virtual void make(RootType &object) const {
+            for (size_t i = 0; i < root_elems; i++) {
+                object.data_[i].nullify();
+            }
+        }
+    };
+
+public: // members
+
+    PersistentSortedPODVector<uint64_t> data_[root_elems];
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// And structure the pool with types
+
+template<> uint64_t pmem::PersistentType<RootType>::type_id = POBJ_ROOT_TYPE_NUM;
+template<> uint64_t pmem::PersistentType<pmem::PersistentSortedPODVector<uint64_t>::data_type>::type_id = 1;
+
+// Create a global fixture, so that this pool is only created once, and destroyed once.
+
+AutoPool globalAutoPool((RootType::Constructor()));
+
+struct GlobalRootFixture : public PersistentPtr<RootType> {
+ GlobalRootFixture() : PersistentPtr<RootType>(globalAutoPool.pool_.getRoot<RootType>()) {}
+    ~GlobalRootFixture() { nullify(); }
+};
+
+GlobalRootFixture global_root;
+
+
+/// Check that the contents of a vector are in order
+
+template <typename T>
+bool in_order(const PersistentSortedPODVector<T>& pv) {
+    for (size_t i = 1; i < pv.size(); i++) {
+        if (pv[i] < pv[i-1]) return false;
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CASE( "test_pmem_persistent_sorted_pod_vector_insert" )
+{
+    PersistentSortedPODVector<uint64_t>& pv(global_root->data_[0]);
+
+    // An empty vector is sorted, and lookups find nothing
+
+    EXPECT(pv.null());
+    EXPECT(pv.sorted());
+    EXPECT(pv.lower_bound(3) == pv.end());
+
+    // Values appended in order are written into the available space, without reallocation
+
+    pv.insert(10);
+    pv.insert(20);
+    EXPECT(pv.size() == size_t(2));
+    EXPECT(pv.allocated_size() == size_t(2));
+
+    pv.resize(8);
+    const uint64_t* data = pv.begin();
+
+    pv.insert(30);
+    pv.insert(30);
+    EXPECT(pv.begin() == data);
+    EXPECT(pv.size() == size_t(4));
+    EXPECT(pv.sorted());
+
+    // Values out of order are merged into a new copy
+
+    pv.insert(15);
+    pv.insert(5);
+    pv.insert(30);
+    EXPECT(pv.size() == size_t(7));
+    EXPECT(pv.allocated_size() == size_t(8));
+    EXPECT(pv.sorted());
+    EXPECT(in_order(pv));
+    EXPECT(pv[0] == uint64_t(5));
+    EXPECT(pv[2] == uint64_t(15));
+
+    // And we can search
+
+    EXPECT(pv.lower_bound(15) - pv.begin() == 2);
+    EXPECT(pv.lower_bound(16) - pv.begin() == 3);
+    EXPECT(pv.upper_bound(15) - pv.begin() == 3);
+    EXPECT(pv.lower_bound(100) == pv.end());
+
+    std::pair<PersistentSortedPODVector<uint64_t>::const_iterator,
+              PersistentSortedPODVector<uint64_t>::const_iterator> range = pv.equal_range(30);
+    EXPECT(range.first - pv.begin() == 4);
+    EXPECT(range.second == pv.end());
+
+    // Growing the vector when full
+
+    pv.insert(1);
+    pv.insert(2);
+    EXPECT(pv.size() == size_t(9));
+    EXPECT(pv.allocated_size() == size_t(16));
+    EXPECT(in_order(pv));
+    EXPECT(pv[0] == uint64_t(1));
+}
+
+
+CASE( "test_pmem_persistent_sorted_pod_vector_append_then_sort" )
+{
+    PersistentSortedPODVector<uint64_t>& pv(global_root->data_[1]);
+
+    const size_t count = 1000;
+    for (size_t i = 0; i < count; i++) {
+        pv.push_back((i * 7919) % count);
+    }
+
+    // Unordered appends clear the sorted flag, and ordered lookups are then refused.
+
+    EXPECT(pv.size() == count);
+    EXPECT(!pv.sorted());
+    EXPECT_THROWS_AS(pv.lower_bound(10), AssertionFailed);
+
+    // A resize preserves the (absence of the) flag
+
+    pv.resize(2 * count);
+    EXPECT(!pv.sorted());
+
+    pv.sort();
+    EXPECT(pv.sorted());
+    EXPECT(pv.size() == count);
+    EXPECT(pv.allocated_size() == 2 * count);
+    EXPECT(in_order(pv));
+
+    for (size_t i = 0; i < count; i++) {
+        EXPECT(pv[i] == uint64_t(i));
+    }
+}
+
+
+CASE( "test_pmem_persistent_sorted_pod_vector_bulk_insert" )
+{
+    PersistentSortedPODVector<uint64_t>& pv(global_root->data_[2]);
+
+    std::vector<uint64_t> batch1;
+    for (uint64_t i = 0; i < 500; i++) batch1.push_back(1000 - 2 * i);
+
+    pv.insert(batch1.begin(), batch1.end());
+    EXPECT(pv.size() == size_t(500));
+    EXPECT(pv.sorted());
+    EXPECT(in_order(pv));
+
+    // A second batch, interleaved with the first
+
+    std::vector<uint64_t> batch2;
+    for (uint64_t i = 0; i < 500; i++) batch2.push_back(2 * ((i * 37) % 500) + 1);
+
+    pv.insert(batch2.begin(), batch2.end());
+    EXPECT(pv.size() == size_t(1000));
+    EXPECT(pv.allocated_size() == size_t(1000));
+    EXPECT(pv.sorted());
+    EXPECT(in_order(pv));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    return run_tests(argc, argv);
+}
@@ -88,14 +88,14 @@ CASE( "test_pmem_persistent_string_size" )
 
     // n.b. we store the null character, so that data() and c_str() can be implemented O(1) according to the std.
 
-    // Check that space is allocated to store the data, and to store the size of the data
-    EXPECT(ctr.size() == sizeof(size_t) + sizeof(char));
+    // Check that space is allocated to store the data, and to store the size and checksum of the data
+    EXPECT(ctr.size() == sizeof(size_t) + sizeof(uint64_t) + sizeof(char));
 
     std::string str_in2("1234");
     AtomicConstructor1<PersistentString, std::string> ctr2(str_in2);
 
-    // Check that space is allocated to store the data, and to store the size of the data
-    EXPECT(ctr2.size() == sizeof(size_t) + 5 * sizeof(char));
+    // Check that space is allocated to store the data, and to store the size and checksum of the data
+    EXPECT(ctr2.size() == sizeof(size_t) + sizeof(uint64_t) + 5 * sizeof(char));
 }
 
 
@@ -157,6 +157,14 @@ CASE( "test_pmem_persistent_string_equality_operators" )
     EXPECT(str1 != str2);          EXPECT(!(str1 == str2));
     EXPECT(str2 != str1);          EXPECT(!(str2 == str1));
 
+    // A string is not equal to a longer one that it is a prefix of
+
+    PersistentMock<PersistentString> stringMock3(std::string("This is"));
+    PersistentString& str3(stringMock3.object());
+
+    EXPECT(str3 != str1);          EXPECT(!(str3 == str1));
+    EXPECT(str1 != str3);          EXPECT(!(str1 == str3));
+
     // Compare persistent strings to C strings
 
     const char* cstrsame = "This is a string 1";
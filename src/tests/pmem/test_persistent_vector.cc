@@ -13,8 +13,12 @@
  * (Project ID: 671951) www.nextgenio.eu
  */
 
+#include <thread>
+
 #include "eckit/testing/Test.h"
 
+#include "pmem/EpochManager.h"
+#include "pmem/Parallel.h"
 #include "pmem/PersistentVector.h"
 
 #include "test_persistent_helpers.h"
@@ -57,7 +61,7 @@ public: // members
 /// Define a root type. Each test that does allocation should use a different element in the root object.
 
 // How many possibilities do we want?
-const size_t root_elems = 4;
+const size_t root_elems = 8;
 
 
 class RootType : public PersistentType<RootType> {
@@ -69,12 +73,14 @@ public: // constructor
             for (size_t i = 0; i < root_elems; i++) {
                 object.data_[i].nullify();
             }
+            object.retired_.nullify();
         }
     };
 
 public: // members
 
     PersistentVector<CustomType> data_[root_elems];
+    EpochManager::storage_type retired_;
 };
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -84,6 +90,7 @@ public: // members
 template<> uint64_t pmem::PersistentType<RootType>::type_id = POBJ_ROOT_TYPE_NUM;
 template<> uint64_t pmem::PersistentType<CustomType>::type_id = 1;
 template<> uint64_t pmem::PersistentType<pmem::PersistentVectorData<CustomType> >::type_id = 2;
+template<> uint64_t pmem::PersistentType<pmem::PersistentRetireList>::type_id = 3;
 
 // Create a global fixture, so that this pool is only created once, and destroyed once.
 
@@ -401,6 +408,275 @@ CASE( "test_pmem_persistent_vector_consistency_check" )
     EXPECT_THROWS_AS(pv->consistency_check(), AssertionFailed);
 }
 
+CASE( "test_pmem_persistent_vector_iterators" )
+{
+    PersistentVector<CustomType>& pv(global_root->data_[4]);
+
+    // An empty (null) vector gives an empty range
+
+    EXPECT(pv.null());
+    EXPECT(pv.begin() == pv.end());
+
+    for (uint32_t i = 0; i < 5; i++) {
+        pv.push_back(1000 + i);
+    }
+
+    // The iterators walk the elements in order, and agree with operator[]
+
+    EXPECT(size_t(pv.end() - pv.begin()) == pv.size());
+
+    size_t i = 0;
+    for (PersistentVector<CustomType>::const_iterator it = pv.begin(); it != pv.end(); ++it, ++i) {
+        EXPECT(*it == pv[i]);
+        EXPECT((*it)->data1_ == uint32_t(1000 + i));
+    }
+    EXPECT(i == size_t(5));
+
+    // And they can be used for a parallel reduction
+
+    uint64_t total = parallel_transform_reduce(pv.begin(), pv.end(), uint64_t(0),
+                                               [](uint64_t a, uint64_t b) { return a + b; },
+                                               [](const PersistentPtr<CustomType>& p) { return uint64_t(p->data1_); },
+                                               1);
+    EXPECT(total == uint64_t(5010));
+}
+
+CASE( "test_pmem_persistent_vector_erase" )
+{
+    PersistentVector<CustomType>& pv(global_root->data_[5]);
+
+    EXPECT_THROWS_AS(pv.erase(0), OutOfRange);
+
+    for (uint32_t i = 0; i < 4; i++) {
+        pv.push_back(2000 + i);
+    }
+
+    PersistentPtr<CustomType> p0 = pv[0];
+    PersistentPtr<CustomType> p1 = pv[1];
+    PersistentPtr<CustomType> p2 = pv[2];
+    PersistentPtr<CustomType> p3 = pv[3];
+
+    // Erasing from the middle moves the last element into the gap, and returns the removed element
+
+    PersistentPtr<CustomType> removed = pv.erase(1);
+
+    EXPECT(removed == p1);
+    EXPECT(pv.size() == size_t(3));
+    EXPECT(pv.allocated_size() == size_t(4));
+    EXPECT(pv[0] == p0);
+    EXPECT(pv[1] == p3);
+    EXPECT(pv[2] == p2);
+
+    // "Null means end" still holds
+
+    pv->consistency_check();
+    EXPECT(pv.size() == size_t(3));
+
+    // Erasing the last element
+
+    EXPECT(pv.erase(2) == p2);
+    EXPECT(pv.size() == size_t(2));
+    EXPECT(pv[0] == p0);
+    EXPECT(pv[1] == p3);
+
+    EXPECT_THROWS_AS(pv.erase(2), OutOfRange);
+
+    // And we can continue to append afterwards
+
+    pv.push_back(2004);
+    EXPECT(pv.size() == size_t(3));
+    EXPECT(pv[2]->data1_ == uint32_t(2004));
+
+    removed.free();
+    p2.free();
+}
+
+CASE( "test_pmem_persistent_vector_erase_recovery" )
+{
+    // An erase may be interrupted at any point after it has been recorded. consistency_check() (which is
+    // called by any access to the size) must complete it. We simulate each of the intermediate states.
+
+    class Abuser : public PersistentVectorData<CustomType> {
+    public:
+        void record_erase(size_t i, size_t n) {
+            eraseIndex_ = i;
+            eraseSize_ = n;
+        }
+        void set_elem(size_t i, const PersistentPtr<CustomType>& p) {
+            elements_[i] = p;
+        }
+        void null_elem(size_t i) { elements_[i].nullify(); }
+        void tweak_nelem(size_t n) { update_nelem(n); }
+        size_t raw_size() const { return nelem_; }
+    };
+
+    PersistentVector<CustomType>& pv(global_root->data_[6]);
+
+    for (uint32_t i = 0; i < 4; i++) {
+        pv.push_back(3000 + i);
+    }
+
+    PersistentPtr<CustomType> p0 = pv[0];
+    PersistentPtr<CustomType> p1 = pv[1];
+    PersistentPtr<CustomType> p2 = pv[2];
+    PersistentPtr<CustomType> p3 = pv[3];
+    Abuser* abuser = static_cast<Abuser*>(pv.get());
+
+    // i) Interrupted after recording the erase of element 0
+
+    abuser->record_erase(0, 4);
+    EXPECT(pv.size() == size_t(3));
+    EXPECT(pv[0] == p3);
+    EXPECT(pv[1] == p1);
+    EXPECT(pv[2] == p2);
+
+    // ii) Interrupted after moving the last element (p2) into slot 1
+
+    abuser->record_erase(1, 3);
+    abuser->set_elem(1, p2);
+    EXPECT(pv.size() == size_t(2));
+    EXPECT(pv[0] == p3);
+    EXPECT(pv[1] == p2);
+
+    // iii) Interrupted after nullifying the last element, but before updating the count
+
+    abuser->record_erase(0, 2);
+    abuser->set_elem(0, p2);
+    abuser->null_elem(1);
+    EXPECT(abuser->raw_size() == size_t(2));
+    EXPECT(pv.size() == size_t(1));
+    EXPECT(pv[0] == p2);
+
+    // iv) Interrupted after updating the count, but before marking the erase complete.
+
+    pv.push_back_elem(p3);
+    EXPECT(pv.size() == size_t(2));
+
+    abuser->set_elem(0, p3);
+    abuser->null_elem(1);
+    abuser->tweak_nelem(1);
+    abuser->record_erase(0, 2);
+    EXPECT(pv.size() == size_t(1));
+    EXPECT(pv[0] == p3);
+
+    p0.free();
+    p1.free();
+    p2.free();
+}
+
+CASE( "test_pmem_persistent_vector_compact" )
+{
+    PersistentVector<CustomType>& pv(global_root->data_[5]);
+
+    // The vector from the erase test has 3 elements in space for 4. That is already dense.
+
+    EXPECT(pv.size() == size_t(3));
+    EXPECT(pv.allocated_size() == size_t(4));
+    EXPECT(!pv.compact());
+
+    // Make it sparse
+
+    pv.resize(64);
+    EXPECT(pv.allocated_size() == size_t(64));
+
+    PersistentPtr<CustomType> p0 = pv[0];
+    PersistentPtr<CustomType> p1 = pv[1];
+    PersistentPtr<CustomType> p2 = pv[2];
+
+    EXPECT(pv.compact());
+    EXPECT(pv.size() == size_t(3));
+    EXPECT(pv.allocated_size() == size_t(4));
+
+    EXPECT(pv[0] == p0);
+    EXPECT(pv[1] == p1);
+    EXPECT(pv[2] == p2);
+}
+
+CASE( "test_pmem_persistent_vector_publish" )
+{
+    PersistentVector<CustomType>& pv(global_root->data_[7]);
+    PersistentPool& pool(globalAutoPool.pool_);
+
+    EpochManager epochs(global_root->retired_, false);
+
+    pv.publish_back(pool.allocate<CustomType>(uint32_t(0)), epochs);
+    pv.publish_back(pool.allocate<CustomType>(uint32_t(1)), epochs);
+
+    EXPECT(pv.size() == size_t(2));
+    EXPECT(pv.allocated_size() == size_t(2));
+
+    // There are no readers, so the replaced copy can be freed immediately
+
+    EXPECT(epochs.pending() == size_t(1));
+    EXPECT(epochs.reclaim() == size_t(1));
+
+    // A snapshot taken before the data is replaced remains valid afterwards, until the reader exits
+
+    {
+        EpochGuard guard(epochs);
+
+        std::pair<PersistentVector<CustomType>::const_iterator,
+                  PersistentVector<CustomType>::const_iterator> old = pv.published();
+
+        pv.publish_back(pool.allocate<CustomType>(uint32_t(2)), epochs);
+
+        EXPECT(epochs.reclaim() == size_t(0));
+
+        EXPECT(pv.size() == size_t(3));
+        EXPECT(pv.allocated_size() == size_t(4));
+        EXPECT(old.second - old.first == 2);
+        EXPECT((*old.first)->data1_ == uint32_t(0));
+        EXPECT((*(old.first + 1))->data1_ == uint32_t(1));
+    }
+
+    // Appending into the free space does not replace the data
+
+    std::pair<PersistentVector<CustomType>::const_iterator,
+              PersistentVector<CustomType>::const_iterator> current = pv.published();
+
+    pv.publish_back(pool.allocate<CustomType>(uint32_t(3)), epochs);
+
+    EXPECT(pv.published().first == current.first);
+    EXPECT(pv.published().second - pv.published().first == 4);
+
+    // The replaced copies are freed once there are no readers
+
+    EXPECT(epochs.pending() == size_t(1));
+    EXPECT(epochs.reclaim() == size_t(1));
+    EXPECT(epochs.reclaim() == size_t(0));
+
+    // Concurrent readers always see a consistent prefix of the elements
+
+    const size_t count = 2000;
+    bool consistent = true;
+
+    std::thread reader([&pv, &epochs, &consistent, count]() {
+        size_t seen = 0;
+        while (seen < count) {
+            EpochGuard guard(epochs);
+            std::pair<PersistentVector<CustomType>::const_iterator,
+                      PersistentVector<CustomType>::const_iterator> range = pv.published();
+            size_t n = range.second - range.first;
+            for (size_t i = 0; i < n; i++) {
+                if (range.first[i].null() || range.first[i]->data1_ != i)
+                    consistent = false;
+            }
+            if (n < seen) consistent = false;
+            seen = n;
+        }
+    });
+
+    for (size_t i = 4; i < count; i++)
+        pv.publish_back(pool.allocate<CustomType>(uint32_t(i)), epochs);
+
+    reader.join();
+
+    EXPECT(consistent);
+    EXPECT(pv.size() == count);
+    EXPECT(epochs.reclaim() == size_t(9));
+}
+
+
 //----------------------------------------------------------------------------------------------------------------------
 
 int main(int argc, char** argv) {
@@ -0,0 +1,127 @@
+/*
+ * (C) Copyright 1996-2015 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation nor
+ * does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+#include <limits>
+#include <vector>
+
+#include "eckit/testing/Test.h"
+
+#include "pmem/PODKernels.h"
+
+using namespace std;
+using namespace pmem;
+using namespace eckit;
+using namespace eckit::testing;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Compare the (possibly vectorised) kernels against the scalar reference implementations, for every length up
+/// to a few vectors, and from unaligned starting points, so that all the head/tail handling is exercised.
+///
+/// The values include the extremes of the type, to catch sign handling in the unsigned comparisons. All of the
+/// values are exactly representable, so the floating point sums are order independent.
+
+template <typename T>
+bool check_kernels() {
+
+    std::vector<T> values;
+    for (size_t i = 0; i < 80; i++) {
+        values.push_back(T((i * 37) % 23) - T(5));
+    }
+    values[13] = std::numeric_limits<T>::max();
+    values[41] = std::numeric_limits<T>::is_integer ? std::numeric_limits<T>::min() : -std::numeric_limits<T>::max();
+
+    const T lo = T(2);
+    const T hi = T(9);
+
+    bool ok = true;
+
+    for (size_t offset = 0; offset < 3; offset++) {
+        for (size_t n = 0; n + offset <= values.size(); n++) {
+
+            const T* data = &values[offset];
+
+            for (T target = T(-6); target < T(20); target += T(5)) {
+                ok = ok && (kernels::find(data, n, target) == kernels::scalar::find(data, n, target));
+                ok = ok && (kernels::count(data, n, target) == kernels::scalar::count(data, n, target));
+            }
+
+            ok = ok && (kernels::count_range(data, n, lo, hi) == kernels::scalar::count_range(data, n, lo, hi));
+
+            std::vector<size_t> indices(1, 999);
+            std::vector<size_t> expected(1, 999);
+            size_t nfound = kernels::filter_range(data, n, lo, hi, indices);
+            kernels::scalar::filter_range(data, n, lo, hi, expected);
+            ok = ok && (indices == expected) && (nfound == expected.size() - 1);
+
+            if (n != 0) {
+                ok = ok && (kernels::min(data, n) == kernels::scalar::min(data, n));
+                ok = ok && (kernels::max(data, n) == kernels::scalar::max(data, n));
+            }
+
+            if (n < 13 || std::numeric_limits<T>::is_integer) {
+                ok = ok && (kernels::sum(data, n) == kernels::scalar::sum(data, n));
+            }
+        }
+    }
+
+    return ok;
+}
+
+
+CASE( "test_pmem_pod_kernels_match_scalar" )
+{
+    EXPECT(check_kernels<int32_t>());
+    EXPECT(check_kernels<uint32_t>());
+    EXPECT(check_kernels<int64_t>());
+    EXPECT(check_kernels<uint64_t>());
+    EXPECT(check_kernels<float>());
+    EXPECT(check_kernels<double>());
+
+    // The generic (unspecialised) template.
+    EXPECT(check_kernels<int16_t>());
+}
+
+
+CASE( "test_pmem_pod_kernels_values" )
+{
+    std::vector<uint32_t> values;
+    for (uint32_t i = 0; i < 100; i++) values.push_back(i);
+    values.push_back(0xffffffff);
+
+    EXPECT(kernels::find(&values[0], values.size(), uint32_t(37)) == size_t(37));
+    EXPECT(kernels::find(&values[0], values.size(), uint32_t(1000)) == values.size());
+    EXPECT(kernels::count(&values[0], values.size(), uint32_t(99)) == size_t(1));
+    EXPECT(kernels::count_range(&values[0], values.size(), uint32_t(10), uint32_t(19)) == size_t(10));
+    EXPECT(kernels::min(&values[0], values.size()) == uint32_t(0));
+    EXPECT(kernels::max(&values[0], values.size()) == uint32_t(0xffffffff));
+
+    // Sums of 32-bit values are accumulated in 64 bits.
+    EXPECT(kernels::sum(&values[0], values.size()) == uint64_t(4950) + uint64_t(0xffffffff));
+
+    std::vector<size_t> indices;
+    EXPECT(kernels::filter_range(&values[0], values.size(), uint32_t(95), uint32_t(0xffffffff), indices) == size_t(6));
+    EXPECT(indices.size() == size_t(6));
+    EXPECT(indices[0] == size_t(95));
+    EXPECT(indices[5] == size_t(100));
+
+    EXPECT_THROWS_AS(kernels::min(&values[0], 0), AssertionFailed);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    return run_tests(argc, argv);
+}
@@ -0,0 +1,283 @@
+/*
+ * (C) Copyright 1996-2015 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation nor
+ * does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "eckit/testing/Test.h"
+
+#include "pmem/EpochManager.h"
+#include "pmem/InternTable.h"
+#include "pmem/PersistentBuffer.h"
+
+#include "pmem/tree/TreeDedupStore.h"
+#include "pmem/tree/TreeNode.h"
+
+#include "tests/pmem/test_persistent_helpers.h"
+
+using namespace std;
+using namespace pmem;
+using namespace eckit;
+using namespace eckit::testing;
+using namespace tree;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Define a root type. Each test that does allocation should use a different element in the root object.
+
+const size_t root_elems = 4;
+
+
+class RootType : public PersistentType<RootType> {
+
+public: // constructor
+
+    class Constructor : public AtomicConstructor<RootType> {
+        virtual void make(RootType &object) const {
+            for (size_t i = 0; i < root_elems; i++) {
+                object.stores_[i].nullify();
+                object.nodes_[i].nullify();
+            }
+            object.symbols_.nullify();
+            object.retired_.nullify();
+        }
+    };
+
+public: // members
+
+    PersistentPtr<TreeDedupStore> stores_[root_elems];
+    PersistentPtr<TreeNode> nodes_[root_elems];
+    InternTable::storage_type symbols_;
+    EpochManager::storage_type retired_;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// And structure the pool with types
+
+template<> uint64_t pmem::PersistentType<RootType>::type_id = POBJ_ROOT_TYPE_NUM;
+template<> uint64_t pmem::PersistentType<TreeNode>::type_id = 1;
+template<> uint64_t pmem::PersistentType<pmem::PersistentVectorData<TreeNode> >::type_id = 2;
+template<> uint64_t pmem::PersistentType<pmem::PersistentBuffer>::type_id = 3;
+template<> uint64_t pmem::PersistentType<TreeDedupStore>::type_id = 4;
+template<> uint64_t pmem::PersistentType<PersistentString>::type_id = 5;
+template<> uint64_t pmem::PersistentType<pmem::PersistentVectorData<PersistentString> >::type_id = 6;
+template<> uint64_t pmem::PersistentType<PersistentRetireList>::type_id = 7;
+
+// Create a global fixture, so that this pool is only created once, and destroyed once.
+
+AutoPool globalAutoPool((RootType::Constructor()));
+PersistentPool* global_pool = &globalAutoPool.pool_;
+
+struct GlobalRootFixture : public PersistentPtr<RootType> {
+ GlobalRootFixture() : PersistentPtr<RootType>(globalAutoPool.pool_.getRoot<RootType>()) {}
+    ~GlobalRootFixture() { nullify(); }
+};
+
+GlobalRootFixture global_root;
+
+// The tree nodes store their keys and values in the intern table of the pool, and retire replaced child lists to
+// its epoch manager. Both must be open.
+
+InternTable global_symbols(global_root->symbols_);
+EpochManager global_epochs(global_root->retired_);
+
+
+/// Obtain a reference to a (new) buffer holding the given string, as TreeObject does.
+
+static PersistentPtr<PersistentBuffer> share(PersistentPtr<TreeDedupStore>& store, const std::string& s) {
+
+    uint64_t digest = TreeDedupStore::digest(s.c_str(), s.length());
+    PersistentPtr<PersistentBuffer> buffer = store->acquire(s.c_str(), s.length(), digest);
+
+    if (buffer.null()) {
+        if (store->full())
+            store.replace_ctr(TreeDedupStore::Constructor(*store, 2 * store->capacity()));
+        buffer = store->insert(digest, AtomicConstructor2<PersistentBuffer, const void*, size_t>(s.c_str(), s.length()));
+    }
+
+    return buffer;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CASE( "test_tree_dedup_store_shares_identical_data" )
+{
+    PersistentPtr<TreeDedupStore>& store(global_root->stores_[0]);
+    store.allocate_ctr(TreeDedupStore::Constructor(16));
+
+    EXPECT(store->capacity() == size_t(16));
+    EXPECT(store->stats().buffers == size_t(0));
+
+    std::string data1("Some data to store");
+    std::string data2("Some other data");
+
+    PersistentPtr<PersistentBuffer> b1 = share(store, data1);
+    PersistentPtr<PersistentBuffer> b2 = share(store, data2);
+    PersistentPtr<PersistentBuffer> b3 = share(store, data1);
+
+    EXPECT(b1 == b3);
+    EXPECT(!(b1 == b2));
+    EXPECT(::memcmp(b1->data(), data1.c_str(), data1.length()) == 0);
+
+    TreeDedupStore::Stats stats = store->stats();
+    EXPECT(stats.buffers == size_t(2));
+    EXPECT(stats.references == size_t(3));
+    EXPECT(stats.storedBytes == data1.length() + data2.length());
+    EXPECT(stats.savedBytes == data1.length());
+
+    // Buffers are only freed once the last reference is dropped
+
+    EXPECT(store->release(b1));
+    EXPECT(store->stats().buffers == size_t(2));
+    EXPECT(::memcmp(b3->data(), data1.c_str(), data1.length()) == 0);
+
+    EXPECT(store->release(b3));
+    EXPECT(store->stats().buffers == size_t(1));
+    EXPECT(store->stats().references == size_t(1));
+
+    // And new data with the same contents gets a new buffer
+
+    PersistentPtr<PersistentBuffer> b4 = share(store, data1);
+    EXPECT(store->stats().buffers == size_t(2));
+    EXPECT(::memcmp(b4->data(), data1.c_str(), data1.length()) == 0);
+
+    // Buffers that are not in the store are not released
+
+    PersistentPtr<PersistentBuffer> other;
+    other.allocate_ctr(*global_pool, AtomicConstructor2<PersistentBuffer, const void*, size_t>(data2.c_str(), data2.length()));
+    EXPECT(!store->release(other));
+    other.free();
+}
+
+CASE( "test_tree_dedup_store_grows" )
+{
+    PersistentPtr<TreeDedupStore>& store(global_root->stores_[1]);
+    store.allocate_ctr(TreeDedupStore::Constructor(4));
+
+    std::vector<PersistentPtr<PersistentBuffer> > buffers;
+    for (size_t i = 0; i < 100; i++) {
+        std::ostringstream ss;
+        ss << "value " << (i % 50);
+        buffers.push_back(share(store, ss.str()));
+    }
+
+    EXPECT(store->capacity() >= size_t(64));
+    EXPECT(!store->full());
+
+    TreeDedupStore::Stats stats = store->stats();
+    EXPECT(stats.buffers == size_t(50));
+    EXPECT(stats.references == size_t(100));
+
+    for (size_t i = 0; i < 50; i++) {
+        EXPECT(buffers[i] == buffers[i + 50]);
+    }
+
+    // The references survive the growth of the table
+
+    for (size_t i = 0; i < buffers.size(); i++) {
+        EXPECT(store->release(buffers[i]));
+    }
+    EXPECT(store->stats().buffers == size_t(0));
+    EXPECT(store->stats().references == size_t(0));
+}
+
+CASE( "test_tree_dedup_store_shared_leaves" )
+{
+    PersistentPtr<TreeDedupStore>& store(global_root->stores_[2]);
+    PersistentPtr<TreeNode>& first(global_root->nodes_[2]);
+    store.allocate_ctr(TreeDedupStore::Constructor(16));
+
+    TreeNode::KeyType key1;
+    key1.push_back(std::make_pair("key1", "value1"));
+    key1.push_back(std::make_pair("key2", "value2"));
+
+    TreeNode::KeyType key2;
+    key2.push_back(std::make_pair("key1", "value1"));
+    key2.push_back(std::make_pair("key2", "value2a"));
+
+    std::string data("\"data 1234\"");
+
+    first.setPersist(TreeNode::allocateNested(*global_pool, "SAMPLE", key1, share(store, data)));
+    first->addNode(key2, share(store, data));
+
+    StringDict request;
+    request["key1"] = "value1";
+    std::vector<PersistentPtr<TreeNode> > result = first->lookup(request);
+
+    EXPECT(result.size() == size_t(2));
+    EXPECT(result[0]->shared());
+    EXPECT(result[1]->shared());
+    EXPECT(result[0]->buffer() == result[1]->buffer());
+    EXPECT(store->stats().references == size_t(2));
+
+    // Removing a shared leaf does not free the data. That is up to the store.
+
+    PersistentPtr<PersistentBuffer> buffer = result[0]->buffer();
+    EXPECT(first->removeNode(key1));
+    EXPECT(store->release(buffer));
+
+    result = first->lookup(request);
+    EXPECT(result.size() == size_t(1));
+    EXPECT(::memcmp(result[0]->data(), data.c_str(), data.length()) == 0);
+    EXPECT(store->stats().references == size_t(1));
+}
+
+CASE( "test_tree_dedup_store_recover" )
+{
+    PersistentPtr<TreeDedupStore>& store(global_root->stores_[3]);
+    store.allocate_ctr(TreeDedupStore::Constructor(16));
+
+    std::string data("Some data");
+    PersistentPtr<PersistentBuffer> b1 = share(store, data);
+
+    // There is nothing to recover after operations that completed
+
+    EXPECT(store->recover() == size_t(0));
+    EXPECT(store->stats().buffers == size_t(1));
+
+    // Simulate an insertion that was interrupted before it was published, by inserting a buffer whose constructor
+    // fails after the slot has been claimed.
+
+    struct FailingConstructor : public AtomicConstructor<PersistentBuffer> {
+        virtual void make(PersistentBuffer&) const { throw AtomicConstructorBase::AllocationError("Interrupted"); }
+        virtual size_t size() const { return sizeof(PersistentBuffer); }
+    };
+
+    std::string other("Other data");
+    uint64_t digest = TreeDedupStore::digest(other.c_str(), other.length());
+    EXPECT_THROWS_AS(store->insert(digest, FailingConstructor()), AtomicConstructorBase::AllocationError);
+
+    // The slot is left unpublished, so the data is not found
+
+    EXPECT(store->acquire(other.c_str(), other.length(), digest).null());
+    EXPECT(store->recover() == size_t(0));
+    EXPECT(store->stats().buffers == size_t(1));
+
+    // And the store continues to function
+
+    PersistentPtr<PersistentBuffer> b2 = share(store, other);
+    EXPECT(store->stats().buffers == size_t(2));
+    EXPECT(store->release(b1));
+    EXPECT(store->release(b2));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    return run_tests(argc, argv);
+}
@@ -0,0 +1,368 @@
+/*
+ * (C) Copyright 1996-2015 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation nor
+ * does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "eckit/testing/Test.h"
+
+#include "pmem/EpochManager.h"
+#include "pmem/InternTable.h"
+
+#include "pmem/tree/TreeKeyIndex.h"
+#include "pmem/tree/TreeNode.h"
+
+#include "tests/pmem/test_persistent_helpers.h"
+
+using namespace std;
+using namespace pmem;
+using namespace eckit;
+using namespace eckit::testing;
+using namespace tree;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Define a root type. Each test that does allocation should use a different element in the root object.
+
+const size_t root_elems = 4;
+
+
+class RootType : public PersistentType<RootType> {
+
+public: // constructor
+
+    class Constructor : public AtomicConstructor<RootType> {
+        virtual void make(RootType &object) const {
+            for (size_t i = 0; i < root_elems; i++) {
+                object.data_[i].nullify();
+                object.keys_[i].nullify();
+            }
+            object.symbols_.nullify();
+            object.retired_.nullify();
+        }
+    };
+
+public: // members
+
+    PersistentPtr<TreeNode> data_[root_elems];
+    PersistentPtr<TreeKeyIndex> keys_[root_elems];
+    InternTable::storage_type symbols_;
+    EpochManager::storage_type retired_;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// And structure the pool with types
+
+template<> uint64_t pmem::PersistentType<RootType>::type_id = POBJ_ROOT_TYPE_NUM;
+template<> uint64_t pmem::PersistentType<TreeNode>::type_id = 1;
+template<> uint64_t pmem::PersistentType<pmem::PersistentVectorData<TreeNode> >::type_id = 2;
+template<> uint64_t pmem::PersistentType<PersistentString>::type_id = 5;
+template<> uint64_t pmem::PersistentType<pmem::PersistentVectorData<PersistentString> >::type_id = 6;
+template<> uint64_t pmem::PersistentType<PersistentRetireList>::type_id = 7;
+template<> uint64_t pmem::PersistentType<TreeKeyIndex>::type_id = 8;
+
+// Create a global fixture, so that this pool is only created once, and destroyed once.
+
+AutoPool globalAutoPool((RootType::Constructor()));
+PersistentPool* global_pool = &globalAutoPool.pool_;
+
+struct GlobalRootFixture : public PersistentPtr<RootType> {
+ GlobalRootFixture() : PersistentPtr<RootType>(globalAutoPool.pool_.getRoot<RootType>()) {}
+    ~GlobalRootFixture() { nullify(); }
+};
+
+GlobalRootFixture global_root;
+
+InternTable global_symbols(global_root->symbols_);
+EpochManager global_epochs(global_root->retired_);
+
+
+static TreeNode::KeyType make_key(const std::string& date, const std::string& param, const std::string& step) {
+    TreeNode::KeyType key;
+    key.push_back(std::make_pair("date", date));
+    key.push_back(std::make_pair("param", param));
+    key.push_back(std::make_pair("step", step));
+    return key;
+}
+
+
+/// Encode a key as TreeObject does.
+
+static std::vector<uint32_t> encode(const std::string& date, const std::string& param, const std::string& step) {
+    std::vector<uint32_t> ids;
+    ids.push_back(global_symbols.intern(date));
+    ids.push_back(global_symbols.intern(param));
+    ids.push_back(global_symbols.intern(step));
+    return ids;
+}
+
+
+static void add_leaf(PersistentPtr<TreeNode>& root, const std::string& date, const std::string& param,
+                     const std::string& step) {
+
+    TreeNode::KeyType key = make_key(date, param, step);
+    std::string data = date + param + step;
+
+    if (root.null())
+        root.setPersist(TreeNode::allocateNested(*global_pool, "root", key, data.c_str(), data.length()));
+    else
+        root->addNode(key, data.c_str(), data.length());
+}
+
+
+/// Add a leaf to the tree and the index, following the protocol used by TreeObject.
+
+static void add_indexed(PersistentPtr<TreeNode>& root, PersistentPtr<TreeKeyIndex>& keys, const std::string& date,
+                        const std::string& param, const std::string& step) {
+
+    std::vector<uint32_t> ids = encode(date, param, step);
+    uint64_t digest = TreeKeyIndex::digest(ids);
+
+    if (keys->full())
+        global_epochs.replace_ctr(keys, TreeKeyIndex::Constructor(*keys, 2 * keys->capacity()));
+    keys->reserve(ids, digest);
+
+    add_leaf(root, date, param, step);
+
+    EpochGuard guard(global_epochs);
+    keys->resolve(ids, digest, TreeKeyIndex::leaf(root, ids));
+}
+
+
+static std::string leaf_data(const PersistentPtr<TreeNode>& leaf) {
+    return std::string(static_cast<const char*>(leaf->data()), leaf->dataSize());
+}
+
+
+/// A tree of two dates, three params and steps from 0 to 24 hours in steps of 6.
+
+static PersistentPtr<TreeNode>& test_tree(size_t elem) {
+
+    PersistentPtr<TreeNode>& root(global_root->data_[elem]);
+
+    const char* dates[] = { "20261001", "20261002" };
+    const char* params[] = { "t", "u", "v" };
+
+    for (size_t d = 0; d < 2; d++) {
+        for (size_t p = 0; p < 3; p++) {
+            for (size_t step = 0; step <= 24; step += 6) {
+                std::ostringstream ss;
+                ss << step;
+                add_leaf(root, dates[d], params[p], ss.str());
+            }
+        }
+    }
+
+    return root;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CASE( "test_tree_key_index_built_from_tree" )
+{
+    PersistentPtr<TreeNode>& root(test_tree(0));
+    PersistentPtr<TreeKeyIndex>& keys(global_root->keys_[0]);
+
+    {
+        EpochGuard guard(global_epochs);
+        keys.allocate_ctr(TreeKeyIndex::Constructor(3, root));
+    }
+
+    EXPECT(keys->depth() == size_t(3));
+    EXPECT(keys->capacity() == size_t(1024));
+    EXPECT(keys->size() == size_t(30));
+
+    // Every leaf is found directly, and is the same leaf as found by walking the tree
+
+    bool same = true;
+    for (size_t step = 0; step <= 24; step += 6) {
+        std::ostringstream ss;
+        ss << step;
+        std::vector<uint32_t> ids = encode("20261002", "u", ss.str());
+        PersistentPtr<TreeNode> leaf = keys->find(ids, TreeKeyIndex::digest(ids));
+        same = same && !leaf.null() && leaf_data(leaf) == "20261002u" + ss.str();
+
+        StringDict request;
+        request["date"] = "20261002";
+        request["param"] = "u";
+        request["step"] = ss.str();
+        std::vector<PersistentPtr<TreeNode> > found = root->lookup(request);
+        same = same && found.size() == 1 && found[0] == leaf;
+    }
+    EXPECT(same);
+
+    // Keys that are absent, or refer to internal nodes, are not found
+
+    std::vector<uint32_t> missing = encode("20261002", "u", "3");
+    EXPECT(keys->find(missing, TreeKeyIndex::digest(missing)).null());
+
+    std::vector<uint32_t> swapped = encode("u", "20261002", "6");
+    EXPECT(keys->find(swapped, TreeKeyIndex::digest(swapped)).null());
+
+    EpochGuard guard(global_epochs);
+    std::vector<uint32_t> internal = encode("20261002", "u", "6");
+    internal.pop_back();
+    EXPECT(TreeKeyIndex::leaf(root, internal).null());
+}
+
+
+CASE( "test_tree_key_index_insert_and_remove" )
+{
+    PersistentPtr<TreeNode>& root(global_root->data_[1]);
+    PersistentPtr<TreeKeyIndex>& keys(global_root->keys_[1]);
+
+    keys.allocate_ctr(TreeKeyIndex::Constructor(3, root));
+    EXPECT(keys->size() == size_t(0));
+
+    add_indexed(root, keys, "20261001", "t", "0");
+    add_indexed(root, keys, "20261001", "t", "6");
+
+    std::vector<uint32_t> ids = encode("20261001", "t", "6");
+    uint64_t digest = TreeKeyIndex::digest(ids);
+
+    EXPECT(keys->size() == size_t(2));
+    EXPECT(leaf_data(keys->find(ids, digest)) == "20261001t6");
+
+    // A pending key is not found until it is resolved
+
+    std::vector<uint32_t> pending = encode("20261001", "u", "0");
+    uint64_t pendingDigest = TreeKeyIndex::digest(pending);
+
+    keys->reserve(pending, pendingDigest);
+    EXPECT(keys->find(pending, pendingDigest).null());
+    EXPECT(keys->size() == size_t(2));
+
+    // If the leaf is not added after all, resolving the key deletes it
+
+    {
+        EpochGuard guard(global_epochs);
+        keys->resolve(pending, pendingDigest, TreeKeyIndex::leaf(root, pending));
+    }
+    EXPECT(keys->find(pending, pendingDigest).null());
+
+    // Removing a leaf unlinks it first, and resolving afterwards deletes it
+
+    EXPECT(keys->unlink(ids, digest));
+    EXPECT(keys->find(ids, digest).null());
+    EXPECT(!keys->unlink(ids, digest));
+
+    EXPECT(root->removeNode(make_key("20261001", "t", "6")));
+
+    {
+        EpochGuard guard(global_epochs);
+        keys->resolve(ids, digest, TreeKeyIndex::leaf(root, ids));
+    }
+    EXPECT(keys->find(ids, digest).null());
+    EXPECT(keys->size() == size_t(1));
+
+    // And the key can be added again
+
+    add_indexed(root, keys, "20261001", "t", "6");
+    EXPECT(leaf_data(keys->find(ids, digest)) == "20261001t6");
+    EXPECT(keys->size() == size_t(2));
+}
+
+
+CASE( "test_tree_key_index_recovers_pending_keys" )
+{
+    PersistentPtr<TreeNode>& root(global_root->data_[2]);
+    PersistentPtr<TreeKeyIndex>& keys(global_root->keys_[2]);
+
+    keys.allocate_ctr(TreeKeyIndex::Constructor(3, root));
+
+    add_indexed(root, keys, "20261001", "t", "0");
+    add_indexed(root, keys, "20261001", "t", "6");
+
+    // Simulate insertions and removals interrupted at each stage
+
+    std::vector<uint32_t> added = encode("20261001", "t", "12");
+    std::vector<uint32_t> abandoned = encode("20261001", "t", "18");
+    std::vector<uint32_t> removed = encode("20261001", "t", "0");
+    std::vector<uint32_t> kept = encode("20261001", "t", "6");
+
+    keys->reserve(added, TreeKeyIndex::digest(added));
+    add_leaf(root, "20261001", "t", "12");
+
+    keys->reserve(abandoned, TreeKeyIndex::digest(abandoned));
+
+    EXPECT(keys->unlink(removed, TreeKeyIndex::digest(removed)));
+    EXPECT(root->removeNode(make_key("20261001", "t", "0")));
+
+    EXPECT(keys->unlink(kept, TreeKeyIndex::digest(kept)));
+
+    // Each pending key is resolved from the tree
+
+    {
+        EpochGuard guard(global_epochs);
+        EXPECT(keys->recover(root) == size_t(4));
+        EXPECT(keys->recover(root) == size_t(0));
+    }
+
+    EXPECT(keys->size() == size_t(2));
+    EXPECT(leaf_data(keys->find(added, TreeKeyIndex::digest(added))) == "20261001t12");
+    EXPECT(leaf_data(keys->find(kept, TreeKeyIndex::digest(kept))) == "20261001t6");
+    EXPECT(keys->find(abandoned, TreeKeyIndex::digest(abandoned)).null());
+    EXPECT(keys->find(removed, TreeKeyIndex::digest(removed)).null());
+}
+
+
+CASE( "test_tree_key_index_grows" )
+{
+    PersistentPtr<TreeNode>& root(global_root->data_[3]);
+    PersistentPtr<TreeKeyIndex>& keys(global_root->keys_[3]);
+
+    keys.allocate_ctr(TreeKeyIndex::Constructor(3, root));
+    EXPECT(keys->capacity() == size_t(1024));
+
+    // Enough leaves that the table must be replaced (twice), with a key left pending across the growth
+
+    std::vector<uint32_t> pending = encode("20261001", "pending", "0");
+    keys->reserve(pending, TreeKeyIndex::digest(pending));
+
+    for (size_t i = 0; i < 2000; i++) {
+        std::ostringstream param, step;
+        param << "p" << (i / 100);
+        step << (i % 100);
+        add_indexed(root, keys, "20261001", param.str(), step.str());
+    }
+
+    EXPECT(keys->capacity() == size_t(4096));
+    EXPECT(keys->size() == size_t(2000));
+
+    bool found = true;
+    for (size_t i = 0; i < 2000; i += 7) {
+        std::ostringstream param, step;
+        param << "p" << (i / 100);
+        step << (i % 100);
+        std::vector<uint32_t> ids = encode("20261001", param.str(), step.str());
+        PersistentPtr<TreeNode> leaf = keys->find(ids, TreeKeyIndex::digest(ids));
+        found = found && !leaf.null() && leaf_data(leaf) == "20261001" + param.str() + step.str();
+    }
+    EXPECT(found);
+
+    // The pending key was carried across, and is still resolved from the tree
+
+    EpochGuard guard(global_epochs);
+    EXPECT(keys->recover(root) == size_t(1));
+    EXPECT(keys->find(pending, TreeKeyIndex::digest(pending)).null());
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    return run_tests(argc, argv);
+}
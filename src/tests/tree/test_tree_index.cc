@@ -0,0 +1,443 @@
+/*
+ * (C) Copyright 1996-2015 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation nor
+ * does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+#include <atomic>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "eckit/testing/Test.h"
+
+#include "pmem/EpochManager.h"
+#include "pmem/InternTable.h"
+#include "pmem/ThreadPool.h"
+
+#include "pmem/tree/TreeIndex.h"
+#include "pmem/tree/TreeNode.h"
+#include "pmem/tree/TreeQuery.h"
+
+#include "tests/pmem/test_persistent_helpers.h"
+
+using namespace std;
+using namespace pmem;
+using namespace eckit;
+using namespace eckit::testing;
+using namespace tree;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Define a root type. Each test that does allocation should use a different element in the root object.
+
+const size_t root_elems = 5;
+
+
+class RootType : public PersistentType<RootType> {
+
+public: // constructor
+
+    class Constructor : public AtomicConstructor<RootType> {
+        virtual void make(RootType &object) const {
+            for (size_t i = 0; i < root_elems; i++) {
+                object.data_[i].nullify();
+            }
+            object.symbols_.nullify();
+            object.retired_.nullify();
+        }
+    };
+
+public: // members
+
+    PersistentPtr<TreeNode> data_[root_elems];
+    InternTable::storage_type symbols_;
+    EpochManager::storage_type retired_;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// And structure the pool with types
+
+template<> uint64_t pmem::PersistentType<RootType>::type_id = POBJ_ROOT_TYPE_NUM;
+template<> uint64_t pmem::PersistentType<TreeNode>::type_id = 1;
+template<> uint64_t pmem::PersistentType<pmem::PersistentVectorData<TreeNode> >::type_id = 2;
+template<> uint64_t pmem::PersistentType<PersistentString>::type_id = 5;
+template<> uint64_t pmem::PersistentType<pmem::PersistentVectorData<PersistentString> >::type_id = 6;
+template<> uint64_t pmem::PersistentType<PersistentRetireList>::type_id = 7;
+
+// Create a global fixture, so that this pool is only created once, and destroyed once.
+
+AutoPool globalAutoPool((RootType::Constructor()));
+PersistentPool* global_pool = &globalAutoPool.pool_;
+
+struct GlobalRootFixture : public PersistentPtr<RootType> {
+ GlobalRootFixture() : PersistentPtr<RootType>(globalAutoPool.pool_.getRoot<RootType>()) {}
+    ~GlobalRootFixture() { nullify(); }
+};
+
+GlobalRootFixture global_root;
+
+InternTable global_symbols(global_root->symbols_);
+EpochManager global_epochs(global_root->retired_);
+
+
+static TreeNode::KeyType make_key(const std::string& date, const std::string& param, const std::string& step) {
+    TreeNode::KeyType key;
+    key.push_back(std::make_pair("date", date));
+    key.push_back(std::make_pair("param", param));
+    key.push_back(std::make_pair("step", step));
+    return key;
+}
+
+
+/// Add a leaf to the tree, and then to the index (as TreeObject does).
+
+static void add_leaf(PersistentPtr<TreeNode>& root, TreeIndex* index, const std::string& date,
+                     const std::string& param, const std::string& step) {
+
+    TreeNode::KeyType key = make_key(date, param, step);
+    std::string data = date + param + step;
+
+    if (root.null())
+        root.setPersist(TreeNode::allocateNested(*global_pool, "root", key, data.c_str(), data.length()));
+    else
+        root->addNode(key, data.c_str(), data.length());
+
+    if (index)
+        index->add(root, key);
+}
+
+
+/// A tree of two dates, three params and steps from 0 to 24 hours in steps of 6.
+
+static PersistentPtr<TreeNode>& test_tree(size_t elem, TreeIndex* index=0) {
+
+    PersistentPtr<TreeNode>& root(global_root->data_[elem]);
+
+    const char* dates[] = { "20261001", "20261002" };
+    const char* params[] = { "t", "u", "v" };
+
+    for (size_t d = 0; d < 2; d++) {
+        for (size_t p = 0; p < 3; p++) {
+            for (size_t step = 0; step <= 24; step += 6) {
+                std::ostringstream ss;
+                ss << step;
+                add_leaf(root, index, dates[d], params[p], ss.str());
+            }
+        }
+    }
+
+    return root;
+}
+
+
+static std::vector<std::string> schema_keys() {
+    std::vector<std::string> keys;
+    keys.push_back("date");
+    keys.push_back("param");
+    keys.push_back("step");
+    return keys;
+}
+
+
+static std::vector<PersistentPtr<TreeNode> > index_lookup(const TreeIndex& index, const TreeQuery& query) {
+
+    std::vector<PersistentPtr<TreeNode> > result;
+
+    TreeIndex::Result r = index.visit(query, [&result](const PersistentPtr<TreeNode>& leaf) {
+        result.push_back(leaf);
+        return true;
+    });
+
+    EXPECT(r == TreeIndex::Completed);
+    return result;
+}
+
+
+/// Do the index and the tree find the same leaves, in the same order?
+
+static bool same_leaves(PersistentPtr<TreeNode>& root, const TreeIndex& index, const TreeQuery& query) {
+
+    std::vector<PersistentPtr<TreeNode> > expected = root->lookup(query);
+    std::vector<PersistentPtr<TreeNode> > found = index_lookup(index, query);
+
+    if (found.size() != expected.size())
+        return false;
+
+    for (size_t i = 0; i < found.size(); i++) {
+        if (found[i].get() != expected[i].get())
+            return false;
+    }
+
+    return true;
+}
+
+
+static std::vector<TreeQuery> test_queries() {
+
+    std::vector<TreeQuery> queries;
+
+    queries.push_back(TreeQuery(global_symbols, schema_keys()));
+
+    StringDict request;
+    request["date"] = "20261002";
+    request["param"] = "u";
+    request["step"] = "18";
+    queries.push_back(TreeQuery(global_symbols, request, schema_keys()));
+
+    request.clear();
+    request["param"] = "v/t";
+    request["step"] = "6/to/18";
+    queries.push_back(TreeQuery(global_symbols, request, schema_keys(), true));
+
+    request.clear();
+    request["step"] = "36";
+    queries.push_back(TreeQuery(global_symbols, request, schema_keys()));
+
+    return queries;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CASE( "test_tree_index_build" )
+{
+    PersistentPtr<TreeNode>& root(test_tree(0));
+
+    TreeIndex index(global_symbols);
+    EXPECT(!index.available());
+
+    EXPECT(index.visit(TreeQuery(global_symbols), [](const PersistentPtr<TreeNode>&) { return true; })
+               == TreeIndex::Unavailable);
+
+    // Building in parallel, or serially, gives the same leaves as the tree
+
+    EXPECT(index.build(root));
+    EXPECT(index.available());
+    EXPECT(index.size() > size_t(0));
+
+    ThreadPool serial(0);
+    TreeIndex serialIndex(global_symbols);
+    EXPECT(serialIndex.build(root, serial));
+    EXPECT(serialIndex.size() == index.size());
+
+    std::vector<TreeQuery> queries = test_queries();
+    EXPECT(index_lookup(index, queries[0]).size() == size_t(30));
+    EXPECT(index_lookup(index, queries[1]).size() == size_t(1));
+    EXPECT(index_lookup(index, queries[2]).size() == size_t(12));
+    EXPECT(index_lookup(index, queries[3]).size() == size_t(0));
+
+    for (size_t i = 0; i < queries.size(); i++) {
+        EXPECT(same_leaves(root, index, queries[i]));
+        EXPECT(same_leaves(root, serialIndex, queries[i]));
+    }
+
+    // The visitor can stop the lookup
+
+    size_t count = 0;
+    EXPECT(index.visit(queries[0], [&count](const PersistentPtr<TreeNode>&) { return ++count < 5; })
+               == TreeIndex::Stopped);
+    EXPECT(count == size_t(5));
+
+    // Building again does nothing
+
+    size_t size = index.size();
+    EXPECT(index.build(root));
+    EXPECT(index.size() == size);
+}
+
+
+CASE( "test_tree_index_add" )
+{
+    // An index built on an empty tree follows the leaves as they are added
+
+    TreeIndex index(global_symbols);
+    EXPECT(index.build(PersistentPtr<TreeNode>()));
+    EXPECT(index_lookup(index, TreeQuery(global_symbols)).size() == size_t(0));
+
+    PersistentPtr<TreeNode>& root(test_tree(1, &index));
+
+    add_leaf(root, &index, "20261003", "w", "0");
+    add_leaf(root, &index, "20261001", "w", "36");
+
+    std::vector<TreeQuery> queries = test_queries();
+    EXPECT(index_lookup(index, queries[0]).size() == size_t(32));
+    EXPECT(index_lookup(index, queries[3]).size() == size_t(1));
+
+    for (size_t i = 0; i < queries.size(); i++) {
+        EXPECT(same_leaves(root, index, queries[i]));
+    }
+
+    // Adding the same leaf again (e.g. one indexed while the index was built) is harmless
+
+    size_t size = index.size();
+    index.add(root, make_key("20261003", "w", "0"));
+    EXPECT(index.size() == size);
+    EXPECT(same_leaves(root, index, queries[0]));
+
+    // Leaves added before an index is built are found by building it
+
+    TreeIndex lazy(global_symbols);
+    add_leaf(root, &lazy, "20261003", "w", "6");
+    EXPECT(!lazy.available());
+
+    EXPECT(lazy.build(root));
+    EXPECT(lazy.available());
+    EXPECT(index_lookup(lazy, queries[0]).size() == size_t(33));
+}
+
+
+CASE( "test_tree_index_budget" )
+{
+    PersistentPtr<TreeNode>& root(test_tree(2));
+
+    TreeIndex unlimited(global_symbols);
+    EXPECT(unlimited.build(root));
+    size_t size = unlimited.size();
+
+    // An index that does not fit is discarded, and the tree must be used
+
+    TreeIndex small(global_symbols, size / 2);
+    EXPECT(!small.build(root));
+    EXPECT(!small.available());
+    EXPECT(small.size() == size_t(0));
+    EXPECT(small.visit(TreeQuery(global_symbols), [](const PersistentPtr<TreeNode>&) { return true; })
+               == TreeIndex::Unavailable);
+
+    // Including when it grows too large
+
+    TreeIndex exact(global_symbols, size);
+    EXPECT(exact.build(root));
+    EXPECT(exact.size() == size);
+
+    for (size_t i = 0; i < 10 && exact.available(); i++) {
+        std::ostringstream ss;
+        ss << "p" << i;
+        add_leaf(root, &exact, "20261001", ss.str(), "0");
+    }
+
+    EXPECT(!exact.available());
+    EXPECT(exact.size() == size_t(0));
+    EXPECT(!exact.build(root));
+}
+
+
+CASE( "test_tree_index_remove" )
+{
+    PersistentPtr<TreeNode>& root(test_tree(3));
+
+    TreeIndex index(global_symbols);
+    EXPECT(index.build(root));
+
+    add_leaf(root, &index, "20261003", "w", "0");
+
+    size_t size = index.size();
+    std::vector<TreeQuery> queries = test_queries();
+
+    // Removing a leaf, and then the last leaf of a branch, which is pruned
+
+    TreeNode::KeyType key = make_key("20261002", "u", "18");
+    EXPECT(root->removeNode(key));
+    index.remove(key);
+
+    EXPECT(index_lookup(index, queries[0]).size() == size_t(30));
+    EXPECT(index_lookup(index, queries[1]).size() == size_t(0));
+
+    key = make_key("20261003", "w", "0");
+    EXPECT(root->removeNode(key));
+    index.remove(key);
+
+    EXPECT(index.size() < size);
+
+    for (size_t i = 0; i < queries.size(); i++) {
+        EXPECT(same_leaves(root, index, queries[i]));
+    }
+
+    // Removing leaves that are not present does nothing
+
+    size = index.size();
+    index.remove(make_key("20261002", "u", "18"));
+    index.remove(make_key("20261001", "t", "unknown"));
+    EXPECT(index.size() == size);
+    EXPECT(index_lookup(index, queries[0]).size() == size_t(29));
+}
+
+
+
+CASE( "test_tree_index_add_during_build" )
+{
+    PersistentPtr<TreeNode>& root(test_tree(4));
+
+    const char* dates[] = { "20261001", "20261002" };
+    const char* params[] = { "t", "u", "v" };
+
+    // Leaves are added (as by TreeObject, under the read lock of the tree) while a lazy index is being built. Each
+    // must be found through the index, whether the build copied it from the tree, or it waited for the build.
+
+    size_t leaves = 30;
+
+    for (size_t round = 0; round < 30; round++) {
+
+        TreeIndex index(global_symbols);
+        std::atomic<size_t> added(0);
+
+        std::vector<std::thread> writers;
+        for (size_t t = 0; t < 4; t++) {
+            writers.push_back(std::thread([&root, &index, &added, &dates, &params, round, t]() {
+                for (size_t i = 0; i < 50; i++) {
+                    std::ostringstream ss;
+                    ss << 1000 + (round * 4 + t) * 50 + i;
+                    add_leaf(root, &index, dates[i % 2], params[(i / 2) % 3], ss.str());
+                    ++added;
+                }
+            }));
+        }
+
+        // Start building once the writers are under way.
+
+        while (added == 0) {}
+
+        EXPECT(index.build(root));
+
+        for (size_t t = 0; t < writers.size(); t++) {
+            writers[t].join();
+        }
+
+        // n.b. Leaves added concurrently may be indexed in a different order from the tree.
+
+        leaves += 200;
+
+        std::vector<PersistentPtr<TreeNode> > expected = root->lookup(TreeQuery(global_symbols));
+        std::vector<PersistentPtr<TreeNode> > found = index_lookup(index, TreeQuery(global_symbols));
+        EXPECT(expected.size() == leaves);
+        EXPECT(found.size() == leaves);
+
+        std::set<const TreeNode*> indexed;
+        for (size_t i = 0; i < found.size(); i++) {
+            indexed.insert(found[i].get());
+        }
+
+        bool all = true;
+        for (size_t i = 0; i < expected.size(); i++) {
+            all = all && indexed.count(expected[i].get()) == 1;
+        }
+        EXPECT(all);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    return run_tests(argc, argv);
+}
@@ -13,9 +13,19 @@
  * (Project ID: 671951) www.nextgenio.eu
  */
 
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
 #include "eckit/parser/JSONDataBlob.h"
 #include "eckit/testing/Test.h"
 
+#include "pmem/EpochManager.h"
+#include "pmem/InternTable.h"
+#include "pmem/PersistentBuffer.h"
+#include "pmem/ThreadPool.h"
+
 #include "pmem/tree/TreeNode.h"
 
 #include "tests/pmem/test_persistent_helpers.h"
@@ -31,7 +41,7 @@ using namespace tree;
 /// Define a root type. Each test that does allocation should use a different element in the root object.
 
 // How many possibilities do we want?
-const size_t root_elems = 7;
+const size_t root_elems = 15;
 
 
 class RootType : public PersistentType<RootType> {
@@ -43,12 +53,16 @@ public: // constructor
             for (size_t i = 0; i < root_elems; i++) {
                 object.data_[i].nullify();
             }
+            object.symbols_.nullify();
+            object.retired_.nullify();
         }
     };
 
 public: // members
 
     PersistentPtr<TreeNode> data_[root_elems];
+    InternTable::storage_type symbols_;
+    EpochManager::storage_type retired_;
 };
 
 
@@ -68,6 +82,9 @@ public:
 template<> uint64_t pmem::PersistentType<RootType>::type_id = POBJ_ROOT_TYPE_NUM;
 template<> uint64_t pmem::PersistentType<TreeNode>::type_id = 1;
 template<> uint64_t pmem::PersistentType<pmem::PersistentVectorData<TreeNode> >::type_id = 2;
+template<> uint64_t pmem::PersistentType<PersistentString>::type_id = 5;
+template<> uint64_t pmem::PersistentType<pmem::PersistentVectorData<PersistentString> >::type_id = 6;
+template<> uint64_t pmem::PersistentType<PersistentRetireList>::type_id = 7;
 
 // Create a global fixture, so that this pool is only created once, and destroyed once.
 
@@ -81,6 +98,12 @@ struct GlobalRootFixture : public PersistentPtr<RootType> {
 
 GlobalRootFixture global_root;
 
+// The tree nodes store their keys and values in the intern table of the pool, and retire replaced child lists to
+// its epoch manager. Both must be open.
+
+InternTable global_symbols(global_root->symbols_);
+EpochManager global_epochs(global_root->retired_);
+
 //----------------------------------------------------------------------------------------------------------------------
 
 CASE( "test_tree_node_placeholder" ) {
@@ -497,6 +520,413 @@ CASE( "test_tree_node_locate_leaf" )
 }
 
 
+CASE( "test_tree_node_remove_leaf" )
+{
+    PersistentPtr<TreeNode>& first(global_root->data_[7]);
+
+    EXPECT(first.null());
+
+    TreeNode::KeyType key;
+    key.push_back(std::make_pair("key1", "value1"));
+    key.push_back(std::make_pair("key2", "value2"));
+    key.push_back(std::make_pair("key3", "value3"));
+
+    TreeNode::KeyType key2;
+    key2.push_back(std::make_pair("key1", "value1"));
+    key2.push_back(std::make_pair("key2", "value2"));
+    key2.push_back(std::make_pair("key3", "value3a"));
+
+    TreeNode::KeyType key3;
+    key3.push_back(std::make_pair("key1", "value1"));
+    key3.push_back(std::make_pair("key2", "value2a"));
+    key3.push_back(std::make_pair("key3", "value3"));
+
+    std::string data("\"data 1234\"");
+    eckit::JSONDataBlob blob(data.c_str(), data.length());
+
+    first.setPersist(TreeNode::allocateNested(*global_pool, "SAMPLE", key, blob));
+    first->addNode(key2, blob);
+    first->addNode(key3, blob);
+
+    StringDict request;
+    request["key1"] = "value1";
+    EXPECT(first->lookup(request).size() == size_t(3));
+
+    // Removing a non-existent leaf does nothing
+
+    TreeNode::KeyType bad_key(key);
+    bad_key[2].second = "value_bad";
+    EXPECT(!first->removeNode(bad_key));
+    EXPECT(first->lookup(request).size() == size_t(3));
+
+    // Remove a leaf that shares its parent with another
+
+    EXPECT(first->removeNode(key));
+    EXPECT(first->lookup(request).size() == size_t(2));
+
+    const PersistentPtr<TreeNode> child1 = (*reinterpret_cast<TreeNodeSpy*>(first.get())).items()[0];
+    EXPECT(child1->nodeCount() == size_t(2));
+
+    // Removing the only leaf in a branch prunes the branch
+
+    EXPECT(first->removeNode(key3));
+    EXPECT(child1->nodeCount() == size_t(1));
+
+    std::vector<PersistentPtr<TreeNode> > result = first->lookup(request);
+    EXPECT(result.size() == size_t(1));
+    EXPECT(result[0]->value() == "value3a");
+
+    // And the leaf can be re-added
+
+    first->addNode(key, blob);
+    EXPECT(first->lookup(request).size() == size_t(2));
+
+    // Compaction leaves the contents intact
+
+    first->compact();
+    EXPECT(first->lookup(request).size() == size_t(2));
+}
+
+
+CASE( "test_tree_node_interned_keys" )
+{
+    PersistentPtr<TreeNode>& first(global_root->data_[8]);
+
+    EXPECT(first.null());
+
+    // Values are not limited in length
+
+    TreeNode::KeyType key;
+    key.push_back(std::make_pair("class", "operational"));
+    key.push_back(std::make_pair("expver", "a_rather_long_experiment_name"));
+    key.push_back(std::make_pair("step", "0"));
+
+    TreeNode::KeyType key2(key);
+    key2[1].second = "0001";
+    key2[2].second = "operational";
+
+    std::string data("\"data 1234\"");
+    eckit::JSONDataBlob blob(data.c_str(), data.length());
+
+    first.setPersist(TreeNode::allocateNested(*global_pool, "SAMPLE", key, blob));
+    first->addNode(key2, blob);
+
+    const PersistentPtr<TreeNode> child1 = (*reinterpret_cast<TreeNodeSpy*>(first.get())).items()[0];
+    const PersistentPtr<TreeNode> branch1 = (*reinterpret_cast<TreeNodeSpy*>(child1.get())).items()[0];
+    const PersistentPtr<TreeNode> branch2 = (*reinterpret_cast<TreeNodeSpy*>(child1.get())).items()[1];
+    const PersistentPtr<TreeNode> leaf1 = (*reinterpret_cast<TreeNodeSpy*>(branch1.get())).items()[0];
+    const PersistentPtr<TreeNode> leaf2 = (*reinterpret_cast<TreeNodeSpy*>(branch2.get())).items()[0];
+
+    EXPECT(branch1->value() == "a_rather_long_experiment_name");
+    EXPECT(leaf2->value() == "operational");
+
+    // Each string is stored once, whether it is used as a key or a value
+
+    EXPECT(branch1->keyId() == branch2->keyId());
+    EXPECT(leaf2->valueId() == child1->valueId());
+    EXPECT(global_symbols.string(first->keyId()) == "class");
+    EXPECT(global_symbols.find("a_rather_long_experiment_name") == branch1->valueId());
+
+    // Keys and values that have never been stored are handled without modifying the table
+
+    size_t symbols = global_symbols.size();
+
+    StringDict request;
+    request["step"] = "0";
+    request["unknown_key"] = "1";
+    std::vector<PersistentPtr<TreeNode> > result = first->lookup(request);
+    EXPECT(result.size() == size_t(1));
+    EXPECT(result[0] == leaf1);
+
+    request["step"] = "unknown_value";
+    EXPECT(first->lookup(request).size() == size_t(0));
+
+    TreeNode::KeyType bad_key(key);
+    bad_key[2].second = "unknown_value";
+    EXPECT(!first->removeNode(bad_key));
+
+    EXPECT(global_symbols.size() == symbols);
+}
+
+
+CASE( "test_tree_node_inline_data" )
+{
+    PersistentPtr<TreeNode>& small(global_root->data_[9]);
+    PersistentPtr<TreeNode>& large(global_root->data_[10]);
+
+    // Payloads up to the threshold are stored in the node itself
+
+    std::string data(TreeNode::inline_threshold, 'x');
+    data[0] = 'a';
+    std::string data2(TreeNode::inline_threshold + 1, 'y');
+
+    small.setPersist(TreeNode::allocateLeaf(*global_pool, "small", data.c_str(), data.length()));
+    large.setPersist(TreeNode::allocateLeaf(*global_pool, "large", data2.c_str(), data2.length()));
+
+    EXPECT(small->leaf());
+    EXPECT(small->inlined());
+    EXPECT(small->buffer().null());
+    EXPECT(small->value() == "small");
+    EXPECT(small->dataSize() == data.length());
+    EXPECT(small->data() == reinterpret_cast<const char*>(small.get()) + sizeof(TreeNode));
+    EXPECT(std::string(static_cast<const char*>(small->data()), small->dataSize()) == data);
+    EXPECT(small->verify());
+
+    std::vector<char> scratch;
+    EXPECT(small->data(scratch) == small->data());
+
+    // The inline data carries a checksum, which detects corruption
+
+    char* raw = const_cast<char*>(static_cast<const char*>(small->data()));
+    raw[0] = 'b';
+    EXPECT(!small->verify());
+    raw[0] = 'a';
+    EXPECT(small->verify());
+
+    // Larger ones have a buffer of their own
+
+    EXPECT(large->leaf());
+    EXPECT(!large->inlined());
+    EXPECT(!large->buffer().null());
+    EXPECT(large->dataSize() == data2.length());
+    EXPECT(std::string(static_cast<const char*>(large->data()), large->dataSize()) == data2);
+    EXPECT(large->verify());
+}
+
+
+CASE( "test_tree_node_compressed_data" )
+{
+    PersistentPtr<TreeNode>& leaf(global_root->data_[14]);
+
+    std::string data(4096, 'z');
+    leaf.setPersist(TreeNode::allocateLeaf(*global_pool, "compressed",
+                                           PersistentBuffer::CompressedConstructor(data.c_str(), data.length())));
+
+    EXPECT(leaf->buffer()->compressed());
+    EXPECT(leaf->dataSize() == data.length());
+    EXPECT(leaf->verify());
+
+    // The data can only be read by decompressing it. Direct access fails cleanly, rather than aborting.
+
+    std::vector<char> scratch;
+    EXPECT(std::string(static_cast<const char*>(leaf->data(scratch)), leaf->dataSize()) == data);
+    EXPECT_THROWS_AS(leaf->data(), UserError);
+}
+
+
+CASE( "test_tree_node_concurrent_insert" )
+{
+    PersistentPtr<TreeNode>& root(global_root->data_[11]);
+
+    TreeNode::KeyType chain;
+    chain.push_back(std::make_pair("date", "d0"));
+    chain.push_back(std::make_pair("param", "initial"));
+    chain.push_back(std::make_pair("step", "0"));
+
+    std::string initial("initial");
+    root.setPersist(TreeNode::allocateNested(*global_pool, "root", chain, initial.c_str(), initial.length()));
+
+    // Several writers insert at once. They share the nodes near the top of the tree (the dates), but each adds
+    // leaves under its own params. A reader looks up the existing leaf meanwhile.
+
+    const size_t nthreads = 8;
+    const size_t count = 200;
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < nthreads; t++) {
+        threads.push_back(std::thread([&root, t, count]() {
+            for (size_t i = 0; i < count; i++) {
+                std::ostringstream date, param, step;
+                date << "d" << (i % 3);
+                param << "p" << t;
+                step << i;
+
+                TreeNode::KeyType key;
+                key.push_back(std::make_pair("date", date.str()));
+                key.push_back(std::make_pair("param", param.str()));
+                key.push_back(std::make_pair("step", step.str()));
+
+                std::string data = date.str() + param.str() + step.str();
+                root->addNode(key, data.c_str(), data.length());
+            }
+        }));
+    }
+
+    // Readers never see leaves disappear while the child lists are being replaced
+
+    size_t found = 0;
+    size_t growing = 0;
+    bool monotonic = true;
+    for (size_t i = 0; i < 1000; i++) {
+        StringDict request;
+        request["param"] = "initial";
+        found += root->lookup(request).size();
+
+        request["param"] = "p0";
+        size_t n = root->lookup(request).size();
+        monotonic = monotonic && (n >= growing);
+        growing = n;
+    }
+
+    for (size_t t = 0; t < nthreads; t++)
+        threads[t].join();
+
+    EXPECT(found == size_t(1000));
+    EXPECT(monotonic);
+
+    // All the leaves were added, once each, into the shared branches
+
+    EXPECT(root->nodeCount() == size_t(3));
+    EXPECT(root->lookup(StringDict()).size() == nthreads * count + 1);
+
+    StringDict request;
+    request["date"] = "d1";
+    request["param"] = "p5";
+    request["step"] = "100";
+
+    std::vector<PersistentPtr<TreeNode> > leaves = root->lookup(request);
+    EXPECT(leaves.size() == size_t(1));
+    EXPECT(std::string(static_cast<const char*>(leaves[0]->data()), leaves[0]->dataSize()) == "d1p5100");
+
+    request.erase("step");
+    EXPECT(root->lookup(request).size() == size_t(67));
+
+    // The superseded child lists are freed once there are no lookups that may be using them
+
+    global_epochs.reclaim();
+    EXPECT(global_epochs.pending() == size_t(0));
+    EXPECT(root->lookup(StringDict()).size() == nthreads * count + 1);
+    EXPECT(root->lookup(request).size() == size_t(67));
+}
+
+
+
+static std::vector<const TreeNode*> node_addresses(const std::vector<PersistentPtr<TreeNode> >& nodes) {
+    std::vector<const TreeNode*> addresses;
+    for (size_t i = 0; i < nodes.size(); i++)
+        addresses.push_back(nodes[i].get());
+    return addresses;
+}
+
+
+CASE( "test_tree_node_parallel_lookup" )
+{
+    PersistentPtr<TreeNode>& root(global_root->data_[12]);
+
+    TreeNode::KeyType chain;
+    chain.push_back(std::make_pair("date", "d0"));
+    chain.push_back(std::make_pair("param", "p0"));
+    chain.push_back(std::make_pair("step", "0"));
+
+    std::string initial("d0p00");
+    root.setPersist(TreeNode::allocateNested(*global_pool, "root", chain, initial.c_str(), initial.length()));
+
+    for (size_t i = 1; i < 3 * 5 * 20; i++) {
+        std::ostringstream date, param, step;
+        date << "d" << (i % 3);
+        param << "p" << (i / 3) % 5;
+        step << i / 15;
+
+        TreeNode::KeyType key;
+        key.push_back(std::make_pair("date", date.str()));
+        key.push_back(std::make_pair("param", param.str()));
+        key.push_back(std::make_pair("step", step.str()));
+
+        std::string data = date.str() + param.str() + step.str();
+        root->addNode(key, data.c_str(), data.length());
+    }
+
+    // Partial, complete, empty and unmatched requests give the same results as a serial lookup. Unless ordered,
+    // the results may come back in any order.
+
+    ThreadPool pool(4);
+
+    std::vector<StringDict> requests(6);
+    requests[1]["step"] = "7";
+    requests[2]["param"] = "p3";
+    requests[3]["date"] = "d1";
+    requests[3]["step"] = "12";
+    requests[4]["date"] = "d2";
+    requests[4]["param"] = "p1";
+    requests[4]["step"] = "19";
+    requests[5]["param"] = "unknown";
+
+    size_t expected[] = { 300, 15, 60, 5, 1, 0 };
+
+    for (size_t i = 0; i < requests.size(); i++) {
+
+        std::vector<const TreeNode*> serial = node_addresses(root->lookup(requests[i]));
+        EXPECT(serial.size() == expected[i]);
+
+        EXPECT(node_addresses(root->parallelLookup(requests[i], true, pool)) == serial);
+
+        std::vector<const TreeNode*> unordered = node_addresses(root->parallelLookup(requests[i], false, pool));
+        std::sort(serial.begin(), serial.end());
+        std::sort(unordered.begin(), unordered.end());
+        EXPECT(unordered == serial);
+    }
+
+    // The selected leaves are the expected ones
+
+    std::vector<PersistentPtr<TreeNode> > leaves = root->parallelLookup(requests[4], true, pool);
+    EXPECT(std::string(static_cast<const char*>(leaves[0]->data()), leaves[0]->dataSize()) == "d2p119");
+}
+
+
+CASE( "test_tree_node_visit" )
+{
+    PersistentPtr<TreeNode>& root(global_root->data_[13]);
+
+    TreeNode::KeyType chain;
+    chain.push_back(std::make_pair("param", "p0"));
+    chain.push_back(std::make_pair("step", "0"));
+
+    std::string initial("p00");
+    root.setPersist(TreeNode::allocateNested(*global_pool, "root", chain, initial.c_str(), initial.length()));
+
+    for (size_t i = 1; i < 4 * 10; i++) {
+        std::ostringstream param, step;
+        param << "p" << i % 4;
+        step << i / 4;
+
+        TreeNode::KeyType key;
+        key.push_back(std::make_pair("param", param.str()));
+        key.push_back(std::make_pair("step", step.str()));
+
+        std::string data = param.str() + step.str();
+        root->addNode(key, data.c_str(), data.length());
+    }
+
+    // The leaves are visited in the same order as they are returned by lookup
+
+    StringDict request;
+    request["step"] = "3";
+
+    std::vector<const TreeNode*> visited;
+    EXPECT(root->visit(request, [&visited](const PersistentPtr<TreeNode>& leaf) {
+        visited.push_back(leaf.get());
+        return true;
+    }));
+
+    EXPECT(visited.size() == size_t(4));
+    EXPECT(visited == node_addresses(root->lookup(request)));
+
+    // The lookup stops as soon as the visitor asks it to
+
+    size_t count = 0;
+    EXPECT(!root->visit(StringDict(), [&count](const PersistentPtr<TreeNode>& leaf) {
+        EXPECT(leaf->leaf());
+        return ++count < 7;
+    }));
+    EXPECT(count == size_t(7));
+
+    // And a visitor is not called if nothing matches
+
+    request["param"] = "unknown";
+    EXPECT(root->visit(request, [](const PersistentPtr<TreeNode>&) -> bool { throw std::runtime_error("visited"); }));
+}
+
+
 //----------------------------------------------------------------------------------------------------------------------
 
 int main(int argc, char** argv) {
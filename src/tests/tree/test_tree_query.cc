@@ -0,0 +1,343 @@
+/*
+ * (C) Copyright 1996-2015 ECMWF.
+ *
+ * This software is licensed under the terms of the Apache Licence Version 2.0
+ * which can be obtained at http://www.apache.org/licenses/LICENSE-2.0.
+ * In applying this licence, ECMWF does not waive the privileges and immunities
+ * granted to it by virtue of its status as an intergovernmental organisation nor
+ * does it submit to any jurisdiction.
+ */
+
+/*
+ * This software was developed as part of the EC H2020 funded project NextGenIO
+ * (Project ID: 671951) www.nextgenio.eu
+ */
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "eckit/testing/Test.h"
+
+#include "pmem/EpochManager.h"
+#include "pmem/InternTable.h"
+
+#include "pmem/tree/TreeNode.h"
+#include "pmem/tree/TreeQuery.h"
+
+#include "tests/pmem/test_persistent_helpers.h"
+
+using namespace std;
+using namespace pmem;
+using namespace eckit;
+using namespace eckit::testing;
+using namespace tree;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Define a root type. Each test that does allocation should use a different element in the root object.
+
+const size_t root_elems = 2;
+
+
+class RootType : public PersistentType<RootType> {
+
+public: // constructor
+
+    class Constructor : public AtomicConstructor<RootType> {
+        virtual void make(RootType &object) const {
+            for (size_t i = 0; i < root_elems; i++) {
+                object.data_[i].nullify();
+            }
+            object.symbols_.nullify();
+            object.retired_.nullify();
+        }
+    };
+
+public: // members
+
+    PersistentPtr<TreeNode> data_[root_elems];
+    InternTable::storage_type symbols_;
+    EpochManager::storage_type retired_;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// And structure the pool with types
+
+template<> uint64_t pmem::PersistentType<RootType>::type_id = POBJ_ROOT_TYPE_NUM;
+template<> uint64_t pmem::PersistentType<TreeNode>::type_id = 1;
+template<> uint64_t pmem::PersistentType<pmem::PersistentVectorData<TreeNode> >::type_id = 2;
+template<> uint64_t pmem::PersistentType<PersistentString>::type_id = 5;
+template<> uint64_t pmem::PersistentType<pmem::PersistentVectorData<PersistentString> >::type_id = 6;
+template<> uint64_t pmem::PersistentType<PersistentRetireList>::type_id = 7;
+
+// Create a global fixture, so that this pool is only created once, and destroyed once.
+
+AutoPool globalAutoPool((RootType::Constructor()));
+PersistentPool* global_pool = &globalAutoPool.pool_;
+
+struct GlobalRootFixture : public PersistentPtr<RootType> {
+ GlobalRootFixture() : PersistentPtr<RootType>(globalAutoPool.pool_.getRoot<RootType>()) {}
+    ~GlobalRootFixture() { nullify(); }
+};
+
+GlobalRootFixture global_root;
+
+InternTable global_symbols(global_root->symbols_);
+EpochManager global_epochs(global_root->retired_);
+
+
+static void add_leaf(PersistentPtr<TreeNode>& root, const std::string& date, const std::string& param,
+                     const std::string& step) {
+
+    TreeNode::KeyType key;
+    key.push_back(std::make_pair("date", date));
+    key.push_back(std::make_pair("param", param));
+    key.push_back(std::make_pair("step", step));
+
+    std::string data = date + param + step;
+
+    if (root.null())
+        root.setPersist(TreeNode::allocateNested(*global_pool, "root", key, data.c_str(), data.length()));
+    else
+        root->addNode(key, data.c_str(), data.length());
+}
+
+
+/// A tree of two dates, four params and steps from 0 to 48 hours in steps of 3.
+
+static PersistentPtr<TreeNode>& test_tree(size_t elem) {
+
+    PersistentPtr<TreeNode>& root(global_root->data_[elem]);
+
+    const char* dates[] = { "20261001", "20261002" };
+    const char* params[] = { "t", "u", "v", "w" };
+
+    for (size_t d = 0; d < 2; d++) {
+        for (size_t p = 0; p < 4; p++) {
+            for (size_t step = 0; step <= 48; step += 3) {
+                std::ostringstream ss;
+                ss << step;
+                add_leaf(root, dates[d], params[p], ss.str());
+            }
+        }
+    }
+
+    return root;
+}
+
+
+static std::vector<std::string> schema_keys() {
+    std::vector<std::string> keys;
+    keys.push_back("date");
+    keys.push_back("param");
+    keys.push_back("step");
+    return keys;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CASE( "test_tree_query_predicates" )
+{
+    PersistentPtr<TreeNode>& root(test_tree(0));
+
+    // An empty query matches everything
+
+    TreeQuery all(global_symbols, schema_keys());
+    EXPECT(!all.complete());
+    EXPECT(root->lookup(all).size() == size_t(136));
+
+    // Exact values
+
+    StringDict request;
+    request["date"] = "20261002";
+    request["param"] = "v";
+    request["step"] = "27";
+
+    TreeQuery exact(global_symbols, request, schema_keys());
+    EXPECT(exact.complete());
+
+    std::vector<PersistentPtr<TreeNode> > leaves = root->lookup(exact);
+    EXPECT(leaves.size() == size_t(1));
+    EXPECT(std::string(static_cast<const char*>(leaves[0]->data()), leaves[0]->dataSize()) == "20261002v27");
+
+    // Sets of values, which need not all exist
+
+    std::vector<std::string> params;
+    params.push_back("w");
+    params.push_back("t");
+    params.push_back("unknown");
+
+    TreeQuery set(global_symbols, schema_keys());
+    set.set("param", params);
+    EXPECT(root->lookup(set).size() == size_t(68));
+
+    // Ranges, with and without a step
+
+    TreeQuery range(global_symbols, schema_keys());
+    range.range("step", 0, 12);
+    EXPECT(root->lookup(range).size() == size_t(40));
+
+    range.range("step", 0, 24, 6);
+    EXPECT(root->lookup(range).size() == size_t(40));
+
+    range.range("step", 1, 2);
+    EXPECT(root->lookup(range).size() == size_t(0));
+
+    EXPECT_THROWS_AS(range.range("step", 0, 24, -6), BadParameter);
+
+    // Predicates combine across levels
+
+    TreeQuery combined(global_symbols, schema_keys());
+    combined.set("param", std::vector<std::string>(params.begin(), params.begin() + 2)).range("step", 6, 12, 6);
+
+    leaves = root->lookup(combined);
+    EXPECT(leaves.size() == size_t(8));
+    EXPECT(std::string(static_cast<const char*>(leaves[0]->data()), leaves[0]->dataSize()) == "20261001t6");
+    EXPECT(std::string(static_cast<const char*>(leaves[7]->data()), leaves[7]->dataSize()) == "20261002w12");
+
+    std::ostringstream ss;
+    ss << combined;
+    EXPECT(ss.str() == "TreeQuery(param=w/t, step=6/to/12/by/6)");
+
+    // And a key can be unconstrained again
+
+    combined.any("param");
+    EXPECT(root->lookup(combined).size() == size_t(16));
+}
+
+
+CASE( "test_tree_query_levels_are_hints" )
+{
+    PersistentPtr<TreeNode>& root(global_root->data_[0]);
+
+    // Plans compiled without the schema, or with the levels in the wrong order, find the same leaves.
+
+    std::vector<std::string> keys = schema_keys();
+    std::vector<std::string> reversed(keys.rbegin(), keys.rend());
+
+    StringDict request;
+    request["param"] = "u";
+    request["step"] = "9";
+
+    std::vector<PersistentPtr<TreeNode> > expected = root->lookup(TreeQuery(global_symbols, request, schema_keys()));
+    EXPECT(expected.size() == size_t(2));
+
+    std::vector<PersistentPtr<TreeNode> > unordered = root->lookup(TreeQuery(global_symbols, request));
+    std::vector<PersistentPtr<TreeNode> > wrong = root->lookup(TreeQuery(global_symbols, request, reversed));
+
+    EXPECT(unordered.size() == size_t(2));
+    EXPECT(wrong.size() == size_t(2));
+    EXPECT(unordered[0].get() == expected[0].get() && unordered[1].get() == expected[1].get());
+    EXPECT(wrong[0].get() == expected[0].get() && wrong[1].get() == expected[1].get());
+
+    // The string based lookup compiles the same plan
+
+    EXPECT(root->lookup(request).size() == size_t(2));
+}
+
+
+CASE( "test_tree_query_parse" )
+{
+    PersistentPtr<TreeNode>& root(global_root->data_[0]);
+
+    // MARS style lists and ranges of values, which combine with the constraints already made
+
+    TreeQuery query(global_symbols, schema_keys());
+
+    EXPECT(root->lookup(query.parse("step", "12")).size() == size_t(8));
+    EXPECT(root->lookup(query.parse("param", "t / v")).size() == size_t(4));
+    EXPECT(root->lookup(query.parse("step", "0/to/12")).size() == size_t(20));
+    EXPECT(root->lookup(query.parse("step", "0/TO/24/BY/6")).size() == size_t(20));
+
+    EXPECT_THROWS_AS(query.parse("step", "0/to"), BadParameter);
+    EXPECT_THROWS_AS(query.parse("step", "0/to/x"), BadParameter);
+    EXPECT_THROWS_AS(query.parse("step", "0/to/12/step/6"), BadParameter);
+    EXPECT_THROWS_AS(query.parse("param", "t//v"), BadParameter);
+
+    // A whole request is evaluated in one traversal, giving the same leaves (in the same order) as looking up
+    // each combination of values separately.
+
+    StringDict request;
+    request["date"] = "20261001/20261002";
+    request["param"] = "u/w";
+    request["step"] = "6/to/12/by/6";
+
+    TreeQuery multi(global_symbols, request, schema_keys(), true);
+
+    std::ostringstream ss;
+    ss << multi;
+    EXPECT(ss.str() == "TreeQuery(date=20261001/20261002, param=u/w, step=6/to/12/by/6)");
+
+    std::vector<PersistentPtr<TreeNode> > leaves = root->lookup(multi);
+    EXPECT(leaves.size() == size_t(8));
+
+    const char* dates[] = { "20261001", "20261002" };
+    const char* params[] = { "u", "w" };
+    const char* steps[] = { "6", "12" };
+
+    size_t i = 0;
+    bool same = true;
+    for (size_t d = 0; d < 2; d++) {
+        for (size_t p = 0; p < 2; p++) {
+            for (size_t st = 0; st < 2; st++) {
+                StringDict single;
+                single["date"] = dates[d];
+                single["param"] = params[p];
+                single["step"] = steps[st];
+                std::vector<PersistentPtr<TreeNode> > one = root->lookup(single);
+                same = same && one.size() == 1 && one[0].get() == leaves[i++].get();
+            }
+        }
+    }
+    EXPECT(same);
+}
+
+
+CASE( "test_tree_query_reuse" )
+{
+    PersistentPtr<TreeNode>& root(global_root->data_[1]);
+    add_leaf(root, "20261001", "t", "0");
+
+    // Compile plans referring to values that do not exist yet
+
+    StringDict request;
+    request["param"] = "msl";
+
+    TreeQuery exact(global_symbols, request, schema_keys());
+    TreeQuery range(global_symbols, schema_keys());
+    range.range("step", 100, 200, 50);
+
+    EXPECT(!exact.stale());
+    EXPECT(root->lookup(exact).size() == size_t(0));
+    EXPECT(root->lookup(range).size() == size_t(0));
+
+    // Once they are added, the plans find them
+
+    add_leaf(root, "20261001", "msl", "150");
+    add_leaf(root, "20261001", "t", "100");
+    add_leaf(root, "20261001", "t", "175");
+
+    EXPECT(exact.stale());
+    EXPECT(root->lookup(exact).size() == size_t(1));
+    EXPECT(root->lookup(range).size() == size_t(2));
+
+    // Refreshing only brings the plan up to date
+
+    exact.refresh();
+    range.refresh();
+    EXPECT(!exact.stale());
+    EXPECT(root->lookup(exact).size() == size_t(1));
+    EXPECT(root->lookup(range).size() == size_t(2));
+
+    add_leaf(root, "20261002", "msl", "200");
+    EXPECT(root->lookup(exact).size() == size_t(2));
+    EXPECT(root->lookup(range).size() == size_t(3));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    return run_tests(argc, argv);
+}